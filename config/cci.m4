@@ -117,6 +117,16 @@ AC_DEFUN([CCI_SETUP_CTP],[
     AC_CHECK_HEADERS([sys/epoll.h], [
     AC_CHECK_FUNCS([epoll_create])
     ])
+    AC_CHECK_HEADERS([sys/sendfile.h], [
+    AC_CHECK_FUNCS([sendfile])
+    ])
+    AC_ARG_ENABLE([io-uring],
+        [AC_HELP_STRING([--disable-io-uring],
+                        [Do not build the tcp transport's io_uring engine])])
+    AS_IF([test "x$enable_io_uring" != "xno"],
+          [AC_CHECK_HEADERS([linux/io_uring.h sys/syscall.h])])
+    # NUMA placement of endpoint buffers and pinning of progress threads
+    AC_CHECK_HEADERS([sys/syscall.h linux/mempolicy.h])
     AC_CHECK_DECLS([ethtool_cmd_speed],,,[[#include <linux/ethtool.h>]])
 
     #
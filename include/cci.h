@@ -77,7 +77,7 @@
    application requires (one of the CCI_ABI_* values).
 
    \param[in] flags: A constant describing behaviors that this application
-   requires.  Currently, 0 is the only valid value.
+   requires: 0 or CCI_INIT_SINGLE_THREADED.
 
    \param[out] caps: Capabilities of the underlying library:
    * THREAD_SAFETY
@@ -105,10 +105,22 @@
    can return a failure and continue as if cci_init() had not been
    invoked again.
 
+   Transports that need background progress share the worker threads
+   of a process-wide progress engine instead of starting threads for
+   each endpoint. The CCI_PROGRESS_THREADS environment variable sets the
+   most workers the process may start (1 by default).
+
   \ingroup env
 */
 CCI_DECLSPEC int cci_init(uint32_t abi_ver, uint32_t flags, uint32_t * caps);
 
+/*! cci_init() flag: every endpoint is created as if with
+  CCI_ENDPT_SINGLE_THREADED.
+
+  \ingroup env
+*/
+#define CCI_INIT_SINGLE_THREADED	(1 << 0)
+
 /*!
   This is the last CCI function that must be called; no other
   CCI functions can be invoked after this function.
@@ -309,6 +321,13 @@ priority = 10
 # endpoint.
 default = 1
 
+# The CCI core also reads the placement of the device's endpoints.
+# numa_node is the NUMA node of their buffers and cpus lists the CPUs
+# their progress threads run on. By default, transports that find the
+# NIC use its NUMA node and the CPUs of that node.
+numa_node = 1
+cpus = 8-15
+
 # All other fields are uninterpreted by the CCI core; they're just
 # passed to the transport.  The transport can do whatever it wants with
 # these values (e.g., system admins can set values to configure the
@@ -468,8 +487,34 @@ CCI_DECLSPEC int cci_get_devices(cci_device_t * const ** devices);
   \ingroup endpoints
  */
 typedef enum cci_endpoint_flags {
-	/*! For future expansion */
-	bogus_must_have_something_here
+	/*! The application calls the endpoint, its connections and its
+	   events from one thread at a time, so the transport may skip its
+	   internal locking and make progress inline, in cci_get_event()
+	   and cci_send(), instead of in background threads. An endpoint
+	   created with this flag cannot return an OS handle on transports
+	   that need a thread to signal it. Implies CCI_ENDPT_APP_PROGRESS. */
+	CCI_ENDPT_SINGLE_THREADED = (1 << 0),
+
+	/*! The transport starts no threads for the endpoint. All progress
+	   (receives, acks, resends, keepalives) happens inside the
+	   application's calls, mainly cci_get_event() and cci_send(), so
+	   the application must poll for events regularly. Not compatible
+	   with an OS handle on transports that need a thread to signal
+	   it. */
+	CCI_ENDPT_APP_PROGRESS = (1 << 1),
+
+	/*! cci_send(), cci_sendv() and cci_send_batch() accept messages of
+	   any length (up to 4 GB) on reliable connections. A message that
+	   fits in cci_connection::max_send_size and in
+	   CCI_OPT_ENDPT_EAGER_LIMIT is sent as usual. A longer one is
+	   registered and announced to the receiver, which reads it with
+	   cci_rma() into a buffer from CCI_OPT_ENDPT_LARGE_ALLOC (or
+	   malloc()) and gets a single CCI_EVENT_RECV once it has all of
+	   it. The sender's CCI_EVENT_SEND comes after the receiver's read.
+	   On RO connections, the messages received after a long one are
+	   held until it is read, so they keep their order. Both endpoints
+	   of a connection must set this flag. */
+	CCI_ENDPT_LARGE_MSGS = (1 << 2)
 } cci_endpoint_flags_t;
 
 /*! Endpoint.
@@ -533,9 +578,11 @@ typedef int cci_os_handle_t;
   To be clear, the intent is that this function can be invoked many
   times locally without affecting any remote resources.
 
-  If it is desirable to bind the CCI endpoint to a specific set of
-  resources (e.g., a NUMA node), the application should bind the calling
-  thread before calling cci_create_endpoint().
+  By default, transports that support it allocate the endpoint's
+  buffers on the NUMA node of the device's NIC and run its progress
+  threads on the CPUs of that node. To bind the endpoint to another set
+  of resources, use the device's numa_node and cpus config keys, or set
+  CCI_OPT_ENDPT_NUMA_NODE and CCI_OPT_ENDPT_CPUS after creating it.
 
   Advice to users: to set the send/receive buffer count on the endpoint,
   call cci_set|get_opt() after creating the endpoint with the applicable
@@ -848,7 +895,11 @@ typedef enum cci_event_type {
 	   (connections, etc.) on the endpoint become stale?  What about
 	   sends that are in-flight -- do we complete them all with an
 	   error?  And so on. */
-	CCI_EVENT_ENDPOINT_DEVICE_FAILED
+	CCI_EVENT_ENDPOINT_DEVICE_FAILED,
+
+	/*! A datagram has been received without a connection (see
+	   cci_sendto()). */
+	CCI_EVENT_RECV_FROM
 } cci_event_type_t;
 
 /*!
@@ -927,6 +978,47 @@ typedef struct cci_event_recv {
 	cci_connection_t *connection;
 } cci_event_recv_t;
 
+/*!
+  Address of a peer endpoint for connectionless datagrams.
+
+  Addresses are returned by cci_addr_resolve() and by
+  CCI_EVENT_RECV_FROM events. All handles of a peer are the same
+  pointer. A resolved address remains valid until the endpoint is
+  destroyed. The address of an event remains valid until the event is
+  returned, unless the application resolves its uri to keep it. The
+  endpoint may keep some addresses of past senders for the next
+  datagrams.
+
+  \ingroup communications
+*/
+typedef struct cci_addr {
+	/*! URI of the peer endpoint. */
+	const char *uri;
+} cci_addr_t;
+
+/*!
+  Datagram receive event.
+
+  A completion struct instance is returned for each datagram sent with
+  cci_sendto() to this endpoint. Datagrams are unreliable and unordered
+  (UU): they may be lost, duplicated or delivered out of order.
+
+  \ingroup events
+*/
+typedef struct cci_event_recv_from {
+	/*! Type of event - should equal CCI_EVENT_RECV_FROM */
+	cci_event_type_t type;
+
+	/*! The length of the data (in bytes).  This value may be 0. */
+	uint32_t len;
+
+	/*! Pointer to the data, 8-byte aligned unless (len == 0). */
+	const void * ptr;
+
+	/*! Address of the sender, to reply with cci_sendto(). */
+	const cci_addr_t *addr;
+} cci_event_recv_from_t;
+
 /*!
   Connect request completion event.
 
@@ -1113,6 +1205,7 @@ union cci_event {
 	cci_event_type_t type;
 	cci_event_send_t send;
 	cci_event_recv_t recv;
+	cci_event_recv_from_t recv_from;
 	cci_event_connect_t connect;
 	cci_event_connect_request_t request;
 	cci_event_accept_t accept;
@@ -1215,6 +1308,80 @@ CCI_DECLSPEC int cci_get_event(cci_endpoint_t * endpoint,
 */
 CCI_DECLSPEC int cci_return_event(cci_event_t * event);
 
+/*!
+  Get up to max available CCI events at once.
+
+  This is the batched form of cci_get_event(): it never blocks and
+  dequeues the pending events, in the order cci_get_event() would
+  return them, with a single pass through the transport. Each event
+  must be returned via cci_return_event() or cci_return_events().
+
+  Transports that cannot batch get the events with repeated calls to
+  cci_get_event().
+
+  \param[in]  endpoint  Endpoint to poll for new events.
+  \param[out] events    Array of at least max event pointers.
+  \param[in]  max       Maximum number of events to get.
+  \param[out] count     Number of events stored in events.
+
+  \return CCI_SUCCESS   At least one event was retrieved.
+  \return CCI_EINVAL    Endpoint, events or count is NULL, or max is 0.
+  \return CCI_EAGAIN    No event is available.
+  \return CCI_ENOBUFS	No event is available and there are no available
+                        receive buffers.
+  \return Each transport may have additional error codes.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_get_events(cci_endpoint_t * endpoint,
+				cci_event_t ** events, uint32_t max,
+				uint32_t * count);
+
+/*!
+  Return count events previously obtained via cci_get_event() or
+  cci_get_events(). All events must come from the same endpoint.
+  Transports that cannot batch return them with repeated calls to
+  cci_return_event().
+
+  \param[in] events	Array of events to return.
+  \param[in] count	Number of events in the array.
+
+  \return CCI_SUCCESS  All events were returned to CCI.
+  \return CCI_EINVAL   Events is NULL.
+  \return Otherwise, the first error of cci_return_event(); the other
+          events are still returned.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_return_events(cci_event_t ** events, uint32_t count);
+
+/*!
+  Wait for the next CCI event.
+
+  Like cci_get_event(), but if no event is available, it first polls
+  for CCI_OPT_ENDPT_WAIT_SPIN microseconds and then sleeps until an
+  event arrives or the timeout expires. It does not need an OS handle.
+  The event must be returned via cci_return_event().
+
+  Transports that cannot sleep on their own poll with cci_get_event()
+  and increasing pauses of up to a millisecond.
+
+  \param[in]  endpoint	Endpoint to wait on.
+  \param[out] event	Event, set when CCI_SUCCESS is returned.
+  \param[in]  timeout	How long to wait, NULL to wait forever. A zero
+			timeout polls once.
+
+  \return CCI_SUCCESS   An event was retrieved.
+  \return CCI_EINVAL    Endpoint or event is NULL.
+  \return CCI_ETIMEDOUT No event arrived before the timeout.
+  \return Each transport may have additional error codes.
+
+  \ingroup events
+*/
+CCI_DECLSPEC int cci_wait_event(cci_endpoint_t * endpoint,
+				cci_event_t ** const event,
+				const struct timeval *timeout);
+
 /*====================================================================*/
 /*                                                                    */
 /*                 ENDPOINTS / CONNECTIONS OPTIONS                    */
@@ -1323,9 +1490,90 @@ typedef enum cci_opt_name {
 
 	   The parameter must point to a uint32_t.
 	 */
-	CCI_OPT_CONN_SEND_TIMEOUT
+	CCI_OPT_CONN_SEND_TIMEOUT,
+
+	/*! Back a registered region with the file it maps (e.g. an mmap()ed
+	   file), so that transports able to send from the page cache can
+	   serve RMA reads of the region without touching its pages. The
+	   region is still accessed as memory otherwise. The endpoint keeps
+	   its own reference to the file until the region is deregistered.
+
+	   cci_set_opt() only.
+
+	   The parameter must point to a cci_rma_file_t.
+	 */
+	CCI_OPT_ENDPT_RMA_FILE,
+
+	/*! How long cci_wait_event() polls for an event, in microseconds,
+	   before it sleeps. Spinning trades CPU time for a lower wake-up
+	   latency. The default is 0 (sleep right away).
+
+	   cci_get_opt() and cci_set_opt().
+
+	   The parameter must point to a uint32_t.
+	 */
+	CCI_OPT_ENDPT_WAIT_SPIN,
+
+	/*! NUMA node of the endpoint's buffers, or -1 for none. The default
+	   is the device's numa_node key, else the node of the NIC. Setting it
+	   moves the endpoint's buffer pools to the node, where the CTP
+	   supports it.
+
+	   cci_get_opt() and cci_set_opt().
+
+	   The parameter must point to an int32_t.
+	 */
+	CCI_OPT_ENDPT_NUMA_NODE,
+
+	/*! CPUs the endpoint's progress threads run on, as a list such as
+	   "0-3,8". The default is the device's cpus key, else the CPUs of
+	   the NIC's NUMA node. An empty list lets the threads run anywhere.
+	   Setting it re-pins the running threads, where the CTP supports it.
+
+	   cci_get_opt() and cci_set_opt().
+
+	   The parameter must point to a char *. cci_get_opt() allocates the
+	   string and the application is responsible for freeing it.
+	 */
+	CCI_OPT_ENDPT_CPUS,
+
+	/*! Longest message, in bytes, that cci_send() sends as is on an
+	   endpoint created with CCI_ENDPT_LARGE_MSGS. Longer messages (and
+	   any message longer than the connection's max_send_size) are read
+	   by the receiver with RMA. The default, UINT32_MAX, sends all
+	   messages that fit in max_send_size as is.
+
+	   cci_get_opt() and cci_set_opt().
+
+	   The parameter must point to a uint32_t.
+	 */
+	CCI_OPT_ENDPT_EAGER_LIMIT,
+
+	/*! Buffer allocator for the large messages received by an endpoint
+	   created with CCI_ENDPT_LARGE_MSGS. By default, they are received
+	   in buffers from malloc().
+
+	   cci_get_opt() and cci_set_opt().
+
+	   The parameter must point to a cci_large_alloc_t.
+	 */
+	CCI_OPT_ENDPT_LARGE_ALLOC
 } cci_opt_name_t;
 
+/*!
+  Buffer allocator for large messages, see CCI_OPT_ENDPT_LARGE_ALLOC.
+
+  alloc() returns a buffer of at least len bytes for a message received
+  on connection, or NULL to drop the message (its sender then completes
+  with CCI_ENOMEM). The buffer is the event's recv.ptr and it is passed
+  to release() when the application returns the event.
+*/
+typedef struct cci_large_alloc {
+	void *(*alloc) (cci_connection_t * connection, uint32_t len, void *arg);
+	void (*release) (void *ptr, uint32_t len, void *arg);
+	void *arg;			/*!< Passed to alloc() and release() */
+} cci_large_alloc_t;
+
 typedef struct cci_alignment {
 	uint32_t rma_write_local_addr;	/*!< WRITE local_handle->start + offset */
 	uint32_t rma_write_remote_addr;	/*!< WRITE remote_handle->start + offset */
@@ -1399,7 +1647,11 @@ CCI_DECLSPEC int cci_get_opt(cci_opt_handle_t * handle,
 
   If the application needs to send a message larger than
   cci_connection::max_send_size, the application is responsible for
-  segmenting and reassembly or it should use cci_rma().
+  segmenting and reassembly or it should use cci_rma(), unless the
+  endpoint was created with CCI_ENDPT_LARGE_MSGS. There, a longer
+  message is read by the receiver with RMA. It is copied first, unless
+  CCI_FLAG_NO_COPY or CCI_FLAG_BLOCKING is set and it is a single buffer,
+  in which case it is read from the application's buffer.
 
   When cci_send() returns, the application buffer is reusable. By
   default, CCI will buffer the data internally.
@@ -1506,6 +1758,117 @@ CCI_DECLSPEC int cci_sendv(cci_connection_t * connection,
 			   const struct iovec *data, uint32_t iovcnt,
 			   const void *context, int flags);
 
+/*!
+  One message of a cci_send_batch() call.
+
+  The first five fields are the arguments of cci_sendv(). The status
+  field is set by cci_send_batch().
+
+  \ingroup communications
+*/
+typedef struct cci_send_desc {
+	/*! Connection (destination/reliability). */
+	cci_connection_t *connection;
+
+	/*! Array of local data buffers. */
+	const struct iovec *data;
+
+	/*! Count of local data array. */
+	uint32_t iovcnt;
+
+	/*! Optional flags. See cci_send(). */
+	int flags;
+
+	/*! Cookie to identify the completion through a Send event. */
+	const void *context;
+
+	/*! What cci_sendv() would have returned for this message. */
+	int status;
+} cci_send_desc_t;
+
+/*!
+  Send several short messages at once.
+
+  Each descriptor is posted as if by cci_sendv(), in array order, and
+  generates its own Send event (unless CCI_FLAG_SILENT or
+  CCI_FLAG_BLOCKING is set). All connections must belong to the same
+  endpoint. The transport may queue the whole batch before sending it,
+  which lets it send to many connections with fewer system calls than
+  count calls to cci_sendv().
+
+  Transports that cannot batch post the messages with repeated calls
+  to cci_sendv().
+
+  \param[in,out] descs	Array of message descriptors. The status of
+                        each descriptor is set on return.
+  \param[in] count	Number of descriptors.
+
+  \return CCI_SUCCESS   All messages have been queued to send.
+  \return CCI_EINVAL    Descs is NULL or a connection is NULL. No
+                        message is posted.
+  \return Otherwise, the first failed status; the other messages are
+          still posted.
+
+  \ingroup communications
+*/
+CCI_DECLSPEC int cci_send_batch(cci_send_desc_t * descs, uint32_t count);
+
+/*!
+  Resolve the URI of a peer endpoint for cci_sendto().
+
+  The endpoint keeps the addresses it resolved. Looking up a URI again
+  returns the cached address without any name lookup.
+  The first lookup of a host name may block until the name resolves.
+
+  \param[in] endpoint	Local endpoint.
+  \param[in] uri	URI of the peer endpoint.
+  \param[out] addr	Address, valid until the endpoint is destroyed.
+
+  \return CCI_SUCCESS   The address is resolved.
+  \return CCI_EINVAL    Endpoint, URI or addr is NULL, or the URI is invalid.
+  \return CCI_EADDRNOTAVAIL  The host name did not resolve.
+  \return CCI_ERR_NOT_IMPLEMENTED  The transport has no datagrams.
+  \return Each transport may have additional error codes.
+
+  \ingroup communications
+*/
+CCI_DECLSPEC int cci_addr_resolve(cci_endpoint_t * endpoint,
+				  const char *uri, const cci_addr_t ** addr);
+
+/*!
+  Send a short datagram without a connection.
+
+  The datagram is unreliable and unordered (UU). No handshake and no
+  state is needed to send it, which suits sending little data to many
+  peers. The receiver gets a CCI_EVENT_RECV_FROM event whose addr
+  field can be passed to cci_sendto() to reply.
+
+  Like on a UU connection, the send completes locally. When cci_sendto()
+  returns, the buffer is re-usable by the application.
+
+  \param[in] endpoint	Local endpoint.
+  \param[in] addr	Peer, from cci_addr_resolve() or a
+			CCI_EVENT_RECV_FROM event of this endpoint.
+  \param[in] msg_ptr	Pointer to local segment.
+  \param[in] msg_len	Length of local segment (limited to the
+			max_send_size of the endpoint's device).
+  \param[in] context	Cookie to identify the completion through a Send
+			event (whose connection is NULL).
+  \param[in] flags	Optional flags: CCI_FLAG_BLOCKING,
+			CCI_FLAG_SILENT. See cci_send().
+
+  \return CCI_SUCCESS   The datagram has been sent.
+  \return CCI_EINVAL    Endpoint or addr is NULL.
+  \return CCI_EMSGSIZE  The datagram is larger than max_send_size.
+  \return CCI_ERR_NOT_IMPLEMENTED  The transport has no datagrams.
+  \return Each transport may have additional error codes.
+
+  \ingroup communications
+*/
+CCI_DECLSPEC int cci_sendto(cci_endpoint_t * endpoint, const cci_addr_t * addr,
+			    const void *msg_ptr, uint32_t msg_len,
+			    const void *context, int flags);
+
 /* RMA Area operations */
 
 /*!
@@ -1520,6 +1883,15 @@ typedef const struct cci_rma_handle {
 	uint64_t stuff[4];
 } cci_rma_handle_t;
 
+/*!
+  File mapped by a registered region, see CCI_OPT_ENDPT_RMA_FILE.
+*/
+typedef struct cci_rma_file {
+	cci_rma_handle_t *rma_handle;	/*!< Region from cci_rma_register() */
+	int fd;				/*!< Open file mapped by the region */
+	uint64_t offset;		/*!< File offset of the region's start */
+} cci_rma_file_t;
+
 /*!
   Register memory for RMA operations.
 
@@ -1533,6 +1905,15 @@ typedef const struct cci_rma_handle {
 
   It is allowable to have overlapping registrations.
 
+  If the environment variable CCI_RMA_CACHE is set to N > 0 when the
+  endpoint is created (and the transport supports it), the endpoint
+  keeps up to N deregistered regions registered. Registering the same
+  region (same start and length) with the same flags as a cached (or
+  still registered) one then returns the same handle without calling
+  the transport. The region stays accessible to peers that kept its handle
+  until it is evicted, so call cci_rma_invalidate() before releasing
+  the memory.
+
   \param[in]  endpoint      Local endpoint to use for RMA.
   \param[in]  start         Pointer to local memory.
   \param[in]  length        Length of local memory.
@@ -1572,6 +1953,27 @@ CCI_DECLSPEC int cci_rma_register(cci_endpoint_t * endpoint,
 CCI_DECLSPEC int cci_rma_deregister(cci_endpoint_t * endpoint,
 				    cci_rma_handle_t * rma_handle);
 
+/*!
+  Drop cached registrations of memory about to be released.
+
+  With CCI_RMA_CACHE (see cci_rma_register()), deregistered memory may
+  stay registered. Call this before freeing or unmapping memory that was
+  registered with any endpoint. Cached registrations that overlap the
+  range are deregistered, those still in use are deregistered by their
+  last cci_rma_deregister(), and no later cci_rma_register() returns
+  them. Without the cache, it does nothing.
+
+  \param[in] start     Start of the memory to release.
+  \param[in] length    Length of the memory.
+
+  \return CCI_SUCCESS   The range is no longer cached.
+  \return CCI_ENODEV   CCI is not initialized.
+  \return CCI_EINVAL   start is NULL or length is 0.
+
+  \ingroup communications
+ */
+CCI_DECLSPEC int cci_rma_invalidate(void *start, uint64_t length);
+
 /*!
   Perform a RMA operation between local and remote memory.
 
@@ -1625,6 +2027,9 @@ CCI_DECLSPEC int cci_rma_deregister(cci_endpoint_t * endpoint,
   \return CCI_EINVAL    data_len is 0.
   \return CCI_EINVAL    Both READ and WRITE flags are set.
   \return CCI_EINVAL    Neither the READ or WRITE flag is set.
+  \return CCI_EINVAL    The completion message starts with "CCIL" on an
+                        endpoint created with CCI_ENDPT_LARGE_MSGS, which
+                        marks the messages of the large message protocol.
   \return Each transport may have additional error codes.
 
   \note CCI_FLAG_FENCE only applies to RMA operations for this connection. It does
@@ -1640,4 +2045,136 @@ CCI_DECLSPEC int cci_rma(cci_connection_t * connection,
 			 cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 			 uint64_t data_len, const void *context, int flags);
 
+/*!
+  One segment of a cci_rmav() call.
+
+  \ingroup communications
+*/
+typedef struct cci_rma_seg {
+	/*! Offset in the local RMA area. */
+	uint64_t local_offset;
+
+	/*! Offset in the remote RMA area. */
+	uint64_t remote_offset;
+
+	/*! Length of the segment. */
+	uint64_t length;
+} cci_rma_seg_t;
+
+/*!
+  Perform a vectored RMA operation between local and remote memory.
+
+  Move several non-contiguous segments between the same local and remote
+  RMA areas as a single RMA operation, as cci_rma() moves one. All
+  segments move in the same direction. There is a single local
+  completion once every segment has completed and, if msg_ptr and msg_len
+  are provided, a single remote completion message sent after all of
+  them. The segments may complete in any order.
+
+  Transports may pack small segments together on the wire, which makes
+  this cheaper than one cci_rma() per segment (e.g. halo exchanges or
+  strided arrays). Transports without a vectored RMA issue one silent
+  cci_rma() per segment and fence the last one, which carries the
+  completion message and the context. If one of them cannot be posted,
+  cci_rmav() returns its error while the segments posted before it may
+  still be in flight. They generate no event, so the caller should
+  consider both RMA areas in use until a later operation on the
+  connection with CCI_FLAG_FENCE completes.
+
+  \param[in] connection     Connection (destination).
+  \param[in] msg_ptr        Pointer to data for the remote completion.
+  \param[in] msg_len        Length of data for the remote completion.
+  \param[in] local_handle   Handle of the local RMA area.
+  \param[in] remote_handle  Handle of the remote RMA area.
+  \param[in] segs           Array of segments.
+  \param[in] segcnt         Number of segments.
+  \param[in] context        Cookie to identify the completion through a Send
+                            event when non-blocking.
+  \param[in] flags          Optional flags, as for cci_rma().
+
+  \return CCI_SUCCESS   The RMA operation has been initiated.
+  \return CCI_EINVAL    connection, a handle or segs is NULL.
+  \return CCI_EINVAL    connection is unreliable.
+  \return CCI_EINVAL    segcnt is 0 or a segment's length is 0.
+  \return CCI_EINVAL    Both READ and WRITE flags are set.
+  \return CCI_EINVAL    Neither the READ or WRITE flag is set.
+  \return CCI_EINVAL    The completion message starts with "CCIL" on an
+                        endpoint created with CCI_ENDPT_LARGE_MSGS, which
+                        marks the messages of the large message protocol.
+  \return Each transport may have additional error codes.
+
+  \ingroup communications
+*/
+CCI_DECLSPEC int cci_rmav(cci_connection_t * connection,
+			  const void *msg_ptr, uint32_t msg_len,
+			  cci_rma_handle_t * local_handle,
+			  cci_rma_handle_t * remote_handle,
+			  const cci_rma_seg_t * segs, uint32_t segcnt,
+			  const void *context, int flags);
+
+/*!
+  Remote atomic operations of cci_rma_atomic().
+
+  \ingroup communications
+*/
+typedef enum cci_rma_atomic_op {
+	CCI_RMA_ATOMIC_FETCH_ADD,	/*!< Add operand to the remote word. */
+	CCI_RMA_ATOMIC_CSWAP,	/*!< Replace the remote word with operand
+				   if it equals compare. */
+	CCI_RMA_ATOMIC_SWAP	/*!< Replace the remote word with
+				   operand. */
+} cci_rma_atomic_op_t;
+
+/*!
+  Perform an atomic operation on a 64-bit word of remote memory.
+
+  Apply op to the 64-bit word at remote_offset in the remote RMA area
+  and store the word's previous value, in host byte order, at
+  local_offset in the local RMA area. The target executes it without the
+  application's involvement, which makes one call enough for remote
+  counters and locks.
+
+  The operation is atomic with respect to other cci_rma_atomic() calls
+  on the same word through the same transport, not with respect to
+  cci_rma() or to the target's own accesses. remote_offset must be a
+  multiple of 8. Like a cci_rma(), the operation generates a local
+  completion, but no remote completion event.
+
+  \param[in] connection     Connection (destination).
+  \param[in] local_handle   Handle of the local RMA area.
+  \param[in] local_offset   Offset in the local RMA area of the previous
+                            value.
+  \param[in] remote_handle  Handle of the remote RMA area.
+  \param[in] remote_offset  Offset in the remote RMA area of the word.
+  \param[in] op             Operation to apply.
+  \param[in] operand        Value to add or to swap in.
+  \param[in] compare        Value to compare with for CCI_RMA_ATOMIC_CSWAP,
+                            ignored otherwise.
+  \param[in] context        Cookie to identify the completion through a Send
+                            event when non-blocking.
+  \param[in] flags          Optional flags:
+    - CCI_FLAG_BLOCKING:    Blocking call (see cci_send() for details).
+    - CCI_FLAG_FENCE:       As for cci_rma().
+    - CCI_FLAG_SILENT:      Generates no local completion event (see cci_send()
+                            for details).
+
+  \return CCI_SUCCESS   The atomic operation has been initiated.
+  \return CCI_EINVAL    connection or a handle is NULL.
+  \return CCI_EINVAL    connection is unreliable.
+  \return CCI_EINVAL    op is not a cci_rma_atomic_op_t.
+  \return CCI_EINVAL    remote_offset is not a multiple of 8.
+  \return CCI_ERR_NOT_IMPLEMENTED The transport has no atomics.
+  \return Each transport may have additional error codes.
+
+  \ingroup communications
+*/
+CCI_DECLSPEC int cci_rma_atomic(cci_connection_t * connection,
+				cci_rma_handle_t * local_handle,
+				uint64_t local_offset,
+				cci_rma_handle_t * remote_handle,
+				uint64_t remote_offset,
+				cci_rma_atomic_op_t op, uint64_t operand,
+				uint64_t compare, const void *context,
+				int flags);
+
 #endif				/* CCI_H */
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <time.h>
 #include "bsd/queue.h"
 #include "plugins/ctp/ctp.h"
 
@@ -39,6 +40,44 @@ BEGIN_C_DECLS
  *       - Public struct field names should be their name
  *         (e.g. cci_device_t device;)
  */
+/*! NUMA and CPU placement of a device's endpoints
+ *
+ *  Buffer pools are allocated on node and progress threads run on cpus.
+ *  The defaults follow the NIC: its node is read from sysfs and cpus are
+ *  the CPUs of that node. The numa_node and cpus device keys override
+ *  them, and so do CCI_OPT_ENDPT_NUMA_NODE and CCI_OPT_ENDPT_CPUS on an
+ *  endpoint.
+ */
+#define CCI_MAX_CPUS		(1024)
+#define CCI_AFFINITY_NODE	(1 << 0)	/* node set by a device key */
+#define CCI_AFFINITY_CPUS	(1 << 1)	/* cpus set by a device key */
+
+typedef struct cci__affinity {
+	/*! NUMA node of the buffers, or -1 for any */
+	int node;
+
+	/*! Number of CPUs in cpus, 0 to run anywhere */
+	int ncpus;
+
+	/*! CPUs of the progress threads, one bit per CPU */
+	unsigned long cpus[CCI_MAX_CPUS / (8 * sizeof(unsigned long))];
+
+	/*! CCI_AFFINITY_* set from the config file */
+	int conf;
+} cci__affinity_t;
+
+void cci__affinity_init(cci__affinity_t *aff);
+int cci__affinity_parse_cpus(cci__affinity_t *aff, const char *list);
+char *cci__affinity_cpus_str(const cci__affinity_t *aff);
+void cci__affinity_sysfs(cci__affinity_t *aff, const char *ifname);
+int cci__affinity_set_opt(cci__affinity_t *aff, cci_opt_name_t name,
+			  const void *val);
+int cci__affinity_bind(const cci__affinity_t *aff, int tid);
+int cci__affinity_tid(void);
+void *cci__numa_alloc(const cci__affinity_t *aff, size_t len);
+void cci__numa_free(void *ptr, size_t len);
+int cci__numa_move(const cci__affinity_t *aff, void *ptr, size_t len);
+
 /*! CCI private device */
     typedef struct cci__dev {
 	/*! Pointer to the plugin structure */
@@ -67,6 +106,9 @@ BEGIN_C_DECLS
 
 	/*! Device RMA alignment requirements. Used for CCI_OPT_ENDPT_RMA_ALIGN. */
 	cci_alignment_t align;
+
+	/*! Default placement of the endpoints' buffers and threads */
+	cci__affinity_t affinity;
 } cci__dev_t;
 
 /* export for transports as needed */
@@ -95,6 +137,30 @@ typedef struct cci__ep {
 	/*! Keepalive timeout in microseconds. Used for CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT. */
 	uint32_t keepalive_timeout;
 
+	/*! Spin before sleeping in microseconds. Used for CCI_OPT_ENDPT_WAIT_SPIN. */
+	uint32_t wait_spin;
+
+	/*! Set if used by a single thread (CCI_ENDPT_SINGLE_THREADED) */
+	int single;
+
+	/*! Set if progress only runs in the application's calls
+	    (CCI_ENDPT_APP_PROGRESS, implied by single) */
+	int app_progress;
+
+	/*! Placement of buffers and threads, copied from the device. Used
+	    for CCI_OPT_ENDPT_NUMA_NODE and CCI_OPT_ENDPT_CPUS. */
+	cci__affinity_t affinity;
+
+	/*! Set by the transport's create_endpoint() if its registrations
+	    may be cached (see cci__rcache_t) */
+	int rma_cache;
+
+	/*! Registration cache, NULL if disabled */
+	struct cci__rcache *rcache;
+
+	/*! Large message state, NULL without CCI_ENDPT_LARGE_MSGS */
+	struct cci__large *large;
+
 	/*! Events ready for process */
 	 TAILQ_HEAD(s_evts, cci__evt) evts;
 
@@ -104,6 +170,9 @@ typedef struct cci__ep {
 	/*! Is closing down? */
 	int closing;
 
+	/*! Name lookups in flight for connects, protected by lock */
+	uint32_t resolving;
+
 	/*! Owning dev */
 	cci__dev_t *dev;
 
@@ -119,6 +188,26 @@ typedef struct cci__ep {
 	char *uri;
 } cci__ep_t;
 
+/*! Take or release a lock on the endpoint's paths. No-ops when the
+ *  endpoint is single-threaded, where nothing else can contend for it. */
+static inline void cci__ep_lock(const cci__ep_t *ep, pthread_mutex_t *lock)
+{
+	if (!ep->single)
+		pthread_mutex_lock(lock);
+}
+
+static inline void cci__ep_unlock(const cci__ep_t *ep, pthread_mutex_t *lock)
+{
+	if (!ep->single)
+		pthread_mutex_unlock(lock);
+}
+
+/*! Returns 0 if the lock was taken, like pthread_mutex_trylock(). */
+static inline int cci__ep_trylock(const cci__ep_t *ep, pthread_mutex_t *lock)
+{
+	return ep->single ? 0 : pthread_mutex_trylock(lock);
+}
+
 /*! CCI private connection */
 typedef struct cci__conn {
 	/*! Pointer to the plugin structure */
@@ -164,6 +253,544 @@ typedef struct cci__evt {
 	void *priv;
 } cci__evt_t;
 
+/*! RMA handle registry
+ *
+ *  Transports keep their RMA registrations in a dense table and put the
+ *  key returned by cci__rma_reg_insert() in rma_handle.stuff[0]. The low
+ *  32 bits of the key are the slot index plus one (0 is never valid), the
+ *  high 32 bits are the slot's generation. The generation changes when
+ *  the slot is released, so the key of a deregistered handle never
+ *  matches again, even after the slot is reused.
+ *
+ *  Insert and remove take reg->lock. Lookups are lock-free: slots live in
+ *  fixed size chunks that do not move until cci__rma_reg_fini().
+ */
+#define CCI_RMA_REG_CHUNK_SHIFT (10)
+#define CCI_RMA_REG_CHUNK       (1 << CCI_RMA_REG_CHUNK_SHIFT)	/* slots per chunk */
+#define CCI_RMA_REG_MAX_CHUNKS  (1024)	/* up to 1M registrations */
+
+typedef struct cci__rma_reg_slot {
+	/*! Transport handle, NULL if free */
+	void *handle;
+
+	/*! Generation, incremented when the slot is released */
+	uint32_t gen;
+
+	/*! Next free slot (index plus one, 0 ends the list) */
+	uint32_t next_free;
+} cci__rma_reg_slot_t;
+
+typedef struct cci__rma_reg {
+	/*! Slot chunks, allocated on demand */
+	cci__rma_reg_slot_t *chunks[CCI_RMA_REG_MAX_CHUNKS];
+
+	/*! Number of allocated chunks */
+	uint32_t nchunks;
+
+	/*! First free slot (index plus one, 0 if none) */
+	uint32_t free_head;
+
+	/*! Lock for insert and remove */
+	pthread_mutex_t lock;
+} cci__rma_reg_t;
+
+/* export for transports as needed */
+int cci__rma_reg_init(cci__rma_reg_t *reg);
+void cci__rma_reg_fini(cci__rma_reg_t *reg);
+int cci__rma_reg_insert(cci__rma_reg_t *reg, void *handle, uint64_t *key);
+void *cci__rma_reg_remove(cci__rma_reg_t *reg, uint64_t key);
+
+/*! Return the handle registered under key or NULL if the key is out of
+ *  bounds or stale. Does not take any lock. */
+static inline void *cci__rma_reg_lookup(cci__rma_reg_t *reg, uint64_t key)
+{
+	uint32_t index = (uint32_t) key;
+	uint32_t gen = (uint32_t) (key >> 32);
+	cci__rma_reg_slot_t *slot;
+	void *handle;
+
+	if (index-- == 0)
+		return NULL;
+	if ((index >> CCI_RMA_REG_CHUNK_SHIFT) >=
+	    __atomic_load_n(&reg->nchunks, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	slot = &reg->chunks[index >> CCI_RMA_REG_CHUNK_SHIFT]
+			[index & (CCI_RMA_REG_CHUNK - 1)];
+	if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != gen)
+		return NULL;
+	handle = __atomic_load_n(&slot->handle, __ATOMIC_ACQUIRE);
+
+	/* the slot may have been released while we read it */
+	if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) != gen)
+		return NULL;
+
+	return handle;
+}
+
+/*! RMA registration cache
+ *
+ *  cci_rma_deregister() keeps up to CCI_RMA_CACHE unused registrations of
+ *  an endpoint instead of passing them to the transport, and
+ *  cci_rma_register() of the same range with the same flags as a cached
+ *  one returns that handle. Handles are reference counted, so repeated
+ *  registrations of the same buffer share one transport registration.
+ *  A handle gives the peer access to its whole range, so a shorter or
+ *  overlapping range is registered separately.
+ *
+ *  Registrations are kept in an interval tree (a treap ordered by start,
+ *  augmented with the highest end of each subtree) so that
+ *  cci_rma_invalidate() finds those that overlap released memory. They
+ *  are dropped from the cache and deregistered once unused.
+ *
+ *  A transport opts in by setting ep->rma_cache in create_endpoint(),
+ *  if deferring its deregistrations is safe. Transports that pin memory
+ *  (verbs) keep a cached range pinned until cci_rma_invalidate() or
+ *  eviction, so the application must invalidate memory before it
+ *  unmaps it. The application enables
+ *  the cache by setting CCI_RMA_CACHE to the number of unused
+ *  registrations to keep per endpoint (0, the default, disables it).
+ */
+#define CCI_RCACHE_HASH_SIZE	(256)
+
+typedef struct cci__rcache_entry {
+	/*! Registered range [start, end) */
+	uintptr_t start;
+	uintptr_t end;
+
+	/*! Highest end in this subtree */
+	uintptr_t max_end;
+
+	/*! Treap priority, a heap over the tree */
+	uint32_t prio;
+
+	struct cci__rcache_entry *left;
+	struct cci__rcache_entry *right;
+
+	/*! Registration flags */
+	int flags;
+
+	/*! Number of cci_rma_register() calls that returned it */
+	uint32_t refcnt;
+
+	/*! Set once invalidated (not in the tree anymore) */
+	int invalid;
+
+	/*! Transport handle */
+	cci_rma_handle_t *handle;
+
+	/*! Entry on the LRU list of unused entries */
+	TAILQ_ENTRY(cci__rcache_entry) lentry;
+
+	/*! Entry in the handle hash */
+	TAILQ_ENTRY(cci__rcache_entry) hentry;
+} cci__rcache_entry_t;
+
+typedef struct cci__rcache {
+	/*! Root of the interval tree */
+	cci__rcache_entry_t *root;
+
+	/*! Unused entries, least recently used first */
+	TAILQ_HEAD(s_rcache_lru, cci__rcache_entry) lru;
+
+	/*! Number of unused entries and the most to keep */
+	uint32_t nunused;
+	uint32_t max_unused;
+
+	/*! All entries, hashed by handle */
+	TAILQ_HEAD(s_rcache_hash, cci__rcache_entry) hash[CCI_RCACHE_HASH_SIZE];
+
+	/*! Seed of the treap priorities */
+	uint32_t seed;
+
+	pthread_mutex_t lock;
+} cci__rcache_t;
+
+void cci__rcache_init(cci__ep_t *ep);
+void cci__rcache_fini(cci__ep_t *ep);
+int cci__rcache_put(cci__ep_t *ep, cci_rma_handle_t *handle);
+
+/*! Large messages (CCI_ENDPT_LARGE_MSGS)
+ *
+ *  Messages that do not fit are moved by the core with the transport's
+ *  send and RMA. The sender registers the message and sends an RTS with
+ *  its length and handle. The receiver reads it into its own registered
+ *  buffer, sends a FIN with the status and delivers a CCI_EVENT_RECV
+ *  made by the core. The FIN completes the sender's send. On RO
+ *  connections, the messages received after an RTS are held until its
+ *  read completes so that they are delivered in order.
+ *
+ *  Protocol messages start with CCI_LARGE_MAGIC so that all others are
+ *  passed through untouched. An application message that starts with it
+ *  is sent after a CCI_LARGE_EAGER header, which the receiver strips.
+ */
+#define CCI_LARGE_MAGIC		"CCIL"
+#define CCI_LARGE_EAGER		(1)	/* header of an application message */
+#define CCI_LARGE_RTS		(2)	/* registered message ready to read */
+#define CCI_LARGE_FIN		(3)	/* receiver is done reading */
+
+#define CCI_LARGE_HDR_LEN	(8)	/* magic and type */
+#define CCI_LARGE_FIN_LEN	(16)	/* and id and status */
+
+/*! Protocol message, integers in network order */
+typedef struct cci__large_msg {
+	char magic[4];			/* CCI_LARGE_MAGIC */
+	uint8_t type;			/* CCI_LARGE_* */
+	uint8_t pad[3];
+	uint32_t id;			/* RTS and FIN: sender's id */
+	int32_t status;			/* FIN: outcome of the read */
+	uint32_t len_hi;		/* RTS: length of the message */
+	uint32_t len_lo;
+	cci_rma_handle_t handle;	/* RTS: registration of the message */
+} cci__large_msg_t;
+
+/*! A large message in flight, or an event made by the core */
+typedef struct cci__large_op {
+	/*! Event delivered for the op, its priv is &cci__large_tag */
+	cci__evt_t evt;
+
+	/*! Transport event of a stripped CCI_LARGE_EAGER message */
+	cci_event_t *orig;
+
+	/*! Set on the sender */
+	int send;
+
+	/*! Sender's id, unique on the sender's endpoint */
+	uint32_t id;
+
+	/*! Message (or receive buffer) and its length */
+	void *buf;
+	uint64_t len;
+
+	/*! Sender: buf is a copy to free. Receiver: buf is from malloc() */
+	int own;
+
+	/*! Registration of buf */
+	cci_rma_handle_t *handle;
+
+	/*! Receiver: sender's registration, read until the RMA completes */
+	cci_rma_handle_t remote;
+
+	/*! Application's send context and flags */
+	const void *context;
+	int flags;
+
+	/*! Sender: RTS completion and FIN still to come. Receiver: set
+	 *  while the read is in flight */
+	int pending;
+
+	/*! Outcome, and set once a CCI_FLAG_BLOCKING send completed */
+	int status;
+	int done;
+
+	/*! Entry to hang on large->ops */
+	TAILQ_ENTRY(cci__large_op) entry;
+} cci__large_op_t;
+
+typedef struct cci__large {
+	/*! Lock for ops, evts, held, nheld and next_id */
+	pthread_mutex_t lock;
+
+	/*! Ops waiting for an RTS send, a read or a FIN */
+	TAILQ_HEAD(s_large_ops, cci__large_op) ops;
+
+	/*! Events to deliver before polling the transport again */
+	TAILQ_HEAD(s_large_evts, cci__evt) evts;
+
+	/*! CCI_EVENT_RECVs of RO connections, in order, with the reads
+	 *  that the ones behind them wait for */
+	TAILQ_HEAD(s_large_held, cci__evt) held;
+
+	/*! Number of entries on held, also read without the lock */
+	uint32_t nheld;
+
+	/*! Next sender's id */
+	uint32_t next_id;
+
+	/*! CCI_OPT_ENDPT_EAGER_LIMIT */
+	uint32_t eager_limit;
+
+	/*! CCI_OPT_ENDPT_LARGE_ALLOC */
+	cci_large_alloc_t alloc;
+} cci__large_t;
+
+extern int cci__large_tag;
+
+int cci__large_init(cci__ep_t *ep);
+void cci__large_fini(cci__ep_t *ep);
+int cci__large_sendv(cci__conn_t *conn, const struct iovec *data,
+		     uint32_t iovcnt, const void *context, int flags);
+int cci__large_check_msg(cci__conn_t *conn, const void *ptr, uint32_t len);
+void cci__large_disconnect(cci__ep_t *ep, cci__conn_t *conn);
+int cci__large_get_event(cci__ep_t *ep, cci_event_t **event);
+int cci__large_filter(cci__ep_t *ep, cci_event_t **event);
+int cci__large_return_event(cci__evt_t *evt);
+
+/*! Completed event queue
+ *
+ *  Transports hand completed events from their progress threads to the
+ *  application through a bounded ring of cells instead of ep->evts and
+ *  ep->lock. Each cell carries a sequence number that tells producers
+ *  and consumers whether it is free or holds an event for this lap, so
+ *  both sides only claim cells with a compare-and-swap on tail or head.
+ *  Producers and consumers keep their index on their own cache line.
+ *
+ *  Any number of threads may push and pop. The transport sizes the ring
+ *  to hold all of its tx and rx buffers, so a push never finds it full.
+ */
+#define CCI_CACHE_LINE  (64)
+
+typedef struct cci__evtq_cell {
+	/*! Lap number: index when free, index + 1 when it holds evt */
+	uint64_t seq;
+
+	/*! Queued event */
+	cci__evt_t *evt;
+} cci__evtq_cell_t;
+
+typedef struct cci__evtq {
+	char pad0[CCI_CACHE_LINE];
+
+	/*! Next cell to fill, advanced by producers */
+	uint64_t tail;
+	char pad1[CCI_CACHE_LINE - sizeof(uint64_t)];
+
+	/*! Next cell to drain, advanced by consumers */
+	uint64_t head;
+	char pad2[CCI_CACHE_LINE - sizeof(uint64_t)];
+
+	/*! Cells, a power of two of them */
+	cci__evtq_cell_t *cells;
+
+	/*! Number of cells minus one */
+	uint64_t mask;
+
+	/*! Number of threads sleeping in cci__evtq_wait() */
+	uint32_t nwaiting;
+
+	/*! Lock and condition for the sleepers, signalled by pushes */
+	pthread_mutex_t wlock;
+	pthread_cond_t wcond;
+} cci__evtq_t;
+
+/* export for transports as needed */
+int cci__evtq_init(cci__evtq_t *q, uint32_t size);
+void cci__evtq_fini(cci__evtq_t *q);
+void cci__evtq_wake(cci__evtq_t *q);
+cci__evt_t *cci__evtq_wait(cci__evtq_t *q, const struct timespec *deadline);
+
+/*! Queue evt. Returns CCI_ENOBUFS if the ring is full. */
+static inline int cci__evtq_push(cci__evtq_t *q, cci__evt_t *evt)
+{
+	uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	cci__evtq_cell_t *cell;
+
+	for (;;) {
+		int64_t dif;
+
+		cell = &q->cells[pos & q->mask];
+		dif = (int64_t) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) -
+			(int64_t) pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1,
+						1, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return CCI_ENOBUFS;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->evt = evt;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in cci__evtq_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->nwaiting, __ATOMIC_RELAXED))
+		cci__evtq_wake(q);
+
+	return CCI_SUCCESS;
+}
+
+/*! Dequeue the oldest event or return NULL if there is none. */
+static inline cci__evt_t *cci__evtq_pop(cci__evtq_t *q)
+{
+	uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	cci__evtq_cell_t *cell;
+	cci__evt_t *evt;
+
+	for (;;) {
+		int64_t dif;
+
+		cell = &q->cells[pos & q->mask];
+		dif = (int64_t) __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) -
+			(int64_t) (pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+						1, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+	evt = cell->evt;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return evt;
+}
+
+/*! Completion wait object for blocking sends
+ *
+ *  A blocking sender keeps one on its stack and points its tx at it. The
+ *  thread that completes the tx calls cci__waiter_wake() instead of
+ *  queuing the send event, and the sender sleeps in cci__waiter_wait().
+ *  The waker does not touch the object after it releases the lock, and
+ *  cci__waiter_fini() waits for that, so the object may live on the
+ *  sender's stack.
+ */
+typedef struct cci__waiter {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/*! Set once the tx completed */
+	int done;
+} cci__waiter_t;
+
+static inline void cci__waiter_init(cci__waiter_t *w)
+{
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	w->done = 0;
+}
+
+static inline void cci__waiter_fini(cci__waiter_t *w)
+{
+	/* wait for a waker that is still inside cci__waiter_wake() */
+	pthread_mutex_lock(&w->lock);
+	pthread_mutex_unlock(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+}
+
+/*! Return non-zero if the tx completed. Does not take the lock. */
+static inline int cci__waiter_done(cci__waiter_t *w)
+{
+	return __atomic_load_n(&w->done, __ATOMIC_ACQUIRE);
+}
+
+static inline void cci__waiter_wait(cci__waiter_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	while (!w->done)
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static inline void cci__waiter_wake(cci__waiter_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	__atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/*! Name resolution for connects
+ *
+ *  cci__resolve() splits "<prefix>host:service" and returns CCI_SUCCESS
+ *  with ip and port (network order) filled in when the host is numeric or
+ *  was resolved recently (cached for CCI_RESOLVE_TTL seconds). Otherwise,
+ *  it queues the lookup to a pool of up to CCI_RESOLVE_THREADS threads,
+ *  returns CCI_EAGAIN, and later calls cb from a resolver thread with the
+ *  status (CCI_EADDRNOTAVAIL if the name did not resolve). Concurrent
+ *  lookups of the same name share one getaddrinfo() call. Endpoints
+ *  without threads (ep->app_progress) look the name up in the caller
+ *  instead.
+ *
+ *  ep->resolving counts the endpoint's queued lookups, and
+ *  cci_destroy_endpoint() waits for them before destroying it.
+ */
+#define CCI_RESOLVE_THREADS     (4)
+#define CCI_RESOLVE_TTL         (60)	/* seconds */
+
+typedef void (*cci__resolve_cb_t)(cci__ep_t *ep, void *arg, int status,
+				  uint32_t ip, uint16_t port);
+
+int cci__resolve(cci__ep_t *ep, const char *uri, const char *prefix,
+		 int socktype, uint32_t *ip, uint16_t *port,
+		 cci__resolve_cb_t cb, void *arg);
+void cci__resolve_fini(void);
+
+/*! Process-wide progress engine
+ *
+ *  Transports that need background progress register one source per
+ *  endpoint instead of starting their own threads. A source has an fd
+ *  polled for input (or -1), an optional period, and may be kicked. The
+ *  engine calls fn(arg) from one of its workers when the fd is readable,
+ *  when the period elapsed, or after cci__prog_kick(). A source's fn never
+ *  runs in two workers at once, and a kick while it runs makes it run
+ *  again. fn must drain the fd, or it is called again right away.
+ *
+ *  All sources of the process share at most CCI_PROGRESS_THREADS workers
+ *  (CCI_PROGRESS_THREADS_DFLT if unset, at most CCI_PROGRESS_THREADS_MAX),
+ *  started as sources are added. One worker at a time sleeps in poll() on
+ *  the fds of the idle sources while the others run callbacks. The
+ *  workers run on the union of the sources' CPUs (anywhere if a source
+ *  has none); cci__prog_bind() applies a change of a source's CPUs.
+ *
+ *  A thread that polls for events may run the source's work itself
+ *  between cci__prog_claim() and cci__prog_release() when no worker runs
+ *  it or was woken for it, which saves a thread switch per message. When
+ *  the claim fails, cci__prog_claim() yields the CPU to that worker.
+ *
+ *  cci__prog_del() waits for a running fn, so it must not be called from
+ *  the source's own fn.
+ */
+#define CCI_PROGRESS_THREADS_DFLT	(1)
+#define CCI_PROGRESS_THREADS_MAX	(64)
+
+typedef void (*cci__prog_fn_t)(void *arg);
+
+typedef struct cci__prog_src {
+	/*! Polled for input, or -1 */
+	int fd;
+
+	/*! Nanoseconds between timed runs, 0 if none */
+	uint64_t period;
+
+	/*! Next timed run (CLOCK_MONOTONIC nanoseconds) */
+	uint64_t due;
+
+	cci__prog_fn_t fn;
+	void *arg;
+
+	/*! Set if fn must run (fd readable or kicked) */
+	int pending;
+
+	/*! Set while a worker runs fn, or while claimed */
+	int running;
+
+	/*! Set if the current poll() does not watch fd */
+	int skipped;
+
+	/*! CPUs to run fn on, or NULL */
+	const cci__affinity_t *aff;
+
+	TAILQ_ENTRY(cci__prog_src) entry;
+} cci__prog_src_t;
+
+int cci__prog_add(cci__prog_src_t *src, int fd, uint32_t period_us,
+		  cci__prog_fn_t fn, void *arg, const cci__affinity_t *aff);
+void cci__prog_kick(cci__prog_src_t *src);
+int cci__prog_claim(cci__prog_src_t *src);
+void cci__prog_release(cci__prog_src_t *src);
+void cci__prog_del(cci__prog_src_t *src);
+void cci__prog_bind(void);
+void cci__prog_fini(void);
+
 /*! CCI private global state */
 typedef struct cci__globals {
 	/*! List of all known devices */
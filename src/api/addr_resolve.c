@@ -0,0 +1,33 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_addr_resolve(cci_endpoint_t * endpoint, const char *uri,
+		     const cci_addr_t ** addr)
+{
+	cci__ep_t *ep;
+
+	if (NULL == endpoint || NULL == uri || NULL == addr)
+		return CCI_EINVAL;
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	/* datagrams cannot be built from connections */
+	if (!ep->plugin->addr_resolve)
+		return CCI_ERR_NOT_IMPLEMENTED;
+
+	return ep->plugin->addr_resolve(endpoint, uri, addr);
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * NUMA and CPU placement of endpoints. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_MEMPOLICY_H
+#include <linux/mempolicy.h>
+#endif
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "cci-api.h"
+
+#define CCI_MAX_NODES	(1024)
+#define ULONG_BITS	(8 * sizeof(unsigned long))
+
+#if defined(SYS_mbind) && defined(HAVE_LINUX_MEMPOLICY_H)
+#define CCI_HAVE_MBIND	1
+#endif
+
+void cci__affinity_init(cci__affinity_t *aff)
+{
+	memset(aff, 0, sizeof(*aff));
+	aff->node = -1;
+}
+
+static void aff_set_cpu(cci__affinity_t *aff, int cpu)
+{
+	unsigned long bit = 1UL << (cpu % ULONG_BITS);
+
+	if (!(aff->cpus[cpu / ULONG_BITS] & bit)) {
+		aff->cpus[cpu / ULONG_BITS] |= bit;
+		aff->ncpus++;
+	}
+}
+
+static int aff_has_cpu(const cci__affinity_t *aff, int cpu)
+{
+	return (aff->cpus[cpu / ULONG_BITS] >> (cpu % ULONG_BITS)) & 1;
+}
+
+/* Parse a CPU list such as "0-3,8" (the format of sysfs cpulist files).
+ * An empty list clears the set.
+ */
+int cci__affinity_parse_cpus(cci__affinity_t *aff, const char *list)
+{
+	cci__affinity_t tmp;
+	const char *p = list;
+
+	cci__affinity_init(&tmp);
+
+	while (*p) {
+		char *end;
+		long first, last;
+
+		while (isspace((unsigned char) *p) || *p == ',')
+			p++;
+		if (*p == '\0')
+			break;
+
+		first = strtol(p, &end, 10);
+		if (end == p)
+			return CCI_EINVAL;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				return CCI_EINVAL;
+			p = end;
+		}
+		if (first < 0 || last < first || last >= CCI_MAX_CPUS)
+			return CCI_EINVAL;
+		if (*p != '\0' && *p != ',' && !isspace((unsigned char) *p))
+			return CCI_EINVAL;
+
+		for (; first <= last; first++)
+			aff_set_cpu(&tmp, (int) first);
+	}
+
+	memcpy(aff->cpus, tmp.cpus, sizeof(aff->cpus));
+	aff->ncpus = tmp.ncpus;
+
+	return CCI_SUCCESS;
+}
+
+/* Format the CPU set as a list, the caller frees it */
+char *cci__affinity_cpus_str(const cci__affinity_t *aff)
+{
+	int cpu = 0, len = 0;
+	/* "dddd-dddd," per range at most */
+	char *str = calloc(1, aff->ncpus * 11 + 1);
+
+	if (!str)
+		return NULL;
+
+	while (cpu < CCI_MAX_CPUS) {
+		int last;
+
+		if (!aff_has_cpu(aff, cpu)) {
+			cpu++;
+			continue;
+		}
+		for (last = cpu; last + 1 < CCI_MAX_CPUS &&
+		     aff_has_cpu(aff, last + 1); last++) ;
+
+		if (last == cpu)
+			len += sprintf(str + len, "%s%d", len ? "," : "", cpu);
+		else
+			len += sprintf(str + len, "%s%d-%d", len ? "," : "",
+				       cpu, last);
+		cpu = last + 1;
+	}
+
+	return str;
+}
+
+static int aff_read_line(const char *path, char *buf, int len)
+{
+	FILE *file = fopen(path, "r");
+	int ret = -1;
+
+	if (!file)
+		return -1;
+	if (fgets(buf, len, file)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+	fclose(file);
+
+	return ret;
+}
+
+/* Fill the node and the CPUs that the config file did not set: the node
+ * of the NIC behind ifname (if any), and the CPUs of the node.
+ */
+void cci__affinity_sysfs(cci__affinity_t *aff, const char *ifname)
+{
+	char path[256], buf[4096];
+
+	if (!(aff->conf & CCI_AFFINITY_NODE) && ifname) {
+		snprintf(path, sizeof(path),
+			 "/sys/class/net/%s/device/numa_node", ifname);
+		/* virtual interfaces and single-node hosts have no node */
+		if (!aff_read_line(path, buf, sizeof(buf)))
+			aff->node = atoi(buf) >= 0 ? atoi(buf) : -1;
+	}
+
+	if (!(aff->conf & CCI_AFFINITY_CPUS) && aff->node >= 0) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", aff->node);
+		if (aff_read_line(path, buf, sizeof(buf)) ||
+		    cci__affinity_parse_cpus(aff, buf))
+			aff->ncpus = 0;
+	}
+
+	debug(CCI_DB_INFO, "%s: %s on node %d, %d cpus", __func__,
+	      ifname ? ifname : "device", aff->node, aff->ncpus);
+}
+
+int cci__affinity_set_opt(cci__affinity_t *aff, cci_opt_name_t name,
+			  const void *val)
+{
+	int ret = CCI_SUCCESS;
+
+	switch (name) {
+	case CCI_OPT_ENDPT_NUMA_NODE:
+	{
+		int32_t node = *((const int32_t *) val);
+		char path[64];
+
+		if (node < -1 || node >= CCI_MAX_NODES)
+			return CCI_EINVAL;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d",
+			 node);
+		if (node >= 0 && access(path, F_OK))
+			return CCI_EINVAL;
+		aff->node = node;
+		break;
+	}
+	case CCI_OPT_ENDPT_CPUS:
+	{
+		const char *list = *((char * const *) val);
+		cci__affinity_t tmp, online;
+		char buf[4096];
+		int w, any = 0;
+
+		ret = cci__affinity_parse_cpus(&tmp, list ? list : "");
+		if (ret)
+			return ret;
+
+		/* at least one of the CPUs must be online */
+		if (tmp.ncpus &&
+		    !aff_read_line("/sys/devices/system/cpu/online", buf,
+				   sizeof(buf)) &&
+		    !cci__affinity_parse_cpus(&online, buf)) {
+			for (w = 0; w < (int) (CCI_MAX_CPUS / ULONG_BITS); w++)
+				any |= (tmp.cpus[w] & online.cpus[w]) != 0;
+			if (!any)
+				return CCI_EINVAL;
+		}
+		memcpy(aff->cpus, tmp.cpus, sizeof(aff->cpus));
+		aff->ncpus = tmp.ncpus;
+		break;
+	}
+	default:
+		ret = CCI_EINVAL;
+	}
+
+	return ret;
+}
+
+int cci__affinity_tid(void)
+{
+#if defined(__linux__) && defined(SYS_gettid)
+	return (int) syscall(SYS_gettid);
+#else
+	return 0;
+#endif
+}
+
+/* Pin thread tid (0 for the caller) to the CPU set, or let it run on any
+ * CPU if the set is empty.
+ */
+int cci__affinity_bind(const cci__affinity_t *aff, int tid)
+{
+#if defined(__linux__) && defined(SYS_sched_setaffinity)
+	unsigned long mask[CCI_MAX_CPUS / ULONG_BITS];
+
+	if (aff->ncpus)
+		memcpy(mask, aff->cpus, sizeof(mask));
+	else
+		/* the kernel ignores the CPUs that do not exist */
+		memset(mask, 0xff, sizeof(mask));
+
+	if (syscall(SYS_sched_setaffinity, tid, sizeof(mask), mask)) {
+		debug(CCI_DB_WARN, "%s: unable to pin thread %d (%s)",
+		      __func__, tid, strerror(errno));
+		return errno;
+	}
+#else
+	(void) aff;
+	(void) tid;
+#endif
+	return CCI_SUCCESS;
+}
+
+#ifdef CCI_HAVE_MBIND
+static int aff_mbind(const cci__affinity_t *aff, void *ptr, size_t len,
+		     unsigned flags)
+{
+	unsigned long mask[CCI_MAX_NODES / ULONG_BITS];
+
+	if (aff->node < 0)
+		return (int) syscall(SYS_mbind, ptr, len, MPOL_DEFAULT,
+				     NULL, 0, 0);
+
+	memset(mask, 0, sizeof(mask));
+	mask[aff->node / ULONG_BITS] = 1UL << (aff->node % ULONG_BITS);
+
+	/* prefer the node, the pool still works when it is full */
+	return (int) syscall(SYS_mbind, ptr, len, MPOL_PREFERRED, mask,
+			     CCI_MAX_NODES + 1, flags);
+}
+#endif
+
+/* Allocate zeroed, page-aligned memory on the node. Free it with
+ * cci__numa_free().
+ */
+void *cci__numa_alloc(const cci__affinity_t *aff, size_t len)
+{
+#ifdef CCI_HAVE_MBIND
+	void *ptr;
+
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	/* the pages are placed when first touched */
+	if (aff->node >= 0 && aff_mbind(aff, ptr, len, 0))
+		debug(CCI_DB_WARN, "%s: unable to bind %zu bytes to node %d (%s)",
+		      __func__, len, aff->node, strerror(errno));
+
+	return ptr;
+#else
+	(void) aff;
+	return calloc(1, len);
+#endif
+}
+
+void cci__numa_free(void *ptr, size_t len)
+{
+	if (!ptr)
+		return;
+#ifdef CCI_HAVE_MBIND
+	munmap(ptr, len);
+#else
+	(void) len;
+	free(ptr);
+#endif
+}
+
+/* Move memory from cci__numa_alloc() to the node */
+int cci__numa_move(const cci__affinity_t *aff, void *ptr, size_t len)
+{
+#ifdef CCI_HAVE_MBIND
+	if (aff_mbind(aff, ptr, len, MPOL_MF_MOVE)) {
+		debug(CCI_DB_WARN, "%s: unable to move %zu bytes to node %d (%s)",
+		      __func__, len, aff->node, strerror(errno));
+		return errno;
+	}
+#else
+	(void) aff;
+	(void) ptr;
+	(void) len;
+#endif
+	return CCI_SUCCESS;
+}
@@ -63,6 +63,10 @@ int cci_create_endpoint(cci_device_t * device,
 
 	TAILQ_INIT(&ep->evts);
 	pthread_mutex_init(&ep->lock, NULL);
+	ep->single = (flags & CCI_ENDPT_SINGLE_THREADED) ||
+		(globals->flags & CCI_INIT_SINGLE_THREADED);
+	ep->app_progress = ep->single || (flags & CCI_ENDPT_APP_PROGRESS);
+	ep->affinity = dev->affinity;
 	ep->dev = dev;
 	ep->endpoint.device = &dev->device;
 	*endpoint = &ep->endpoint;
@@ -70,6 +74,10 @@ int cci_create_endpoint(cci_device_t * device,
 	ret = dev->plugin->create_endpoint(device, flags, endpoint, fd);
 
 	ep->plugin = dev->plugin;
+	if (!ret)
+		cci__rcache_init(ep);
+	if (!ret && flags & CCI_ENDPT_LARGE_MSGS)
+		ret = cci__large_init(ep);
 	pthread_mutex_unlock(&globals->lock);
 
 	pthread_mutex_lock(&dev->lock);
@@ -13,6 +13,7 @@
 #include "cci/private_config.h"
 
 #include <stdio.h>
+#include <unistd.h>
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
@@ -34,6 +35,21 @@ int cci_destroy_endpoint(cci_endpoint_t * endpoint)
 	TAILQ_REMOVE(&dev->eps, ep, entry);
 	pthread_mutex_unlock(&dev->lock);
 
+	/* wait for the name lookups of pending connects */
+	pthread_mutex_lock(&ep->lock);
+	while (ep->resolving) {
+		pthread_mutex_unlock(&ep->lock);
+		usleep(1000);
+		pthread_mutex_lock(&ep->lock);
+	}
+	pthread_mutex_unlock(&ep->lock);
+
+	/* drop the large messages in flight */
+	cci__large_fini(ep);
+
+	/* deregister the cached registrations */
+	cci__rcache_fini(ep);
+
 	/* the transport is responsible for cleaning up ep->priv,
 	 * the evts list, and any cci__conn_t that it is maintaining.
 	 */
@@ -20,11 +20,20 @@
 int cci_disconnect(cci_connection_t * connection)
 {
 	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	cci__ep_t *ep;
+	int ret;
 
 	if (NULL == connection) {
 		return CCI_EINVAL;
 	}
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
 
 	/* NOTE the transport does all connection cleanup */
-	return conn->plugin->disconnect(connection);
+	ret = conn->plugin->disconnect(connection);
+
+	/* drop the large messages in flight, conn is only compared */
+	if (ep->large)
+		cci__large_disconnect(ep, conn);
+
+	return ret;
 }
@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Completed event queue shared by the transports. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "cci-api.h"
+
+int cci__evtq_init(cci__evtq_t *q, uint32_t size)
+{
+	uint64_t i, cnt = 1;
+	pthread_condattr_t attr;
+
+	memset(q, 0, sizeof(*q));
+
+	while (cnt < size)
+		cnt <<= 1;
+
+	q->cells = calloc(cnt, sizeof(*q->cells));
+	if (!q->cells)
+		return CCI_ENOMEM;
+	for (i = 0; i < cnt; i++)
+		q->cells[i].seq = i;
+	q->mask = cnt - 1;
+
+	/* deadlines are taken from CLOCK_MONOTONIC */
+	pthread_mutex_init(&q->wlock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->wcond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return CCI_SUCCESS;
+}
+
+void cci__evtq_fini(cci__evtq_t *q)
+{
+	if (!q->cells)
+		return;
+
+	pthread_cond_destroy(&q->wcond);
+	pthread_mutex_destroy(&q->wlock);
+	free(q->cells);
+	q->cells = NULL;
+	q->mask = 0;
+
+	return;
+}
+
+/* Called by cci__evtq_push() when someone sleeps in cci__evtq_wait(). */
+void cci__evtq_wake(cci__evtq_t *q)
+{
+	pthread_mutex_lock(&q->wlock);
+	pthread_cond_signal(&q->wcond);
+	pthread_mutex_unlock(&q->wlock);
+
+	return;
+}
+
+/* Dequeue the oldest event, sleeping until one is pushed or until the
+ * CLOCK_MONOTONIC deadline (forever if NULL). Returns NULL on timeout.
+ */
+cci__evt_t *cci__evtq_wait(cci__evtq_t *q, const struct timespec *deadline)
+{
+	cci__evt_t *evt;
+
+	pthread_mutex_lock(&q->wlock);
+	__atomic_fetch_add(&q->nwaiting, 1, __ATOMIC_RELAXED);
+	/* a push either sees nwaiting or its event is seen by the pop */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	while (!(evt = cci__evtq_pop(q))) {
+		if (!deadline) {
+			pthread_cond_wait(&q->wcond, &q->wlock);
+		} else if (pthread_cond_timedwait(&q->wcond, &q->wlock,
+						  deadline) == ETIMEDOUT) {
+			evt = cci__evtq_pop(q);
+			break;
+		}
+	}
+
+	__atomic_fetch_sub(&q->nwaiting, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&q->wlock);
+
+	return evt;
+}
@@ -59,6 +59,12 @@ int cci_finalize(void)
 		pthread_mutex_unlock(&dev->lock);
 	}
 
+	/* stop the resolver threads */
+	cci__resolve_fini();
+
+	/* stop the progress engine's workers */
+	cci__prog_fini();
+
 	/* let the transport clean up the private device */
 	for (i = 0;
 	     cci_all_plugins[i].plugin != NULL;
@@ -20,5 +20,8 @@
 int cci_get_event(cci_endpoint_t * endpoint, cci_event_t ** event)
 {
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (ep->large)
+		return cci__large_get_event(ep, event);
 	return ep->plugin->get_event(endpoint, event);
 }
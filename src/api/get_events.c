@@ -0,0 +1,45 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_get_events(cci_endpoint_t * endpoint, cci_event_t ** events,
+		   uint32_t max, uint32_t * count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t n = 0;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (NULL == endpoint || NULL == events || NULL == count || 0 == max)
+		return CCI_EINVAL;
+
+	if (ep->plugin->get_events && !ep->large)
+		return ep->plugin->get_events(endpoint, events, max, count);
+
+	/* the transport does not batch (or large messages need the core),
+	 * get the events one at a time */
+	while (n < max) {
+		if (ep->large)
+			ret = cci__large_get_event(ep, &events[n]);
+		else
+			ret = ep->plugin->get_event(endpoint, &events[n]);
+		if (ret != CCI_SUCCESS)
+			break;
+		n++;
+	}
+	*count = n;
+
+	return n ? CCI_SUCCESS : ret;
+}
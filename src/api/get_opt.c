@@ -38,6 +38,12 @@ int cci_get_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT:
 	case CCI_OPT_ENDPT_URI:
 	case CCI_OPT_ENDPT_RMA_ALIGN:
+	case CCI_OPT_ENDPT_RMA_FILE:
+	case CCI_OPT_ENDPT_WAIT_SPIN:
+	case CCI_OPT_ENDPT_NUMA_NODE:
+	case CCI_OPT_ENDPT_CPUS:
+	case CCI_OPT_ENDPT_EAGER_LIMIT:
+	case CCI_OPT_ENDPT_LARGE_ALLOC:
 		ep = container_of(handle, cci__ep_t, endpoint);
 		plugin = ep->plugin;
 		break;
@@ -96,6 +102,52 @@ int cci_get_opt(cci_opt_handle_t * handle,
 			*timeout = conn->tx_timeout;
 			break;
 		}
+	case CCI_OPT_ENDPT_RMA_FILE:
+		/* set only */
+		ret = CCI_EINVAL;
+		break;
+	case CCI_OPT_ENDPT_WAIT_SPIN:
+		{
+			uint32_t *spin = val;
+			*spin = ep->wait_spin;
+			break;
+		}
+	case CCI_OPT_ENDPT_NUMA_NODE:
+		{
+			int32_t *node = val;
+			*node = ep->affinity.node;
+			break;
+		}
+	case CCI_OPT_ENDPT_CPUS:
+		{
+			char **cpusp = val;
+			char *cpus;
+
+			pthread_mutex_lock(&ep->lock);
+			cpus = cci__affinity_cpus_str(&ep->affinity);
+			pthread_mutex_unlock(&ep->lock);
+			if (!cpus)
+				return CCI_ENOMEM;
+
+			*cpusp = cpus;
+			break;
+		}
+	case CCI_OPT_ENDPT_EAGER_LIMIT:
+		{
+			uint32_t *limit = val;
+			if (!ep->large)
+				return CCI_EINVAL;
+			*limit = ep->large->eager_limit;
+			break;
+		}
+	case CCI_OPT_ENDPT_LARGE_ALLOC:
+		{
+			cci_large_alloc_t *alloc = val;
+			if (!ep->large)
+				return CCI_EINVAL;
+			*alloc = ep->large->alloc;
+			break;
+		}
 	default:
 		ret = plugin->get_opt(handle, name, val);
 	}
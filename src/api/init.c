@@ -176,6 +176,7 @@ void cci__init_dev(cci__dev_t *dev)
 	device->pci.bus = -1;		/* per CCI spec */
 	device->pci.dev = -1;		/* per CCI spec */
 	device->pci.func = -1;		/* per CCI spec */
+	cci__affinity_init(&dev->affinity);
 }
 
 /* only used by backends when adding ready devices to the main list
@@ -304,6 +305,9 @@ int cci__get_dev_ifaddrs_info(cci__dev_t *dev, struct ifaddrs *ifaddr)
 	}
 
 	close(sockfd);
+
+	/* place the endpoints near the NIC unless the config file says */
+	cci__affinity_sysfs(&dev->affinity, ifaddr->ifa_name);
 #endif /* __linux__ */
 
 	return 0;
@@ -501,6 +505,21 @@ int cci__parse_config(const char *path)
 					dev->is_default = 1;
 					is_default = i;
 					default_name = (char *)d->name;
+				} else if (0 == strcmp(key, "numa_node")) {
+					dev->affinity.node =
+						(int)strtol(value, NULL, 0);
+					if (dev->affinity.node < 0)
+						dev->affinity.node = -1;
+					dev->affinity.conf |= CCI_AFFINITY_NODE;
+				} else if (0 == strcmp(key, "cpus")) {
+					if (cci__affinity_parse_cpus(&dev->affinity,
+								     value)) {
+						debug(CCI_DB_WARN,
+						      "device [%s] has illegal cpus %s. Ignoring it.",
+						      d->name, value);
+						continue;
+					}
+					dev->affinity.conf |= CCI_AFFINITY_CPUS;
 				}
 			} else {
 				debug(CCI_DB_WARN,
@@ -0,0 +1,791 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Large messages on CCI_ENDPT_LARGE_MSGS endpoints. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "plugins/ctp/ctp.h"
+
+/* Marks the events made by the core in evt->priv */
+int cci__large_tag;
+
+/* Buffers gathered on the stack behind an eager header */
+#define LARGE_IOV_MAX	(16)
+
+int cci__large_init(cci__ep_t *ep)
+{
+	cci__large_t *large;
+
+	large = calloc(1, sizeof(*large));
+	if (!large)
+		return CCI_ENOMEM;
+
+	pthread_mutex_init(&large->lock, NULL);
+	TAILQ_INIT(&large->ops);
+	TAILQ_INIT(&large->evts);
+	TAILQ_INIT(&large->held);
+	large->eager_limit = UINT32_MAX;
+	ep->large = large;
+
+	return CCI_SUCCESS;
+}
+
+/* Deregister and free an op's buffer. */
+static void large_release(cci__ep_t *ep, cci__large_op_t *op)
+{
+	cci__large_t *large = ep->large;
+
+	if (op->handle)
+		cci_rma_deregister(&ep->endpoint, op->handle);
+	op->handle = NULL;
+
+	if (op->buf) {
+		if (op->own)
+			free(op->buf);
+		else if (!op->send)
+			large->alloc.release(op->buf, (uint32_t) op->len,
+					     large->alloc.arg);
+	}
+	op->buf = NULL;
+}
+
+void cci__large_fini(cci__ep_t *ep)
+{
+	cci__large_t *large = ep->large;
+	cci__large_op_t *op;
+	cci__evt_t *evt;
+
+	if (!large)
+		return;
+
+	/* the reads in flight are freed with the ops */
+	while ((evt = TAILQ_FIRST(&large->held))) {
+		TAILQ_REMOVE(&large->held, evt, entry);
+		if (evt->priv != &cci__large_tag)
+			ep->plugin->return_event(&evt->event);
+		else if (!container_of(evt, cci__large_op_t, evt)->pending)
+			cci__large_return_event(evt);
+	}
+	while ((op = TAILQ_FIRST(&large->ops))) {
+		TAILQ_REMOVE(&large->ops, op, entry);
+		large_release(ep, op);
+		free(op);
+	}
+	while ((evt = TAILQ_FIRST(&large->evts))) {
+		TAILQ_REMOVE(&large->evts, evt, entry);
+		if (evt->priv == &cci__large_tag)
+			cci__large_return_event(evt);
+		else
+			ep->plugin->return_event(&evt->event);
+	}
+
+	pthread_mutex_destroy(&large->lock);
+	free(large);
+	ep->large = NULL;
+
+	return;
+}
+
+static void large_push(cci__ep_t *ep, cci__evt_t *evt)
+{
+	cci__large_t *large = ep->large;
+
+	cci__ep_lock(ep, &large->lock);
+	TAILQ_INSERT_TAIL(&large->evts, evt, entry);
+	cci__ep_unlock(ep, &large->lock);
+
+	return;
+}
+
+/* Does an RO connection have held events? Called with large->lock. */
+static int large_is_held_locked(cci__large_t *large, cci__conn_t *conn)
+{
+	cci__evt_t *evt;
+
+	TAILQ_FOREACH(evt, &large->held, entry)
+		if (evt->event.recv.connection == &conn->connection)
+			return 1;
+
+	return 0;
+}
+
+/* Deliver the held events of a connection up to the first read still in
+ * flight. Called with large->lock. */
+static void large_flush_locked(cci__large_t *large, cci__conn_t *conn)
+{
+	cci__evt_t *evt, *next;
+
+	for (evt = TAILQ_FIRST(&large->held); evt; evt = next) {
+		next = TAILQ_NEXT(evt, entry);
+		if (evt->event.recv.connection != &conn->connection)
+			continue;
+		if (evt->priv == &cci__large_tag &&
+		    container_of(evt, cci__large_op_t, evt)->pending)
+			break;
+		TAILQ_REMOVE(&large->held, evt, entry);
+		__atomic_sub_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+		TAILQ_INSERT_TAIL(&large->evts, evt, entry);
+	}
+
+	return;
+}
+
+/* Hold a receive behind the reads of earlier messages of its RO
+ * connection. Returns 1 if it was held. */
+static int large_hold(cci__ep_t *ep, cci__conn_t *conn, cci__evt_t *evt)
+{
+	cci__large_t *large = ep->large;
+	int held = 0;
+
+	if (conn->connection.attribute != CCI_CONN_ATTR_RO ||
+	    !__atomic_load_n(&large->nheld, __ATOMIC_ACQUIRE))
+		return 0;
+
+	cci__ep_lock(ep, &large->lock);
+	if (large_is_held_locked(large, conn)) {
+		TAILQ_INSERT_TAIL(&large->held, evt, entry);
+		__atomic_add_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+		held = 1;
+	}
+	cci__ep_unlock(ep, &large->lock);
+
+	return held;
+}
+
+static cci__large_op_t *large_op_new(cci__ep_t *ep, cci__conn_t *conn)
+{
+	cci__large_op_t *op;
+
+	op = calloc(1, sizeof(*op));
+	if (!op)
+		return NULL;
+
+	op->evt.ep = ep;
+	op->evt.conn = conn;
+	op->evt.priv = &cci__large_tag;
+
+	return op;
+}
+
+/* Tell the sender that we are done reading its message. */
+static void large_send_fin(cci__conn_t *conn, uint32_t id, int status)
+{
+	cci__large_msg_t fin;
+	int ret;
+
+	memset(&fin, 0, CCI_LARGE_FIN_LEN);
+	memcpy(fin.magic, CCI_LARGE_MAGIC, sizeof(fin.magic));
+	fin.type = CCI_LARGE_FIN;
+	fin.id = htonl(id);
+	fin.status = htonl(status);
+
+	ret = conn->plugin->send(&conn->connection, &fin, CCI_LARGE_FIN_LEN,
+				 NULL, CCI_FLAG_SILENT);
+	if (ret)
+		debug(CCI_DB_MSG, "%s: FIN of message %u failed with %s",
+		      __func__, id, cci_strerror(NULL, ret));
+
+	return;
+}
+
+/* Complete a send once its RTS and FIN are done. */
+static void large_send_done(cci__ep_t *ep, cci__large_op_t *op)
+{
+	if (op->flags & CCI_FLAG_BLOCKING) {
+		/* the caller waits in large_wait() and frees the op */
+		__atomic_store_n(&op->done, 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	large_release(ep, op);
+	if (op->flags & CCI_FLAG_SILENT) {
+		free(op);
+		return;
+	}
+
+	op->evt.event.send.type = CCI_EVENT_SEND;
+	op->evt.event.send.status = op->status;
+	op->evt.event.send.connection = &op->evt.conn->connection;
+	op->evt.event.send.context = (void *) op->context;
+	large_push(ep, &op->evt);
+
+	return;
+}
+
+/* Progress until a CCI_FLAG_BLOCKING send completes and keep the other
+ * events for cci_get_event(). */
+static int large_wait(cci__ep_t *ep, cci__large_op_t *op)
+{
+	cci_event_t *event;
+
+	while (!__atomic_load_n(&op->done, __ATOMIC_ACQUIRE)) {
+		if (ep->plugin->get_event(&ep->endpoint, &event))
+			continue;
+		if (cci__large_filter(ep, &event))
+			large_push(ep, container_of(event, cci__evt_t, event));
+	}
+
+	return op->status;
+}
+
+/* Register the message and announce it to the receiver. */
+static int large_send_rts(cci__conn_t *conn, const struct iovec *data,
+			  uint32_t iovcnt, uint64_t len, const void *context,
+			  int flags)
+{
+	cci__ep_t *ep = container_of(conn->connection.endpoint, cci__ep_t,
+				     endpoint);
+	cci__large_t *large = ep->large;
+	cci__large_op_t *op;
+	cci__large_msg_t rts;
+	uint32_t i;
+	int ret;
+
+	if (!cci_conn_is_reliable(conn) || len > UINT32_MAX) {
+		debug(CCI_DB_MSG, "%s: %" PRIu64 " bytes do not fit in a "
+		      "message", __func__, len);
+		return CCI_EMSGSIZE;
+	}
+
+	op = large_op_new(ep, conn);
+	if (!op)
+		return CCI_ENOMEM;
+	op->send = 1;
+	op->len = len;
+	op->context = context;
+	op->flags = flags;
+
+	/* the application keeps its buffer until completion if it said so */
+	if (iovcnt == 1 && flags & (CCI_FLAG_NO_COPY | CCI_FLAG_BLOCKING)) {
+		op->buf = data[0].iov_base;
+	} else {
+		char *p = malloc(len);
+
+		if (!p) {
+			ret = CCI_ENOMEM;
+			goto out;
+		}
+		op->buf = p;
+		op->own = 1;
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(p, data[i].iov_base, data[i].iov_len);
+			p += data[i].iov_len;
+		}
+	}
+
+	ret = cci_rma_register(&ep->endpoint, op->buf, len, CCI_FLAG_READ,
+			       &op->handle);
+	if (ret)
+		goto out;
+
+	memset(&rts, 0, sizeof(rts));
+	memcpy(rts.magic, CCI_LARGE_MAGIC, sizeof(rts.magic));
+	rts.type = CCI_LARGE_RTS;
+	rts.len_hi = htonl((uint32_t) (len >> 32));
+	rts.len_lo = htonl((uint32_t) len);
+	memcpy((void *) &rts.handle, op->handle, sizeof(rts.handle));
+
+	/* wait for the RTS completion and the FIN */
+	op->pending = 2;
+	cci__ep_lock(ep, &large->lock);
+	op->id = large->next_id++;
+	TAILQ_INSERT_TAIL(&large->ops, op, entry);
+	cci__ep_unlock(ep, &large->lock);
+	rts.id = htonl(op->id);
+
+	ret = conn->plugin->send(&conn->connection, &rts, sizeof(rts), op, 0);
+	if (ret) {
+		cci__ep_lock(ep, &large->lock);
+		TAILQ_REMOVE(&large->ops, op, entry);
+		cci__ep_unlock(ep, &large->lock);
+		goto out;
+	}
+
+	if (!(flags & CCI_FLAG_BLOCKING))
+		return CCI_SUCCESS;
+
+	ret = large_wait(ep, op);
+out:
+	large_release(ep, op);
+	free(op);
+	return ret;
+}
+
+/* Send an application message that starts with the magic behind an
+ * eager header. */
+static int large_send_eager(cci__conn_t *conn, const struct iovec *data,
+			    uint32_t iovcnt, const void *context, int flags)
+{
+	struct iovec iov[LARGE_IOV_MAX + 1], *v = iov;
+	char hdr[CCI_LARGE_HDR_LEN] = CCI_LARGE_MAGIC;
+	int ret;
+
+	if (iovcnt > LARGE_IOV_MAX) {
+		v = malloc((iovcnt + 1) * sizeof(*v));
+		if (!v)
+			return CCI_ENOMEM;
+	}
+
+	hdr[4] = CCI_LARGE_EAGER;
+	v[0].iov_base = hdr;
+	v[0].iov_len = sizeof(hdr);
+	memcpy(&v[1], data, iovcnt * sizeof(*v));
+
+	/* the header is on our stack */
+	ret = conn->plugin->sendv(&conn->connection, v, iovcnt + 1, context,
+				  flags & ~CCI_FLAG_NO_COPY);
+
+	if (v != iov)
+		free(v);
+
+	return ret;
+}
+
+/* Does the message start with the magic? */
+static int large_is_magic(const struct iovec *data, uint32_t iovcnt)
+{
+	char magic[4];
+	uint32_t i, n = 0;
+
+	for (i = 0; i < iovcnt && n < sizeof(magic); i++) {
+		size_t len = data[i].iov_len;
+
+		if (len > sizeof(magic) - n)
+			len = sizeof(magic) - n;
+		memcpy(&magic[n], data[i].iov_base, len);
+		n += len;
+	}
+
+	return n == sizeof(magic) &&
+		!memcmp(magic, CCI_LARGE_MAGIC, sizeof(magic));
+}
+
+int cci__large_sendv(cci__conn_t *conn, const struct iovec *data,
+		     uint32_t iovcnt, const void *context, int flags)
+{
+	cci__ep_t *ep = container_of(conn->connection.endpoint, cci__ep_t,
+				     endpoint);
+	uint32_t limit = conn->connection.max_send_size;
+	uint64_t len = 0;
+	uint32_t i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += data[i].iov_len;
+
+	/* unreliable connections have nothing else */
+	if (ep->large->eager_limit < limit && cci_conn_is_reliable(conn))
+		limit = ep->large->eager_limit;
+
+	if (len <= limit) {
+		if (!large_is_magic(data, iovcnt)) {
+			if (iovcnt == 1)
+				return conn->plugin->send(&conn->connection,
+							  data[0].iov_base,
+							  (uint32_t) len,
+							  context, flags);
+			return conn->plugin->sendv(&conn->connection, data,
+						   iovcnt, context, flags);
+		}
+		if (len + CCI_LARGE_HDR_LEN <= conn->connection.max_send_size)
+			return large_send_eager(conn, data, iovcnt, context,
+						flags);
+	}
+
+	return large_send_rts(conn, data, iovcnt, len, context, flags);
+}
+
+int cci__large_check_msg(cci__conn_t *conn, const void *ptr, uint32_t len)
+{
+	cci__ep_t *ep = container_of(conn->connection.endpoint, cci__ep_t,
+				     endpoint);
+
+	if (ep->large && ptr && len >= 4 &&
+	    !memcmp(ptr, CCI_LARGE_MAGIC, 4)) {
+		debug(CCI_DB_INFO, "%s: the completion message starts with "
+		      "%s", __func__, CCI_LARGE_MAGIC);
+		return CCI_EINVAL;
+	}
+
+	return CCI_SUCCESS;
+}
+
+/* Read an announced message into a buffer of ours. */
+static void large_recv_rts(cci__ep_t *ep, cci__conn_t *conn,
+			   const cci__large_msg_t *rts)
+{
+	cci__large_t *large = ep->large;
+	cci__large_op_t *op;
+	int ordered = conn->connection.attribute == CCI_CONN_ATTR_RO;
+	int ret;
+
+	op = large_op_new(ep, conn);
+	if (!op) {
+		large_send_fin(conn, ntohl(rts->id), CCI_ENOMEM);
+		return;
+	}
+	op->evt.event.recv.connection = &conn->connection;
+	op->id = ntohl(rts->id);
+	op->len = (uint64_t) ntohl(rts->len_hi) << 32 | ntohl(rts->len_lo);
+	memcpy((void *) &op->remote, &rts->handle, sizeof(op->remote));
+
+	if (op->len == 0 || op->len > UINT32_MAX) {
+		ret = CCI_EMSGSIZE;
+		goto out;
+	}
+
+	if (large->alloc.alloc) {
+		op->buf = large->alloc.alloc(&conn->connection,
+					     (uint32_t) op->len,
+					     large->alloc.arg);
+	} else {
+		op->buf = malloc(op->len);
+		op->own = 1;
+	}
+	if (!op->buf) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+
+	ret = cci_rma_register(&ep->endpoint, op->buf, op->len,
+			       CCI_FLAG_WRITE, &op->handle);
+	if (ret)
+		goto out;
+
+	/* later receives of an ordered connection wait for the read */
+	cci__ep_lock(ep, &large->lock);
+	TAILQ_INSERT_TAIL(&large->ops, op, entry);
+	if (ordered) {
+		op->pending = 1;
+		TAILQ_INSERT_TAIL(&large->held, &op->evt, entry);
+		__atomic_add_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+	}
+	cci__ep_unlock(ep, &large->lock);
+
+	ret = cci_rma(&conn->connection, NULL, 0, op->handle, 0, &op->remote,
+		      0, op->len, op, CCI_FLAG_READ);
+	if (!ret)
+		return;
+
+	cci__ep_lock(ep, &large->lock);
+	TAILQ_REMOVE(&large->ops, op, entry);
+	if (ordered) {
+		TAILQ_REMOVE(&large->held, &op->evt, entry);
+		__atomic_sub_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+		large_flush_locked(large, conn);
+	}
+	cci__ep_unlock(ep, &large->lock);
+out:
+	debug(CCI_DB_MSG, "%s: cannot read message %u of %" PRIu64 " bytes: "
+	      "%s", __func__, op->id, op->len, cci_strerror(NULL, ret));
+	large_send_fin(conn, op->id, ret);
+	large_release(ep, op);
+	free(op);
+	return;
+}
+
+/* The read of an announced message completed. */
+static void large_read_done(cci__ep_t *ep, cci__large_op_t *op, int status)
+{
+	cci__large_t *large = ep->large;
+	cci__conn_t *conn = op->evt.conn;
+	int ordered = conn->connection.attribute == CCI_CONN_ATTR_RO;
+
+	large_send_fin(conn, op->id, status);
+	if (status) {
+		debug(CCI_DB_MSG, "%s: read of message %u failed with %s",
+		      __func__, op->id, cci_strerror(NULL, status));
+		if (ordered) {
+			cci__ep_lock(ep, &large->lock);
+			TAILQ_REMOVE(&large->held, &op->evt, entry);
+			__atomic_sub_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+			large_flush_locked(large, conn);
+			cci__ep_unlock(ep, &large->lock);
+		}
+		large_release(ep, op);
+		free(op);
+		return;
+	}
+
+	cci_rma_deregister(&ep->endpoint, op->handle);
+	op->handle = NULL;
+
+	op->evt.event.recv.type = CCI_EVENT_RECV;
+	op->evt.event.recv.len = (uint32_t) op->len;
+	op->evt.event.recv.ptr = op->buf;
+	op->evt.event.recv.connection = &conn->connection;
+	if (!ordered) {
+		large_push(ep, &op->evt);
+		return;
+	}
+
+	/* deliver it and the receives that waited for it */
+	cci__ep_lock(ep, &large->lock);
+	op->pending = 0;
+	large_flush_locked(large, conn);
+	cci__ep_unlock(ep, &large->lock);
+
+	return;
+}
+
+/* Find the op of a send completion, NULL if it is the application's. */
+static cci__large_op_t *large_find_ctx(cci__large_t *large,
+				       const void *context)
+{
+	cci__large_op_t *op;
+
+	TAILQ_FOREACH(op, &large->ops, entry)
+		if (op == context)
+			return op;
+
+	return NULL;
+}
+
+static cci__large_op_t *large_find_id(cci__large_t *large,
+				      cci__conn_t *conn, uint32_t id)
+{
+	cci__large_op_t *op;
+
+	TAILQ_FOREACH(op, &large->ops, entry)
+		if (op->send && op->id == id && op->evt.conn == conn)
+			return op;
+
+	return NULL;
+}
+
+/* The RTS send or the read of an op completed. */
+static void large_handle_send(cci__ep_t *ep, cci__large_op_t *op,
+			      int status)
+{
+	cci__large_t *large = ep->large;
+	int done = 1;
+
+	cci__ep_lock(ep, &large->lock);
+	if (op->send && !status && --op->pending) {
+		done = 0;
+	} else {
+		if (status)
+			op->status = status;
+		TAILQ_REMOVE(&large->ops, op, entry);
+	}
+	cci__ep_unlock(ep, &large->lock);
+
+	if (!done)
+		return;
+	if (op->send)
+		large_send_done(ep, op);
+	else
+		large_read_done(ep, op, status);
+
+	return;
+}
+
+static void large_recv_fin(cci__ep_t *ep, cci__conn_t *conn,
+			   const cci__large_msg_t *fin)
+{
+	cci__large_t *large = ep->large;
+	cci__large_op_t *op;
+	uint32_t id = ntohl(fin->id);
+	int done = 0;
+
+	cci__ep_lock(ep, &large->lock);
+	op = large_find_id(large, conn, id);
+	if (op) {
+		op->status = (int32_t) ntohl(fin->status);
+		if (--op->pending == 0) {
+			TAILQ_REMOVE(&large->ops, op, entry);
+			done = 1;
+		}
+	}
+	cci__ep_unlock(ep, &large->lock);
+
+	if (!op)
+		debug(CCI_DB_MSG, "%s: FIN for unknown message %u", __func__,
+		      id);
+	else if (done)
+		large_send_done(ep, op);
+
+	return;
+}
+
+/* Handle the protocol's own events. Returns 1 if *event is for the
+ * application, possibly replaced by an event of the core, and 0 if it
+ * was consumed. */
+int cci__large_filter(cci__ep_t *ep, cci_event_t **event)
+{
+	cci__large_t *large = ep->large;
+	cci_event_t *e = *event;
+	cci__large_op_t *op;
+	cci__large_msg_t msg;
+	cci__conn_t *conn;
+	uint32_t len;
+
+	switch (e->type) {
+	case CCI_EVENT_SEND:
+		cci__ep_lock(ep, &large->lock);
+		op = large_find_ctx(large, e->send.context);
+		cci__ep_unlock(ep, &large->lock);
+		if (!op)
+			return 1;
+		large_handle_send(ep, op, e->send.status);
+		ep->plugin->return_event(e);
+		return 0;
+	case CCI_EVENT_RECV:
+		conn = container_of(e->recv.connection, cci__conn_t,
+				    connection);
+		len = e->recv.len;
+		if (len < CCI_LARGE_HDR_LEN ||
+		    memcmp(e->recv.ptr, CCI_LARGE_MAGIC, sizeof(msg.magic)))
+			return !large_hold(ep, conn,
+					   container_of(e, cci__evt_t, event));
+		break;
+	default:
+		return 1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memcpy(&msg, e->recv.ptr, len < sizeof(msg) ? len : sizeof(msg));
+
+	switch (msg.type) {
+	case CCI_LARGE_EAGER:
+		op = large_op_new(ep, conn);
+		if (!op) {
+			debug(CCI_DB_MSG, "%s: no memory, dropping a message",
+			      __func__);
+			break;
+		}
+		op->orig = e;
+		op->evt.event.recv = e->recv;
+		op->evt.event.recv.ptr = (const char *) e->recv.ptr +
+			CCI_LARGE_HDR_LEN;
+		op->evt.event.recv.len = len - CCI_LARGE_HDR_LEN;
+		if (large_hold(ep, conn, &op->evt))
+			return 0;
+		*event = &op->evt.event;
+		return 1;
+	case CCI_LARGE_RTS:
+		if (len < sizeof(msg))
+			goto invalid;
+		large_recv_rts(ep, conn, &msg);
+		break;
+	case CCI_LARGE_FIN:
+		if (len < CCI_LARGE_FIN_LEN)
+			goto invalid;
+		large_recv_fin(ep, conn, &msg);
+		break;
+	default:
+	invalid:
+		debug(CCI_DB_MSG, "%s: dropping invalid message type %u "
+		      "length %u", __func__, msg.type, len);
+	}
+
+	ep->plugin->return_event(e);
+	return 0;
+}
+
+int cci__large_get_event(cci__ep_t *ep, cci_event_t **event)
+{
+	cci__large_t *large = ep->large;
+	cci__evt_t *evt;
+	int ret;
+
+	for (;;) {
+		cci__ep_lock(ep, &large->lock);
+		evt = TAILQ_FIRST(&large->evts);
+		if (evt)
+			TAILQ_REMOVE(&large->evts, evt, entry);
+		cci__ep_unlock(ep, &large->lock);
+		if (evt) {
+			*event = &evt->event;
+			return CCI_SUCCESS;
+		}
+
+		ret = ep->plugin->get_event(&ep->endpoint, event);
+		if (ret)
+			return ret;
+		if (cci__large_filter(ep, event))
+			return CCI_SUCCESS;
+	}
+}
+
+int cci__large_return_event(cci__evt_t *evt)
+{
+	cci__large_op_t *op = container_of(evt, cci__large_op_t, evt);
+	cci__ep_t *ep = evt->ep;
+	int ret = CCI_SUCCESS;
+
+	if (op->orig)
+		ret = ep->plugin->return_event(op->orig);
+	else
+		large_release(ep, op);
+	free(op);
+
+	return ret;
+}
+
+void cci__large_disconnect(cci__ep_t *ep, cci__conn_t *conn)
+{
+	cci__large_t *large = ep->large;
+	TAILQ_HEAD(s_large_drop, cci__evt) drop;
+	cci__large_op_t *op, *next;
+	cci__evt_t *evt, *enext;
+
+	TAILQ_INIT(&drop);
+
+	/* no more events for the connection, the reads in flight on held
+	 * are dropped with the ops */
+	cci__ep_lock(ep, &large->lock);
+	for (evt = TAILQ_FIRST(&large->held); evt; evt = enext) {
+		enext = TAILQ_NEXT(evt, entry);
+		if (evt->event.recv.connection != &conn->connection)
+			continue;
+		TAILQ_REMOVE(&large->held, evt, entry);
+		__atomic_sub_fetch(&large->nheld, 1, __ATOMIC_RELEASE);
+		if (evt->priv != &cci__large_tag ||
+		    !container_of(evt, cci__large_op_t, evt)->pending)
+			TAILQ_INSERT_TAIL(&drop, evt, entry);
+	}
+	for (op = TAILQ_FIRST(&large->ops); op; op = next) {
+		next = TAILQ_NEXT(op, entry);
+		if (op->evt.conn != conn)
+			continue;
+		TAILQ_REMOVE(&large->ops, op, entry);
+		if (op->send && op->flags & CCI_FLAG_BLOCKING) {
+			op->status = CCI_ERR_DISCONNECTED;
+			__atomic_store_n(&op->done, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		TAILQ_INSERT_TAIL(&drop, &op->evt, entry);
+	}
+	for (evt = TAILQ_FIRST(&large->evts); evt; evt = enext) {
+		enext = TAILQ_NEXT(evt, entry);
+		if (evt->priv != &cci__large_tag || evt->conn != conn)
+			continue;
+		TAILQ_REMOVE(&large->evts, evt, entry);
+		TAILQ_INSERT_TAIL(&drop, evt, entry);
+	}
+	cci__ep_unlock(ep, &large->lock);
+
+	while ((evt = TAILQ_FIRST(&drop))) {
+		TAILQ_REMOVE(&drop, evt, entry);
+		if (evt->priv == &cci__large_tag)
+			cci__large_return_event(evt);
+		else
+			ep->plugin->return_event(&evt->event);
+	}
+
+	return;
+}
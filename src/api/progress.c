@@ -0,0 +1,399 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Process-wide progress engine. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "cci-api.h"
+
+TAILQ_HEAD(s_srcs, cci__prog_src);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* broadcast when the polling worker returns */
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+/* broadcast when a fn returns or a poll ends, for cci__prog_del() */
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static struct s_srcs srcs = TAILQ_HEAD_INITIALIZER(srcs);
+static pthread_t threads[CCI_PROGRESS_THREADS_MAX];
+/* kernel thread IDs of the running workers, to pin them */
+static int tids[CCI_PROGRESS_THREADS_MAX];
+static int nthreads = 0, maxthreads = 0, nsrcs = 0, shutting_down = 0;
+/* interrupts the polling worker */
+static int wake_fd[2] = { -1, -1 }, wake_pending = 0;
+/* set while a worker sleeps in poll(), poll_gen counts the polls */
+static int polling = 0;
+static uint64_t poll_gen = 0;
+
+static uint64_t prog_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* NOTE: caller must hold lock */
+static void prog_wake_locked(void)
+{
+	if (polling && !wake_pending && write(wake_fd[1], "w", 1) == 1)
+		wake_pending = 1;
+}
+
+/* NOTE: caller must hold lock */
+static void prog_drain_locked(void)
+{
+	char buf[64];
+
+	while (read(wake_fd[0], buf, sizeof(buf)) > 0) ;
+	wake_pending = 0;
+}
+
+/* Pin the workers to the CPUs of all the sources.
+ *
+ * NOTE: caller must hold lock
+ */
+static void prog_bind_locked(void)
+{
+	int i, w;
+	cci__affinity_t aff;
+	cci__prog_src_t *src;
+
+	cci__affinity_init(&aff);
+	TAILQ_FOREACH(src, &srcs, entry) {
+		/* a source that may run anywhere lets the workers run anywhere */
+		if (!src->aff || !src->aff->ncpus) {
+			aff.ncpus = 0;
+			break;
+		}
+		for (w = 0; w < (int) (sizeof(aff.cpus) / sizeof(aff.cpus[0])); w++)
+			aff.cpus[w] |= src->aff->cpus[w];
+		aff.ncpus = 1;
+	}
+	if (!aff.ncpus)
+		memset(aff.cpus, 0, sizeof(aff.cpus));
+
+	for (i = 0; i < nthreads; i++) {
+		if (tids[i])
+			cci__affinity_bind(&aff, tids[i]);
+	}
+}
+
+/* NOTE: caller must hold lock */
+static void prog_release_locked(cci__prog_src_t *src)
+{
+	src->running = 0;
+	/* the polling worker skipped its fd */
+	if (src->skipped)
+		prog_wake_locked();
+	pthread_cond_broadcast(&done);
+}
+
+static void *prog_thread(void *arg)
+{
+	int cap = 0;
+	struct pollfd *fds = NULL;
+	cci__prog_src_t **map = NULL;
+
+	pthread_mutex_lock(&lock);
+	tids[(intptr_t) arg] = cci__affinity_tid();
+	prog_bind_locked();
+	while (!shutting_down) {
+		int i, n, timeout = -1;
+		uint64_t now = prog_now(), next = 0;
+		cci__prog_src_t *src, *run = NULL;
+
+		TAILQ_FOREACH(src, &srcs, entry) {
+			if (src->running)
+				continue;
+			if (src->pending || (src->period && src->due <= now)) {
+				run = src;
+				break;
+			}
+			if (src->period && (!next || src->due < next))
+				next = src->due;
+		}
+
+		if (run) {
+			/* move it to the end so that busy sources take turns */
+			TAILQ_REMOVE(&srcs, run, entry);
+			TAILQ_INSERT_TAIL(&srcs, run, entry);
+			run->running = 1;
+			run->pending = 0;
+			if (run->period)
+				run->due = now + run->period;
+			pthread_mutex_unlock(&lock);
+
+			run->fn(run->arg);
+
+			pthread_mutex_lock(&lock);
+			prog_release_locked(run);
+			continue;
+		}
+
+		/* another worker watches the fds and the timers */
+		if (polling) {
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+
+		if (cap < nsrcs + 1) {
+			struct pollfd *f = realloc(fds, (nsrcs + 1) * sizeof(*f));
+			cci__prog_src_t **m = NULL;
+
+			if (f) {
+				fds = f;
+				m = realloc(map, (nsrcs + 1) * sizeof(*m));
+			}
+			if (m) {
+				map = m;
+				cap = nsrcs + 1;
+			}
+		}
+		if (!fds) {
+			pthread_mutex_unlock(&lock);
+			usleep(1000);
+			pthread_mutex_lock(&lock);
+			continue;
+		}
+
+		fds[0].fd = wake_fd[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		n = 1;
+		if (cap >= nsrcs + 1) {
+			TAILQ_FOREACH(src, &srcs, entry) {
+				src->skipped = src->running;
+				if (src->fd < 0 || src->running)
+					continue;
+				fds[n].fd = src->fd;
+				fds[n].events = POLLIN;
+				fds[n].revents = 0;
+				map[n++] = src;
+			}
+		} else {
+			/* out of memory, only the timers run for now */
+			debug(CCI_DB_WARN, "%s: unable to poll %d sources",
+			      __func__, nsrcs);
+			next = now + 1000000;
+		}
+		if (next)
+			timeout = (int) ((next - now + 999999) / 1000000);
+
+		polling = 1;
+		poll_gen++;
+		pthread_mutex_unlock(&lock);
+
+		poll(fds, n, timeout);
+
+		pthread_mutex_lock(&lock);
+		polling = 0;
+		if (fds[0].revents)
+			prog_drain_locked();
+		for (i = 1; i < n; i++) {
+			if (fds[i].revents)
+				map[i]->pending = 1;
+		}
+		/* let another worker poll while this one runs the sources */
+		pthread_cond_broadcast(&cond);
+		pthread_cond_broadcast(&done);
+	}
+	pthread_mutex_unlock(&lock);
+
+	free(fds);
+	free(map);
+
+	return NULL;
+}
+
+int cci__prog_add(cci__prog_src_t *src, int fd, uint32_t period_us,
+		  cci__prog_fn_t fn, void *arg, const cci__affinity_t *aff)
+{
+	int ret = CCI_SUCCESS;
+
+	memset(src, 0, sizeof(*src));
+	src->fd = fd;
+	src->period = (uint64_t) period_us * 1000;
+	src->fn = fn;
+	src->arg = arg;
+	src->aff = aff;
+
+	pthread_mutex_lock(&lock);
+	if (wake_fd[0] == -1) {
+		if (pipe(wake_fd)) {
+			ret = errno;
+			wake_fd[0] = wake_fd[1] = -1;
+			goto out;
+		}
+		fcntl(wake_fd[0], F_SETFL, fcntl(wake_fd[0], F_GETFL) | O_NONBLOCK);
+		fcntl(wake_fd[1], F_SETFL, fcntl(wake_fd[1], F_GETFL) | O_NONBLOCK);
+	}
+	if (!maxthreads) {
+		char *str = getenv("CCI_PROGRESS_THREADS");
+
+		maxthreads = str && str[0] != '\0' ? atoi(str) :
+			CCI_PROGRESS_THREADS_DFLT;
+		if (maxthreads < 1)
+			maxthreads = 1;
+		else if (maxthreads > CCI_PROGRESS_THREADS_MAX)
+			maxthreads = CCI_PROGRESS_THREADS_MAX;
+		debug(CCI_DB_INFO, "%s: up to %d progress threads", __func__,
+		      maxthreads);
+	}
+
+	src->due = prog_now() + src->period;
+	TAILQ_INSERT_TAIL(&srcs, src, entry);
+	nsrcs++;
+
+	/* no more workers than sources */
+	if (nthreads < maxthreads && nthreads < nsrcs) {
+		tids[nthreads] = 0;
+		if (!pthread_create(&threads[nthreads], NULL, prog_thread,
+				    (void *) (intptr_t) nthreads))
+			nthreads++;
+	}
+	if (!nthreads) {
+		TAILQ_REMOVE(&srcs, src, entry);
+		nsrcs--;
+		ret = CCI_ERROR;
+		goto out;
+	}
+
+	prog_bind_locked();
+
+	/* the polling worker must watch the new fd */
+	prog_wake_locked();
+out:
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void cci__prog_kick(cci__prog_src_t *src)
+{
+	/* a pending source runs after this call anyway */
+	if (__atomic_load_n(&src->pending, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (!src->pending) {
+		src->pending = 1;
+		if (!src->running)
+			prog_wake_locked();
+	}
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
+
+int cci__prog_claim(cci__prog_src_t *src)
+{
+	/* never wait, a worker will get to it. A pending source has a
+	 * worker awake for it, let that worker run instead of taking the
+	 * source from it. */
+	if (__atomic_load_n(&src->running, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&src->pending, __ATOMIC_RELAXED) ||
+	    pthread_mutex_trylock(&lock))
+		goto busy;
+
+	if (src->running || src->pending) {
+		pthread_mutex_unlock(&lock);
+		goto busy;
+	}
+	src->running = 1;
+	if (src->period)
+		src->due = prog_now() + src->period;
+	pthread_mutex_unlock(&lock);
+
+	return 1;
+
+busy:
+	/* hand the CPU to the worker now rather than at the next tick, the
+	 * caller is likely to poll again right away */
+	sched_yield();
+
+	return 0;
+}
+
+void cci__prog_release(cci__prog_src_t *src)
+{
+	pthread_mutex_lock(&lock);
+	prog_release_locked(src);
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
+
+void cci__prog_del(cci__prog_src_t *src)
+{
+	uint64_t gen;
+
+	pthread_mutex_lock(&lock);
+	TAILQ_REMOVE(&srcs, src, entry);
+	nsrcs--;
+	prog_bind_locked();
+
+	/* wait for its fn and for a poll that may still hold its fd */
+	gen = poll_gen;
+	while (src->running || (polling && poll_gen == gen)) {
+		prog_wake_locked();
+		pthread_cond_wait(&done, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
+
+void cci__prog_bind(void)
+{
+	pthread_mutex_lock(&lock);
+	prog_bind_locked();
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
+
+void cci__prog_fini(void)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	shutting_down = 1;
+	pthread_cond_broadcast(&cond);
+	prog_wake_locked();
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_lock(&lock);
+	nthreads = 0;
+	maxthreads = 0;
+	shutting_down = 0;
+	if (wake_fd[0] != -1) {
+		close(wake_fd[0]);
+		close(wake_fd[1]);
+		wake_fd[0] = wake_fd[1] = -1;
+	}
+	wake_pending = 0;
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
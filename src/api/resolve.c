@@ -0,0 +1,366 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Asynchronous name resolution for connects. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "cci-api.h"
+
+#define RESOLVE_BUCKETS (256)
+
+typedef struct resolve_waiter {
+	cci__ep_t *ep;
+	cci__resolve_cb_t cb;
+	void *arg;
+	TAILQ_ENTRY(resolve_waiter) entry;
+} resolve_waiter_t;
+
+typedef struct resolve_job {
+	/*! "host:service" */
+	char *name;
+	int socktype;
+
+	/*! Connects waiting on this lookup */
+	TAILQ_HEAD(s_waiters, resolve_waiter) waiters;
+
+	TAILQ_ENTRY(resolve_job) entry;
+} resolve_job_t;
+
+typedef struct resolve_entry {
+	char *name;
+	int socktype;
+	uint32_t ip;
+	uint16_t port;
+	time_t expires;
+	struct resolve_entry *next;
+} resolve_entry_t;
+
+TAILQ_HEAD(s_jobs, resolve_job);
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct s_jobs queued = TAILQ_HEAD_INITIALIZER(queued);
+static struct s_jobs running = TAILQ_HEAD_INITIALIZER(running);
+static resolve_entry_t *cache[RESOLVE_BUCKETS];
+static pthread_t threads[CCI_RESOLVE_THREADS];
+static int nthreads = 0, idle = 0, shutting_down = 0;
+
+static uint32_t resolve_hash(const char *name)
+{
+	uint32_t h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+
+	return h % RESOLVE_BUCKETS;
+}
+
+/* NOTE: caller must hold lock */
+static resolve_entry_t *resolve_cache_find_locked(const char *name,
+						  int socktype)
+{
+	resolve_entry_t *e;
+	time_t now = time(NULL);
+
+	for (e = cache[resolve_hash(name)]; e; e = e->next) {
+		if (e->socktype == socktype && !strcmp(e->name, name))
+			return e->expires > now ? e : NULL;
+	}
+
+	return NULL;
+}
+
+/* NOTE: caller must hold lock */
+static void resolve_cache_insert_locked(const char *name, int socktype,
+					uint32_t ip, uint16_t port)
+{
+	uint32_t i = resolve_hash(name);
+	resolve_entry_t *e;
+
+	for (e = cache[i]; e; e = e->next) {
+		if (e->socktype == socktype && !strcmp(e->name, name))
+			break;
+	}
+	if (!e) {
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			return;
+		e->name = strdup(name);
+		if (!e->name) {
+			free(e);
+			return;
+		}
+		e->socktype = socktype;
+		e->next = cache[i];
+		cache[i] = e;
+	}
+	e->ip = ip;
+	e->port = port;
+	e->expires = time(NULL) + CCI_RESOLVE_TTL;
+
+	return;
+}
+
+static int resolve_name(const char *name, int socktype,
+			uint32_t *ip, uint16_t *port)
+{
+	int ret;
+	char *host, *svc;
+	struct addrinfo *ai = NULL, hints;
+
+	host = strdup(name);
+	if (!host)
+		return CCI_ENOMEM;
+	svc = strchr(host, ':');
+	*svc++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = socktype;
+
+	ret = getaddrinfo(host, svc, &hints, &ai);
+	if (ret) {
+		debug(CCI_DB_CONN, "%s: getaddrinfo(%s) failed with %s",
+			__func__, name, gai_strerror(ret));
+		ret = CCI_EADDRNOTAVAIL;
+	} else {
+		*ip = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
+		*port = ((struct sockaddr_in *)ai->ai_addr)->sin_port;
+	}
+	if (ai)
+		freeaddrinfo(ai);
+	free(host);
+
+	return ret;
+}
+
+static void *resolve_thread(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	while (1) {
+		int ret;
+		uint32_t ip = 0;
+		uint16_t port = 0;
+		resolve_job_t *job;
+
+		while (TAILQ_EMPTY(&queued) && !shutting_down) {
+			idle++;
+			pthread_cond_wait(&cond, &lock);
+			idle--;
+		}
+		if (TAILQ_EMPTY(&queued))
+			break;
+
+		job = TAILQ_FIRST(&queued);
+		TAILQ_REMOVE(&queued, job, entry);
+		TAILQ_INSERT_TAIL(&running, job, entry);
+		pthread_mutex_unlock(&lock);
+
+		ret = resolve_name(job->name, job->socktype, &ip, &port);
+
+		pthread_mutex_lock(&lock);
+		TAILQ_REMOVE(&running, job, entry);
+		if (!ret)
+			resolve_cache_insert_locked(job->name, job->socktype,
+						    ip, port);
+		pthread_mutex_unlock(&lock);
+
+		/* no one can join the job now */
+		while (!TAILQ_EMPTY(&job->waiters)) {
+			resolve_waiter_t *w = TAILQ_FIRST(&job->waiters);
+			cci__ep_t *ep = w->ep;
+
+			TAILQ_REMOVE(&job->waiters, w, entry);
+			w->cb(ep, w->arg, ret, ip, port);
+			free(w);
+
+			pthread_mutex_lock(&ep->lock);
+			ep->resolving--;
+			pthread_mutex_unlock(&ep->lock);
+		}
+		free(job->name);
+		free(job);
+
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return arg;
+}
+
+/* NOTE: caller must hold lock */
+static resolve_job_t *resolve_find_job_locked(struct s_jobs *jobs,
+					      const char *name, int socktype)
+{
+	resolve_job_t *job;
+
+	TAILQ_FOREACH(job, jobs, entry) {
+		if (job->socktype == socktype && !strcmp(job->name, name))
+			return job;
+	}
+
+	return NULL;
+}
+
+int cci__resolve(cci__ep_t *ep, const char *uri, const char *prefix,
+		 int socktype, uint32_t *ip, uint16_t *port,
+		 cci__resolve_cb_t cb, void *arg)
+{
+	int ret = CCI_SUCCESS;
+	size_t len = strlen(prefix);
+	const char *name, *colon;
+	char *end = NULL;
+	struct in_addr in;
+	resolve_entry_t *e;
+	resolve_job_t *job;
+	resolve_waiter_t *w;
+
+	if (strncmp(prefix, uri, len)) {
+		debug(CCI_DB_CONN, "%s: invalid URI %s", __func__, uri);
+		return CCI_EINVAL;
+	}
+	name = uri + len;
+	colon = strchr(name, ':');
+	if (!colon || colon == name || !colon[1]) {
+		debug(CCI_DB_CONN, "%s: invalid URI %s", __func__, uri);
+		return CCI_EINVAL;
+	}
+
+	/* numeric host and port need no lookup */
+	if (colon - name < INET_ADDRSTRLEN) {
+		char host[INET_ADDRSTRLEN];
+		long p = strtol(colon + 1, &end, 10);
+
+		memcpy(host, name, colon - name);
+		host[colon - name] = '\0';
+		if (*end == '\0' && p > 0 && p <= 0xFFFF &&
+		    inet_pton(AF_INET, host, &in) == 1) {
+			*ip = in.s_addr;
+			*port = htons((uint16_t) p);
+			return CCI_SUCCESS;
+		}
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return CCI_ENOMEM;
+	w->ep = ep;
+	w->cb = cb;
+	w->arg = arg;
+
+	pthread_mutex_lock(&lock);
+	e = resolve_cache_find_locked(name, socktype);
+	if (e) {
+		*ip = e->ip;
+		*port = e->port;
+		goto out;
+	}
+
+	/* the endpoint wants no threads, look the name up here instead */
+	if (ep->app_progress) {
+		pthread_mutex_unlock(&lock);
+		free(w);
+		ret = resolve_name(name, socktype, ip, port);
+		if (!ret) {
+			pthread_mutex_lock(&lock);
+			resolve_cache_insert_locked(name, socktype, *ip, *port);
+			pthread_mutex_unlock(&lock);
+		}
+		return ret;
+	}
+
+	/* join a lookup of the same name if there is one */
+	job = resolve_find_job_locked(&queued, name, socktype);
+	if (!job)
+		job = resolve_find_job_locked(&running, name, socktype);
+	if (!job) {
+		job = calloc(1, sizeof(*job));
+		if (!job) {
+			ret = CCI_ENOMEM;
+			goto out;
+		}
+		job->name = strdup(name);
+		if (!job->name) {
+			free(job);
+			ret = CCI_ENOMEM;
+			goto out;
+		}
+		job->socktype = socktype;
+		TAILQ_INIT(&job->waiters);
+		TAILQ_INSERT_TAIL(&queued, job, entry);
+
+		if (!idle && nthreads < CCI_RESOLVE_THREADS &&
+		    !pthread_create(&threads[nthreads], NULL,
+				    resolve_thread, NULL))
+			nthreads++;
+		if (!nthreads) {
+			TAILQ_REMOVE(&queued, job, entry);
+			free(job->name);
+			free(job);
+			ret = CCI_ERROR;
+			goto out;
+		}
+		pthread_cond_signal(&cond);
+	}
+
+	pthread_mutex_lock(&ep->lock);
+	ep->resolving++;
+	pthread_mutex_unlock(&ep->lock);
+
+	TAILQ_INSERT_TAIL(&job->waiters, w, entry);
+	w = NULL;
+	ret = CCI_EAGAIN;
+out:
+	pthread_mutex_unlock(&lock);
+	free(w);
+
+	return ret;
+}
+
+void cci__resolve_fini(void)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	shutting_down = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_lock(&lock);
+	nthreads = 0;
+	shutting_down = 0;
+	for (i = 0; i < RESOLVE_BUCKETS; i++) {
+		while (cache[i]) {
+			resolve_entry_t *e = cache[i];
+
+			cache[i] = e->next;
+			free(e->name);
+			free(e);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return;
+}
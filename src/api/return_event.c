@@ -20,5 +20,8 @@
 int cci_return_event(cci_event_t * event)
 {
 	cci__evt_t *ev = container_of(event, cci__evt_t, event);
+
+	if (ev->priv == &cci__large_tag)
+		return cci__large_return_event(ev);
 	return ev->ep->plugin->return_event(event);
 }
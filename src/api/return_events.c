@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_return_events(cci_event_t ** events, uint32_t count)
+{
+	int ret = CCI_SUCCESS, rc;
+	uint32_t i;
+	cci__evt_t *ev;
+
+	if (NULL == events)
+		return CCI_EINVAL;
+	if (0 == count)
+		return CCI_SUCCESS;
+
+	ev = container_of(events[0], cci__evt_t, event);
+	if (ev->ep->plugin->return_events && !ev->ep->large)
+		return ev->ep->plugin->return_events(events, count);
+
+	/* the transport does not batch (or some events are the core's),
+	 * return the events one at a time */
+	for (i = 0; i < count; i++) {
+		ev = container_of(events[i], cci__evt_t, event);
+		if (ev->priv == &cci__large_tag)
+			rc = cci__large_return_event(ev);
+		else
+			rc = ev->ep->plugin->return_event(events[i]);
+		if (rc && ret == CCI_SUCCESS)
+			ret = rc;
+	}
+
+	return ret;
+}
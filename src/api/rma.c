@@ -60,6 +60,9 @@ int cci_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
+	if (cci__large_check_msg(conn, header_ptr, header_len))
+		return CCI_EINVAL;
+
 	return conn->plugin->rma(connection, header_ptr, header_len,
 				 local_handle, local_offset,
 				 remote_handle, remote_offset,
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_rma_atomic(cci_connection_t * connection,
+		   cci_rma_handle_t * local_handle, uint64_t local_offset,
+		   cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		   cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		   const void *context, int flags)
+{
+	cci__conn_t *conn = NULL;
+
+	if (NULL == local_handle || NULL == remote_handle) {
+		debug(CCI_DB_INFO, "%s: %s handle is NULL\n",
+			__func__, !local_handle ? "local" : "remote");
+		return CCI_EINVAL;
+	}
+
+	if (NULL == connection) {
+		debug(CCI_DB_INFO, "%s: NULL connection", __func__);
+		return CCI_EINVAL;
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	if (!cci_conn_is_reliable(conn)) {
+		debug(CCI_DB_INFO, "%s: RMA requires a reliable connection",
+		      __func__);
+		return CCI_EINVAL;
+	}
+
+	if (op != CCI_RMA_ATOMIC_FETCH_ADD && op != CCI_RMA_ATOMIC_CSWAP &&
+	    op != CCI_RMA_ATOMIC_SWAP) {
+		debug(CCI_DB_INFO, "%s: invalid atomic op %d", __func__, op);
+		return CCI_EINVAL;
+	}
+
+	if (remote_offset & 7) {
+		debug(CCI_DB_INFO, "%s: remote offset is not 64-bit aligned",
+		      __func__);
+		return CCI_EINVAL;
+	}
+
+	/* atomicity cannot be built from other operations */
+	if (!conn->plugin->rma_atomic)
+		return CCI_ERR_NOT_IMPLEMENTED;
+
+	return conn->plugin->rma_atomic(connection, local_handle, local_offset,
+					remote_handle, remote_offset, op,
+					operand, compare, context, flags);
+}
@@ -18,5 +18,12 @@
 int cci_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t * rma_handle)
 {
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (ep->rcache) {
+		int ret = cci__rcache_put(ep, rma_handle);
+
+		if (ret != CCI_ERR_NOT_FOUND)
+			return ret;
+	}
 	return ep->plugin->rma_deregister(endpoint, rma_handle);
 }
@@ -13,21 +13,378 @@
 #include "cci/private_config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cci.h"
 #include "plugins/ctp/ctp.h"
 
+/* Registration cache, see cci_lib_types.h */
+
+static inline uint32_t rcache_rand(cci__rcache_t *rc)
+{
+	/* xorshift32 */
+	rc->seed ^= rc->seed << 13;
+	rc->seed ^= rc->seed >> 17;
+	rc->seed ^= rc->seed << 5;
+
+	return rc->seed;
+}
+
+static inline uint32_t rcache_hash(cci_rma_handle_t *handle)
+{
+	return (uint32_t) (((uintptr_t) handle >> 4) % CCI_RCACHE_HASH_SIZE);
+}
+
+/* entries are ordered by start, then by address to keep keys unique */
+static inline int rcache_less(const cci__rcache_entry_t *a,
+			      const cci__rcache_entry_t *b)
+{
+	return a->start < b->start || (a->start == b->start && a < b);
+}
+
+static inline void rcache_update(cci__rcache_entry_t *e)
+{
+	e->max_end = e->end;
+	if (e->left && e->left->max_end > e->max_end)
+		e->max_end = e->left->max_end;
+	if (e->right && e->right->max_end > e->max_end)
+		e->max_end = e->right->max_end;
+}
+
+static cci__rcache_entry_t *rcache_rotate_right(cci__rcache_entry_t *e)
+{
+	cci__rcache_entry_t *l = e->left;
+
+	e->left = l->right;
+	l->right = e;
+	rcache_update(e);
+	rcache_update(l);
+
+	return l;
+}
+
+static cci__rcache_entry_t *rcache_rotate_left(cci__rcache_entry_t *e)
+{
+	cci__rcache_entry_t *r = e->right;
+
+	e->right = r->left;
+	r->left = e;
+	rcache_update(e);
+	rcache_update(r);
+
+	return r;
+}
+
+static cci__rcache_entry_t *rcache_insert(cci__rcache_entry_t *node,
+					  cci__rcache_entry_t *e)
+{
+	if (!node) {
+		e->left = e->right = NULL;
+		e->max_end = e->end;
+		return e;
+	}
+
+	if (rcache_less(e, node)) {
+		node->left = rcache_insert(node->left, e);
+		if (node->left->prio > node->prio)
+			return rcache_rotate_right(node);
+	} else {
+		node->right = rcache_insert(node->right, e);
+		if (node->right->prio > node->prio)
+			return rcache_rotate_left(node);
+	}
+	rcache_update(node);
+
+	return node;
+}
+
+static cci__rcache_entry_t *rcache_remove(cci__rcache_entry_t *node,
+					  cci__rcache_entry_t *e)
+{
+	if (!node)
+		return NULL;
+
+	if (node == e) {
+		if (!e->left)
+			return e->right;
+		if (!e->right)
+			return e->left;
+		/* rotate e down below its higher priority child */
+		if (e->left->prio > e->right->prio) {
+			node = rcache_rotate_right(e);
+			node->right = rcache_remove(node->right, e);
+		} else {
+			node = rcache_rotate_left(e);
+			node->left = rcache_remove(node->left, e);
+		}
+	} else if (rcache_less(e, node)) {
+		node->left = rcache_remove(node->left, e);
+	} else {
+		node->right = rcache_remove(node->right, e);
+	}
+	rcache_update(node);
+
+	return node;
+}
+
+/* Find a registration of exactly [start, end) with the same flags. A
+ * longer one would let the peer reach past the range asked for. */
+static cci__rcache_entry_t *rcache_find(cci__rcache_entry_t *node,
+					uintptr_t start, uintptr_t end,
+					int flags)
+{
+	cci__rcache_entry_t *e;
+
+	if (!node || node->max_end < end)
+		return NULL;
+	if (start < node->start)
+		return rcache_find(node->left, start, end, flags);
+	if (start > node->start)
+		return rcache_find(node->right, start, end, flags);
+
+	/* entries with the same start may be on both sides */
+	if (node->end == end && node->flags == flags)
+		return node;
+	e = rcache_find(node->left, start, end, flags);
+	if (!e)
+		e = rcache_find(node->right, start, end, flags);
+
+	return e;
+}
+
+/* Find any registration that overlaps [start, end) */
+static cci__rcache_entry_t *rcache_overlap(cci__rcache_entry_t *node,
+					   uintptr_t start, uintptr_t end)
+{
+	cci__rcache_entry_t *e;
+
+	if (!node || node->max_end <= start)
+		return NULL;
+
+	e = rcache_overlap(node->left, start, end);
+	if (e)
+		return e;
+	if (node->start < end && node->end > start)
+		return node;
+	/* the right subtree starts at or after node */
+	if (node->start >= end)
+		return NULL;
+
+	return rcache_overlap(node->right, start, end);
+}
+
+/* Deregister an unused entry and free it.
+ *
+ * NOTE: caller must hold rc->lock
+ */
+static void rcache_drop_locked(cci__ep_t *ep, cci__rcache_entry_t *e)
+{
+	cci__rcache_t *rc = ep->rcache;
+
+	if (!e->invalid)
+		rc->root = rcache_remove(rc->root, e);
+	TAILQ_REMOVE(&rc->hash[rcache_hash(e->handle)], e, hentry);
+
+	ep->plugin->rma_deregister(&ep->endpoint, e->handle);
+	free(e);
+}
+
+void cci__rcache_init(cci__ep_t *ep)
+{
+	int i;
+	long max;
+	char *str = getenv("CCI_RMA_CACHE");
+	cci__rcache_t *rc;
+
+	max = str ? strtol(str, NULL, 0) : 0;
+	if (!ep->rma_cache || max <= 0)
+		return;
+
+	rc = calloc(1, sizeof(*rc));
+	if (!rc) {
+		debug(CCI_DB_WARN, "%s: no memory for the registration cache",
+		      __func__);
+		return;
+	}
+	TAILQ_INIT(&rc->lru);
+	for (i = 0; i < CCI_RCACHE_HASH_SIZE; i++)
+		TAILQ_INIT(&rc->hash[i]);
+	rc->max_unused = max > UINT32_MAX ? UINT32_MAX : (uint32_t) max;
+	rc->seed = (uint32_t) (uintptr_t) ep | 1;
+	pthread_mutex_init(&rc->lock, NULL);
+
+	debug(CCI_DB_INFO, "%s: caching up to %u unused registrations",
+	      __func__, rc->max_unused);
+
+	ep->rcache = rc;
+}
+
+void cci__rcache_fini(cci__ep_t *ep)
+{
+	int i;
+	cci__rcache_t *rc = ep->rcache;
+
+	if (!rc)
+		return;
+
+	pthread_mutex_lock(&rc->lock);
+	for (i = 0; i < CCI_RCACHE_HASH_SIZE; i++) {
+		while (!TAILQ_EMPTY(&rc->hash[i])) {
+			cci__rcache_entry_t *e = TAILQ_FIRST(&rc->hash[i]);
+
+			if (!e->refcnt)
+				TAILQ_REMOVE(&rc->lru, e, lentry);
+			rcache_drop_locked(ep, e);
+		}
+	}
+	pthread_mutex_unlock(&rc->lock);
+
+	pthread_mutex_destroy(&rc->lock);
+	free(rc);
+	ep->rcache = NULL;
+}
+
+/* Called by cci_rma_deregister(). Returns CCI_ERR_NOT_FOUND if the
+ * handle is not cached. */
+int cci__rcache_put(cci__ep_t *ep, cci_rma_handle_t *handle)
+{
+	int ret = CCI_ERR_NOT_FOUND;
+	cci__rcache_t *rc = ep->rcache;
+	cci__rcache_entry_t *e;
+
+	pthread_mutex_lock(&rc->lock);
+	TAILQ_FOREACH(e, &rc->hash[rcache_hash(handle)], hentry) {
+		if (e->handle == handle)
+			break;
+	}
+	if (!e)
+		goto out;
+
+	ret = CCI_SUCCESS;
+	if (!e->refcnt) {
+		/* already deregistered */
+		ret = CCI_EINVAL;
+	} else if (--e->refcnt == 0) {
+		if (e->invalid) {
+			rcache_drop_locked(ep, e);
+		} else {
+			TAILQ_INSERT_TAIL(&rc->lru, e, lentry);
+			if (++rc->nunused > rc->max_unused) {
+				e = TAILQ_FIRST(&rc->lru);
+				TAILQ_REMOVE(&rc->lru, e, lentry);
+				rc->nunused--;
+				rcache_drop_locked(ep, e);
+			}
+		}
+	}
+out:
+	pthread_mutex_unlock(&rc->lock);
+
+	return ret;
+}
+
+static void rcache_invalidate(cci__ep_t *ep, uintptr_t start, uintptr_t end)
+{
+	cci__rcache_t *rc = ep->rcache;
+	cci__rcache_entry_t *e;
+
+	pthread_mutex_lock(&rc->lock);
+	while ((e = rcache_overlap(rc->root, start, end))) {
+		rc->root = rcache_remove(rc->root, e);
+		e->invalid = 1;
+		/* entries in use are dropped by their last deregistration */
+		if (!e->refcnt) {
+			TAILQ_REMOVE(&rc->lru, e, lentry);
+			rc->nunused--;
+			rcache_drop_locked(ep, e);
+		}
+	}
+	pthread_mutex_unlock(&rc->lock);
+}
+
 int cci_rma_register(cci_endpoint_t * endpoint,
 		     void *start, uint64_t length,
 		     int flags, cci_rma_handle_t ** rma_handle)
 {
+	int ret;
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+	cci__rcache_t *rc;
+	cci__rcache_entry_t *e;
+	uintptr_t end;
 
 	if (NULL == endpoint ||
 	    NULL == rma_handle || NULL == start || 0ULL == length) {
 		return CCI_EINVAL;
 	}
 
-	return ep->plugin->rma_register(endpoint, start, length, flags,
-					rma_handle);
+	rc = ep->rcache;
+	if (!rc || length > UINTPTR_MAX - (uintptr_t) start)
+		return ep->plugin->rma_register(endpoint, start, length,
+						flags, rma_handle);
+
+	end = (uintptr_t) start + length;
+
+	pthread_mutex_lock(&rc->lock);
+	e = rcache_find(rc->root, (uintptr_t) start, end, flags);
+	if (e) {
+		if (e->refcnt++ == 0) {
+			TAILQ_REMOVE(&rc->lru, e, lentry);
+			rc->nunused--;
+		}
+		*rma_handle = e->handle;
+	}
+	pthread_mutex_unlock(&rc->lock);
+	if (e)
+		return CCI_SUCCESS;
+
+	ret = ep->plugin->rma_register(endpoint, start, length, flags,
+				       rma_handle);
+	if (ret)
+		return ret;
+
+	/* without an entry, the handle is simply not cached */
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return CCI_SUCCESS;
+	e->start = (uintptr_t) start;
+	e->end = end;
+	e->flags = flags;
+	e->refcnt = 1;
+	e->handle = *rma_handle;
+
+	pthread_mutex_lock(&rc->lock);
+	e->prio = rcache_rand(rc);
+	rc->root = rcache_insert(rc->root, e);
+	TAILQ_INSERT_TAIL(&rc->hash[rcache_hash(e->handle)], e, hentry);
+	pthread_mutex_unlock(&rc->lock);
+
+	return CCI_SUCCESS;
+}
+
+int cci_rma_invalidate(void *start, uint64_t length)
+{
+	cci__dev_t *dev;
+	cci__ep_t *ep;
+	uintptr_t end;
+
+	if (!globals)
+		return CCI_ENODEV;
+	if (NULL == start || 0ULL == length)
+		return CCI_EINVAL;
+
+	end = length > UINTPTR_MAX - (uintptr_t) start ?
+		UINTPTR_MAX : (uintptr_t) start + length;
+
+	pthread_mutex_lock(&globals->lock);
+	TAILQ_FOREACH(dev, &globals->devs, entry) {
+		pthread_mutex_lock(&dev->lock);
+		TAILQ_FOREACH(ep, &dev->eps, entry) {
+			if (ep->rcache)
+				rcache_invalidate(ep, (uintptr_t) start, end);
+		}
+		pthread_mutex_unlock(&dev->lock);
+	}
+	pthread_mutex_unlock(&globals->lock);
+
+	return CCI_SUCCESS;
 }
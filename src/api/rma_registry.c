@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * RMA handle registry shared by the transports. See cci_lib_types.h.
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cci.h"
+#include "cci_lib_types.h"
+#include "cci-api.h"
+
+int cci__rma_reg_init(cci__rma_reg_t *reg)
+{
+	memset(reg, 0, sizeof(*reg));
+
+	return pthread_mutex_init(&reg->lock, NULL) ? CCI_ERROR : CCI_SUCCESS;
+}
+
+void cci__rma_reg_fini(cci__rma_reg_t *reg)
+{
+	uint32_t i;
+
+	for (i = 0; i < reg->nchunks; i++)
+		free(reg->chunks[i]);
+	reg->nchunks = 0;
+	reg->free_head = 0;
+	pthread_mutex_destroy(&reg->lock);
+
+	return;
+}
+
+/* NOTE: caller must hold reg->lock */
+static int cci__rma_reg_grow_locked(cci__rma_reg_t *reg)
+{
+	uint32_t i, base;
+	cci__rma_reg_slot_t *slots;
+
+	if (reg->nchunks == CCI_RMA_REG_MAX_CHUNKS)
+		return CCI_ENOMEM;
+
+	slots = calloc(CCI_RMA_REG_CHUNK, sizeof(*slots));
+	if (!slots)
+		return CCI_ENOMEM;
+
+	/* chain the new slots on the free list, lowest index first */
+	base = reg->nchunks << CCI_RMA_REG_CHUNK_SHIFT;
+	for (i = 0; i < CCI_RMA_REG_CHUNK - 1; i++)
+		slots[i].next_free = base + i + 2;
+	slots[i].next_free = reg->free_head;
+	reg->free_head = base + 1;
+
+	/* publish the chunk before lookups can index into it */
+	reg->chunks[reg->nchunks] = slots;
+	__atomic_store_n(&reg->nchunks, reg->nchunks + 1, __ATOMIC_RELEASE);
+
+	return CCI_SUCCESS;
+}
+
+static inline cci__rma_reg_slot_t *cci__rma_reg_slot(cci__rma_reg_t *reg,
+						      uint32_t index)
+{
+	return &reg->chunks[index >> CCI_RMA_REG_CHUNK_SHIFT]
+			[index & (CCI_RMA_REG_CHUNK - 1)];
+}
+
+int cci__rma_reg_insert(cci__rma_reg_t *reg, void *handle, uint64_t *key)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t index;
+	cci__rma_reg_slot_t *slot;
+
+	pthread_mutex_lock(&reg->lock);
+	if (!reg->free_head) {
+		ret = cci__rma_reg_grow_locked(reg);
+		if (ret)
+			goto out;
+	}
+
+	index = reg->free_head - 1;
+	slot = cci__rma_reg_slot(reg, index);
+	reg->free_head = slot->next_free;
+	slot->next_free = 0;
+	__atomic_store_n(&slot->handle, handle, __ATOMIC_RELEASE);
+
+	*key = ((uint64_t) slot->gen << 32) | (uint64_t) (index + 1);
+out:
+	pthread_mutex_unlock(&reg->lock);
+
+	return ret;
+}
+
+void *cci__rma_reg_remove(cci__rma_reg_t *reg, uint64_t key)
+{
+	void *handle;
+	uint32_t index = (uint32_t) key;
+	cci__rma_reg_slot_t *slot;
+
+	pthread_mutex_lock(&reg->lock);
+	handle = cci__rma_reg_lookup(reg, key);
+	if (handle) {
+		slot = cci__rma_reg_slot(reg, index - 1);
+
+		/* invalidate outstanding keys before clearing the slot */
+		__atomic_store_n(&slot->gen, slot->gen + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&slot->handle, NULL, __ATOMIC_RELEASE);
+		slot->next_free = reg->free_head;
+		reg->free_head = index;
+	}
+	pthread_mutex_unlock(&reg->lock);
+
+	return handle;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_rmav(cci_connection_t * connection,
+	     const void *msg_ptr, uint32_t msg_len,
+	     cci_rma_handle_t * local_handle,
+	     cci_rma_handle_t * remote_handle,
+	     const cci_rma_seg_t * segs, uint32_t segcnt,
+	     const void *context, int flags)
+{
+	int ret;
+	uint32_t i;
+	cci__conn_t *conn = NULL;
+
+	if (NULL == local_handle || NULL == remote_handle) {
+		debug(CCI_DB_INFO, "%s: %s handle is NULL",
+			__func__, !local_handle ? "local" : "remote");
+		return CCI_EINVAL;
+	}
+
+	if (NULL == connection || NULL == segs || 0 == segcnt) {
+		debug(CCI_DB_INFO, "%s: no connection or no segments",
+		      __func__);
+		return CCI_EINVAL;
+	}
+
+	for (i = 0; i < segcnt; i++) {
+		if (0 == segs[i].length) {
+			debug(CCI_DB_INFO, "%s: segment %u is empty",
+			      __func__, i);
+			return CCI_EINVAL;
+		}
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	if (!cci_conn_is_reliable(conn)) {
+		debug(CCI_DB_INFO, "%s: RMA requires a reliable connection",
+		      __func__);
+		return CCI_EINVAL;
+	}
+
+	if (flags & CCI_FLAG_READ && flags & CCI_FLAG_WRITE) {
+		debug(CCI_DB_INFO,
+		      "%s: RMA requires either CCI_FLAG_READ or CCI_FLAG_WRITE,"
+		      " but not both", __func__);
+		return CCI_EINVAL;
+	}
+
+	if (!(flags & CCI_FLAG_READ || flags & CCI_FLAG_WRITE)) {
+		debug(CCI_DB_INFO,
+		      "%s: RMA requires either CCI_FLAG_READ or CCI_FLAG_WRITE",
+		      __func__);
+		return CCI_EINVAL;
+	}
+
+	if (cci__large_check_msg(conn, msg_ptr, msg_len))
+		return CCI_EINVAL;
+
+	if (conn->plugin->rmav)
+		return conn->plugin->rmav(connection, msg_ptr, msg_len,
+					  local_handle, remote_handle,
+					  segs, segcnt, context, flags);
+
+	/* the transport does not gather, post one silent RMA per segment
+	 * and let the fenced last one complete the whole op */
+	for (i = 0; i + 1 < segcnt; i++) {
+		ret = conn->plugin->rma(connection, NULL, 0,
+					local_handle, segs[i].local_offset,
+					remote_handle, segs[i].remote_offset,
+					segs[i].length, context,
+					(flags & ~CCI_FLAG_BLOCKING) |
+					CCI_FLAG_SILENT);
+		if (ret) {
+			/* the earlier segments cannot be recalled and will
+			 * complete silently, see cci_rmav() */
+			debug(CCI_DB_INFO, "%s: posting segment %u of %u "
+			      "failed with %s", __func__, i, segcnt,
+			      cci_strerror(connection->endpoint, ret));
+			return ret;
+		}
+	}
+
+	return conn->plugin->rma(connection, msg_ptr, msg_len,
+				 local_handle, segs[i].local_offset,
+				 remote_handle, segs[i].remote_offset,
+				 segs[i].length, context,
+				 segcnt > 1 ? flags | CCI_FLAG_FENCE : flags);
+}
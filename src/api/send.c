@@ -21,9 +21,17 @@ int cci_send(cci_connection_t * connection,
 	     const void *msg_ptr, uint32_t msg_len, const void *context, int flags)
 {
 	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	cci__ep_t *ep;
 
 	if (NULL == connection)
 		return CCI_EINVAL;
 
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	if (ep->large) {
+		struct iovec iov = { (void *) msg_ptr, msg_len };
+
+		return cci__large_sendv(conn, &iov, 1, context, flags);
+	}
+
 	return conn->plugin->send(connection, msg_ptr, msg_len, context, flags);
 }
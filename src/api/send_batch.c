@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i;
+	cci__conn_t *conn;
+	cci__ep_t *ep;
+
+	if (NULL == descs)
+		return CCI_EINVAL;
+	for (i = 0; i < count; i++)
+		if (NULL == descs[i].connection)
+			return CCI_EINVAL;
+	if (0 == count)
+		return CCI_SUCCESS;
+
+	conn = container_of(descs[0].connection, cci__conn_t, connection);
+	ep = container_of(descs[0].connection->endpoint, cci__ep_t, endpoint);
+	if (conn->plugin->send_batch && !ep->large)
+		return conn->plugin->send_batch(descs, count);
+
+	/* the transport does not batch (or large messages need the core),
+	 * post the sends one at a time */
+	for (i = 0; i < count; i++) {
+		conn = container_of(descs[i].connection, cci__conn_t, connection);
+		if (ep->large)
+			descs[i].status = cci__large_sendv(conn, descs[i].data,
+							   descs[i].iovcnt,
+							   descs[i].context,
+							   descs[i].flags);
+		else
+			descs[i].status = conn->plugin->sendv(descs[i].connection,
+							      descs[i].data,
+							      descs[i].iovcnt,
+							      descs[i].context,
+							      descs[i].flags);
+		if (descs[i].status && ret == CCI_SUCCESS)
+			ret = descs[i].status;
+	}
+
+	return ret;
+}
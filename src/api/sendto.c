@@ -0,0 +1,33 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+int cci_sendto(cci_endpoint_t * endpoint, const cci_addr_t * addr,
+	       const void *msg_ptr, uint32_t msg_len,
+	       const void *context, int flags)
+{
+	cci__ep_t *ep;
+
+	if (NULL == endpoint || NULL == addr)
+		return CCI_EINVAL;
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	if (!ep->plugin->sendto)
+		return CCI_ERR_NOT_IMPLEMENTED;
+
+	return ep->plugin->sendto(endpoint, addr, msg_ptr, msg_len, context,
+				  flags);
+}
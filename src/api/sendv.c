@@ -21,9 +21,14 @@ int cci_sendv(cci_connection_t * connection,
 	      const struct iovec *data, uint32_t iovcnt, const void *context, int flags)
 {
 	cci__conn_t *conn = container_of(connection, cci__conn_t, connection);
+	cci__ep_t *ep;
 
 	if (NULL == connection)
 		return CCI_EINVAL;
 
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	if (ep->large)
+		return cci__large_sendv(conn, data, iovcnt, context, flags);
+
 	return conn->plugin->sendv(connection, data, iovcnt, context, flags);
 }
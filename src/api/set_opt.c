@@ -35,11 +35,39 @@ int cci_set_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_ENDPT_SEND_BUF_COUNT:
 	case CCI_OPT_ENDPT_KEEPALIVE_TIMEOUT:
 	case CCI_OPT_ENDPT_URI:
-	case CCI_OPT_ENDPT_RMA_ALIGN: {
+	case CCI_OPT_ENDPT_RMA_ALIGN:
+	case CCI_OPT_ENDPT_RMA_FILE:
+	case CCI_OPT_ENDPT_NUMA_NODE:
+	case CCI_OPT_ENDPT_CPUS: {
 		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
 		plugin = ep->plugin;
 		break;
 	}
+	case CCI_OPT_ENDPT_WAIT_SPIN: {
+		/* only used by cci_wait_event() */
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+		ep->wait_spin = *((uint32_t *) val);
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
+	case CCI_OPT_ENDPT_EAGER_LIMIT: {
+		/* only used by the core's large messages */
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+		if (!ep->large)
+			return CCI_EINVAL;
+		ep->large->eager_limit = *((uint32_t *) val);
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
+	case CCI_OPT_ENDPT_LARGE_ALLOC: {
+		cci__ep_t *ep = container_of(handle, cci__ep_t, endpoint);
+		const cci_large_alloc_t *alloc = val;
+		if (!ep->large || (alloc->alloc && !alloc->release))
+			return CCI_EINVAL;
+		ep->large->alloc = *alloc;
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
 	case CCI_OPT_CONN_SEND_TIMEOUT: {
 		cci__conn_t *conn = container_of(handle, cci__conn_t, connection);
 		plugin = conn->plugin;
@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2010-2011 UT-Battelle, LLC. All rights reserved.
+ * Copyright © 2010-2011 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ */
+
+#include "cci/private_config.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "cci.h"
+#include "plugins/ctp/ctp.h"
+
+/* Longest pause between polls when the transport cannot sleep */
+#define WAIT_MAX_PAUSE_NS	(1000000L)
+
+static void wait_add_us(struct timespec *ts, uint64_t us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (us % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* Return the nanoseconds left until deadline, 0 if it passed. */
+static int64_t wait_left_ns(const struct timespec *deadline)
+{
+	struct timespec now;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000000LL +
+		(deadline->tv_nsec - now.tv_nsec);
+
+	return ns > 0 ? ns : 0;
+}
+
+/* Get an event as cci_get_event() does. */
+static int wait_get_event(cci__ep_t *ep, cci_event_t ** const event)
+{
+	if (ep->large)
+		return cci__large_get_event(ep, event);
+	return ep->plugin->get_event(&ep->endpoint, event);
+}
+
+int cci_wait_event(cci_endpoint_t * endpoint, cci_event_t ** const event,
+		   const struct timeval *timeout)
+{
+	int ret;
+	long pause = 1000;
+	struct timespec deadline, spin;
+	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	if (NULL == endpoint || NULL == event)
+		return CCI_EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	spin = deadline;
+	if (timeout)
+		wait_add_us(&deadline, (uint64_t) timeout->tv_sec * 1000000 +
+			    timeout->tv_usec);
+	wait_add_us(&spin, ep->wait_spin);
+
+	/* poll for a while, but not past the timeout */
+	do {
+		ret = wait_get_event(ep, event);
+		if (ret != CCI_EAGAIN && ret != CCI_ENOBUFS)
+			return ret;
+	} while (wait_left_ns(&spin) && (!timeout || wait_left_ns(&deadline)));
+
+	if (timeout && !wait_left_ns(&deadline))
+		return CCI_ETIMEDOUT;
+
+	if (ep->plugin->wait_event) {
+		for (;;) {
+			ret = ep->plugin->wait_event(endpoint, event,
+						     timeout ? &deadline : NULL);
+			if (ret || !ep->large || cci__large_filter(ep, event))
+				return ret;
+
+			/* the core consumed it, it may have made one */
+			ret = cci__large_get_event(ep, event);
+			if (ret != CCI_EAGAIN && ret != CCI_ENOBUFS)
+				return ret;
+		}
+	}
+
+	/* the transport cannot sleep, poll with growing pauses */
+	for (;;) {
+		struct timespec ts = { 0, pause };
+
+		if (timeout) {
+			int64_t left = wait_left_ns(&deadline);
+
+			if (!left)
+				return CCI_ETIMEDOUT;
+			if (left < ts.tv_nsec)
+				ts.tv_nsec = (long) left;
+		}
+		nanosleep(&ts, NULL);
+		if (pause < WAIT_MAX_PAUSE_NS)
+			pause *= 2;
+
+		ret = wait_get_event(ep, event);
+		if (ret != CCI_EAGAIN && ret != CCI_ENOBUFS)
+			return ret;
+	}
+}
@@ -61,12 +61,20 @@ typedef int (*cci_arm_os_handle_fn_t) (cci_endpoint_t * endpoint, int flags);
 typedef int (*cci_get_event_fn_t) (cci_endpoint_t * endpoint,
 				   cci_event_t ** const event);
 typedef int (*cci_return_event_fn_t) (cci_event_t * event);
+typedef int (*cci_get_events_fn_t) (cci_endpoint_t * endpoint,
+				    cci_event_t ** events, uint32_t max,
+				    uint32_t * count);
+typedef int (*cci_return_events_fn_t) (cci_event_t ** events, uint32_t count);
+typedef int (*cci_wait_event_fn_t) (cci_endpoint_t * endpoint,
+				    cci_event_t ** const event,
+				    const struct timespec * deadline);
 typedef int (*cci_send_fn_t) (cci_connection_t * connection,
 			      const void *msg_ptr, uint32_t msg_len,
 			      const void *context, int flags);
 typedef int (*cci_sendv_fn_t) (cci_connection_t * connection,
 			       const struct iovec * data, uint32_t iovcnt,
 			       const void *context, int flags);
+typedef int (*cci_send_batch_fn_t) (cci_send_desc_t * descs, uint32_t count);
 typedef int (*cci_rma_register_fn_t) (cci_endpoint_t * endpoint,
 				      void *start, uint64_t length,
 				      int flags, cci_rma_handle_t ** rma_handle);
@@ -77,6 +85,27 @@ typedef int (*cci_rma_fn_t) (cci_connection_t * connection,
 			     cci_rma_handle_t * local_handle, uint64_t local_offset,
 			     cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 			     uint64_t data_len, const void *context, int flags);
+typedef int (*cci_rmav_fn_t) (cci_connection_t * connection,
+			      const void *msg_ptr, uint32_t msg_len,
+			      cci_rma_handle_t * local_handle,
+			      cci_rma_handle_t * remote_handle,
+			      const cci_rma_seg_t * segs, uint32_t segcnt,
+			      const void *context, int flags);
+typedef int (*cci_rma_atomic_fn_t) (cci_connection_t * connection,
+				    cci_rma_handle_t * local_handle,
+				    uint64_t local_offset,
+				    cci_rma_handle_t * remote_handle,
+				    uint64_t remote_offset,
+				    cci_rma_atomic_op_t op, uint64_t operand,
+				    uint64_t compare, const void *context,
+				    int flags);
+typedef int (*cci_addr_resolve_fn_t) (cci_endpoint_t * endpoint,
+				      const char *uri,
+				      const cci_addr_t ** addr);
+typedef int (*cci_sendto_fn_t) (cci_endpoint_t * endpoint,
+				const cci_addr_t * addr, const void *msg_ptr,
+				uint32_t msg_len, const void *context,
+				int flags);
 
 /* Plugin struct */
 
@@ -103,6 +132,27 @@ typedef struct cci_plugin_ctp {
 	cci_rma_register_fn_t rma_register;
 	cci_rma_deregister_fn_t rma_deregister;
 	cci_rma_fn_t rma;
+
+	/* Optional, emulated with get_event and return_event if NULL */
+	cci_get_events_fn_t get_events;
+	cci_return_events_fn_t return_events;
+
+	/* Optional, emulated with sendv if NULL */
+	cci_send_batch_fn_t send_batch;
+
+	/* Optional, emulated with get_event if NULL. The deadline is on
+	   CLOCK_MONOTONIC, NULL to wait forever. */
+	cci_wait_event_fn_t wait_event;
+
+	/* Optional, emulated with rma if NULL */
+	cci_rmav_fn_t rmav;
+
+	/* Optional, CCI_ERR_NOT_IMPLEMENTED if NULL */
+	cci_rma_atomic_fn_t rma_atomic;
+
+	/* Optional, CCI_ERR_NOT_IMPLEMENTED if NULL. Both or neither. */
+	cci_addr_resolve_fn_t addr_resolve;
+	cci_sendto_fn_t sendto;
 } cci_plugin_ctp_t;
 
 /* Global variable containing all plugins handles,
@@ -111,7 +161,7 @@ extern struct cci_plugin_handle *cci_all_plugins;
 
 /* Define for the version of this plugin type header file */
 #define CCI_CTP_API_VERSION_MAJOR 1
-#define CCI_CTP_API_VERSION_MINOR 0
+#define CCI_CTP_API_VERSION_MINOR 5
 #define CCI_CTP_API_VERSION_RELEASE 0
 #define CCI_CTP_API_VERSION \
     "ctp", \
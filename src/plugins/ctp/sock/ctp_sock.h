@@ -36,21 +36,25 @@ BEGIN_C_DECLS
 #define SOCK_EP_TX_TIMEOUT_SEC  (64)	/* seconds for now */
 #define SOCK_EP_RX_CNT          (16*1024)	/* number of rx active messages */
 #define SOCK_EP_TX_CNT          (16*1024)	/* number of tx active messages */
+#define SOCK_RX_WINDOW          (SOCK_EP_TX_CNT) /* seqs tracked for resends */
 #define SOCK_EP_HASH_SIZE       (256)	/* nice round number */
 #define SOCK_MAX_EPS            (256)	/* max sock fd value - 1 */
 #define SOCK_BLOCK_SIZE         (64)	/* use 64b blocks for id storage */
 #define SOCK_NUM_BLOCKS         (16384)	/* number of blocks */
 #define SOCK_MAX_ID             (SOCK_BLOCK_SIZE * SOCK_NUM_BLOCKS)
     /* 1048576 conns per endpoint */
-#define SOCK_PROG_TIME_US       (100)	/* try to progress every N microseconds */
+#define SOCK_PROG_TIME_US       (1000)	/* try to progress every N microseconds */
 #define SOCK_RESEND_TIME_SEC    (1)	/* time between resends in seconds */
 #define SOCK_PEEK_LEN           (32)	/* large enough for RMA header */
 #define SOCK_CONN_REQ_HDR_LEN   ((int) (sizeof(struct sock_header_r)))
     /* header + seqack */
 #define SOCK_RMA_DEPTH          (256)	/* how many in-flight msgs per RMA */
+#define SOCK_RMAV_PACK_LEN      (1024)	/* cci_rmav() segments copied together */
+#define SOCK_RMAV_MAX_SEGS      (255)	/* max segments per packed RMA write */
+#define SOCK_ATOMIC_CACHE       (64)	/* atomic replies kept per connection */
+#define SOCK_ADDR_MAX_UNUSED    (1024)	/* datagram senders kept once unused */
 #define ACK_TIMEOUT             (100) /* Timeout associated to ACK blocks */
 #define PENDING_ACK_THRESHOLD   (SOCK_RMA_DEPTH/4) /* Maximum size of a ACK block */
-#define SOCK_EP_NUM_EVTS        (64)
 
 /*
  * System Parameters
@@ -125,6 +129,9 @@ typedef enum sock_msg_type {
 	SOCK_MSG_RMA_READ_REQUEST,
 	SOCK_MSG_RMA_READ_REPLY,
 	SOCK_MSG_RMA_INVALID,	/* invalid handle */
+	SOCK_MSG_RMA_ATOMIC_REQUEST,
+	SOCK_MSG_RMA_ATOMIC_REPLY,
+	SOCK_MSG_DGRAM,		/* connectionless UU datagram */
 	SOCK_MSG_TYPE_MAX
 } sock_msg_type_t;
 
@@ -441,6 +448,26 @@ sock_pack_send(sock_header_t * header, uint16_t len, uint32_t id)
 	sock_pack_header(header, SOCK_MSG_SEND, 0, len, id);
 }
 
+/* datagram header:
+
+    <---------- 32 bits ---------->
+    <- 8 -> <- 8 -> <---- 16 ----->
+   +-------+-------+---------------+
+   | type  | rsvd  |   data len    |
+   +-------+-------+---------------+
+   |           reserved            |
+   +-------------------------------+
+
+   The data follows the header. There is no connection, the receiver
+   knows the sender by the datagram's source address.
+
+ */
+
+static inline void sock_pack_dgram(sock_header_t * header, uint16_t len)
+{
+	sock_pack_header(header, SOCK_MSG_DGRAM, 0, len, 0);
+}
+
 /* keepalive header:
 
     <---------- 32 bits ---------->
@@ -664,14 +691,52 @@ typedef struct sock_rma_header {
    +-------------------------------+
    |             data              |
 
-   a = unused
+   a = number of packed segments of a cci_rmav() write, 0 otherwise
    data_len = number of data bytes in this message
    local handle: cci_rma() caller's handle (stays same for each packet)
    local offset: offset into the local handle (changes for each packet)
    remote handle: passive peer's handle (stays same for each packet)
    remote offset: offset into the remote handle (changes for each packet)
+
+   A cci_rmav() write copies up to SOCK_RMAV_MAX_SEGS consecutive segments
+   of at most SOCK_RMAV_PACK_LEN bytes in one message. The offsets are
+   then 0 and data starts with a sock_rma_seg_t (remote offset and length)
+   per segment, followed by the segments' data. data_len counts both.
  */
 
+typedef struct sock_rma_seg {
+	uint64_t offset;
+	uint32_t len;
+	uint32_t pad;
+} sock_rma_seg_t;
+
+static inline void
+sock_pack_rma_seg(sock_rma_seg_t * seg, uint64_t offset, uint32_t len)
+{
+	seg->offset = sock_htonll(offset);
+	seg->len = htonl(len);
+	seg->pad = 0;
+}
+
+static inline void
+sock_parse_rma_seg(sock_rma_seg_t * seg, uint64_t * offset, uint32_t * len)
+{
+	*offset = sock_ntohll(seg->offset);
+	*len = ntohl(seg->len);
+}
+
+static inline void
+sock_pack_rma_writev(sock_rma_header_t * write, uint8_t count,
+		    uint16_t data_len, uint32_t peer_id, uint32_t seq, uint32_t ts,
+		    uint64_t local_handle, uint64_t remote_handle)
+{
+	sock_pack_header(&write->header_r.header, SOCK_MSG_RMA_WRITE,
+			 count, data_len, peer_id);
+	sock_pack_seq_ts(&write->header_r.seq_ts, seq, ts);
+	sock_pack_rma_handle_offset(&write->local, local_handle, 0);
+	sock_pack_rma_handle_offset(&write->remote, remote_handle, 0);
+}
+
 static inline void
 sock_pack_rma_write(sock_rma_header_t * write, uint16_t data_len,
 		    uint32_t peer_id, uint32_t seq, uint32_t ts,
@@ -762,6 +827,94 @@ sock_pack_rma_read_reply (sock_rma_header_t * read, uint64_t data_len,
 
 
 
+/* RMA atomic request and reply
+
+    <---------- 32 bits ---------->
+    <- 8 -> <- 8 -> <---- 16 ----->
+   +-------+-------+---------------+
+   | type  |   a   |       b       |
+   +-------+-------+---------------+
+   |            peer id            |
+   +-------------------------------+
+
+   +-------------------------------+
+   |              seq              |
+   +-------------------------------+
+   |           timestamp           |
+   +-------------------------------+
+
+   +-------------------------------+
+   |        ACK Piggyback          |
+   +-------------------------------+
+
+   +-------------------------------+
+   |   local handle and offset     |
+   |          (128 bits)           |
+   +-------------------------------+
+   |   remote handle and offset    |
+   |          (128 bits)           |
+   +-------------------------------+
+
+   +-------------------------------+
+   |        operand (0 - 63)       |
+   +-------------------------------+
+   |        compare (0 - 63)       |
+   +-------------------------------+
+   |            status             |
+   +-------------------------------+
+   |            unused             |
+   +-------------------------------+
+
+   a = cci_rma_atomic_op_t
+   b = unused
+   operand: the request's operand, or the previous value in the reply
+   compare: the compare value of CCI_RMA_ATOMIC_CSWAP
+   status: the target's status in the reply
+
+   The target applies the request once and answers with a reply, sent
+   directly like an RMA read reply, whose ACK piggyback is the request's
+   seq. The reply is not acked, so the initiator resends the request until
+   a reply arrives and the target answers a resent request from the last
+   SOCK_ATOMIC_CACHE replies of the connection without applying it again.
+ */
+
+typedef struct sock_rma_atomic {
+	uint64_t operand;
+	uint64_t compare;
+	uint32_t status;
+	uint32_t pad;
+} sock_rma_atomic_t;
+
+static inline void
+sock_pack_rma_atomic(sock_rma_header_t * hdr, sock_msg_type_t type,
+		uint8_t op, uint32_t peer_id, uint32_t seq, uint32_t ts,
+		uint64_t local_handle, uint64_t local_offset,
+		uint64_t remote_handle, uint64_t remote_offset,
+		uint64_t operand, uint64_t compare, uint32_t status)
+{
+	sock_rma_atomic_t *atomic = (sock_rma_atomic_t *) hdr->data;
+
+	sock_pack_header(&hdr->header_r.header, type, op, 0, peer_id);
+	sock_pack_seq_ts(&hdr->header_r.seq_ts, seq, ts);
+	sock_pack_rma_handle_offset(&hdr->local, local_handle, local_offset);
+	sock_pack_rma_handle_offset(&hdr->remote, remote_handle, remote_offset);
+	atomic->operand = sock_htonll(operand);
+	atomic->compare = sock_htonll(compare);
+	atomic->status = htonl(status);
+	atomic->pad = 0;
+}
+
+static inline void
+sock_parse_rma_atomic(sock_rma_header_t * hdr, uint64_t * operand,
+		uint64_t * compare, uint32_t * status)
+{
+	sock_rma_atomic_t *atomic = (sock_rma_atomic_t *) hdr->data;
+
+	*operand = sock_ntohll(atomic->operand);
+	*compare = sock_ntohll(atomic->compare);
+	*status = ntohl(atomic->status);
+}
+
 /* RMA WRITE DONE message
     <---------- 32 bits ---------->
     <- 8 -> <- 8 -> <---- 16 ----->
@@ -828,6 +981,9 @@ typedef struct sock_tx {
 	/*! State of send - not to be confused with completion status */
 	sock_tx_state_t state;
 
+	/*! Wait object of a blocked sender, NULL if none */
+	cci__waiter_t *waiter;
+
 	/*! Buffer (wire header, data) */
 	void *buffer;
 
@@ -904,7 +1060,7 @@ typedef struct sock_rma_handle {
 	void *start;
 
 	/*! CCI RMA handle
-	    rma_handle->stuff[0] = address of sock_rma_handle_t
+	    rma_handle->stuff[0] = key in sep->reg
 	 */
 	cci_rma_handle_t rma_handle;
 
@@ -915,6 +1071,25 @@ typedef struct sock_rma_handle {
 	uint32_t refcnt;
 } sock_rma_handle_t;
 
+/*! One message of a cci_rmav() op: a slice of segment seg (cnt is 0) or
+    cnt segments copied together in one RMA write. */
+typedef struct sock_rma_frag {
+	/*! First segment */
+	uint32_t seg;
+
+	/*! Number of packed segments, 0 for a slice */
+	uint32_t cnt;
+
+	/*! Slice: offset in the segment */
+	uint64_t offset;
+
+	/*! Bytes of data (and segment table if packed) */
+	uint32_t len;
+
+	/*! Packed: segment table and data, in the op's allocation */
+	void *buf;
+} sock_rma_frag_t;
+
 typedef struct sock_rma_op {
 	/*! Entry to hang on sep->rma_ops */
 	TAILQ_ENTRY(sock_rma_op) entry;
@@ -961,20 +1136,19 @@ typedef struct sock_rma_op {
 
 	/*! Application AM ptr if provided */
 	char *msg_ptr;
+
+	/*! cci_rmav() segments and their fragments, in the op's allocation.
+	    NULL for cci_rma(). */
+	cci_rma_seg_t *segs;
+	sock_rma_frag_t *frags;
 } sock_rma_op_t;
 
 typedef struct sock_ep {
 	int event_fd;
 	int fd[2];
 
-	/*! ID of the recv thread for the endpoint */
-	pthread_t recv_tid;
-
-	/*! ID of the progress thread for the endpoint */
-	pthread_t progress_tid;
-
-	pthread_mutex_t progress_mutex;
-	pthread_cond_t  wait_condition;
+	/*! Progress engine source, unless ep->app_progress */
+	cci__prog_src_t prog;
 
 	/* Our IP and port */
 	struct sockaddr_in sin;
@@ -988,6 +1162,10 @@ typedef struct sock_ep {
 	/*! Array of conn lists hased over IP/port */
 	TAILQ_HEAD(s_conns, sock_conn) conn_hash[SOCK_EP_HASH_SIZE];
 
+	/*! Buffers of all txs and of all rxs, from cci__numa_alloc() */
+	void *tx_buf;
+	void *rx_buf;
+
 	/*! List of all txs */
 	TAILQ_HEAD(s_txs, sock_tx) txs;
 
@@ -1020,8 +1198,29 @@ typedef struct sock_ep {
 	/*! List of RMA registrations */
 	TAILQ_HEAD(s_handles, sock_rma_handle) handles;
 
+	/*! RMA registrations indexed by rma_handle.stuff[0] */
+	cci__rma_reg_t reg;
+
 	/*! List of RMA ops */
 	TAILQ_HEAD(s_ops, sock_rma_op) rma_ops;
+
+	/*! Fragments in flight per RMA, so that writes and read replies
+	    fit in the socket's receive buffer */
+	uint32_t rma_depth;
+
+	/*! Completed events for the application, instead of ep->evts */
+	cci__evtq_t evtq;
+
+	/*! Lock for addr_hash, addr_lru and the addresses' refcnt */
+	pthread_mutex_t addr_lock;
+
+	/*! Datagram peers hashed over IP/port */
+	TAILQ_HEAD(s_addrs, sock_addr) addr_hash[SOCK_EP_HASH_SIZE];
+
+	/*! Senders that no event refers to, least recently used first.
+	    Beyond SOCK_ADDR_MAX_UNUSED, the oldest ones are freed */
+	TAILQ_HEAD(s_addrs_lru, sock_addr) addr_lru;
+	uint32_t addr_nunused;
 } sock_ep_t;
 
 /* Connection info */
@@ -1061,6 +1260,46 @@ typedef struct sock_ack {
 	 TAILQ_ENTRY(sock_ack) entry;
 } sock_ack_t;
 
+/*! Reply to an atomic request, kept by the target */
+typedef struct sock_atomic_reply {
+	/*! Previous value of the remote word */
+	uint64_t value;
+
+	/*! Request's seq */
+	uint32_t seq;
+
+	/*! Status sent back */
+	uint32_t status;
+
+	/*! Is this slot in use? */
+	int used;
+} sock_atomic_reply_t;
+
+/*! Peer address of connectionless datagrams */
+typedef struct sock_addr {
+	/*! Public address, addr.uri is uri */
+	cci_addr_t addr;
+
+	/*! Peer's IP and port */
+	struct sockaddr_in sin;
+
+	/*! URI it was resolved from, or built from sin */
+	char *uri;
+
+	/*! Returned by cci_addr_resolve(), kept until the endpoint is
+	    destroyed */
+	int resolved;
+
+	/*! CCI_EVENT_RECV_FROM events not yet returned */
+	uint32_t refcnt;
+
+	/*! Hang on sep->addr_hash */
+	 TAILQ_ENTRY(sock_addr) entry;
+
+	/*! Hang on sep->addr_lru while unused */
+	 TAILQ_ENTRY(sock_addr) lru;
+} sock_addr_t;
+
 typedef struct sock_conn {
 	/*! Owning conn */
 	cci__conn_t *conn;
@@ -1120,12 +1359,25 @@ typedef struct sock_conn {
 	/*! List of sequence numbers to ack */
 	TAILQ_HEAD(s_acks, sock_ack) acks;
 
+	/*! Peer's lowest seq not received yet */
+	uint32_t rx_next;
+
+	/*! Peer's seqs received from rx_next on, indexed by seq modulo
+	    SOCK_RX_WINDOW, so that resent messages are delivered once */
+	uint64_t rx_seen[SOCK_RX_WINDOW / 64];
+
 	/*! Last RMA started */
 	uint32_t rma_id;
 
 	/*! List of RMA ops in process in case of fence */
 	TAILQ_HEAD(s_rmas, sock_rma_op) rmas;
 
+	/*! Replies to the last atomic requests, for resent requests */
+	sock_atomic_reply_t atomics[SOCK_ATOMIC_CACHE];
+
+	/*! Next slot of atomics to reuse */
+	uint32_t atomic_next;
+
 	/*! Flag to know if the receiver is ready or not */
 	uint32_t rnr;
 } sock_conn_t;
@@ -33,18 +33,13 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sched.h>
 #ifdef HAVE_IFADDRS_H
 #include <ifaddrs.h>
 #include <net/if.h>
 #endif
 
 
-#ifdef HAVE_SYS_EPOLL_H
-#include <sys/epoll.h>
-#else
-#include <poll.h>
-#endif /* HAVE_SYS_EPOLL_H */
-
 #include "cci.h"
 #include "cci_lib_types.h"
 #include "cci-api.h"
@@ -91,6 +86,13 @@ static int ctp_sock_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 static int ctp_sock_get_event(cci_endpoint_t * endpoint,
 			cci_event_t ** const event);
 static int ctp_sock_return_event(cci_event_t * event);
+static int ctp_sock_get_events(cci_endpoint_t * endpoint,
+			cci_event_t ** events, uint32_t max,
+			uint32_t * count);
+static int ctp_sock_return_events(cci_event_t ** events, uint32_t count);
+static int ctp_sock_wait_event(cci_endpoint_t * endpoint,
+			cci_event_t ** const event,
+			const struct timespec *deadline);
 static int ctp_sock_send(cci_connection_t * connection,
 						const void *msg_ptr,
 						uint32_t msg_len,
@@ -109,11 +111,26 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		    cci_rma_handle_t * local_handle, uint64_t local_offset,
 		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 		    uint64_t data_len, const void *context, int flags);
+static int ctp_sock_rmav(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle,
+		    cci_rma_handle_t * remote_handle,
+		    const cci_rma_seg_t * segs, uint32_t segcnt,
+		    const void *context, int flags);
+static int ctp_sock_rma_atomic(cci_connection_t * connection,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		    const void *context, int flags);
+static int ctp_sock_addr_resolve(cci_endpoint_t * endpoint, const char *uri,
+		    const cci_addr_t ** addr);
+static int ctp_sock_sendto(cci_endpoint_t * endpoint, const cci_addr_t * addr,
+		    const void *msg_ptr, uint32_t msg_len,
+		    const void *context, int flags);
 
 static uint8_t sock_ip_hash(in_addr_t ip, uint16_t port);
+static void sock_addr_put(cci__ep_t * ep, const cci_addr_t * addr);
 static void sock_progress_sends(cci__ep_t * ep);
-static void *sock_progress_thread(void *arg);
-static void *sock_recv_thread(void *arg);
 static int sock_sendto(cci_os_handle_t sock,
 					void *buf,
 					int len,
@@ -125,6 +142,8 @@ static inline int pack_piggyback_ack (cci__ep_t *ep,
 					sock_conn_t *sconn, sock_tx_t *tx);
 static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn);
 static int sock_recvfrom_ep(cci__ep_t * ep);
+static void sock_keepalive(cci__ep_t *ep);
+static void sock_drain_acks(cci__ep_t *ep);
 
 /*
 * Public plugin structure.
@@ -172,7 +191,15 @@ cci_plugin_ctp_t cci_ctp_sock_plugin = {
 	ctp_sock_sendv,
 	ctp_sock_rma_register,
 	ctp_sock_rma_deregister,
-	ctp_sock_rma
+	ctp_sock_rma,
+	ctp_sock_get_events,
+	ctp_sock_return_events,
+	NULL,
+	ctp_sock_wait_event,
+	ctp_sock_rmav,
+	ctp_sock_rma_atomic,
+	ctp_sock_addr_resolve,
+	ctp_sock_sendto
 };
 
 static inline void
@@ -218,6 +245,12 @@ static inline const char *sock_msg_type(sock_msg_type_t type)
 		return "RMA read reply";
 	case SOCK_MSG_RMA_INVALID:
 		return "invalid RMA handle";
+	case SOCK_MSG_RMA_ATOMIC_REQUEST:
+		return "RMA atomic request";
+	case SOCK_MSG_RMA_ATOMIC_REPLY:
+		return "RMA atomic reply";
+	case SOCK_MSG_DGRAM:
+		return "datagram";
 	case SOCK_MSG_INVALID:
 		assert(0);
 		return "invalid";
@@ -228,43 +261,80 @@ static inline const char *sock_msg_type(sock_msg_type_t type)
 	return NULL;
 }
 
-static inline int sock_create_threads (cci__ep_t *ep)
+/* Progress an endpoint: receive what the socket holds, then send
+ * keepalives, acks, resends and queued messages. The progress engine
+ * calls it, or the caller without threads (CCI_ENDPT_APP_PROGRESS).
+ */
+static void sock_progress_ep(cci__ep_t *ep)
 {
-	int ret;
-	sock_ep_t *sep;
+	sock_ep_t *sep = ep->priv;
 
-	assert (ep);
+	if (sep->closing)
+		return;
 
-	sep = ep->priv;
+	while (sock_recvfrom_ep(ep) == 1)
+		;
+	sock_keepalive(ep);
+	sock_progress_sends(ep);
+}
 
-	ret = pthread_create(&sep->recv_tid, NULL, sock_recv_thread, (void*)ep);
-	if (ret)
-		goto out;
+static void sock_progress_src(void *arg)
+{
+	sock_progress_ep((cci__ep_t *) arg);
+}
 
-	ret = pthread_create(&sep->progress_tid, NULL, sock_progress_thread, (void*)ep);
-	if (ret)
-		goto out;
+/* Sleep in select() until the socket is readable or until the deadline. */
+static void sock_wait_readable(sock_ep_t *sep, const struct timespec *deadline)
+{
+	struct timespec now;
+	struct timeval tv;
+	int64_t us;
+	fd_set fds;
 
-out:
-	return ret;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000 +
+		(deadline->tv_nsec - now.tv_nsec) / 1000;
+	if (us <= 0)
+		return;
+	tv.tv_sec = us / 1000000;
+	tv.tv_usec = us % 1000000;
+
+	FD_ZERO(&fds);
+	FD_SET(sep->sock, &fds);
+	select(sep->sock + 1, &fds, NULL, NULL, &tv);
 }
 
-static inline int sock_terminate_threads (sock_ep_t *sep)
+/* Progress here unless a worker of the progress engine runs the
+ * endpoint. This saves a switch to a worker for each message.
+ */
+static inline int sock_try_progress(cci__ep_t *ep)
 {
-	CCI_ENTER;
+	sock_ep_t *sep = ep->priv;
 
-	assert (sep);
+	if (ep->app_progress) {
+		sock_progress_ep(ep);
+	} else if (cci__prog_claim(&sep->prog)) {
+		sock_progress_ep(ep);
+		cci__prog_release(&sep->prog);
+	} else {
+		return 0;
+	}
 
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	return 1;
+}
 
-	pthread_join(sep->progress_tid, NULL);
-	pthread_join(sep->recv_tid, NULL);
+/* Try to progress sends: progress here or kick the progress engine. Not
+ * for the receive path, sock_progress_ep() follows it with the sends.
+ */
+static inline void sock_kick_progress(cci__ep_t *ep)
+{
+	sock_ep_t *sep = ep->priv;
 
-	CCI_EXIT;
+	if (sep->closing)
+		return;
 
-	return CCI_SUCCESS;
+	if (!sock_try_progress(ep))
+		cci__prog_kick(&sep->prog);
 }
 
 static int ctp_sock_init(cci_plugin_ctp_t *plugin,
@@ -598,6 +668,31 @@ static inline void sock_close_socket(cci_os_handle_t sock)
 	return;
 }
 
+/* Hand a completed event to the application. A blocking send is not
+ * queued, its sender is woken up instead. Returns 1 if the event was
+ * queued.
+ */
+static inline int sock_deliver_evt(sock_ep_t *sep, cci__evt_t *evt)
+{
+	if (evt->event.type == CCI_EVENT_SEND) {
+		sock_tx_t *tx = container_of(evt, sock_tx_t, evt);
+
+		if (tx->waiter) {
+			cci__waiter_wake(tx->waiter);
+			return 0;
+		}
+	}
+
+	/* the queue holds every tx and rx, it cannot be full */
+	if (cci__evtq_push(&sep->evtq, evt)) {
+		debug(CCI_DB_ERR, "%s: event queue full, dropping event %p",
+			__func__, (void*)evt);
+		return 0;
+	}
+
+	return 1;
+}
+
 static int ctp_sock_create_endpoint(cci_device_t * device,
 				int flags,
 				cci_endpoint_t ** endpointp,
@@ -642,6 +737,8 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 	ep->tx_buf_cnt = SOCK_EP_TX_CNT;
 	ep->buffer_len = dev->device.max_send_size + SOCK_MAX_HDRS;
 	ep->tx_timeout = SOCK_EP_TX_TIMEOUT_SEC * 1000000;
+	/* handles are refcounted, deferred deregistrations are safe */
+	ep->rma_cache = 1;
 
 	sep = ep->priv;
 	sep->ids = calloc(SOCK_NUM_BLOCKS, sizeof(*sep->ids));
@@ -650,8 +747,6 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 		goto out;
 	}
 	sep->closing = 0;
-	pthread_mutex_init (&sep->progress_mutex, NULL);
-	pthread_cond_init (&sep->wait_condition, NULL);
 
 	sep->sock = socket(PF_INET, SOCK_DGRAM, 0);
 	if (sep->sock == -1) {
@@ -704,6 +799,26 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 	}
 #endif
 
+	/* A write or read reply that finds the receive buffer full is
+	   dropped and only sent again after the resend time, so RMAs keep no
+	   more fragments in flight than the buffer holds. The peer's buffer
+	   is assumed to be as large as ours. */
+	{
+		int size = 0;
+		socklen_t optlen = sizeof (size);
+
+		if (getsockopt (sep->sock, SOL_SOCKET, SO_RCVBUF,
+				&size, &optlen) == -1)
+			size = 0;
+		/* Linux reports twice the size, for its bookkeeping */
+		sep->rma_depth = (uint32_t) size / 2 /
+			dev->device.max_send_size;
+		if (sep->rma_depth < 1)
+			sep->rma_depth = 1;
+		else if (sep->rma_depth > SOCK_RMA_DEPTH)
+			sep->rma_depth = SOCK_RMA_DEPTH;
+	}
+
 	/* bind socket to device */
 	memset(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
@@ -733,7 +848,10 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 	for (i = 0; i < SOCK_EP_HASH_SIZE; i++) {
 		TAILQ_INIT(&sep->conn_hash[i]);
 		TAILQ_INIT(&sep->active_hash[i]);
+		TAILQ_INIT(&sep->addr_hash[i]);
 	}
+	TAILQ_INIT(&sep->addr_lru);
+	pthread_mutex_init(&sep->addr_lock, NULL);
 
 	TAILQ_INIT(&sep->txs);
 	TAILQ_INIT(&sep->idle_txs);
@@ -741,9 +859,25 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 	TAILQ_INIT(&sep->idle_rxs);
 	TAILQ_INIT(&sep->handles);
 	TAILQ_INIT(&sep->rma_ops);
+	cci__rma_reg_init(&sep->reg);
 	TAILQ_INIT(&sep->queued);
 	TAILQ_INIT(&sep->pending);
 
+	/* room for every tx and rx, so delivering an event never fails */
+	ret = cci__evtq_init(&sep->evtq, ep->tx_buf_cnt + ep->rx_buf_cnt);
+	if (ret)
+		goto out;
+
+	/* the buffers are allocated on the endpoint's NUMA node */
+	sep->tx_buf = cci__numa_alloc(&ep->affinity,
+				      (size_t) ep->tx_buf_cnt * ep->buffer_len);
+	sep->rx_buf = cci__numa_alloc(&ep->affinity,
+				      (size_t) ep->rx_buf_cnt * ep->buffer_len);
+	if (!sep->tx_buf || !sep->rx_buf) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+
 	/* alloc txs */
 	for (i = 0; i < ep->tx_buf_cnt; i++) {
 		sock_tx_t *tx;
@@ -755,11 +889,7 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 		}
 		tx->evt.event.type = CCI_EVENT_SEND;
 		tx->evt.ep = ep;
-		tx->buffer = calloc(1, ep->buffer_len);
-		if (!tx->buffer) {
-			ret = CCI_ENOMEM;
-			goto out;
-		}
+		tx->buffer = (char *) sep->tx_buf + (size_t) i * ep->buffer_len;
 		tx->len = 0;
 		TAILQ_INSERT_TAIL(&sep->txs, tx, tentry);
 		TAILQ_INSERT_TAIL(&sep->idle_txs, tx, dentry);
@@ -776,11 +906,7 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 		}
 		rx->evt.event.type = CCI_EVENT_RECV;
 		rx->evt.ep = ep;
-		rx->buffer = calloc(1, ep->buffer_len);
-		if (!rx->buffer) {
-			ret = CCI_ENOMEM;
-			goto out;
-		}
+		rx->buffer = (char *) sep->rx_buf + (size_t) i * ep->buffer_len;
 		rx->len = 0;
 		TAILQ_INSERT_TAIL(&sep->rxs, rx, gentry);
 		TAILQ_INSERT_TAIL(&sep->idle_rxs, rx, entry);
@@ -790,63 +916,34 @@ static int ctp_sock_create_endpoint(cci_device_t * device,
 	if (ret)
 		goto out;
 
+	/* only a thread can signal the OS handle */
+	if (fd && ep->app_progress) {
+		debug(CCI_DB_WARN, "%s: an endpoint without threads cannot "
+			"return an OS handle", __func__);
+		ret = CCI_EINVAL;
+		goto out;
+	}
+
 	sep->event_fd = 0;
-#ifdef HAVE_SYS_EPOLL_H
 	if (fd) {
-		int fflags = 0;
-		int rc;
-		struct epoll_event ev;
-
-		ret = epoll_create (2);
-		if (ret == -1) {
-			ret = errno;
-			goto out;
-		}
-		sep->event_fd = ret;
-
-		fflags = fcntl(sep->event_fd, F_GETFL, 0);
-		if (fflags == -1) {
-			ret = errno;
-			goto out;
-		}
-
-		ret = fcntl(sep->event_fd, F_SETFL, fflags | O_NONBLOCK);
-		if (ret == -1) {
-			ret = errno;
-			goto out;
-		}
-
-		ev.data.ptr = (void*)sock_recvfrom_ep;
-		ev.events = EPOLLIN;
-		ret = epoll_ctl (sep->event_fd, EPOLL_CTL_ADD, sep->sock, &ev);
-		if (ret == -1) {
+		/* The progress engine watches the socket, so we just need a
+		pipe so that it can wake up the application thread */
+		if (pipe (sep->fd) == -1) {
 			ret = errno;
 			goto out;
 		}
-
-		rc = pipe (sep->fd);
-		if (rc == -1) {
-			debug (CCI_DB_WARN, "%s: %s", __func__, strerror (errno));
-			return CCI_ERROR;
-		}
-		*fd = sep->fd[0];
-	}
-#else
-	if (fd) {
-		/* We will have poll on the receive thread so we just need to create a
-		pipe so the receive and send thread can wake up the application
-		thread */
-		pipe (sep->fd);
 		*fd = sep->fd[0];
 		/* We set event_fd to value different than zero to know that we are
 		in blocking mode at the application level */
 		sep->event_fd = 1;
 	}
-#endif /* HAVE_SYS_EPOLL_H */
 
-	ret = sock_create_threads (ep);
-	if (ret)
-		goto out;
+	if (!ep->app_progress) {
+		ret = cci__prog_add(&sep->prog, sep->sock, SOCK_PROG_TIME_US,
+				    sock_progress_src, ep, &ep->affinity);
+		if (ret)
+			goto out;
+	}
 
 	CCI_EXIT;
 	return CCI_SUCCESS;
@@ -861,8 +958,6 @@ out:
 
 			tx = TAILQ_FIRST(&sep->txs);
 			TAILQ_REMOVE(&sep->txs, tx, tentry);
-			if (tx->buffer)
-				free(tx->buffer);
 			free(tx);
 		}
 		while (!TAILQ_EMPTY(&sep->rxs)) {
@@ -870,10 +965,13 @@ out:
 
 			rx = TAILQ_FIRST(&sep->rxs);
 			TAILQ_REMOVE(&sep->rxs, rx, gentry);
-			if (rx->buffer)
-				free(rx->buffer);
 			free(rx);
 		}
+		cci__numa_free(sep->tx_buf,
+			       (size_t) ep->tx_buf_cnt * ep->buffer_len);
+		cci__numa_free(sep->rx_buf,
+			       (size_t) ep->rx_buf_cnt * ep->buffer_len);
+		cci__evtq_fini(&sep->evtq);
 		if (sep->ids)
 			free(sep->ids);
 		if (sep->sock)
@@ -905,7 +1003,7 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 	sep = ep->priv;
 
 	pthread_mutex_lock(&dev->lock);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 
 	if (sep) {
 		int i;
@@ -915,10 +1013,13 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 		sep->closing = 1;
 
 		pthread_mutex_unlock(&dev->lock);
-		pthread_mutex_unlock(&ep->lock);
-		sock_terminate_threads (sep);
+		cci__ep_unlock(ep, &ep->lock);
+		if (!ep->app_progress)
+			cci__prog_del (&sep->prog);
+		/* we may have delayed some ACKs for optimization */
+		sock_drain_acks (ep);
 		pthread_mutex_lock(&dev->lock);
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 
 		if (sep->fd[0] > 0)
 			close (sep->fd[0]);
@@ -945,6 +1046,13 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 				free(conn);
 				free(sconn);
 			}
+			while (!TAILQ_EMPTY(&sep->addr_hash[i])) {
+				sock_addr_t *saddr = TAILQ_FIRST(&sep->addr_hash[i]);
+
+				TAILQ_REMOVE(&sep->addr_hash[i], saddr, entry);
+				free(saddr->uri);
+				free(saddr);
+			}
 		}
 		while (!TAILQ_EMPTY(&sep->txs)) {
 			sock_tx_t *tx;
@@ -955,8 +1063,6 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 				TAILQ_REMOVE(&sep->queued, &tx->evt, entry);
 			else if (tx->state == SOCK_TX_PENDING)
 				TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
-			if (tx->buffer)
-				free(tx->buffer);
 			free(tx);
 		}
 		while (!TAILQ_EMPTY(&sep->rxs)) {
@@ -964,10 +1070,12 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 
 			rx = TAILQ_FIRST(&sep->rxs);
 			TAILQ_REMOVE(&sep->rxs, rx, gentry);
-			if (rx->buffer)
-				free(rx->buffer);
 			free(rx);
 		}
+		cci__numa_free(sep->tx_buf,
+			       (size_t) ep->tx_buf_cnt * ep->buffer_len);
+		cci__numa_free(sep->rx_buf,
+			       (size_t) ep->rx_buf_cnt * ep->buffer_len);
 		while (!TAILQ_EMPTY(&sep->rma_ops)) {
 			sock_rma_op_t *rma_op = TAILQ_FIRST(&sep->rma_ops);
 			TAILQ_REMOVE(&sep->rma_ops, rma_op, entry);
@@ -978,6 +1086,9 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 			TAILQ_REMOVE(&sep->handles, handle, entry);
 			free(handle);
 		}
+		cci__rma_reg_fini(&sep->reg);
+		cci__evtq_fini(&sep->evtq);
+		pthread_mutex_destroy(&sep->addr_lock);
 		if (sep->ids)
 			free(sep->ids);
 		free(sep);
@@ -986,7 +1097,7 @@ static int ctp_sock_destroy_endpoint(cci_endpoint_t * endpoint)
 	ep->priv = NULL;
 	if (ep->uri)
 		free((char *)ep->uri);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 	pthread_mutex_unlock(&dev->lock);
 
 	CCI_EXIT;
@@ -1097,12 +1208,12 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	}
 
 	/* get a tx */
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	if (!TAILQ_EMPTY(&sep->idle_txs)) {
 		tx = TAILQ_FIRST(&sep->idle_txs);
 		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx) {
 		free(conn->priv);
@@ -1147,6 +1258,8 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	sock_get_id(sep, &sconn->id);
 	sconn->seq = sock_get_new_seq();	/* even for UU since this reply is reliable */
 	sconn->seq_pending = sconn->seq - 1; 
+	sconn->acked = peer_seq;
+	sconn->rx_next = peer_seq + 1;
 	if (cci_conn_is_reliable(conn)) {
 		sconn->max_tx_cnt = max_recv_buffer_count < ep->tx_buf_cnt ?
 			max_recv_buffer_count : ep->tx_buf_cnt;
@@ -1159,9 +1272,9 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	/* insert in sock ep's list of conns */
 
 	i = sock_ip_hash(sconn->sin.sin_addr.s_addr, sconn->sin.sin_port);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->conn_hash[i], sconn, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	debug(CCI_DB_CONN, "accepting conn with hash %d", i);
 
@@ -1201,14 +1314,12 @@ static int ctp_sock_accept(cci_event_t *event, const void *context)
 	/* insert at tail of device's queued list */
 
 	tx->state = SOCK_TX_QUEUED;
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(ep);
 	
 	CCI_EXIT;
 
@@ -1254,12 +1365,12 @@ static int ctp_sock_reject(cci_event_t *event)
 	rx = container_of(evt, sock_rx_t, evt);
 
 	/* get a tx */
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	if (!TAILQ_EMPTY(&sep->idle_txs)) {
 		tx = TAILQ_FIRST(&sep->idle_txs);
 		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx) {
 		ret = CCI_ENOBUFS;
@@ -1294,14 +1405,12 @@ static int ctp_sock_reject(cci_event_t *event)
 	/* insert at tail of endpoint's queued list */
 
 	tx->state = SOCK_TX_QUEUED;
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_kick_progress(ep);
 	
 	memset(name, 0, sizeof(name));
 	sock_sin_to_name(rx->sin, name, sizeof(name));
@@ -1313,54 +1422,6 @@ out:
 	return ret;
 }
 
-static int sock_getaddrinfo(const char *uri, in_addr_t * in, uint16_t * port)
-{
-	int ret;
-	char *hostname, *svc, *colon;
-	struct addrinfo *ai = NULL, hints;
-
-	if (0 == strncmp("sock://", uri, 7))
-		hostname = strdup(&uri[7]);
-	else {
-		CCI_EXIT;
-		return CCI_EINVAL;
-	}
-
-	colon = strchr(hostname, ':');
-	if (colon) {
-		*colon = '\0';
-	} else {
-		free(hostname);
-		CCI_EXIT;
-		return CCI_EINVAL;
-	}
-
-	colon++;
-	svc = colon;
-
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_DGRAM;
-	hints.ai_protocol = IPPROTO_UDP;
-
-	ret = getaddrinfo(hostname, svc, &hints, &ai);
-	free(hostname);
-
-	if (ret) {
-		if (ai)
-			freeaddrinfo(ai);
-		CCI_EXIT;
-		return ret;
-	}
-
-	*in = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
-	*port = ((struct sockaddr_in *)ai->ai_addr)->sin_port;
-	freeaddrinfo(ai);
-
-	CCI_EXIT;
-	return CCI_SUCCESS;
-}
-
 static sock_conn_t *sock_find_open_conn(sock_ep_t * sep, in_addr_t ip,
 					uint16_t port, uint32_t id)
 {
@@ -1415,13 +1476,73 @@ static sock_conn_t *sock_find_conn(sock_ep_t * sep, in_addr_t ip, uint16_t port,
 	}
 }
 
+/* Address the conn of a CONN_REQUEST tx and queue the tx. */
+static void
+sock_connect_start(cci__ep_t *ep, sock_tx_t *tx, in_addr_t ip, uint16_t port)
+{
+	sock_ep_t *sep = ep->priv;
+	sock_conn_t *sconn = tx->evt.conn->priv;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&sconn->sin;
+	struct s_active *active_list;
+
+	sin->sin_addr.s_addr = ip;	/* already in network order */
+	sin->sin_port = port;	/* already in network order */
+
+	active_list = &sep->active_hash[sock_ip_hash(ip, 0)];
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_INSERT_TAIL(active_list, sconn, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
+	/* insert at tail of device's queued list */
+
+	tx->state = SOCK_TX_QUEUED;
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
+	/* try to progress txs */
+	sock_kick_progress(ep);
+
+	return;
+}
+
+/* Resolver callback for connects to names that needed a lookup. Failures
+ * are reported with the CONNECT event, like a timed out request. */
+static void
+sock_connect_resolved(cci__ep_t *ep, void *arg, int status,
+			uint32_t ip, uint16_t port)
+{
+	sock_tx_t *tx = arg;
+	cci__conn_t *conn = tx->evt.conn;
+
+	if (!status) {
+		sock_connect_start(ep, tx, ip, port);
+		return;
+	}
+
+	debug(CCI_DB_CONN, "%s: connect to %s failed with %s", __func__,
+		conn->uri ? conn->uri : "", cci_strerror(&ep->endpoint, status));
+
+	tx->evt.event.connect.status = status;
+	tx->evt.event.connect.connection = NULL;
+	tx->evt.conn = NULL;
+	tx->state = SOCK_TX_COMPLETED;
+	if (conn->uri)
+		free((char *)conn->uri);
+	free(conn->priv);
+	free(conn);
+
+	sock_deliver_evt(ep->priv, &tx->evt);
+
+	return;
+}
+
 static int ctp_sock_connect(cci_endpoint_t * endpoint, const char *server_uri,
 			const void *data_ptr, uint32_t data_len,
 			cci_conn_attribute_t attribute,
 			const void *context, int flags, const struct timeval *timeout)
 {
 	int ret;
-	int i;
 	cci__ep_t *ep = NULL;
 	cci__dev_t *dev = NULL;
 	cci__conn_t *conn = NULL;
@@ -1435,7 +1556,6 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	void *ptr = NULL;
 	in_addr_t ip;
 	uint32_t ts = 0;
-	struct s_active *active_list;
 	sock_handshake_t *hs = NULL;
 	uint16_t port;
 	uint32_t keepalive = 0ULL;
@@ -1479,16 +1599,11 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint, const char *server_uri,
 
 	sconn->status = SOCK_CONN_ACTIVE;
 	sconn->cwnd = SOCK_INITIAL_CWND;
+	/* the address is set once the name is resolved */
 	sin = (struct sockaddr_in *)&sconn->sin;
 	memset(sin, 0, sizeof(*sin));
 	sin->sin_family = AF_INET;
 
-	ret = sock_getaddrinfo(server_uri, &ip, &port);
-	if (ret)
-		goto out;
-	sin->sin_addr.s_addr = ip;	/* already in network order */
-	sin->sin_port = port;	/* already in network order */
-
 	/* peer will assign id */
 
 	/* get our endpoint and device */
@@ -1507,24 +1622,17 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint, const char *server_uri,
 		keepalive = ep->keepalive_timeout;
 	}
 
-	i = sock_ip_hash(ip, 0);
-	active_list = &sep->active_hash[i];
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(active_list, sconn, entry);
-	pthread_mutex_unlock(&ep->lock);
-
 	/* get a tx */
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	if (!TAILQ_EMPTY(&sep->idle_txs)) {
 		tx = TAILQ_FIRST(&sep->idle_txs);
 		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx) {
-		/* FIXME leak */
-		CCI_EXIT;
-		return CCI_ENOBUFS;
+		ret = CCI_ENOBUFS;
+		goto out;
 	}
 
 	tx->rma_ptr = NULL;
@@ -1586,17 +1694,20 @@ static int ctp_sock_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	tx->len += data_len;
 	assert(tx->len <= ep->buffer_len);
 
-	/* insert at tail of device's queued list */
-
-	tx->state = SOCK_TX_QUEUED;
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	/* names that need a lookup finish in sock_connect_resolved() */
+	ret = cci__resolve(ep, server_uri, "sock://", SOCK_DGRAM, &ip, &port,
+			sock_connect_resolved, tx);
+	if (ret == CCI_EAGAIN) {
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	} else if (ret) {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+		cci__ep_unlock(ep, &ep->lock);
+		goto out;
+	}
 
-	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	sock_connect_start(ep, tx, ip, port);
 
 	CCI_EXIT;
 	return CCI_SUCCESS;
@@ -1645,9 +1756,9 @@ static int ctp_sock_disconnect(cci_connection_t * connection)
 		free((char *)conn->uri);
 
 	i = sock_ip_hash(sconn->sin.sin_addr.s_addr, sconn->sin.sin_port);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_REMOVE(&sep->conn_hash[i], sconn, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	free(sconn);
 	free(conn);
@@ -1656,6 +1767,31 @@ static int ctp_sock_disconnect(cci_connection_t * connection)
 	return CCI_SUCCESS;
 }
 
+/* Apply CCI_OPT_ENDPT_NUMA_NODE by moving the buffers to the node, or
+ * CCI_OPT_ENDPT_CPUS by re-pinning the progress engine's workers.
+ */
+static int sock_set_affinity(cci__ep_t *ep, cci_opt_name_t name,
+			     const void *val)
+{
+	int ret;
+	sock_ep_t *sep = ep->priv;
+
+	cci__ep_lock(ep, &ep->lock);
+	ret = cci__affinity_set_opt(&ep->affinity, name, val);
+	if (!ret && name == CCI_OPT_ENDPT_NUMA_NODE) {
+		cci__numa_move(&ep->affinity, sep->tx_buf,
+			       (size_t) ep->tx_buf_cnt * ep->buffer_len);
+		cci__numa_move(&ep->affinity, sep->rx_buf,
+			       (size_t) ep->rx_buf_cnt * ep->buffer_len);
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (!ret && name == CCI_OPT_ENDPT_CPUS && !ep->app_progress)
+		cci__prog_bind();
+
+	return ret;
+}
+
 static int ctp_sock_set_opt(cci_opt_handle_t * handle,
 			cci_opt_name_t name, const void *val)
 {
@@ -1688,6 +1824,11 @@ static int ctp_sock_set_opt(cci_opt_handle_t * handle,
 	case CCI_OPT_CONN_SEND_TIMEOUT:
 		conn->tx_timeout = *((uint32_t*) val);
 		break;
+	case CCI_OPT_ENDPT_NUMA_NODE:
+	case CCI_OPT_ENDPT_CPUS:
+		ep = container_of(handle, cci__ep_t, endpoint);
+		ret = sock_set_affinity(ep, name, val);
+		break;
 	default:
 		debug(CCI_DB_INFO, "unknown option %u", name);
 		ret = CCI_EINVAL;
@@ -1768,7 +1909,7 @@ ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 	int ret = CCI_SUCCESS;
 	cci__ep_t *ep;
 	sock_ep_t *sep;
-	cci__evt_t *ev = NULL, *e;
+	cci__evt_t *ev = NULL;
 
 	CCI_ENTER;
 
@@ -1780,46 +1921,21 @@ ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
 
-	/* try to progress sends... */
-	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
-	}
-
-	pthread_mutex_lock(&ep->lock);
-
-	/* give the user the first event */
-	TAILQ_FOREACH(e, &ep->evts, entry) {
-		if (e->event.type == CCI_EVENT_SEND) {
-			/* NOTE: if it is blocking, skip it since sock_sendv()
-			* is waiting on it
-			*/
-			sock_tx_t *tx = container_of(e, sock_tx_t, evt);
-			if (tx->flags & CCI_FLAG_BLOCKING) {
-				continue;
-			} else {
-				ev = e;
-				break;
-			}
-		} else {
-			ev = e;
-			break;
-		}
-	}
+	sock_try_progress(ep);
 
-	if (ev) {
-		TAILQ_REMOVE(&ep->evts, ev, entry);
-	} else {
+	/* give the user the first event, blocking sends are never queued */
+	ev = cci__evtq_pop(&sep->evtq);
+	if (!ev) {
+		/* the caller polls again right away, let the thread that
+		 * will produce the event (a worker or the peer) run first */
+		sched_yield();
 		ret = CCI_EAGAIN;
 	}
 
-	pthread_mutex_unlock(&ep->lock);
-
 	*event = &ev->event;
 
 	/* We read on the fd to block again */
-	if (sep->event_fd) {
+	if (ev && sep->event_fd) {
 		char a[1];
 		int rc;
 
@@ -1833,13 +1949,19 @@ ctp_sock_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 	return ret;
 }
 
-static int ctp_sock_return_event(cci_event_t * event)
+/* Sleep until an event is queued or until the deadline. The progress
+ * engine receives and runs the timers while we sleep. Without threads,
+ * progress here every SOCK_PROG_TIME_US and sleep in select() on the
+ * socket between passes.
+ */
+static int
+ctp_sock_wait_event(cci_endpoint_t * endpoint, cci_event_t ** const event,
+		const struct timespec *deadline)
 {
+	int ret = CCI_SUCCESS;
 	cci__ep_t *ep;
 	sock_ep_t *sep;
-	cci__evt_t *evt;
-	sock_tx_t *tx;
-	sock_rx_t *rx;
+	cci__evt_t *ev = NULL;
 
 	CCI_ENTER;
 
@@ -1848,49 +1970,224 @@ static int ctp_sock_return_event(cci_event_t * event)
 		return CCI_ENODEV;
 	}
 
-	evt = container_of(event, cci__evt_t, event);
-
-	ep = evt->ep;
+	ep = container_of(endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
 
-	/* enqueue the event */
-
-	switch (event->type) {
-	case CCI_EVENT_SEND:
-		tx = container_of(evt, sock_tx_t, evt);
-		pthread_mutex_lock(&ep->lock);
-		/* insert at head to keep it in cache */
-		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
-		pthread_mutex_unlock(&ep->lock);
-		break;
-	case CCI_EVENT_RECV:
-		rx = container_of(evt, sock_rx_t, evt);
-		pthread_mutex_lock(&ep->lock);
-		/* insert at head to keep it in cache */
-		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
-		break;
-	default:
-		/* TODO */
-		break;
+	if (!ep->app_progress) {
+		ev = cci__evtq_wait(&sep->evtq, deadline);
 	}
 
-	CCI_EXIT;
+	while (ep->app_progress && !ev) {
+		struct timespec slice;
 
-	return CCI_SUCCESS;
-}
+		sock_progress_ep(ep);
 
-/** Try to put a message on the wire.
- * @return -1	An error occured, the type of error is available via errno.
- * @return 	Any return code different than -1 gives the number of bytes
- *		that were sent.
- */
-static int sock_sendmsg(cci_os_handle_t sock, struct iovec iov[2],
-			int count, const struct sockaddr_in sin)
-{
-	int ret, i;
-	struct msghdr msg;
-	ssize_t sent = 0;
+		clock_gettime(CLOCK_MONOTONIC, &slice);
+		if (deadline && (slice.tv_sec > deadline->tv_sec ||
+				 (slice.tv_sec == deadline->tv_sec &&
+				  slice.tv_nsec >= deadline->tv_nsec)))
+			break;
+
+		slice.tv_nsec += SOCK_PROG_TIME_US * 1000;
+		if (slice.tv_nsec >= 1000000000L) {
+			slice.tv_sec++;
+			slice.tv_nsec -= 1000000000L;
+		}
+		if (deadline && (slice.tv_sec > deadline->tv_sec ||
+				 (slice.tv_sec == deadline->tv_sec &&
+				  slice.tv_nsec > deadline->tv_nsec)))
+			slice = *deadline;
+
+		ev = cci__evtq_pop(&sep->evtq);
+		if (!ev)
+			sock_wait_readable(sep, &slice);
+	}
+	if (!ev) {
+		CCI_EXIT;
+		return CCI_ETIMEDOUT;
+	}
+	*event = &ev->event;
+
+	/* We read on the fd to block again */
+	if (sep->event_fd) {
+		char a[1];
+		int rc;
+
+		/* Draining event */
+		rc = read (sep->fd[0], a, sizeof (a));
+		if (rc != sizeof (a))
+			ret = CCI_ERROR;
+	}
+
+	CCI_EXIT;
+	return ret;
+}
+
+/* Get up to max events with one wake up of the progress thread. */
+static int
+ctp_sock_get_events(cci_endpoint_t * endpoint, cci_event_t ** events,
+		uint32_t max, uint32_t * count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t n = 0;
+	cci__ep_t *ep;
+	sock_ep_t *sep;
+	cci__evt_t *e;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+
+	sock_try_progress(ep);
+
+	while (n < max && (e = cci__evtq_pop(&sep->evtq)))
+		events[n++] = &e->event;
+
+	if (!n) {
+		/* see ctp_sock_get_event() */
+		sched_yield();
+		ret = CCI_EAGAIN;
+	}
+	*count = n;
+
+	/* We read on the fd to block again, one byte per event */
+	if (sep->event_fd && n) {
+		char a[64];
+		uint32_t left = n;
+
+		while (left) {
+			int rc = read (sep->fd[0], a,
+				left < sizeof (a) ? left : sizeof (a));
+			if (rc <= 0) {
+				ret = CCI_ERROR;
+				break;
+			}
+			left -= rc;
+		}
+	}
+
+	CCI_EXIT;
+	return ret;
+}
+
+/* Return events of one endpoint under a single ep->lock. */
+static int ctp_sock_return_events(cci_event_t ** events, uint32_t count)
+{
+	uint32_t i;
+	cci__ep_t *ep;
+	sock_ep_t *sep;
+	cci__evt_t *evt;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(events[0], cci__evt_t, event)->ep;
+	sep = ep->priv;
+
+	/* the senders of datagrams are no longer referenced */
+	for (i = 0; i < count; i++)
+		if (events[i]->type == CCI_EVENT_RECV_FROM)
+			sock_addr_put(ep, events[i]->recv_from.addr);
+
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < count; i++) {
+		evt = container_of(events[i], cci__evt_t, event);
+		assert(evt->ep == ep);
+
+		/* insert at head to keep them in cache */
+		switch (evt->event.type) {
+		case CCI_EVENT_SEND:
+			TAILQ_INSERT_HEAD(&sep->idle_txs,
+				container_of(evt, sock_tx_t, evt), dentry);
+			break;
+		case CCI_EVENT_RECV:
+		case CCI_EVENT_RECV_FROM:
+			TAILQ_INSERT_HEAD(&sep->idle_rxs,
+				container_of(evt, sock_rx_t, evt), entry);
+			break;
+		default:
+			/* TODO */
+			break;
+		}
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	CCI_EXIT;
+
+	return CCI_SUCCESS;
+}
+
+static int ctp_sock_return_event(cci_event_t * event)
+{
+	cci__ep_t *ep;
+	sock_ep_t *sep;
+	cci__evt_t *evt;
+	sock_tx_t *tx;
+	sock_rx_t *rx;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	evt = container_of(event, cci__evt_t, event);
+
+	ep = evt->ep;
+	sep = ep->priv;
+
+	/* enqueue the event */
+
+	switch (event->type) {
+	case CCI_EVENT_SEND:
+		tx = container_of(evt, sock_tx_t, evt);
+		cci__ep_lock(ep, &ep->lock);
+		/* insert at head to keep it in cache */
+		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+		cci__ep_unlock(ep, &ep->lock);
+		break;
+	case CCI_EVENT_RECV_FROM:
+		sock_addr_put(ep, event->recv_from.addr);
+		/* fall through */
+	case CCI_EVENT_RECV:
+		rx = container_of(evt, sock_rx_t, evt);
+		cci__ep_lock(ep, &ep->lock);
+		/* insert at head to keep it in cache */
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+		break;
+	default:
+		/* TODO */
+		break;
+	}
+
+	CCI_EXIT;
+
+	return CCI_SUCCESS;
+}
+
+/** Try to put a message on the wire.
+ * @return -1	An error occured, the type of error is available via errno.
+ * @return 	Any return code different than -1 gives the number of bytes
+ *		that were sent.
+ */
+static int sock_sendmsg(cci_os_handle_t sock, struct iovec iov[2],
+			int count, const struct sockaddr_in sin)
+{
+	int ret, i;
+	struct msghdr msg;
+	ssize_t sent = 0;
 
 	for (i = 0; i < count; i++)
 		sent += iov[i].iov_len;
@@ -2012,10 +2309,20 @@ static void sock_progress_pending(cci__ep_t * ep)
 				}
 				break;
 			case SOCK_MSG_RMA_WRITE:
-				pthread_mutex_lock(&ep->lock);
+				cci__ep_lock(ep, &ep->lock);
 				tx->rma_op->pending--;
 				tx->rma_op->status = CCI_ETIMEDOUT;
-				pthread_mutex_unlock(&ep->lock);
+				cci__ep_unlock(ep, &ep->lock);
+				break;
+			case SOCK_MSG_RMA_READ_REQUEST:
+				/* a late reply must not find it */
+				TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+				tx->rma_op->status = CCI_ETIMEDOUT;
+				break;
+			case SOCK_MSG_RMA_ATOMIC_REQUEST:
+				/* a late reply must not find it */
+				TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+				event->send.status = CCI_ETIMEDOUT;
 				break;
 			case SOCK_MSG_CONN_REQUEST:
 				{
@@ -2030,9 +2337,9 @@ static void sock_progress_pending(cci__ep_t * ep)
 					i = sock_ip_hash(sconn->sin.sin_addr.
 							s_addr, 0);
 					active_list = &sep->active_hash[i];
-					pthread_mutex_lock(&ep->lock);
+					cci__ep_lock(ep, &ep->lock);
 					TAILQ_REMOVE(active_list, sconn, entry);
-					pthread_mutex_unlock(&ep->lock);
+					cci__ep_unlock(ep, &ep->lock);
 					free(sconn);
 					free(conn);
 					sconn = NULL;
@@ -2051,7 +2358,9 @@ static void sock_progress_pending(cci__ep_t * ep)
 			/* if SILENT, put idle tx */
 			if (tx->flags & CCI_FLAG_SILENT &&
 				(tx->msg_type == SOCK_MSG_SEND ||
-				tx->msg_type == SOCK_MSG_RMA_WRITE)) {
+				tx->msg_type == SOCK_MSG_RMA_WRITE ||
+				tx->msg_type == SOCK_MSG_RMA_READ_REQUEST ||
+				tx->msg_type == SOCK_MSG_RMA_ATOMIC_REQUEST)) {
 
 				tx->state = SOCK_TX_IDLE;
 				/* store locally until we can drop the dev->lock */
@@ -2123,9 +2432,9 @@ static void sock_progress_pending(cci__ep_t * ep)
 		TAILQ_REMOVE(&idle_txs, tx, dentry);
 		ep = tx->evt.ep;
 		sep = ep->priv;
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	/* transfer evts to the ep's list */
@@ -2133,10 +2442,7 @@ static void sock_progress_pending(cci__ep_t * ep)
 		evt = TAILQ_FIRST(&evts);
 		TAILQ_REMOVE(&evts, evt, entry);
 		ep = evt->ep;
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-		pthread_mutex_unlock(&ep->lock);
-		if (sep->event_fd) {
+		if (sock_deliver_evt(ep->priv, evt) && sep->event_fd) {
 			int rc;
 			rc = write (sep->fd[1], "a", 1);
 			if (rc != 1) {
@@ -2169,6 +2475,8 @@ pack_piggyback_ack (cci__ep_t *ep, sock_conn_t *sconn, sock_tx_t *tx)
 		} else if (ack != NULL && ack->start == ack->end) {
 			sock_header_r_t *hdr_r = tx->buffer;
 			hdr_r->pb_ack = ack->start;
+			if (ack->start == sconn->acked + 1)
+				sconn->acked = ack->start;
 			TAILQ_REMOVE(&sconn->acks, ack, entry);
 			ack = TAILQ_FIRST(&sconn->acks);
 			/* We could get now from the caller if we wanted to */
@@ -2210,7 +2518,7 @@ static void sock_progress_queued(cci__ep_t * ep)
 
 	now = sock_get_usecs();
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_FOREACH_SAFE(evt, &sep->queued, entry, tmp) {
 		tx = container_of (evt, sock_tx_t, evt);
 		event = &evt->event;
@@ -2253,6 +2561,9 @@ static void sock_progress_queued(cci__ep_t * ep)
 					tx->rma_op->pending--;
 					tx->rma_op->status = CCI_ETIMEDOUT;
 					break;
+				case SOCK_MSG_RMA_ATOMIC_REQUEST:
+					event->send.status = CCI_ETIMEDOUT;
+					break;
 				case SOCK_MSG_CONN_REPLY:
 				case SOCK_MSG_CONN_ACK:
 				default:
@@ -2269,7 +2580,8 @@ static void sock_progress_queued(cci__ep_t * ep)
 				/* if SILENT, put idle tx */
 				if (tx->flags & CCI_FLAG_SILENT &&
 				    (tx->msg_type == SOCK_MSG_SEND ||
-				     tx->msg_type == SOCK_MSG_RMA_WRITE))
+				     tx->msg_type == SOCK_MSG_RMA_WRITE ||
+				     tx->msg_type == SOCK_MSG_RMA_ATOMIC_REQUEST))
 				{
 					tx->state = SOCK_TX_IDLE;
 					/* store locally until we can drop the
@@ -2318,7 +2630,7 @@ static void sock_progress_queued(cci__ep_t * ep)
 		/* For RMA Writes, we only allow a given number of messages to be
 		in fly */
 		if (tx->msg_type == SOCK_MSG_RMA_WRITE) {
-			if (tx->rma_op->pending >= SOCK_RMA_DEPTH)
+			if (tx->rma_op->pending >= sep->rma_depth)
 				continue;
 		}
 
@@ -2375,7 +2687,7 @@ static void sock_progress_queued(cci__ep_t * ep)
 			}
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	/* transfer txs to sock ep's list */
 	while (!TAILQ_EMPTY(&idle_txs)) {
@@ -2383,9 +2695,9 @@ static void sock_progress_queued(cci__ep_t * ep)
 		TAILQ_REMOVE(&idle_txs, tx, dentry);
 		ep = tx->evt.ep;
 		sep = ep->priv;
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	/* transfer evts to the ep's list */
@@ -2393,10 +2705,7 @@ static void sock_progress_queued(cci__ep_t * ep)
 		evt = TAILQ_FIRST(&evts);
 		TAILQ_REMOVE(&evts, evt, entry);
 		ep = evt->ep;
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-		pthread_mutex_unlock(&ep->lock);
-		if (sep->event_fd) {
+		if (sock_deliver_evt(ep->priv, evt) && sep->event_fd) {
 			int rc;
 			rc = write (sep->fd[1], "a", 1);
 			if (rc != 1) {
@@ -2459,6 +2768,7 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	void *ptr;
 	cci__evt_t *evt;
 	union cci_event *event;	/* generic CCI event */
+	cci__waiter_t waiter;
 
 	debug(CCI_DB_FUNC, "entering %s", func);
 
@@ -2478,12 +2788,12 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	is_reliable = cci_conn_is_reliable(conn);
 
 	/* get a tx */
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	if (!TAILQ_EMPTY(&sep->idle_txs)) {
 		tx = TAILQ_FIRST(&sep->idle_txs);
 		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx) {
 		debug(CCI_DB_FUNC, "exiting %s", func);
@@ -2496,13 +2806,15 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	/* tx bookkeeping */
 	tx->msg_type = SOCK_MSG_SEND;
 	tx->flags = flags;
+	tx->waiter = NULL;
+	/* the tx may have carried an RMA fragment, it must not count for
+	 * that RMA once acked */
+	tx->rma_op = NULL;
 
 	/* zero even if unreliable */
 	if (!is_reliable) {
 		tx->last_attempt_us = 0ULL;
 		tx->timeout_us = 0ULL;
-		/* If the connection is not reliable, it cannot be a RMA operation */
-		tx->rma_op = NULL;
 	} else {
 		tx->last_attempt_us = 0ULL;
 		tx->timeout_us =
@@ -2530,9 +2842,9 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 		sock_header_r_t *hdr_r = tx->buffer;
 		uint32_t ts = 0;
 
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		tx->seq = ++(sconn->seq);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		sock_pack_seq_ts(&hdr_r->seq_ts, tx->seq, ts);
 		tx->len = sizeof(*hdr_r);
@@ -2557,11 +2869,16 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 		if (ret == tx->len) {
 			/* queue event on enpoint's completed queue */
 			tx->state = SOCK_TX_COMPLETED;
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-			pthread_mutex_unlock(&ep->lock);
 			debug(CCI_DB_MSG, "sent UU msg with %d bytes",
 				tx->len - (int)sizeof(sock_header_t));
+			if (flags & CCI_FLAG_BLOCKING) {
+				cci__ep_lock(ep, &ep->lock);
+				TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+				cci__ep_unlock(ep, &ep->lock);
+				debug(CCI_DB_FUNC, "exiting %s", func);
+				return CCI_SUCCESS;
+			}
+			sock_deliver_evt(sep, evt);
 			/* waking up the app thread if it is blocking on a OS handle */
 			if (sep->event_fd) {
 				int rc;
@@ -2570,11 +2887,7 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 					return CCI_ERROR;
 			}
 
-			if (!sep->closing) {
-				pthread_mutex_lock(&sep->progress_mutex);
-				pthread_cond_signal(&sep->wait_condition);
-				pthread_mutex_unlock(&sep->progress_mutex);
-			}
+			sock_kick_progress(ep);
 
 			debug(CCI_DB_FUNC, "exiting %s", func);
 
@@ -2587,20 +2900,21 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 			debug (CCI_DB_WARN, "Send failed (%s)", strerror (errno));
 	}
 
+	/* a blocked sender is woken up by the completion, not an event */
+	if (is_reliable && (flags & CCI_FLAG_BLOCKING)) {
+		cci__waiter_init(&waiter);
+		tx->waiter = &waiter;
+	}
+
 	/* insert at tail of sock device's queued list */
 
 	tx->state = SOCK_TX_QUEUED;
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->queued, evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	/* try to progress txs */
-
-	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
-	}
+	sock_kick_progress(ep);
 
 	/* if unreliable, we are done since it is buffered internally */
 	if (!is_reliable) {
@@ -2614,28 +2928,22 @@ static int ctp_sock_sendv(cci_connection_t * connection,
 	/* if blocking, wait for completion */
 
 	if (tx->flags & CCI_FLAG_BLOCKING) {
-		struct timeval tv = { 0, SOCK_PROG_TIME_US / 2 };
-
-		while (tx->state != SOCK_TX_COMPLETED)
-			select(0, NULL, NULL, NULL, &tv);
+		/* the progress thread wakes us up, or we progress ourselves */
+		if (ep->app_progress) {
+			while (!cci__waiter_done(&waiter))
+				sock_progress_ep(ep);
+		} else {
+			cci__waiter_wait(&waiter);
+		}
 
 		/* get status and cleanup */
 		ret = event->send.status;
+		cci__waiter_fini(&waiter);
+		tx->waiter = NULL;
 
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_REMOVE(&ep->evts, evt, entry);
-		pthread_mutex_unlock(&ep->lock);
-		/* waking up the app thread if it is blocking on a OS handle */
-		if (sep->event_fd) {
-			int rc;
-			rc = write (sep->fd[1], "a", 1);
-			if (rc != 1)
-				ret = CCI_ERROR;
-		}
-
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	debug(CCI_DB_FUNC, "exiting %s", func);
@@ -2649,6 +2957,7 @@ static int ctp_sock_rma_register(cci_endpoint_t * endpoint,
 	cci__ep_t *ep = NULL;
 	sock_ep_t *sep = NULL;
 	sock_rma_handle_t *handle = NULL;
+	int ret;
 
 	CCI_ENTER;
 
@@ -2672,12 +2981,19 @@ static int ctp_sock_rma_register(cci_endpoint_t * endpoint,
 	handle->ep = ep;
 	handle->length = length;
 	handle->start = start;
-	*((uint64_t *)&handle->rma_handle.stuff[0]) = (uintptr_t)handle;
 	handle->refcnt = 1;
 
-	pthread_mutex_lock(&ep->lock);
+	ret = cci__rma_reg_insert(&sep->reg, handle,
+			(uint64_t *) &handle->rma_handle.stuff[0]);
+	if (ret) {
+		free(handle);
+		CCI_EXIT;
+		return ret;
+	}
+
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->handles, handle, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	*rma_handle = &handle->rma_handle;
 
@@ -2694,7 +3010,6 @@ ctp_sock_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t * rma_handle
 	cci__ep_t *ep = NULL;
 	sock_ep_t *sep = NULL;
 	sock_rma_handle_t *h = NULL;
-	sock_rma_handle_t *tmp = NULL;
 
 	CCI_ENTER;
 
@@ -2708,16 +3023,16 @@ ctp_sock_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t * rma_handle
 	ep = handle->ep;
 	sep = ep->priv;
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH_SAFE(h, &sep->handles, entry, tmp) {
-		if (h == handle) {
-			handle->refcnt--;
-			if (handle->refcnt == 1)
-				TAILQ_REMOVE(&sep->handles, handle, entry);
-			break;
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&sep->reg, rma_handle->stuff[0]);
+	if (h == handle) {
+		handle->refcnt--;
+		if (handle->refcnt == 1) {
+			TAILQ_REMOVE(&sep->handles, handle, entry);
+			cci__rma_reg_remove(&sep->reg, rma_handle->stuff[0]);
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (h == handle) {
 		if (handle->refcnt == 1) {
@@ -2731,11 +3046,133 @@ ctp_sock_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t * rma_handle
 	return ret;
 }
 
-static int ctp_sock_rma(cci_connection_t * connection,
+/* Split the segments of a cci_rmav() op in messages of at most max bytes.
+ * A write copies consecutive small segments together, other segments
+ * are sliced. Returns the number of messages and adds the size of the
+ * packed messages to *stage_len. Fills frags, pointing them into stage,
+ * if not NULL.
+ */
+static uint32_t
+sock_rmav_plan(const cci_rma_seg_t *segs, uint32_t segcnt, uint32_t max,
+		int write, sock_rma_frag_t *frags, char *stage, size_t *stage_len)
+{
+	uint32_t i = 0, n = 0;
+
+	while (i < segcnt) {
+		uint32_t cnt = 0, len = 0;
+		uint64_t off = 0;
+
+		while (write && i + cnt < segcnt && cnt < SOCK_RMAV_MAX_SEGS &&
+			segs[i + cnt].length <= SOCK_RMAV_PACK_LEN &&
+			len + sizeof(sock_rma_seg_t) + segs[i + cnt].length <= max) {
+			len += sizeof(sock_rma_seg_t) + segs[i + cnt].length;
+			cnt++;
+		}
+
+		if (cnt > 1) {
+			if (frags) {
+				frags[n].seg = i;
+				frags[n].cnt = cnt;
+				frags[n].offset = 0;
+				frags[n].len = len;
+				frags[n].buf = stage + *stage_len;
+			}
+			/* keep the segment tables aligned */
+			*stage_len += (len + 7) & ~7;
+			n++;
+			i += cnt;
+			continue;
+		}
+
+		do {
+			uint64_t left = segs[i].length - off;
+
+			if (frags) {
+				frags[n].seg = i;
+				frags[n].cnt = 0;
+				frags[n].offset = off;
+				frags[n].len = left > max ? max : (uint32_t) left;
+				frags[n].buf = NULL;
+			}
+			off += left > max ? max : left;
+			n++;
+		} while (off < segs[i].length);
+		i++;
+	}
+
+	return n;
+}
+
+/* Pack message i of an RMA op in tx, which already has its seq */
+static void
+sock_rma_pack_frag(sock_conn_t *sconn, sock_rma_op_t *rma_op, sock_tx_t *tx,
+		uint32_t i, size_t max_send_size)
+{
+	sock_rma_header_t *rma_hdr = (sock_rma_header_t *) tx->buffer;
+	sock_rma_handle_t *local = container_of(rma_op->local_handle,
+						sock_rma_handle_t, rma_handle);
+	sock_rma_frag_t *f = rma_op->frags ? &rma_op->frags[i] : NULL;
+	uint64_t local_offset, remote_offset;
+	uint32_t len;
+
+	if (f) {
+		local_offset = rma_op->segs[f->seg].local_offset + f->offset;
+		remote_offset = rma_op->segs[f->seg].remote_offset + f->offset;
+		len = f->len;
+	} else {
+		uint64_t offset = (uint64_t)i * (uint64_t)max_send_size;
+
+		local_offset = rma_op->local_offset + offset;
+		remote_offset = rma_op->remote_offset + offset;
+		len = max_send_size;
+		if (i == (rma_op->num_msgs - 1)) {
+			if (rma_op->data_len % max_send_size)
+				len = rma_op->data_len % max_send_size;
+		}
+	}
+
+	tx->rma_ptr = NULL;
+	tx->rma_len = 0;
+
+	if (f && f->cnt) {
+		tx->rma_ptr = f->buf;
+		tx->rma_len = (uint16_t) len;
+		tx->msg_type = SOCK_MSG_RMA_WRITE;
+		sock_pack_rma_writev(rma_hdr, (uint8_t) f->cnt, tx->rma_len,
+					sconn->peer_id, tx->seq, 0,
+					rma_op->local_handle->stuff[0],
+					rma_op->remote_handle->stuff[0]);
+	} else if (rma_op->flags & CCI_FLAG_WRITE) {
+		tx->rma_ptr = (void*)(uintptr_t)(local->start + local_offset);
+		tx->rma_len = (uint16_t) len;
+		tx->msg_type = SOCK_MSG_RMA_WRITE;
+		sock_pack_rma_write(rma_hdr, tx->rma_len, sconn->peer_id,
+					tx->seq, 0, rma_op->local_handle->stuff[0],
+					local_offset,
+					rma_op->remote_handle->stuff[0],
+					remote_offset);
+	} else {
+		tx->msg_type = SOCK_MSG_RMA_READ_REQUEST;
+		debug (CCI_DB_MSG, "%s: Packing RMA_READ_REQUEST msg (seq %u)",
+			   __func__, tx->seq);
+		sock_pack_rma_read_request (rma_hdr, len, sconn->peer_id,
+					tx->seq, 0, rma_op->local_handle->stuff[0],
+					local_offset,
+					rma_op->remote_handle->stuff[0],
+					remote_offset);
+	}
+	tx->len = sizeof(sock_rma_header_t);
+}
+
+/* Post an RMA: the range of cci_rma() or the segments of cci_rmav() if
+ * segs is not NULL.
+ */
+static int sock_rma_common(cci_connection_t * connection,
 		    const void *msg_ptr, uint32_t msg_len,
 		    cci_rma_handle_t * local_handle, uint64_t local_offset,
 		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
-		    uint64_t data_len, const void *context, int flags)
+		    uint64_t data_len, const cci_rma_seg_t * segs,
+		    uint32_t segcnt, const void *context, int flags)
 {
 	int ret = CCI_ERR_NOT_IMPLEMENTED;
 	cci__ep_t *ep = NULL;
@@ -2745,7 +3182,8 @@ static int ctp_sock_rma(cci_connection_t * connection,
 	sock_rma_handle_t *local = container_of(local_handle, sock_rma_handle_t, rma_handle);
 	sock_rma_handle_t *h = NULL;
 	sock_rma_op_t *rma_op = NULL;
-	size_t max_send_size;
+	size_t max_send_size, stage_len = 0;
+	uint32_t j, nfrags = 0;
 
 	CCI_ENTER;
 
@@ -2765,14 +3203,11 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &sep->handles, entry) {
-		if (h == local) {
-			local->refcnt++;
-			break;
-		}
-	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&sep->reg, local_handle->stuff[0]);
+	if (h == local)
+		local->refcnt++;
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (h != local) {
 		debug(CCI_DB_INFO, "%s: invalid endpoint for this RMA handle",
@@ -2781,11 +3216,35 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
-	rma_op = calloc(1, sizeof(*rma_op));
+	RMA_PAYLOAD_SIZE (connection, max_send_size);
+
+	if (segs) {
+		data_len = 0;
+		for (j = 0; j < segcnt; j++) {
+			/* packed segments are copied from the local region */
+			if (segs[j].local_offset > local->length ||
+			    segs[j].length > local->length - segs[j].local_offset) {
+				debug(CCI_DB_INFO, "%s: segment %u exceeds the "
+					"local RMA handle", __func__, j);
+				cci__ep_lock(ep, &ep->lock);
+				local->refcnt--;
+				cci__ep_unlock(ep, &ep->lock);
+				CCI_EXIT;
+				return CCI_EINVAL;
+			}
+			data_len += segs[j].length;
+		}
+		nfrags = sock_rmav_plan(segs, segcnt, (uint32_t) max_send_size,
+				flags & CCI_FLAG_WRITE, NULL, NULL, &stage_len);
+	}
+
+	/* a vectored op keeps its segments and messages with it */
+	rma_op = calloc(1, sizeof(*rma_op) + segcnt * sizeof(*segs) +
+			nfrags * sizeof(*rma_op->frags) + stage_len);
 	if (!rma_op) {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		local->refcnt--;
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		CCI_EXIT;
 		return CCI_ENOMEM;
 	}
@@ -2796,10 +3255,40 @@ static int ctp_sock_rma(cci_connection_t * connection,
 	rma_op->remote_handle = remote_handle;
 	rma_op->remote_offset = remote_offset;
 	rma_op->id = ++(sconn->rma_id);
-	RMA_PAYLOAD_SIZE (connection, max_send_size);
-	rma_op->num_msgs = data_len / max_send_size;
-	if (data_len % max_send_size)
-		rma_op->num_msgs++;
+	if (segs) {
+		char *stage;
+
+		rma_op->segs = (cci_rma_seg_t *) (rma_op + 1);
+		memcpy(rma_op->segs, segs, segcnt * sizeof(*segs));
+		rma_op->frags = (sock_rma_frag_t *) (rma_op->segs + segcnt);
+		stage = (char *) (rma_op->frags + nfrags);
+		stage_len = 0;
+		rma_op->num_msgs = sock_rmav_plan(segs, segcnt,
+				(uint32_t) max_send_size, flags & CCI_FLAG_WRITE,
+				rma_op->frags, stage, &stage_len);
+
+		/* copy the packed segments now, they may be sent at once */
+		for (j = 0; j < rma_op->num_msgs; j++) {
+			sock_rma_frag_t *f = &rma_op->frags[j];
+			sock_rma_seg_t *table = f->buf;
+			char *data = (char *) (table + f->cnt);
+			uint32_t k;
+
+			for (k = 0; k < f->cnt; k++) {
+				const cci_rma_seg_t *seg = &segs[f->seg + k];
+
+				sock_pack_rma_seg(&table[k], seg->remote_offset,
+						(uint32_t) seg->length);
+				memcpy(data, local->start + seg->local_offset,
+					seg->length);
+				data += seg->length;
+			}
+		}
+	} else {
+		rma_op->num_msgs = data_len / max_send_size;
+		if (data_len % max_send_size)
+			rma_op->num_msgs++;
+	}
 	rma_op->completed = 0;
 	rma_op->status = CCI_SUCCESS;	/* for now */
 	rma_op->context = (void *)context;
@@ -2817,23 +3306,22 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		int err = 0;
 		sock_tx_t **txs = NULL;
 		uint64_t old_seq = 0ULL;
-		size_t max_send_size;
 
-		RMA_PAYLOAD_SIZE (connection, max_send_size);
-		cnt = rma_op->num_msgs < SOCK_RMA_DEPTH ?
-			rma_op->num_msgs : SOCK_RMA_DEPTH;
+		cnt = sep->rma_depth;
+		if (rma_op->num_msgs < cnt)
+			cnt = rma_op->num_msgs;
 
 		txs = calloc(cnt, sizeof(*txs));
 		if (!txs) {
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			local->refcnt--;
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 			free(rma_op);
 			CCI_EXIT;
 			return CCI_ENOMEM;
 		}
 
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		old_seq = sconn->seq;
 		for (i = 0; i < cnt; i++) {
 			if (!TAILQ_EMPTY(&sep->idle_txs)) {
@@ -2852,7 +3340,7 @@ static int ctp_sock_rma(cci_connection_t * connection,
 			local->refcnt--;
 			sconn->seq = old_seq;
 		}
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		if (err) {
 			free(txs);
@@ -2864,14 +3352,10 @@ static int ctp_sock_rma(cci_connection_t * connection,
 		/* we have all the txs we need, pack them and queue them */
 		for (i = 0; i < cnt; i++) {
 			sock_tx_t *tx = txs[i];
-			uint64_t offset = (uint64_t)i * (uint64_t)max_send_size;
-			sock_rma_header_t *rma_hdr = (sock_rma_header_t *) tx->buffer;
 
 			rma_op->next = i + 1;
 			tx->flags = flags | CCI_FLAG_SILENT;
 			tx->state = SOCK_TX_QUEUED;
-			/* payload size for now */
-			tx->len = (uint16_t)max_send_size;
 			tx->send_count = 0;
 			tx->last_attempt_us = 0ULL;
 			tx->timeout_us = 0ULL;
@@ -2882,42 +3366,14 @@ static int ctp_sock_rma(cci_connection_t * connection,
 			tx->evt.conn = conn;
 			tx->evt.ep = ep;
 
-			if (i == (rma_op->num_msgs - 1)) {
-				if (data_len % max_send_size)
-					tx->len = data_len % max_send_size;
-			}
-
-			tx->rma_ptr = NULL;
-			tx->rma_len = 0;
-
-			if (flags & CCI_FLAG_WRITE) {
-				tx->rma_ptr = (void*)(uintptr_t)(local->start + local_offset + offset);
-				tx->rma_len = tx->len;
-				tx->msg_type = SOCK_MSG_RMA_WRITE;
-				sock_pack_rma_write(rma_hdr, tx->len, sconn->peer_id,
-									tx->seq, 0, local_handle->stuff[0],
-									local_offset + offset,
-									remote_handle->stuff[0],
-									remote_offset + offset);
-				memcpy(rma_hdr->data, tx->rma_ptr, tx->len);
-			} else {
-				tx->msg_type = SOCK_MSG_RMA_READ_REQUEST;
-				debug (CCI_DB_MSG, "%s: Packing RMA_READ_REQUEST msg (seq %u)",
-					   __func__, tx->seq);
-				sock_pack_rma_read_request (rma_hdr, tx->len, sconn->peer_id,
-									tx->seq, 0, local_handle->stuff[0],
-									local_offset + offset,
-									remote_handle->stuff[0],
-									remote_offset + offset);
-			}
-			tx->len = sizeof(sock_rma_header_t);
+			sock_rma_pack_frag(sconn, rma_op, tx, i, max_send_size);
 		}
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		for (i = 0; i < cnt; i++)
 			TAILQ_INSERT_TAIL(&sep->queued, &(txs[i])->evt, entry);
 		TAILQ_INSERT_TAIL(&sconn->rmas, rma_op, rmas);
 		TAILQ_INSERT_TAIL(&sep->rma_ops, rma_op, entry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		/* it is no longer needed */
 		free(txs);
@@ -2929,12 +3385,376 @@ static int ctp_sock_rma(cci_connection_t * connection,
 	return ret;
 }
 
+static int ctp_sock_rma(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    uint64_t data_len, const void *context, int flags)
+{
+	return sock_rma_common(connection, msg_ptr, msg_len,
+			local_handle, local_offset,
+			remote_handle, remote_offset,
+			data_len, NULL, 0, context, flags);
+}
+
+static int ctp_sock_rmav(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle,
+		    cci_rma_handle_t * remote_handle,
+		    const cci_rma_seg_t * segs, uint32_t segcnt,
+		    const void *context, int flags)
+{
+	return sock_rma_common(connection, msg_ptr, msg_len,
+			local_handle, 0, remote_handle, 0,
+			0, segs, segcnt, context, flags);
+}
+
+static int ctp_sock_rma_atomic(cci_connection_t * connection,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		    const void *context, int flags)
+{
+	cci__ep_t *ep = NULL;
+	cci__conn_t *conn = NULL;
+	sock_ep_t *sep = NULL;
+	sock_conn_t *sconn = NULL;
+	sock_rma_handle_t *local = container_of(local_handle, sock_rma_handle_t, rma_handle);
+	sock_rma_handle_t *h = NULL;
+	sock_tx_t *tx = NULL;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	sconn = conn->priv;
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+
+	/* the reply looks the local handle up again */
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&sep->reg, local_handle->stuff[0]);
+	if (h != local || local_offset > local->length ||
+	    sizeof(uint64_t) > local->length - local_offset) {
+		cci__ep_unlock(ep, &ep->lock);
+		debug(CCI_DB_INFO, "%s: invalid local RMA handle or offset",
+			__func__);
+		CCI_EXIT;
+		return CCI_EINVAL;
+	}
+	if (!TAILQ_EMPTY(&sep->idle_txs)) {
+		tx = TAILQ_FIRST(&sep->idle_txs);
+		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
+		tx->seq = ++(sconn->seq);
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (!tx) {
+		CCI_EXIT;
+		return CCI_ENOBUFS;
+	}
+
+	tx->msg_type = SOCK_MSG_RMA_ATOMIC_REQUEST;
+	tx->flags = flags;
+	tx->state = SOCK_TX_QUEUED;
+	tx->len = sizeof(sock_rma_header_t) + sizeof(sock_rma_atomic_t);
+	tx->send_count = 0;
+	tx->last_attempt_us = 0ULL;
+	tx->timeout_us = 0ULL;
+	tx->rnr = 0;
+	tx->rma_op = NULL;
+	tx->rma_ptr = NULL;
+	tx->rma_len = 0;
+	tx->waiter = NULL;
+
+	tx->evt.event.type = CCI_EVENT_SEND;
+	tx->evt.event.send.status = CCI_SUCCESS;
+	tx->evt.event.send.context = (void *)context;
+	tx->evt.event.send.connection = connection;
+	tx->evt.conn = conn;
+	tx->evt.ep = ep;
+
+	memset(tx->buffer, 0, tx->len);
+	sock_pack_rma_atomic((sock_rma_header_t *) tx->buffer,
+			SOCK_MSG_RMA_ATOMIC_REQUEST, (uint8_t) op,
+			sconn->peer_id, tx->seq, 0, local_handle->stuff[0],
+			local_offset, remote_handle->stuff[0], remote_offset,
+			operand, compare, 0);
+
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
+	sock_kick_progress(ep);
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
+/* Find the datagram peer at sin, or add it under uri (or a URI built
+ * from sin if NULL). A resolved address is kept until the endpoint is
+ * destroyed, otherwise the caller holds a reference until
+ * sock_addr_put(). Returns NULL if out of memory. */
+static sock_addr_t *sock_addr_get(cci__ep_t * ep,
+				  const struct sockaddr_in *sin,
+				  const char *uri, int resolved)
+{
+	sock_ep_t *sep = ep->priv;
+	sock_addr_t *saddr;
+	uint8_t i = sock_ip_hash(sin->sin_addr.s_addr, sin->sin_port);
+
+	cci__ep_lock(ep, &sep->addr_lock);
+	TAILQ_FOREACH(saddr, &sep->addr_hash[i], entry) {
+		if (saddr->sin.sin_addr.s_addr == sin->sin_addr.s_addr &&
+		    saddr->sin.sin_port == sin->sin_port)
+			break;
+	}
+	if (saddr) {
+		if (!saddr->resolved && !saddr->refcnt) {
+			TAILQ_REMOVE(&sep->addr_lru, saddr, lru);
+			sep->addr_nunused--;
+		}
+		goto out;
+	}
+
+	saddr = calloc(1, sizeof(*saddr));
+	if (!saddr)
+		goto unlock;
+	if (uri) {
+		saddr->uri = strdup(uri);
+	} else {
+		char name[40];
+
+		sprintf(name, "sock://");
+		sock_sin_to_name(*sin, name + 7, sizeof(name) - 7);
+		saddr->uri = strdup(name);
+	}
+	if (!saddr->uri) {
+		free(saddr);
+		saddr = NULL;
+		goto unlock;
+	}
+	saddr->sin = *sin;
+	saddr->addr.uri = saddr->uri;
+	TAILQ_INSERT_TAIL(&sep->addr_hash[i], saddr, entry);
+out:
+	if (resolved)
+		saddr->resolved = 1;
+	else
+		saddr->refcnt++;
+unlock:
+	cci__ep_unlock(ep, &sep->addr_lock);
+	return saddr;
+}
+
+/* Drop the reference of a CCI_EVENT_RECV_FROM event. Unused senders are
+ * kept for the next datagram, up to SOCK_ADDR_MAX_UNUSED of them. */
+static void sock_addr_put(cci__ep_t * ep, const cci_addr_t * addr)
+{
+	sock_ep_t *sep = ep->priv;
+	sock_addr_t *saddr = container_of(addr, sock_addr_t, addr);
+	sock_addr_t *old = NULL;
+
+	cci__ep_lock(ep, &sep->addr_lock);
+	if (--saddr->refcnt == 0 && !saddr->resolved) {
+		TAILQ_INSERT_TAIL(&sep->addr_lru, saddr, lru);
+		if (sep->addr_nunused < SOCK_ADDR_MAX_UNUSED) {
+			sep->addr_nunused++;
+		} else {
+			uint8_t i;
+
+			old = TAILQ_FIRST(&sep->addr_lru);
+			TAILQ_REMOVE(&sep->addr_lru, old, lru);
+			i = sock_ip_hash(old->sin.sin_addr.s_addr,
+					 old->sin.sin_port);
+			TAILQ_REMOVE(&sep->addr_hash[i], old, entry);
+		}
+	}
+	cci__ep_unlock(ep, &sep->addr_lock);
+
+	if (old) {
+		free(old->uri);
+		free(old);
+	}
+
+	return;
+}
+
+typedef struct sock_addr_wait {
+	cci__waiter_t waiter;
+	int status;
+	uint32_t ip;
+	uint16_t port;
+} sock_addr_wait_t;
+
+static void sock_addr_resolved(cci__ep_t * ep, void *arg, int status,
+			       uint32_t ip, uint16_t port)
+{
+	sock_addr_wait_t *w = arg;
+
+	UNUSED_PARAM (ep);
+
+	w->status = status;
+	w->ip = ip;
+	w->port = port;
+	cci__waiter_wake(&w->waiter);
+}
+
+static int ctp_sock_addr_resolve(cci_endpoint_t * endpoint, const char *uri,
+				 const cci_addr_t ** addr)
+{
+	int ret;
+	cci__ep_t *ep;
+	struct sockaddr_in sin;
+	sock_addr_t *saddr;
+	sock_addr_wait_t w;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+
+	/* numeric and recently resolved URIs return right away, host names
+	 * are looked up by the resolver threads */
+	memset(&w, 0, sizeof(w));
+	cci__waiter_init(&w.waiter);
+	ret = cci__resolve(ep, uri, "sock://", SOCK_DGRAM, &w.ip, &w.port,
+			   sock_addr_resolved, &w);
+	if (ret == CCI_EAGAIN) {
+		cci__waiter_wait(&w.waiter);
+		ret = w.status;
+	}
+	cci__waiter_fini(&w.waiter);
+	if (ret) {
+		debug(CCI_DB_INFO, "%s: cannot resolve %s (%s)", __func__,
+		      uri, cci_strerror(endpoint, ret));
+		CCI_EXIT;
+		return ret;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = w.ip;
+	sin.sin_port = w.port;
+
+	saddr = sock_addr_get(ep, &sin, uri, 1);
+	if (!saddr) {
+		CCI_EXIT;
+		return CCI_ENOMEM;
+	}
+	*addr = &saddr->addr;
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
+
+static int ctp_sock_sendto(cci_endpoint_t * endpoint, const cci_addr_t * addr,
+			   const void *msg_ptr, uint32_t msg_len,
+			   const void *context, int flags)
+{
+	int ret;
+	cci__ep_t *ep;
+	sock_ep_t *sep;
+	sock_addr_t *saddr;
+	sock_tx_t *tx = NULL;
+	sock_header_t hdr;
+	cci__evt_t *evt;
+
+	CCI_ENTER;
+
+	if (!sglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	sep = ep->priv;
+	saddr = container_of(addr, sock_addr_t, addr);
+
+	if (msg_len > ep->dev->device.max_send_size) {
+		CCI_EXIT;
+		return CCI_EMSGSIZE;
+	}
+
+	/* only the completion event needs a tx */
+	if (!(flags & (CCI_FLAG_BLOCKING | CCI_FLAG_SILENT))) {
+		cci__ep_lock(ep, &ep->lock);
+		if (!TAILQ_EMPTY(&sep->idle_txs)) {
+			tx = TAILQ_FIRST(&sep->idle_txs);
+			TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
+		}
+		cci__ep_unlock(ep, &ep->lock);
+
+		if (!tx) {
+			CCI_EXIT;
+			return CCI_ENOBUFS;
+		}
+	}
+
+	/* nothing is kept for a datagram, send it from the caller's buffer */
+	sock_pack_dgram(&hdr, msg_len);
+	ret = sock_sendto(sep->sock, &hdr, sizeof(hdr), (void *) msg_ptr,
+			  (uint16_t) msg_len, saddr->sin);
+	if (ret == -1) {
+		ret = errno;
+		debug(CCI_DB_MSG, "%s: sending to %s failed (%s)", __func__,
+		      saddr->uri, strerror(ret));
+		if (tx) {
+			cci__ep_lock(ep, &ep->lock);
+			TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+			cci__ep_unlock(ep, &ep->lock);
+		}
+		CCI_EXIT;
+		return ret;
+	}
+	debug(CCI_DB_MSG, "sent datagram with %u bytes to %s", msg_len,
+	      saddr->uri);
+
+	if (!tx) {
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	}
+
+	tx->msg_type = SOCK_MSG_DGRAM;
+	tx->flags = flags;
+	tx->state = SOCK_TX_COMPLETED;
+	tx->waiter = NULL;
+	tx->rma_op = NULL;
+	tx->rma_ptr = NULL;
+	tx->rma_len = 0;
+	tx->len = 0;
+
+	evt = &tx->evt;
+	evt->ep = ep;
+	evt->conn = NULL;
+	evt->event.type = CCI_EVENT_SEND;
+	evt->event.send.status = CCI_SUCCESS;
+	evt->event.send.connection = NULL;
+	evt->event.send.context = (void *) context;
+
+	/* waking up the app thread if it is blocking on a OS handle */
+	if (sock_deliver_evt(sep, evt) && sep->event_fd) {
+		if (write(sep->fd[1], "a", 1) != 1)
+			debug(CCI_DB_WARN, "%s: Write failed", __func__);
+	}
+
+	CCI_EXIT;
+	return CCI_SUCCESS;
+}
 
 /*!
 Handle incoming sequence number
 
-If we have acked it
-	ignore it
+A seq that we already acked is acked again, the peer resent it because
+our ack was lost.
 Walk sconn->acks:
 	if it exists in a current entry
 	do nothing
@@ -2957,13 +3777,11 @@ static inline void sock_handle_seq(sock_conn_t * sconn, uint32_t seq)
 	cci_endpoint_t *endpoint = connection->endpoint;
 	cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
 
-	if (SOCK_SEQ_LTE(seq, sconn->acked)) {
-		debug(CCI_DB_MSG, "%s ignoring seq %u (acked %u) ***", __func__,
+	if (SOCK_SEQ_LTE(seq, sconn->acked))
+		debug(CCI_DB_MSG, "%s acking seq %u again (acked %u)", __func__,
 			seq, sconn->acked);
-		return;
-	}
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_FOREACH_SAFE(ack, &sconn->acks, entry, tmp) {
 		if (SOCK_SEQ_GTE(seq, ack->start) &&
 			SOCK_SEQ_LTE(seq, ack->end)) {
@@ -3003,9 +3821,9 @@ static inline void sock_handle_seq(sock_conn_t * sconn, uint32_t seq)
 			/* Forcing ACK */
 			if (ack->end - ack->start >= PENDING_ACK_THRESHOLD) {
 				debug(CCI_DB_MSG, "Forcing ACK");
-				pthread_mutex_unlock(&ep->lock);
+				cci__ep_unlock(ep, &ep->lock);
 				sock_ack_conns (ep);
-				pthread_mutex_lock(&ep->lock);
+				cci__ep_lock(ep, &ep->lock);
 			}
 
 			done = 1;
@@ -3039,11 +3857,40 @@ static inline void sock_handle_seq(sock_conn_t * sconn, uint32_t seq)
 				seq);
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 }
 
+/*!
+Record the seq of a message that the sender numbered
+
+Returns 1 if it was already received, 0 if it is new or too far ahead
+of the oldest missing seq to tell. The caller holds ep->lock.
+*/
+static inline int sock_seq_seen(sock_conn_t * sconn, uint32_t seq)
+{
+	uint32_t i = seq % SOCK_RX_WINDOW;
+
+	if (SOCK_SEQ_LT(seq, sconn->rx_next))
+		return 1;
+	if (seq - sconn->rx_next >= SOCK_RX_WINDOW)
+		return 0;
+	if (sconn->rx_seen[i / 64] & (1ULL << (i % 64)))
+		return 1;
+	sconn->rx_seen[i / 64] |= 1ULL << (i % 64);
+
+	/* slide past the contiguous seqs */
+	for (i = sconn->rx_next % SOCK_RX_WINDOW;
+	     sconn->rx_seen[i / 64] & (1ULL << (i % 64));
+	     i = sconn->rx_next % SOCK_RX_WINDOW) {
+		sconn->rx_seen[i / 64] &= ~(1ULL << (i % 64));
+		sconn->rx_next++;
+	}
+
+	return 0;
+}
+
 static void
 sock_handle_active_message(sock_conn_t * sconn,
 			sock_rx_t * rx, uint16_t len, uint32_t id)
@@ -3089,9 +3936,7 @@ sock_handle_active_message(sock_conn_t * sconn,
 
 	/* queue event on endpoint's completed event queue */
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	sock_deliver_evt(sep, evt);
 
 	/* waking up the app thread if it is blocking on a OS handle */
 	if (sep->event_fd) {
@@ -3107,6 +3952,53 @@ sock_handle_active_message(sock_conn_t * sconn,
 	return;
 }
 
+/*!
+Handle incoming datagrams, tagged with the address of their sender
+*/
+static void
+sock_handle_dgram(cci__ep_t * ep, sock_rx_t * rx, uint16_t len,
+		  const struct sockaddr_in *sin)
+{
+	cci__evt_t *evt;
+	sock_header_t *hdr;	/* wire header */
+	union cci_event *event;	/* generic CCI event */
+	sock_ep_t *sep = ep->priv;
+	sock_addr_t *saddr;
+
+	CCI_ENTER;
+
+	saddr = sock_addr_get(ep, sin, NULL, 0);
+	if (!saddr) {
+		debug(CCI_DB_MSG, "%s: no memory for the sender's address, "
+		      "dropping datagram", __func__);
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+		CCI_EXIT;
+		return;
+	}
+
+	evt = &rx->evt;
+	evt->conn = NULL;
+	hdr = (sock_header_t *) rx->buffer;
+
+	event = &evt->event;
+	event->type = CCI_EVENT_RECV_FROM;
+	event->recv_from.len = len;
+	event->recv_from.ptr = (void *)&hdr->data;
+	event->recv_from.addr = &saddr->addr;
+
+	/* waking up the app thread if it is blocking on a OS handle */
+	if (sock_deliver_evt(sep, evt) && sep->event_fd) {
+		if (write(sep->fd[1], "a", 1) != 1)
+			debug(CCI_DB_WARN, "%s: Write failed", __func__);
+	}
+
+	CCI_EXIT;
+
+	return;
+}
+
 /*!
 Handle incoming RNR messages
 */
@@ -3171,7 +4063,8 @@ sock_handle_ack(sock_conn_t * sconn,
 			|| type == SOCK_MSG_SEND || type == SOCK_MSG_RMA_WRITE
 			|| type == SOCK_MSG_RMA_READ_REQUEST
 			|| type == SOCK_MSG_RMA_WRITE_DONE
-            || type == SOCK_MSG_RMA_READ_REPLY);
+            || type == SOCK_MSG_RMA_READ_REPLY
+			|| type == SOCK_MSG_RMA_ATOMIC_REQUEST);
 	} else {
 		assert(type == SOCK_MSG_SACK);
 	}
@@ -3186,26 +4079,40 @@ sock_handle_ack(sock_conn_t * sconn,
 			   || type == SOCK_MSG_RMA_WRITE
 			   || type == SOCK_MSG_RMA_WRITE_DONE
 			   || type == SOCK_MSG_RMA_READ_REQUEST
-               || type == SOCK_MSG_RMA_READ_REPLY) {
+               || type == SOCK_MSG_RMA_READ_REPLY
+			   || type == SOCK_MSG_RMA_ATOMIC_REQUEST) {
 		/* Piggybacked ACK */
 		acks[0] = hdr_r->pb_ack;
 		if (sconn->seq_pending == acks[0] - 1)
 			sconn->seq_pending = acks[0];
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
+	/* The handlers of sends and writes still use (or return) the rx
+	   that piggybacked the ACK */
+	if (type != SOCK_MSG_SEND && type != SOCK_MSG_RMA_WRITE
+	    && type != SOCK_MSG_RMA_WRITE_DONE) {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+	}
 
 	pthread_mutex_lock(&dev->lock);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_FOREACH_SAFE(tx, &sconn->tx_seqs, tx_seq, tmp) {
+		/* Only their reply completes read and atomic requests, the
+		   cumulative acks of later messages do not */
+		if ((type == SOCK_MSG_ACK_UP_TO || type == SOCK_MSG_SACK) &&
+		    (tx->msg_type == SOCK_MSG_RMA_READ_REQUEST ||
+		     tx->msg_type == SOCK_MSG_RMA_ATOMIC_REQUEST))
+			continue;
+
 		/* Note that type of msgs can include a piggybacked ACK */
 		if (type == SOCK_MSG_ACK_ONLY || type == SOCK_MSG_SEND 
 									|| type == SOCK_MSG_RMA_WRITE
 									|| type == SOCK_MSG_RMA_READ_REQUEST
 									|| type == SOCK_MSG_RMA_WRITE_DONE
-                                    || type == SOCK_MSG_RMA_READ_REPLY)
+                                    || type == SOCK_MSG_RMA_READ_REPLY
+									|| type == SOCK_MSG_RMA_ATOMIC_REQUEST)
 		{
 			if (tx->seq == acks[0]) {
 				if (tx->state == SOCK_TX_PENDING) {
@@ -3374,13 +4281,13 @@ sock_handle_ack(sock_conn_t * sconn,
 			}
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 	pthread_mutex_unlock(&dev->lock);
 
 	debug(CCI_DB_MSG, "%s acked %d msgs (%s %u)", __func__, found,
 		sock_msg_type(type), acks[0]);
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	/* transfer txs to sock ep's list */
 	while (!TAILQ_EMPTY(&idle_txs)) {
 		sock_rma_op_t *rma_op = NULL;
@@ -3417,17 +4324,13 @@ sock_handle_ack(sock_conn_t * sconn,
 			/* they acked a data segment,
 			* do we need to send more or send the remote completion? */
 			if (rma_op->next < rma_op->num_msgs) {
-				sock_rma_header_t *write = (sock_rma_header_t *) tx->buffer;
-				uint64_t offset = 0ULL;
 				size_t max_send_size;
 
 				/* send more data */
 				i = rma_op->next++;
 				tx->flags = rma_op->flags | CCI_FLAG_SILENT;
 				tx->state = SOCK_TX_QUEUED;
-				/* payload size for now */
 				RMA_PAYLOAD_SIZE (connection, max_send_size);
-				tx->len = (uint16_t) max_send_size;
 				tx->send_count = 0;
 				tx->last_attempt_us = 0ULL;
 				tx->timeout_us = 0ULL;
@@ -3436,35 +4339,10 @@ sock_handle_ack(sock_conn_t * sconn,
 				tx->evt.event.type = CCI_EVENT_SEND;
 				tx->evt.event.send.connection = connection;
 				tx->evt.conn = conn;
-				if (i == (rma_op->num_msgs - 1)) {
-					if (rma_op->data_len % max_send_size)
-						tx->len = rma_op->data_len % max_send_size;
-				}
 				tx->seq = ++(sconn->seq);
-				tx->rma_len = tx->len;
-				tx->len = sizeof(sock_rma_header_t);
-
-				offset = (uint64_t) i * (uint64_t) max_send_size;
-
-				if (tx->flags & CCI_FLAG_WRITE) {
-					sock_pack_rma_write(write, tx->len,
-								sconn->peer_id, tx->seq, 0,
-								rma_op->local_handle->stuff[0],
-								rma_op->local_offset + offset,
-								rma_op->remote_handle->stuff[0],
-								rma_op->remote_offset + offset);
-					memcpy(write->data, local->start + offset, tx->len);
-				} else {
-					tx->msg_type = SOCK_MSG_RMA_READ_REQUEST;
-					/* FIXME: not nice to use a "write" variable here, esp since
-					 * the code is correct, only the name is confusing */
-					sock_pack_rma_read_request (write, tx->len, 
-								sconn->peer_id, tx->seq, 0, 
-								rma_op->local_handle->stuff[0],
-								rma_op->local_offset + offset,
-								rma_op->remote_handle->stuff[0],
-								rma_op->remote_offset + offset);
-				}
+
+				sock_rma_pack_frag(sconn, rma_op, tx, i,
+						max_send_size);
 
 				/* now include the header */
 				//tx->len += sizeof(sock_rma_header_t);
@@ -3501,7 +4379,8 @@ sock_handle_ack(sock_conn_t * sconn,
 								(uint16_t) rma_op->msg_len,
 								sconn->peer_id,
 								tx->seq, 0);
-					memcpy(&hdr_r->data, rma_op->context, sizeof(uint64_t));
+					/* the first 8 bytes are unused, the context
+					 * means nothing to the peer */
 					msg_ptr = (void *)(hdr_r->data + sizeof(uint64_t));
 					memcpy(msg_ptr, rma_op->msg_ptr, tx->len);
 					tx->len += sizeof(sock_rma_header_t) + sizeof(uint64_t);
@@ -3539,9 +4418,8 @@ sock_handle_ack(sock_conn_t * sconn,
 		cci__evt_t *evt;
 		evt = TAILQ_FIRST(&evts);
 		TAILQ_REMOVE(&evts, evt, entry);
-		TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
 		/* waking up the app thread if it is blocking on a OS handle */
-		if (sep->event_fd) {
+		if (sock_deliver_evt(sep, evt) && sep->event_fd) {
 			int rc;
 			rc = write (sep->fd[1], "a", 1);
 			if (rc != 1) {
@@ -3551,26 +4429,19 @@ sock_handle_ack(sock_conn_t * sconn,
 			}
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	pthread_mutex_lock(&dev->lock);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	while (!TAILQ_EMPTY(&queued)) {
 		sock_tx_t *my_tx;
 		my_tx = TAILQ_FIRST(&queued);
 		TAILQ_REMOVE(&queued, my_tx, dentry);
 		TAILQ_INSERT_TAIL(&sep->queued, &my_tx->evt, entry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 	pthread_mutex_unlock(&dev->lock);
 
-	/* We received a ACK so we wake up the send thread */
-	if (!sep->closing) {
-		pthread_mutex_lock(&sep->progress_mutex);
-		pthread_cond_signal(&sep->wait_condition);
-		pthread_mutex_unlock(&sep->progress_mutex);
-	}
-
 	CCI_EXIT;
 	return;
 }
@@ -3601,12 +4472,10 @@ sock_handle_conn_request(sock_rx_t * rx,
 
 	/* queue event on endpoint's completed event queue */
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, &rx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	sep = ep->priv;
+	sock_deliver_evt(sep, &rx->evt);
 
 	/* waking up the app thread if it is blocking on a OS handle */
-	sep = ep->priv;
 	if (sep->event_fd) {
 		int rc;
 		rc = write (sep->fd[1], "a", 1);
@@ -3691,9 +4560,9 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 					cci_strerror(&ep->endpoint,
 						(enum cci_status)ret));
 			}
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 			CCI_EXIT;
 			return;
 		}
@@ -3722,7 +4591,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 					&mss, &keepalive);
 
 		/* get pending conn_req tx, create event, move conn to conn_hash */
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_FOREACH_SAFE(e, &sep->pending, entry, tmp) {
 			t = container_of (e, sock_tx_t, evt);
 			if (t->seq == ack) {
@@ -3731,7 +4600,7 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 				break;
 			}
 		}
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		/* Since we remove the pending tx, update the pending_seq for that
 		given connection */
 		if (sconn->seq_pending == ack - 1)
@@ -3782,20 +4651,21 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 
 		i = sock_ip_hash(sin.sin_addr.s_addr, 0);
 		active_list = &sep->active_hash[i];
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_REMOVE(active_list, sconn, entry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		if (CCI_SUCCESS == reply) {
 			sconn->peer_id = peer_id;
 			sconn->status = SOCK_CONN_READY;
 			*((struct sockaddr_in *)&sconn->sin) = sin;
 			sconn->acked = seq;
+			sconn->rx_next = seq + 1;
 
 			i = sock_ip_hash(sin.sin_addr.s_addr, sin.sin_port);
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_INSERT_TAIL(&sep->conn_hash[i], sconn, entry);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 
 			debug(CCI_DB_CONN, "conn ready on hash %d", i);
 
@@ -3828,10 +4698,8 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 						(enum cci_status)ret));
 			}
 		}
-		/* add rx->evt to ep->evts */
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_INSERT_TAIL(&ep->evts, &rx->evt, entry);
-		pthread_mutex_unlock(&ep->lock);
+		/* hand rx->evt to the application */
+		sock_deliver_evt(sep, &rx->evt);
 		/* waking up the app thread if it is blocking on a OS handle */
 		if (sep->event_fd) {
 			int rc;
@@ -3848,12 +4716,12 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 			return;
 		}
 	} else if (sconn->status == SOCK_CONN_READY) {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		if (!TAILQ_EMPTY(&sep->idle_txs)) {
 			tx = TAILQ_FIRST(&sep->idle_txs);
 			TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 		}
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		if (!tx) {
 			char to[32];
@@ -3865,9 +4733,9 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 			debug((CCI_DB_CONN | CCI_DB_MSG),
 				"ep %d does not have any tx "
 				"buffs to send a conn_ack to %s", sep->sock, to);
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 
 			CCI_EXIT;
 			return;
@@ -3902,19 +4770,14 @@ static void sock_handle_conn_reply(sock_conn_t * sconn,	/* NULL if rejected */
 		__LINE__, tx->seq);
 
 	tx->state = SOCK_TX_QUEUED;
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&sep->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 #if DEBUG_RNR
 	conn_established = true;
 #endif
 
-	/* try to progress txs */
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
-
 	CCI_EXIT;
 
 	return;
@@ -3931,7 +4794,7 @@ sock_handle_rma_read_reply(sock_conn_t *sconn, sock_rx_t *rx,
 	sock_ep_t *sep;
 	sock_rma_header_t *read = rx->buffer;
 	uint64_t local_handle, local_offset;
-	sock_rma_handle_t *local, *h = NULL;
+	sock_rma_handle_t *local;
 	void *ptr = NULL;
 	sock_header_r_t *hdr_r;
 	uint32_t seq, ts;
@@ -3944,8 +4807,6 @@ sock_handle_rma_read_reply(sock_conn_t *sconn, sock_rx_t *rx,
 	hdr_r = (sock_header_r_t *) rx->buffer;
 	rma_read_seq = hdr_r->pb_ack;
 	sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
-	if (rma_read_seq != 0)
-		sock_handle_ack (sconn, SOCK_MSG_RMA_READ_REPLY, rx, 1, tx_id);
 
 	debug(CCI_DB_MSG, 
 		"%s: recv'ing RMA_READ_REPLY on conn %p with len %u (answer to "
@@ -3953,20 +4814,13 @@ sock_handle_rma_read_reply(sock_conn_t *sconn, sock_rx_t *rx,
 		__func__, conn, len, rma_read_seq);
 
 	sock_parse_rma_handle_offset(&read->local, &local_handle, &local_offset);
-	local = (sock_rma_handle_t *) (uintptr_t) local_handle;
 
 	endpoint = (&conn->connection)->endpoint;
 	ep = container_of (endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &sep->handles, entry) {
-		if (h == local) {
-			break;
-		}
-	}
-	pthread_mutex_unlock(&ep->lock);
+	local = cci__rma_reg_lookup(&sep->reg, local_handle);
 
-	if (h != local) {
+	if (!local) {
 		/* local is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: local handle not valid", __func__);
@@ -3999,6 +4853,15 @@ out:
 		/* TODO we need to drain the message from the fd */
 	}
 
+	/* only now that we are done with rx, sock_handle_ack() returns it */
+	if (rma_read_seq != 0) {
+		sock_handle_ack (sconn, SOCK_MSG_RMA_READ_REPLY, rx, 1, tx_id);
+	} else {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+	}
+
 	CCI_EXIT;
 
 return;
@@ -4057,7 +4920,7 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 
 	debug(CCI_DB_CONN, "%s: seq %u ack %u", __func__, seq, ts);
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_FOREACH_SAFE(e, &sep->pending, entry, tmp) {
 		/* the conn_ack stores the ack for the conn_reply in ts */
 		t = container_of (e, sock_tx_t, evt);
@@ -4068,7 +4931,7 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 			break;
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx) {
 		/* FIXME do what here? */
@@ -4078,9 +4941,9 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 			"received conn_ack and no matching tx "
 			"(seq %u ack %u)", seq, ts);	//FIXME
 	} else {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		if (tx->evt.event.accept.connection) {
-			TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
+			sock_deliver_evt(sep, &tx->evt);
 			/* waking up the app thread if it is blocking on a OS handle */
 			if (sep->event_fd) {
 				int rc;
@@ -4094,16 +4957,12 @@ sock_handle_conn_ack(sock_conn_t * sconn,
 		} else {
 			TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
 		}
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
-	
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	cci__ep_unlock(ep, &ep->lock);
 
 	CCI_EXIT;
 
@@ -4132,39 +4991,27 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	uint64_t local_offset;
 	uint64_t remote_handle;
 	uint64_t remote_offset;
-	uint32_t seq, ts = 0;
+	uint32_t seq, ts = 0, pb_ack;
 	int ret = CCI_SUCCESS;
 	sock_rma_header_t *rma_hdr;
-	sock_rma_handle_t *remote, *h;
+	sock_rma_handle_t *remote;
 	sock_header_r_t *hdr_r;
-	sock_tx_t *tx;
+	sock_tx_t *tx = NULL;
 
 	hdr_r = (sock_header_r_t *) rx->buffer;
 	sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
+	pb_ack = hdr_r->pb_ack;
 
 	connection = &conn->connection;
 	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
 
-	if (hdr_r->pb_ack != 0) {
-		sock_handle_ack (sconn, SOCK_MSG_RMA_READ_REQUEST, rx, 1, id);
-	}
-
 	/* Parse the RMA read request message */
 	sock_parse_rma_handle_offset(&read->local, &local_handle, &local_offset);
 	sock_parse_rma_handle_offset(&read->remote, &remote_handle, &remote_offset);
-	remote = (sock_rma_handle_t *) (uintptr_t) remote_handle;
-	assert (remote);
-
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &sep->handles, entry) {
-		if (h == remote) {
-			break;
-		}
-	}
-	pthread_mutex_unlock(&ep->lock);
+	remote = cci__rma_reg_lookup(&sep->reg, remote_handle);
 
-	if (h != remote) {
+	if (!remote) {
 		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
@@ -4182,12 +5029,17 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	}
 
 	/* Get a TX buffer */
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	if (!TAILQ_EMPTY(&sep->idle_txs)) {
 		tx = TAILQ_FIRST(&sep->idle_txs);
 		TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
+	if (!tx) {
+		/* the requester will ask again */
+		ret = CCI_ENOBUFS;
+		goto out;
+	}
 
 	/* Prepare the TX buffer */
 	tx->msg_type = SOCK_MSG_RMA_READ_REPLY;
@@ -4198,7 +5050,9 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	tx->rma_ptr = remote->start + (uintptr_t) remote_offset;
 	/*tx->rma_len = (uint16_t)remote->length;*/
         tx->rma_len = len;
-	tx->seq = ++(sconn->seq);
+	/* The reply is never resent, so it takes no seq: a seq that never
+	   arrives would stop the peer's window of received seqs */
+	tx->seq = 0;
 
 	tx->evt.event.type = CCI_EVENT_SEND;
 	tx->evt.event.send.status = CCI_SUCCESS; /* for now */
@@ -4229,28 +5083,220 @@ sock_handle_rma_read_request(sock_conn_t * sconn, sock_rx_t * rx,
 	sock_sendto(sep->sock, tx->buffer, tx->len, tx->rma_ptr,
 				tx->rma_len, sconn->sin);
 
-	/* Emit an event */
-	tx->state = SOCK_TX_COMPLETED;
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
-
-	/* TODO: do we need to return the TX? */
+	/* The reply is not acked (the requester asks again if it is lost)
+	   and the application did not ask for it, so there is no event */
+	cci__ep_lock(ep, &ep->lock);
+	tx->state = SOCK_TX_IDLE;
+	TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+	cci__ep_unlock(ep, &ep->lock);
 
 out:
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
-
-	pthread_mutex_lock(&sep->progress_mutex);
-	pthread_cond_signal(&sep->wait_condition);
-	pthread_mutex_unlock(&sep->progress_mutex);
+	/* sock_handle_ack() returns the rx */
+	if (pb_ack != 0) {
+		sock_handle_ack (sconn, SOCK_MSG_RMA_READ_REQUEST, rx, 1, id);
+	} else {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+	}
 
 	return (ret);
 }
 
+/* Apply an atomic request and answer it, or answer it again if it was
+ * resent because the reply was lost.
+ */
+static void
+sock_handle_rma_atomic_request(sock_conn_t * sconn, sock_rx_t * rx,
+				uint8_t op, uint32_t id)
+{
+	cci__conn_t *conn = sconn->conn;
+	cci__ep_t *ep = container_of(conn->connection.endpoint, cci__ep_t,
+				     endpoint);
+	sock_ep_t *sep = ep->priv;
+	sock_rma_header_t *request = rx->buffer;
+	sock_header_r_t *hdr_r = rx->buffer;
+	char buffer[sizeof(sock_rma_header_t) + sizeof(sock_rma_atomic_t)];
+	sock_atomic_reply_t *reply = NULL;
+	sock_rma_handle_t *remote;
+	uint64_t local_handle, local_offset, remote_handle, remote_offset;
+	uint64_t operand, compare, old = 0;
+	uint64_t *word = NULL;
+	uint32_t seq, ts, status, i;
+	int ret = CCI_SUCCESS;
+
+	sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
+	sock_parse_rma_handle_offset(&request->local, &local_handle,
+				     &local_offset);
+	sock_parse_rma_handle_offset(&request->remote, &remote_handle,
+				     &remote_offset);
+	sock_parse_rma_atomic(request, &operand, &compare, &status);
+
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_ATOMIC_REQUEST seq %u op %u",
+		__func__, seq, op);
+
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < SOCK_ATOMIC_CACHE; i++) {
+		if (sconn->atomics[i].used && sconn->atomics[i].seq == seq) {
+			reply = &sconn->atomics[i];
+			break;
+		}
+	}
+	if (reply) {
+		debug(CCI_DB_MSG, "%s: seq %u was resent, replying again",
+			__func__, seq);
+		old = reply->value;
+		ret = (int) reply->status;
+		goto send;
+	}
+
+	remote = cci__rma_reg_lookup(&sep->reg, remote_handle);
+	if (!remote) {
+		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
+		ret = CCI_ERR_RMA_HANDLE;
+		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
+		goto save;
+	} else if (remote_offset > remote->length ||
+		   sizeof(*word) > remote->length - remote_offset) {
+		/* offset exceeds remote handle's range, send nak */
+		ret = CCI_ERR_RMA_HANDLE;
+		debug(CCI_DB_WARN, "%s: remote offset not valid", __func__);
+		goto save;
+	}
+
+	word = (uint64_t *)((uintptr_t)remote->start + (uintptr_t)remote_offset);
+	if ((uintptr_t)word & (sizeof(*word) - 1)) {
+		ret = CCI_EINVAL;
+		debug(CCI_DB_WARN, "%s: remote word not aligned", __func__);
+		goto save;
+	}
+
+	switch (op) {
+	case CCI_RMA_ATOMIC_FETCH_ADD:
+		old = __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+		break;
+	case CCI_RMA_ATOMIC_CSWAP:
+		/* old keeps compare if the swap succeeds */
+		old = compare;
+		__atomic_compare_exchange_n(word, &old, operand, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		break;
+	case CCI_RMA_ATOMIC_SWAP:
+		old = __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		ret = CCI_EINVAL;
+	}
+
+save:
+	/* keep the reply in case it is lost */
+	reply = &sconn->atomics[sconn->atomic_next++ % SOCK_ATOMIC_CACHE];
+	reply->value = old;
+	reply->seq = seq;
+	reply->status = (uint32_t) ret;
+	reply->used = 1;
+
+send:
+	cci__ep_unlock(ep, &ep->lock);
+
+	/* reply directly, piggybacking the request's seq as its ACK */
+	memset(buffer, 0, sizeof(buffer));
+	sock_pack_rma_atomic((sock_rma_header_t *) buffer,
+			SOCK_MSG_RMA_ATOMIC_REPLY, op, sconn->peer_id, 0, 0,
+			local_handle, local_offset, remote_handle,
+			remote_offset, old, compare, (uint32_t) ret);
+	((sock_header_r_t *) buffer)->pb_ack = seq;
+	sock_sendto(sep->sock, buffer, sizeof(buffer), NULL, 0, sconn->sin);
+
+	/* acks of our own messages, this releases rx */
+	if (hdr_r->pb_ack != 0) {
+		sock_handle_ack(sconn, SOCK_MSG_RMA_ATOMIC_REQUEST, rx, 1, id);
+	} else {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+	}
+}
+
+/* Complete the atomic request acked by this reply with its previous value */
+static void
+sock_handle_rma_atomic_reply(sock_conn_t * sconn, sock_rx_t * rx)
+{
+	cci__conn_t *conn = sconn->conn;
+	cci__ep_t *ep = container_of(conn->connection.endpoint, cci__ep_t,
+				     endpoint);
+	sock_ep_t *sep = ep->priv;
+	sock_rma_header_t *reply = rx->buffer;
+	sock_header_r_t *hdr_r = rx->buffer;
+	sock_rma_handle_t *local;
+	sock_tx_t *tx = NULL, *tmp;
+	uint64_t local_handle, local_offset, remote_handle, remote_offset;
+	uint64_t old, compare;
+	uint32_t status;
+	int ret = 0, flags;
+
+	sock_parse_rma_handle_offset(&reply->local, &local_handle,
+				     &local_offset);
+	sock_parse_rma_handle_offset(&reply->remote, &remote_handle,
+				     &remote_offset);
+	sock_parse_rma_atomic(reply, &old, &compare, &status);
+
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_ATOMIC_REPLY to seq %u",
+		__func__, hdr_r->pb_ack);
+
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_FOREACH_SAFE(tx, &sconn->tx_seqs, tx_seq, tmp) {
+		if (tx->seq == hdr_r->pb_ack &&
+		    tx->msg_type == SOCK_MSG_RMA_ATOMIC_REQUEST &&
+		    tx->state == SOCK_TX_PENDING)
+			break;
+	}
+	if (!tx) {
+		/* a reply to a resent request */
+		debug(CCI_DB_MSG, "%s: seq %u already completed", __func__,
+			hdr_r->pb_ack);
+		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+		cci__ep_unlock(ep, &ep->lock);
+		return;
+	}
+	TAILQ_REMOVE(&sep->pending, &tx->evt, entry);
+	TAILQ_REMOVE(&sconn->tx_seqs, tx, tx_seq);
+
+	ret = (int) status;
+	if (!ret) {
+		local = cci__rma_reg_lookup(&sep->reg, local_handle);
+		if (!local || local_offset > local->length ||
+		    sizeof(old) > local->length - local_offset) {
+			ret = CCI_ERR_RMA_HANDLE;
+			debug(CCI_DB_WARN, "%s: local handle not valid",
+				__func__);
+		} else {
+			memcpy(local->start + (uintptr_t) local_offset, &old,
+				sizeof(old));
+		}
+	}
+
+	flags = tx->flags;
+	if (flags & CCI_FLAG_SILENT) {
+		tx->state = SOCK_TX_IDLE;
+		TAILQ_INSERT_HEAD(&sep->idle_txs, tx, dentry);
+	} else {
+		tx->state = SOCK_TX_COMPLETED;
+		tx->evt.event.send.status = ret;
+		sock_deliver_evt(sep, &tx->evt);
+	}
+	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (!(flags & CCI_FLAG_SILENT) && sep->event_fd) {
+		if (write(sep->fd[1], "a", 1) != 1)
+			debug(CCI_DB_WARN, "%s: Write failed", __func__);
+	}
+}
+
 static void
-sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
+sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint8_t count,
+			uint16_t len)
 {
 	cci__ep_t *ep = NULL;
 	cci__conn_t *conn = sconn->conn;
@@ -4260,7 +5306,7 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 	uint64_t local_offset;
 	uint64_t remote_handle;	/* our handle */
 	uint64_t remote_offset;	/* our offset */
-	sock_rma_handle_t *remote, *h;
+	sock_rma_handle_t *remote;
 
 	ep = container_of(conn->connection.endpoint, cci__ep_t, endpoint);
 	sep = ep->priv;
@@ -4269,17 +5315,48 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 					&local_offset);
 	sock_parse_rma_handle_offset(&write->remote, &remote_handle,
 					&remote_offset);
-	remote = (sock_rma_handle_t *) (uintptr_t) remote_handle;
+	remote = cci__rma_reg_lookup(&sep->reg, remote_handle);
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &sep->handles, entry) {
-		if (h == remote) {
-			break;
+	if (remote && count) {
+		sock_rma_seg_t *table = (sock_rma_seg_t *) write->data;
+		char *data = (char *) (table + count);
+		uint32_t i, left = len;
+
+		/* check the whole table before copying any segment */
+		if (count * sizeof(*table) > left) {
+			debug(CCI_DB_WARN, "%s: invalid segment count %u",
+				__func__, count);
+			goto out;
+		}
+		left -= count * sizeof(*table);
+		for (i = 0; i < count; i++) {
+			uint64_t offset;
+			uint32_t seg_len;
+
+			sock_parse_rma_seg(&table[i], &offset, &seg_len);
+			if (seg_len > left || offset > remote->length ||
+			    seg_len > remote->length - offset) {
+				debug(CCI_DB_WARN, "%s: segment %u not valid",
+					__func__, i);
+				goto out;
+			}
+			left -= seg_len;
+		}
+
+		debug(CCI_DB_INFO, "%s: copying %u segments into target buffer",
+			__func__, count);
+		for (i = 0; i < count; i++) {
+			uint64_t offset;
+			uint32_t seg_len;
+
+			sock_parse_rma_seg(&table[i], &offset, &seg_len);
+			memcpy(remote->start + (uintptr_t) offset, data, seg_len);
+			data += seg_len;
 		}
+		goto out;
 	}
-	pthread_mutex_unlock(&ep->lock);
 
-	if (h != remote) {
+	if (!remote) {
 		/* remote is no longer valid, send nack */
 		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
 		// TODO
@@ -4320,11 +5397,11 @@ sock_handle_rma_write(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len)
 out:
 	/* We force the ACK */
 	//sconn->last_ack_ts = sconn->last_ack_ts - 2 * ACK_TIMEOUT;
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	sock_ack_sconn (sep, sconn);
 	
 	TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 }
@@ -4339,7 +5416,6 @@ sock_handle_rma_write_done(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len,
 	cci_endpoint_t *endpoint;	/* generic CCI endpoint */
 	cci__ep_t *ep;
 	sock_ep_t *sep = NULL;
-	void *context;
 	sock_header_r_t *hdr_r = rx->buffer;
 
 	if (hdr_r->pb_ack != 0) {
@@ -4349,9 +5425,6 @@ sock_handle_rma_write_done(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len,
 	endpoint = (&conn->connection)->endpoint;
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 
-    context = malloc (sizeof (uint64_t));
-	memcpy(context, hdr_r->data, sizeof(uint64_t));
-
 	/* get cci__evt_t to hang on ep->events */
 	evt = &rx->evt;
 
@@ -4359,16 +5432,15 @@ sock_handle_rma_write_done(sock_conn_t * sconn, sock_rx_t * rx, uint16_t len,
 	event = & evt->event;
 	event->type = CCI_EVENT_RECV;
 	event->recv.len = len;
-	*((void **)&event->recv.ptr) = context;
+	/* the completion message follows the 8 unused bytes */
+	*((void **)&event->recv.ptr) = hdr_r->data + sizeof(uint64_t);
 	event->recv.connection = &conn->connection;
 
 	/* queue event on endpoint's completed event queue */
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+    sep = ep->priv;
+	sock_deliver_evt(sep, evt);
 
 	/* waking up the app thread if it is blocking on a OS handle */
-    sep = ep->priv;
 	if (sep->event_fd) {
 		int rc;
 		rc = write (sep->fd[1], "a", 1);
@@ -4390,7 +5462,7 @@ static inline void sock_drop_msg(cci_os_handle_t sock)
 static int sock_recvfrom_ep(cci__ep_t * ep)
 {
 	int ret = 0, drop_msg = 0, q_rx = 0, reply = 0, request = 0, again = 0;
-	int ka = 0;
+	int ka = 0, dgram = 0, dup = 0;
 	uint8_t a;
 	uint16_t b;
 	uint32_t id;
@@ -4410,10 +5482,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	if (!sep)
 		return 0;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 #if 0
 	if (ep->closing) {
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		CCI_EXIT;
 		return 0;
 	}
@@ -4423,7 +5495,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		rx = TAILQ_FIRST(&sep->idle_rxs);
 		TAILQ_REMOVE(&sep->idle_rxs, rx, entry);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	/* If we run out of RX, we fall down to a special case: we have to use a
 	special buffer to receive the message, parse it. Ultimately, we need
@@ -4463,10 +5535,14 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		context of a reliable connection */
 		hdr = (sock_header_t *) tmp_buff;
 		sock_parse_header(hdr, &type, &a, &b, &id);
+		if (type == SOCK_MSG_DGRAM) {
+			/* unreliable and connectionless, nothing to nack */
+			CCI_EXIT;
+			return 0;
+		}
 		sconn =
 			sock_find_conn(sep, sin.sin_addr.s_addr, sin.sin_port, id,
 				type);
-		conn = sconn->conn;
 		if (sconn == NULL) {
 			/* If the connection is not already established, we just drop the
 			message */
@@ -4475,6 +5551,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			CCI_EXIT;
 			return 0;
 		}
+		conn = sconn->conn;
 
 		/* If this is a reliable connection, we issue a RNR message */
 		if (cci_conn_is_reliable(sconn->conn)) {
@@ -4518,8 +5595,10 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 
 	if (SOCK_MSG_KEEPALIVE == type)
 		ka = 1;
+	else if (SOCK_MSG_DGRAM == type)
+		dgram = 1;
 
-	if (!request)
+	if (!request && !dgram)
 		sconn =
 			sock_find_conn(sep, sin.sin_addr.s_addr, sin.sin_port, id,
 				type);
@@ -4537,7 +5616,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	}
 
 	/* if no conn, drop msg, requeue rx */
-	if (!ka && !sconn && !reply && !request) {
+	if (!ka && !sconn && !reply && !request && !dgram) {
 		debug((CCI_DB_CONN | CCI_DB_MSG),
 			"no sconn for incoming %s msg " "from %s:%d",
 			sock_msg_type(type), inet_ntoa(sin.sin_addr),
@@ -4550,12 +5629,42 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		!(type == SOCK_MSG_CONN_REPLY)) {
 
         sock_header_r_t *hdr_r = rx->buffer;
+		int atomic = (type == SOCK_MSG_RMA_ATOMIC_REQUEST
+			      || type == SOCK_MSG_RMA_ATOMIC_REPLY);
+		int read = (type == SOCK_MSG_RMA_READ_REQUEST
+			    || type == SOCK_MSG_RMA_READ_REPLY);
+
         sock_parse_seq_ts(&hdr_r->seq_ts, &seq, &ts);
 
-        if (!(type == SOCK_MSG_RMA_READ_REQUEST)) {
-		    sock_handle_seq(sconn, seq);
-        }
-		if (hdr_r->pb_ack != 0)
+		/* On RO connections, a message that overtook a seq still
+		 * missing is dropped without an ack, the peer resends it
+		 * after the missing one */
+		if (sconn->conn->connection.attribute == CCI_CONN_ATTR_RO
+		    && (type == SOCK_MSG_SEND
+			|| type == SOCK_MSG_RMA_WRITE_DONE)) {
+			int early;
+
+			cci__ep_lock(ep, &ep->lock);
+			early = SOCK_SEQ_GT(seq, sconn->rx_next);
+			cci__ep_unlock(ep, &ep->lock);
+			if (early) {
+				debug(CCI_DB_MSG, "dropping %s msg seq %u, "
+					"waiting for seq %u", sock_msg_type(type),
+					seq, sconn->rx_next);
+				q_rx = 1;
+				goto out;
+			}
+		}
+
+		/* the reply of a read or atomic request acks it, and acks,
+		 * nacks and replies take no seq of their own */
+		if (type == SOCK_MSG_SEND || type == SOCK_MSG_CONN_ACK
+		    || type == SOCK_MSG_RMA_WRITE
+		    || type == SOCK_MSG_RMA_WRITE_DONE)
+			sock_handle_seq(sconn, seq);
+		/* the read and atomic handlers still need rx, they handle
+		 * pb_ack */
+		if (hdr_r->pb_ack != 0 && !atomic && !read)
 			sock_handle_ack (sconn, type, rx, 1, id);
 	}
 
@@ -4579,6 +5688,26 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 			sconn->rnr = 0;
 	}
 
+	/* Acks, nacks and read and atomic replies carry no seq of their
+	   own. A message resent because its ack was lost or late was
+	   already delivered. */
+	if (sconn && cci_conn_is_reliable(sconn->conn)
+	    && (type == SOCK_MSG_SEND || type == SOCK_MSG_CONN_ACK
+		|| type == SOCK_MSG_RMA_WRITE || type == SOCK_MSG_RMA_WRITE_DONE
+		|| type == SOCK_MSG_RMA_READ_REQUEST
+		|| type == SOCK_MSG_RMA_ATOMIC_REQUEST)) {
+		cci__ep_lock(ep, &ep->lock);
+		dup = sock_seq_seen(sconn, seq);
+		cci__ep_unlock(ep, &ep->lock);
+		if (dup && (type == SOCK_MSG_SEND
+			    || type == SOCK_MSG_RMA_WRITE_DONE)) {
+			debug(CCI_DB_MSG, "dropping resent %s msg seq %u",
+				sock_msg_type(type), seq);
+			q_rx = 1;
+			goto out;
+		}
+	}
+
 	/* TODO handle types */
 
 	switch (type) {
@@ -4613,7 +5742,7 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 		sock_handle_ack(sconn, type, rx, (uint32_t)a, id);
 		break;
 	case SOCK_MSG_RMA_WRITE:
-		sock_handle_rma_write(sconn, rx, b);
+		sock_handle_rma_write(sconn, rx, a, b);
 		break;
 	case SOCK_MSG_RMA_WRITE_DONE:
 		sock_handle_rma_write_done(sconn, rx, b, id);
@@ -4624,6 +5753,19 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 	case SOCK_MSG_RMA_READ_REPLY:
         sock_handle_rma_read_reply(sconn, rx, b, id);
 		break;
+	case SOCK_MSG_RMA_ATOMIC_REQUEST:
+		sock_handle_rma_atomic_request(sconn, rx, a, id);
+		break;
+	case SOCK_MSG_RMA_ATOMIC_REPLY:
+		sock_handle_rma_atomic_reply(sconn, rx);
+		break;
+	case SOCK_MSG_DGRAM:
+		if (ret < (int)sizeof(sock_header_t) + b) {
+			q_rx = 1;
+			break;
+		}
+		sock_handle_dgram(ep, rx, b, &sin);
+		break;
 	default:
 		debug(CCI_DB_MSG, "unknown active message with type %u",
 			(enum sock_msg_type)type);
@@ -4631,9 +5773,9 @@ static int sock_recvfrom_ep(cci__ep_t * ep)
 
 out:
 	if (q_rx) {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_INSERT_HEAD(&sep->idle_rxs, rx, entry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	if (drop_msg) {
@@ -4733,9 +5875,7 @@ static void sock_keepalive(cci__ep_t *ep)
 			event->connection = &conn->connection;
 			TAILQ_REMOVE(&evts, evt, entry);
 			ep = evt->ep;
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-			pthread_mutex_unlock(&ep->lock);
+			sock_deliver_evt(ep->priv, evt);
 			/* waking up the app thread if it is blocking on a OS handle */
 			if (sep->event_fd) {
 				int rc;
@@ -4751,12 +5891,12 @@ static void sock_keepalive(cci__ep_t *ep)
 			*/
 
 			/* Get a TX */
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			if (!TAILQ_EMPTY(&sep->idle_txs)) {
 				tx = TAILQ_FIRST(&sep->idle_txs);
 				TAILQ_REMOVE(&sep->idle_txs, tx, dentry);
 			}
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 
 			/* Prepare and send the msg */
 			ep = container_of(conn->connection.endpoint, cci__ep_t, endpoint);
@@ -4776,18 +5916,12 @@ static void sock_keepalive(cci__ep_t *ep)
 static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn)
 {
 	uint64_t now = 0ULL;
-	static uint64_t last = 0ULL;
 	int count = 0;
 
+	/* sock_ack_conns() paces the passes over all connections, a
+	   connection only delays its own acks (last_ack_ts) */
 	now = sock_get_usecs();
 
-	if (last == 0ULL)
-		last = now;
-	else if (last + 10ULL > now)
-		return 0;
-
-	last = now;
-	
 	if (!TAILQ_EMPTY(&sconn->acks)) {
 		sock_header_r_t *hdr_r;
 		uint32_t acks[SOCK_MAX_SACK * 2];
@@ -4829,7 +5963,8 @@ static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn)
 				if (count == SOCK_MAX_SACK * 2)
 					break;
 			}
-			if (acks[0] == sconn->acked + 1) {
+			if (SOCK_SEQ_LTE(acks[0], sconn->acked + 1) &&
+			    SOCK_SEQ_GT(acks[1], sconn->acked)) {
 				sconn->acked = acks[1];
 			}
 		} else {
@@ -4842,14 +5977,23 @@ static inline int sock_ack_sconn (sock_ep_t *sep, sock_conn_t *sconn)
 				return 0;
 			}
 			TAILQ_REMOVE(&sconn->acks, ack, entry);
-			if (ack->start == sconn->acked)
+			/* SOCK_MSG_ACK_UP_TO acks all the seqs up to its own,
+			 so only send it when the range follows the seqs that
+			 we acked. Otherwise a seq lost before the range would
+			 be acked too, and never resent. */
+			if (SOCK_SEQ_LTE(ack->start, sconn->acked + 1) &&
+			    SOCK_SEQ_GT(ack->end, sconn->acked)) {
 				sconn->acked = ack->end;
-			acks[0] = ack->end;
-			/* If we have a single pending ACK, we send a 
-			 SOCK_MSG_ACK_ONLY ACK, otherwise we send a
-			 SOCK_MSG_ACK_UP_TO ACK */
-			if (ack->start == ack->end)
+				acks[0] = ack->end;
+			} else if (ack->start == ack->end) {
 				type = SOCK_MSG_ACK_ONLY;
+				acks[0] = ack->start;
+			} else {
+				type = SOCK_MSG_SACK;
+				acks[0] = ack->start;
+				acks[1] = ack->end;
+				count = 2;
+			}
 			free(ack);
 		}
 		hdr_r = (sock_header_r_t *) buffer;
@@ -4891,7 +6035,7 @@ static void sock_ack_conns(cci__ep_t * ep)
 
 	last = now;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	for (i = 0; i < SOCK_EP_HASH_SIZE; i++) {
 		if (!TAILQ_EMPTY(&sep->conn_hash[i])) {
 			TAILQ_FOREACH(sconn, &sep->conn_hash[i], entry) {
@@ -4904,15 +6048,15 @@ static void sock_ack_conns(cci__ep_t * ep)
 			}
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	while (!TAILQ_EMPTY(&txs)) {
 		tx = TAILQ_FIRST(&txs);
 		evt = &tx->evt;
 		TAILQ_REMOVE(&txs, tx, dentry);
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_INSERT_TAIL(&sep->queued, evt, entry);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 #if 0
@@ -4925,39 +6069,13 @@ static void sock_ack_conns(cci__ep_t * ep)
 	return;
 }
 
-static void *sock_progress_thread(void *arg)
+/* Send all delayed ACKs now */
+static void sock_drain_acks(cci__ep_t *ep)
 {
-	cci__ep_t *ep = (cci__ep_t *) arg;
-	sock_ep_t *sep;
-	int i;
+	sock_ep_t *sep = ep->priv;
 	sock_conn_t *sconn = NULL;
+	int i;
 
-	assert (ep);
-	sep = ep->priv;
-
-	pthread_mutex_lock(&ep->lock);
-	while (!sep->closing) {
-
-		pthread_mutex_unlock(&ep->lock);
-
-		sock_keepalive (ep);
-		sock_progress_sends (ep);
-
-		/* If the endpoint is in the process of closing, we just move
-		   on, otherwise, we wait for a signal to wake up and do progress */
-		if (!sep->closing) {
-			pthread_mutex_lock(&sep->progress_mutex);
-			pthread_cond_wait(&sep->wait_condition,
-			                  &sep->progress_mutex);
-			pthread_mutex_unlock(&sep->progress_mutex);
-		}
-
-		pthread_mutex_lock(&ep->lock);
-	}
-	pthread_mutex_unlock(&ep->lock);
-
-	/* Because we may have delayed some ACKs for optimization,
-	   we drain all pending ACKs before ending the progress thread */
 	for (i = 0; i < SOCK_EP_HASH_SIZE; i++) {
 		if (!TAILQ_EMPTY(&sep->conn_hash[i])) {
 			TAILQ_FOREACH(sconn, &sep->conn_hash[i], entry) {
@@ -4969,111 +6087,6 @@ static void *sock_progress_thread(void *arg)
 		}
 	}
 	sock_ack_conns (ep);
-
-	pthread_exit(NULL);
-	return (NULL);		/* make pgcc happy */
-}
-
-int progress_recv (cci__ep_t *ep) {
-	sock_ep_t *sep;
-	int ret = 0;
-	struct timeval tv = { 0, SOCK_PROG_TIME_US };
-	fd_set fds;
-	int again;
-
-	sep = ep->priv;
-
-	/* Not that on system without epoll support, sep->event_fd is equal to 0 */
-	if (!sep->event_fd) {
-		FD_ZERO(&fds);
-		FD_SET (sep->sock, &fds);
-		ret = select (sep->sock + 1, &fds, NULL, NULL, &tv);
-		if (ret == -1) {
-			switch (errno) {
-			case EBADF:
-				debug(CCI_DB_INFO, "select() failed with %s", strerror(errno));
-				break;
-			default:
-				break;
-			}
-			goto wait4signal;
-		}
-
-		do {
-			again = sock_recvfrom_ep (ep);
-		} while (again == 1);
-	}
-
-#ifdef HAVE_SYS_EPOLL_H
-	else {
-		struct epoll_event events[SOCK_EP_NUM_EVTS];
-
-		ret = epoll_wait (sep->event_fd, events, SOCK_EP_NUM_EVTS, 0);
-		if (ret > 0) {
-			int count = ret;
-			int i;
-
-			debug(CCI_DB_EP, "%s: epoll_wait() found %d event(s)", __func__, 
-				count);
-			for (i = 0; i < count; i++) {
-				int (*func)(cci__ep_t*) = events[i].data.ptr;
-				if ((events[i].events & EPOLLIN)) {
-					if (func != NULL && ep != NULL) {
-						do {
-							again = (*func)(ep);
-// 							write (sep->fd[1], "a", 1);
-						} while (again == 1);
-						/* We notify the application thread */
-					}
-				}
-			}
-
-		} else if (ret == -1) {
-			debug(CCI_DB_EP, "%s: epoll_wait() returned %s",
-				__func__, strerror(errno));
-		}
-	}
-#else
-	else {
-		struct pollfd fds[1];
-		
-		fds[0].fd = sep->sock;
-		fds[0].events = POLLIN;
-		ret = poll (fds, 1, -1);
-		if (ret > 0) {
-			int i;
-			
-			for (i = 0; i < 1; i++) {
-				if (fds[i].revents & POLLIN) {
-					sock_recvfrom_ep (ep);
-					/* We notify the application thread */
-// 					write (sep->fd[1], "a", 1);
-				}
-			}
-		}
-	}
-#endif /* HAVE_SYS_EPOLL_H */
-
-wait4signal:
-// 		pthread_mutex_lock(&sep->progress_mutex);
-// 		pthread_cond_signal(&sep->wait_condition);
-// 		pthread_mutex_unlock(&sep->progress_mutex);
-
-	return CCI_SUCCESS;
 }
 
-static void *sock_recv_thread(void *arg)
-{
-	cci__ep_t *ep = (cci__ep_t *)arg;
-	sock_ep_t *sep;
-
-	assert (ep);
-	sep = ep->priv;
-	while (!sep->closing) {
-		progress_recv (ep);
-	}
-
-	pthread_exit(NULL);
-	return (NULL);		/* make pgcc happy */
-}
 
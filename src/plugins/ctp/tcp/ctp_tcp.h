@@ -19,7 +19,15 @@
 #include <assert.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 #include <poll.h>
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define TCP_HAVE_IO_URING 1
+#endif
+#endif
 
 #include "cci.h"
 #include "cci_lib_types.h"
@@ -29,19 +37,33 @@ BEGIN_C_DECLS
 #define TCP_DEFAULT_MSS        (8*1024)	/* assume jumbo frames */
 #define TCP_MIN_MSS            (128)
 #define TCP_MAX_MSS            (9000)
+#define TCP_MAX_SEND_SIZE      (8*1024*1024)	/* largest eager message */
 
-#define TCP_EP_RX_CNT          (16*1024)	/* number of rx messages */
-#define TCP_EP_TX_CNT          (16*1024)	/* number of tx messages */
+#define TCP_EP_RX_CNT          (16*1024)	/* max number of rx messages */
+#define TCP_EP_TX_CNT          (16*1024)	/* max number of tx messages */
+#define TCP_SLAB_CNT           (256)	/* txs/rxs allocated at a time */
+#define TCP_SLABS(cnt)         (((cnt) + TCP_SLAB_CNT - 1) / TCP_SLAB_CNT)
 #define TCP_PROG_TIME_MS       (10)	/* try to progress every N milliseconds */
 
 #define TCP_HDR_LEN            (8)	/* common header size */
 
-#define TCP_RMA_DEPTH          (16)	/* how many in-flight msgs per RMA */
-#define TCP_RMA_FRAG_SIZE      (128*1024)
-#define TCP_RMA_FRAG_MAX       (1024*1024)
+#define TCP_RMA_DEPTH          (16)	/* initial in-flight msgs per RMA */
+#define TCP_RMA_MIN_DEPTH      (2)
+#define TCP_RMA_MAX_DEPTH      (64)
+#define TCP_RMA_FRAG_SIZE      (128*1024)	/* initial RMA fragment size */
+#define TCP_RMA_MIN_FRAG       (16*1024)
+#define TCP_RMA_MAX_FRAG       (4*1024*1024)
+#define TCP_RMAV_PACK_LEN      (4*1024)	/* cci_rmav() segments copied together */
+#define TCP_RMAV_MAX_SEGS      (64)	/* max segments per packed fragment */
 
 #define TCP_EP_MAX_CONNS       (1024)
 
+#define TCP_MAX_DATA_SOCKS     (8)	/* max auxiliary RMA sockets per conn */
+
+#define TCP_MAX_PROGRESS_THREADS (16)	/* max progress workers per endpoint */
+
+#define TCP_URING_IOV          (32)	/* max iovecs per io_uring send */
+
 static inline uint64_t tcp_tv_to_usecs(struct timeval tv)
 {
 	return (tv.tv_sec * 1000000) + tv.tv_usec;
@@ -75,8 +97,12 @@ static inline uint64_t tcp_get_usecs(void)
  * A tcp device may have these items:
  *
  * mtu = 9000             # MTU less headers will become max_send_size
+ * max_send_size = 1048576 # override max_send_size, up to TCP_MAX_SEND_SIZE
  * min_port = 4444        # lowest port to use for endpoints
  * max_port = 5555        # highest port to use for endpoints
+ * data_sockets = 4       # auxiliary sockets per conn for RMA data
+ * progress_threads = 4   # progress workers per endpoint
+ * io_uring = 1           # drive the sockets through io_uring if available
  */
 
 /* Message types */
@@ -85,7 +111,7 @@ typedef enum tcp_msg_type {
 	TCP_MSG_INVALID = 0,
 	TCP_MSG_CONN_REQUEST,	/* SYN */
 	TCP_MSG_CONN_REPLY,	/* SYN-ACK */
-	TCP_MSG_CONN_ACK,	/* ACK */
+	TCP_MSG_CONN_ACK,	/* unused, the reply completes the handshake */
 	TCP_MSG_DISCONNECT,	/* spec says no disconnect is sent */
 	TCP_MSG_SEND,
 	TCP_MSG_RNR,		/* for both msg and RMA */
@@ -98,6 +124,9 @@ typedef enum tcp_msg_type {
 	TCP_MSG_RMA_READ_REQUEST,
 	TCP_MSG_RMA_READ_REPLY,
 	TCP_MSG_RMA_INVALID,	/* invalid handle */
+	TCP_MSG_CONN_DATA,	/* attach a data socket to a conn */
+	TCP_MSG_RMA_WRITEV,	/* several RMA write segments */
+	TCP_MSG_RMA_ATOMIC,	/* atomic request and its reply */
 	TCP_MSG_TYPE_MAX
 } tcp_msg_type_t;
 
@@ -178,31 +207,46 @@ typedef struct tcp_handshake {
 	uint32_t mss;		/* lower of each endpoint */
 	uint32_t keepalive;	/* keepalive timeout (when activated) */
 	uint32_t server_tx_id;  /* id of server's tx */
+	uint32_t data_socks;	/* number of auxiliary RMA data sockets */
+	uint32_t conn_id;	/* server's conn id for attaching data sockets */
+	uint32_t token_high;	/* server's random token for data sockets */
+	uint32_t token_low;
 } tcp_handshake_t;
 
 static inline void
 tcp_pack_handshake(tcp_handshake_t * hs,
 		    uint32_t max_recv_buffer_count, uint32_t mss,
-		    uint32_t keepalive, uint32_t server_tx_id)
+		    uint32_t keepalive, uint32_t server_tx_id,
+		    uint32_t data_socks, uint32_t conn_id, uint64_t token)
 {
-	assert(mss <= (TCP_MAX_MSS));
+	assert(mss <= (TCP_MAX_SEND_SIZE));
 	assert(mss >= TCP_MIN_MSS);
 
 	hs->max_recv_buffer_count = htonl(max_recv_buffer_count);
 	hs->mss = htonl(mss);
 	hs->keepalive = htonl(keepalive);
 	hs->server_tx_id = htonl(server_tx_id);
+	hs->data_socks = htonl(data_socks);
+	hs->conn_id = htonl(conn_id);
+	hs->token_high = htonl((uint32_t)(token >> 32));
+	hs->token_low = htonl((uint32_t)(token & 0xFFFFFFFF));
 }
 
 static inline void
 tcp_parse_handshake(tcp_handshake_t * hs,
 		     uint32_t * max_recv_buffer_count, uint32_t * mss,
-		     uint32_t * ka, uint32_t *server_tx_id)
+		     uint32_t * ka, uint32_t *server_tx_id,
+		     uint32_t * data_socks, uint32_t * conn_id,
+		     uint64_t * token)
 {
 	*max_recv_buffer_count = ntohl(hs->max_recv_buffer_count);
 	*mss = ntohl(hs->mss);
 	*ka = ntohl(hs->keepalive);
 	*server_tx_id = ntohl(hs->server_tx_id);
+	*data_socks = ntohl(hs->data_socks);
+	*conn_id = ntohl(hs->conn_id);
+	*token = ((uint64_t) ntohl(hs->token_high)) << 32;
+	*token |= (uint64_t) ntohl(hs->token_low);
 }
 
 /* connection request header:
@@ -224,6 +268,14 @@ tcp_parse_handshake(tcp_handshake_t * hs,
    +-------------------------------+
    |          server tx_id         |
    +-------------------------------+
+   |           data socks          |
+   +-------------------------------+
+   |            conn id            |
+   +-------------------------------+
+   |           token high          |
+   +-------------------------------+
+   |           token low           |
+   +-------------------------------+
 
    The peer uses the id when sending to us.
    The user data follows the header.
@@ -235,6 +287,9 @@ tcp_parse_handshake(tcp_handshake_t * hs,
    mss: max send size
    keepalive: if keepalive is activated, this specifies the keepalive timeout
    server tx_id: 0 in conn_request and set by server in conn_reply
+   data socks: number of data sockets the client would like to open
+   conn id: 0 in conn_request
+   token: 0 in conn_request
  */
 
 static inline void
@@ -264,13 +319,24 @@ tcp_pack_conn_request(tcp_header_t * header, cci_conn_attribute_t attr,
    +-------------------------------+
    |          server tx_id         |
    +-------------------------------+
+   |           data socks          |
+   +-------------------------------+
+   |            conn id            |
+   +-------------------------------+
+   |           token high          |
+   +-------------------------------+
+   |           token low           |
+   +-------------------------------+
 
    The reply is 0 for success else errno.
    The tx id is from the active client (to lookup its tx)
 
    reply: CCI_EVENT_CONNECT_[ACCEPTED|REJECTED]
    mss: max app payload (user header and user data)
-   server tx_id: set by server, client will return in conn_ack
+   server tx_id: set by server, unused
+   data socks: number of data sockets the server agreed to (lower of each)
+   conn id: set by server, client will send it on each data socket
+   token: random, set by server, client will send it on each data socket
  */
 
 static inline void
@@ -279,41 +345,77 @@ tcp_pack_conn_reply(tcp_header_t * header, uint8_t reply, uint32_t client_tx_id)
 	tcp_pack_header(header, TCP_MSG_CONN_REPLY, reply, client_tx_id);
 }
 
-/* connection ack header:
+/* data socket header:
 
     <----------- 32 bits ---------->
     <---------- 28b ---------->  4b
-   +----------------------------+----+
-   |         reserved           |type|
-   +----------------------------+----+
-   |          server tx_id           |
-   +---------------------------------+
+   +---------------------------+----+
+   |        socket index       |type|
+   +---------------------------+----+
+   |         server conn id         |
+   +--------------------------------+
+   |       server token high        |
+   +--------------------------------+
+   |       server token low         |
+   +--------------------------------+
+
+   First (and only control) message sent on an auxiliary data socket.
+   The server uses the conn id and the token from the conn_reply
+   handshake to attach the socket to the connection, if it comes from
+   the connection's peer address. Conn ids are sequential, the token
+   keeps other hosts from guessing them. Afterwards, the socket only carries
+   RMA_WRITE and RMA_READ_REPLY fragments; the acks and all other
+   messages stay on the connection's primary socket.
 
  */
 
-static inline void tcp_pack_conn_ack(tcp_header_t * header, uint32_t server_tx_id)
+typedef struct tcp_conn_data {
+	uint32_t token_high;
+	uint32_t token_low;
+} tcp_conn_data_t;
+
+static inline void
+tcp_pack_conn_data(tcp_header_t * header, uint32_t index, uint32_t conn_id,
+		    uint64_t token)
 {
-	tcp_pack_header(header, TCP_MSG_CONN_ACK, 0, server_tx_id);
+	tcp_conn_data_t *data = (tcp_conn_data_t *) header->data;
+
+	tcp_pack_header(header, TCP_MSG_CONN_DATA, index, conn_id);
+	data->token_high = htonl((uint32_t)(token >> 32));
+	data->token_low = htonl((uint32_t)(token & 0xFFFFFFFF));
+}
+
+static inline void
+tcp_parse_conn_data(tcp_conn_data_t * data, uint64_t * token)
+{
+	*token = ((uint64_t) ntohl(data->token_high)) << 32;
+	*token |= (uint64_t) ntohl(data->token_low);
 }
 
 /* send header:
 
     <----------- 32 bits ---------->
-    <--- 12b --> <---- 16b ----->  4b
-   +------------+----------------+----+
-   |    rsvd    |       len      |type|
-   +------------+----------------+----+
-   |               tx_id              |
-   +----------------------------------+
+    <4b> <-------- 24b ------->  4b
+   +----+----------------------+----+
+   |rsvd|          len         |type|
+   +----+----------------------+----+
+   |               tx_id            |
+   +--------------------------------+
 
    length of payload
    tx_id for reliable connections
 
+   Payloads larger than the endpoint's buffers (up to TCP_MAX_SEND_SIZE)
+   are sent from and received into separately allocated buffers.
+
  */
 
+#define TCP_SEND_LEN_MASK      (0xFFFFFF)
+
 static inline void
-tcp_pack_send(tcp_header_t * header, uint16_t len, uint32_t tx_id)
+tcp_pack_send(tcp_header_t * header, uint32_t len, uint32_t tx_id)
 {
+	assert(len <= TCP_SEND_LEN_MASK);
 	tcp_pack_header(header, TCP_MSG_SEND, len, tx_id);
 }
 
@@ -460,16 +562,79 @@ tcp_pack_rma_write(tcp_rma_header_t * write, uint32_t data_len, uint32_t tx_id,
 	tcp_pack_rma_handle_offset(&write->remote, remote_handle, remote_offset);
 }
 
-/* RMA read request
+/* Vectored RMA write
 
     <----------- 32 bits ---------->
     <----------- 28b ---------->  4b
    +----------------------------+----+
-   |             len            |type|
+   |            count           |type|
    +----------------------------+----+
    |              tx_id              |
    +---------------------------------+
 
+   local and remote handles as in the RMA write, with offsets of 0
+
+   count times:
+   +-------------------------------+
+   |     remote offset (0 - 31)    |
+   +-------------------------------+
+   |     remote offset (32 - 63)   |
+   +-------------------------------+
+   |            length             |
+   +-------------------------------+
+
+   +-------------------------------+
+   |   data of all the segments    |
+
+   type is TCP_MSG_RMA_WRITEV
+   count: number of segments, at most TCP_RMAV_MAX_SEGS
+
+   A cci_rmav() write copies consecutive segments of at most
+   TCP_RMAV_PACK_LEN bytes in one fragment, up to the op's fragment size.
+   The target acks the fragment as a whole, as an RMA write.
+ */
+
+typedef struct tcp_rma_seg {
+	uint32_t offset_high;
+	uint32_t offset_low;
+	uint32_t len;
+} tcp_rma_seg_t;
+
+static inline void
+tcp_pack_rma_writev(tcp_rma_header_t * write, uint32_t count, uint32_t tx_id,
+		    uint64_t local_handle, uint64_t remote_handle)
+{
+	tcp_pack_header(&write->header, TCP_MSG_RMA_WRITEV, count, tx_id);
+	tcp_pack_rma_handle_offset(&write->local, local_handle, 0);
+	tcp_pack_rma_handle_offset(&write->remote, remote_handle, 0);
+}
+
+static inline void
+tcp_pack_rma_seg(tcp_rma_seg_t * seg, uint64_t offset, uint32_t len)
+{
+	seg->offset_high = htonl((uint32_t) (offset >> 32));
+	seg->offset_low = htonl((uint32_t) (offset & 0xFFFFFFFF));
+	seg->len = htonl(len);
+}
+
+static inline void
+tcp_parse_rma_seg(tcp_rma_seg_t * seg, uint64_t * offset, uint32_t * len)
+{
+	*offset = ((uint64_t) ntohl(seg->offset_high)) << 32;
+	*offset |= (uint64_t) ntohl(seg->offset_low);
+	*len = ntohl(seg->len);
+}
+
+/* RMA read request
+
+    <----------- 32 bits ---------->
+    <----------- 28b ---------->  4b
+   +------+--------+--------+-----+----+
+   | rsvd | count  | depth  |shift|type|
+   +------+--------+--------+-----+----+
+   |              tx_id              |
+   +---------------------------------+
+
    +-------------------------------+
    |     local handle (0 - 31)     |
    +-------------------------------+
@@ -487,23 +652,126 @@ tcp_pack_rma_write(tcp_rma_header_t * write, uint32_t data_len, uint32_t tx_id,
    +-------------------------------+
    |     remote offset (32 - 63)   |
    +-------------------------------+
+   |        length (0 - 31)        |
+   +-------------------------------+
+   |        length (32 - 63)       |
+   +-------------------------------+
 
-   type is TCP_MSG_RMA_READ_REQUEST or TCP_MSG_RMA_READ_REPLY
-   length of _requested_ payload
-   local handle: cci_rma() caller's handle (stays same for each packet)
-   local offset: offset into the local handle (changes for each packet)
-   remote handle: passive peer's handle (stays same for each packet)
-   remote offset: offset into the remote handle (changes for each packet)
+   type is TCP_MSG_RMA_READ_REQUEST
+   shift: log2 of the fragment size the target should use (5 bits)
+   depth: number of reply fragments the target may have in flight (8 bits)
+   count: number of segments of a cci_rmav() read (8 bits), 0 otherwise
+   local handle: cci_rma() caller's handle
+   local offset: offset into the local handle
+   remote handle: passive peer's handle
+   remote offset: offset into the remote handle
+   length: length of the whole range to read
+
+   One request covers the whole range. The target streams it back as
+   TCP_MSG_RMA_READ_REPLY fragments, which use the RMA write layout
+   (len is the fragment's payload length, offsets change for each
+   fragment). The target acks the request only if it fails.
+
+   A cci_rmav() read packs up to TCP_RMAV_MAX_SEGS segments in one request.
+   The offsets of the request are then 0, length is the sum of the
+   segments' lengths and count of these follow the request:
+
+   +-------------------------------+
+   |     local offset (0 - 31)     |
+   +-------------------------------+
+   |     local offset (32 - 63)    |
+   +-------------------------------+
+   |     remote offset (0 - 31)    |
+   +-------------------------------+
+   |     remote offset (32 - 63)   |
+   +-------------------------------+
+   |        length (0 - 31)        |
+   +-------------------------------+
+   |        length (32 - 63)       |
+   +-------------------------------+
+
+   The target streams the segments back in order, a reply fragment never
+   spans two segments.
  */
 
+typedef struct tcp_rma_read_request {
+	tcp_rma_header_t rma;
+	uint32_t len_high;
+	uint32_t len_low;
+} tcp_rma_read_request_t;
+
+#define TCP_RMA_SHIFT_MASK     (0x1F)
+#define TCP_RMA_DEPTH_SHIFT    (5)
+#define TCP_RMA_DEPTH_MASK     (0xFF)
+#define TCP_RMA_COUNT_SHIFT    (13)
+#define TCP_RMA_COUNT_MASK     (0xFF)
+
+typedef struct tcp_rma_read_seg {
+	uint32_t local_high;
+	uint32_t local_low;
+	uint32_t remote_high;
+	uint32_t remote_low;
+	uint32_t len_high;
+	uint32_t len_low;
+} tcp_rma_read_seg_t;
+
+static inline uint32_t tcp_rma_frag_shift(uint32_t frag)
+{
+	uint32_t shift = 0;
+
+	while ((1U << (shift + 1)) <= frag)
+		shift++;
+	return shift;
+}
+
 static inline void
-tcp_pack_rma_read_request(tcp_rma_header_t * read, uint64_t data_len, uint32_t tx_id,
+tcp_pack_rma_read_request(tcp_rma_read_request_t * read, uint32_t frag,
+		  uint32_t depth, uint32_t count, uint64_t data_len, uint32_t tx_id,
 		  uint64_t local_handle, uint64_t local_offset,
 		  uint64_t remote_handle, uint64_t remote_offset)
 {
-	tcp_pack_header(&read->header, TCP_MSG_RMA_READ_REQUEST, data_len, tx_id);
-	tcp_pack_rma_handle_offset(&read->local, local_handle, local_offset);
-	tcp_pack_rma_handle_offset(&read->remote, remote_handle, remote_offset);
+	uint32_t a = tcp_rma_frag_shift(frag) |
+		((depth & TCP_RMA_DEPTH_MASK) << TCP_RMA_DEPTH_SHIFT) |
+		((count & TCP_RMA_COUNT_MASK) << TCP_RMA_COUNT_SHIFT);
+
+	tcp_pack_header(&read->rma.header, TCP_MSG_RMA_READ_REQUEST, a, tx_id);
+	tcp_pack_rma_handle_offset(&read->rma.local, local_handle, local_offset);
+	tcp_pack_rma_handle_offset(&read->rma.remote, remote_handle, remote_offset);
+	read->len_high = htonl((uint32_t) (data_len >> 32));
+	read->len_low = htonl((uint32_t) (data_len & 0xFFFFFFFF));
+}
+
+static inline void
+tcp_parse_rma_read_request(uint32_t a, uint32_t * frag, uint32_t * depth,
+			   uint32_t * count)
+{
+	*frag = 1U << (a & TCP_RMA_SHIFT_MASK);
+	*depth = (a >> TCP_RMA_DEPTH_SHIFT) & TCP_RMA_DEPTH_MASK;
+	*count = (a >> TCP_RMA_COUNT_SHIFT) & TCP_RMA_COUNT_MASK;
+}
+
+static inline void
+tcp_pack_rma_read_seg(tcp_rma_read_seg_t * seg, uint64_t local_offset,
+		      uint64_t remote_offset, uint64_t len)
+{
+	seg->local_high = htonl((uint32_t) (local_offset >> 32));
+	seg->local_low = htonl((uint32_t) (local_offset & 0xFFFFFFFF));
+	seg->remote_high = htonl((uint32_t) (remote_offset >> 32));
+	seg->remote_low = htonl((uint32_t) (remote_offset & 0xFFFFFFFF));
+	seg->len_high = htonl((uint32_t) (len >> 32));
+	seg->len_low = htonl((uint32_t) (len & 0xFFFFFFFF));
+}
+
+static inline void
+tcp_parse_rma_read_seg(tcp_rma_read_seg_t * seg, uint64_t * local_offset,
+		       uint64_t * remote_offset, uint64_t * len)
+{
+	*local_offset = ((uint64_t) ntohl(seg->local_high)) << 32;
+	*local_offset |= (uint64_t) ntohl(seg->local_low);
+	*remote_offset = ((uint64_t) ntohl(seg->remote_high)) << 32;
+	*remote_offset |= (uint64_t) ntohl(seg->remote_low);
+	*len = ((uint64_t) ntohl(seg->len_high)) << 32;
+	*len |= (uint64_t) ntohl(seg->len_low);
 }
 
 static inline void
@@ -516,6 +784,79 @@ tcp_pack_rma_read_reply(tcp_rma_header_t * read, uint64_t data_len, uint32_t tx_
 	tcp_pack_rma_handle_offset(&read->remote, remote_handle, remote_offset);
 }
 
+/* RMA atomic request and reply
+
+    <----------- 32 bits ---------->
+    <--------- 25b ---------> 1b 2b  4b
+   +------------------------+--+--+----+
+   |        reserved        |r |op|type|
+   +------------------------+--+--+----+
+   |              tx_id              |
+   +---------------------------------+
+
+   local and remote handles and offsets as in the RMA write
+
+   +-------------------------------+
+   |       operand (0 - 31)        |
+   +-------------------------------+
+   |       operand (32 - 63)       |
+   +-------------------------------+
+   |       compare (0 - 31)        |
+   +-------------------------------+
+   |       compare (32 - 63)       |
+   +-------------------------------+
+
+   type is TCP_MSG_RMA_ATOMIC
+   op: cci_rma_atomic_op_t
+   r: 0 for the request, 1 for the reply
+   local offset: where the initiator stores the previous value
+   remote offset: the target's 64-bit word
+
+   The target applies op to the word in its progress thread and sends
+   the request back as the reply, with the previous value as operand.
+   It acks the request instead, with the error, if it fails.
+ */
+
+typedef struct tcp_rma_atomic {
+	tcp_rma_header_t rma;
+	uint32_t operand_high;
+	uint32_t operand_low;
+	uint32_t compare_high;
+	uint32_t compare_low;
+} tcp_rma_atomic_t;
+
+#define TCP_ATOMIC_OP_MASK     (0x3)
+#define TCP_ATOMIC_REPLY       (1 << 2)
+
+static inline void
+tcp_pack_rma_atomic(tcp_rma_atomic_t * atomic, uint32_t op, int reply,
+		    uint32_t tx_id, uint64_t local_handle, uint64_t local_offset,
+		    uint64_t remote_handle, uint64_t remote_offset,
+		    uint64_t operand, uint64_t compare)
+{
+	uint32_t a = (op & TCP_ATOMIC_OP_MASK) | (reply ? TCP_ATOMIC_REPLY : 0);
+
+	tcp_pack_header(&atomic->rma.header, TCP_MSG_RMA_ATOMIC, a, tx_id);
+	tcp_pack_rma_handle_offset(&atomic->rma.local, local_handle, local_offset);
+	tcp_pack_rma_handle_offset(&atomic->rma.remote, remote_handle, remote_offset);
+	atomic->operand_high = htonl((uint32_t) (operand >> 32));
+	atomic->operand_low = htonl((uint32_t) (operand & 0xFFFFFFFF));
+	atomic->compare_high = htonl((uint32_t) (compare >> 32));
+	atomic->compare_low = htonl((uint32_t) (compare & 0xFFFFFFFF));
+}
+
+static inline void
+tcp_parse_rma_atomic(tcp_rma_atomic_t * atomic, uint32_t a, uint32_t * op,
+		     int * reply, uint64_t * operand, uint64_t * compare)
+{
+	*op = a & TCP_ATOMIC_OP_MASK;
+	*reply = !!(a & TCP_ATOMIC_REPLY);
+	*operand = ((uint64_t) ntohl(atomic->operand_high)) << 32;
+	*operand |= (uint64_t) ntohl(atomic->operand_low);
+	*compare = ((uint64_t) ntohl(atomic->compare_high)) << 32;
+	*compare |= (uint64_t) ntohl(atomic->compare_low);
+}
+
 /************* TCP private structures ****************/
 
 typedef enum tcp_tx_state_t {
@@ -559,6 +900,9 @@ typedef struct tcp_tx {
 	/*! State of send - not to be confused with completion status */
 	tcp_tx_state_t state;
 
+	/*! Wait object of a blocked sender, NULL if none */
+	cci__waiter_t *waiter;
+
 	/*! Buffer (wire header, data) */
 	void *buffer;
 
@@ -580,11 +924,26 @@ typedef struct tcp_tx {
 	/*! RMA fragment ID */
 	uint32_t rma_id;
 
+	/*! Conn whose socket carries this RMA fragment (primary or data) */
+	cci__conn_t *dconn;
+
 	/*! Number of RNR nacks received */
 	uint32_t rnr;
 
 	/*! Peer address if connect reject message (i.e. no conn) */
 	struct sockaddr_in sin;
+
+	/*! Copy of a payload too large for buffer, freed with the tx */
+	void *large;
+
+	/*! Read request: bytes of the range not yet received */
+	uint64_t rma_left;
+
+	/*! Read reply: stream that this fragment belongs to */
+	struct tcp_rma_stream *stream;
+
+	/*! Read reply: file offset of the payload if the stream has a file */
+	uint64_t rma_foff;
 } tcp_tx_t;
 
 /*! Receive message context.
@@ -608,8 +967,32 @@ typedef struct tcp_rx {
 
 	/*! Peer's sockaddr_in for connection requests */
 	struct sockaddr_in sin;
+
+	/*! Payload too large for buffer, freed when the rx is returned */
+	void *large;
 } tcp_rx_t;
 
+/*! A slab of txs or rxs and their buffers. The tx and rx pools start
+ *  with one slab and grow one slab at a time, up to ep->tx_buf_cnt and
+ *  ep->rx_buf_cnt. A tx or rx id is its slab index * TCP_SLAB_CNT plus
+ *  its index in the slab. */
+typedef struct tcp_slab {
+	/*! Array of tcp_tx_t or tcp_rx_t, NULL if not allocated */
+	void *objs;
+
+	/*! Buffers for objs, from cci__numa_alloc() */
+	void *buf;
+
+	/*! Size of buf */
+	size_t len;
+
+	/*! Number of objects in this slab */
+	uint32_t cnt;
+
+	/*! Number of idle objects in this slab */
+	uint32_t idle;
+} tcp_slab_t;
+
 typedef struct tcp_rma_handle {
 	/*! Owning endpoint */
 	cci__ep_t *ep;
@@ -620,7 +1003,9 @@ typedef struct tcp_rma_handle {
 	/*! Application memory */
 	void *start;
 
-	/*! CCI RMA handle */
+	/*! CCI RMA handle
+	    rma_handle->stuff[0] = key in tep->reg
+	 */
 	cci_rma_handle_t rma_handle;
 
 	/*! Access flags */
@@ -631,8 +1016,35 @@ typedef struct tcp_rma_handle {
 
 	/*! Reference count */
 	uint32_t refcnt;
+
+	/*! File mapped by the region (CCI_OPT_ENDPT_RMA_FILE) or -1 */
+	int fd;
+
+	/*! File offset of the region's start */
+	uint64_t file_offset;
 } tcp_rma_handle_t;
 
+/*! One fragment of a cci_rmav() op: a slice of segment seg (cnt is 0),
+    cnt segments copied together in a TCP_MSG_RMA_WRITEV or cnt segments
+    of one read request. A lone segment is read with a plain request. */
+typedef struct tcp_rma_frag {
+	/*! First segment */
+	uint32_t seg;
+
+	/*! Number of packed segments, 0 for a slice */
+	uint32_t cnt;
+
+	/*! Slice: offset in the segment */
+	uint64_t offset;
+
+	/*! Bytes of data */
+	uint64_t len;
+
+	/*! Packed: segment table (and data of a write), in the op's
+	    allocation */
+	void *buf;
+} tcp_rma_frag_t;
+
 typedef struct tcp_rma_op {
 	/*! Entry to hang on sep->rma_ops */
 	TAILQ_ENTRY(tcp_rma_op) entry;
@@ -659,9 +1071,18 @@ typedef struct tcp_rma_op {
 	/*! Last fragment acked */
 	int32_t acked;
 
-	/*! Number of fragments pending */
+	/*! Number of fragments completed (acks may arrive out of order) */
+	uint32_t completed;
+
+	/*! Number of fragments in flight */
 	uint32_t pending;
 
+	/*! Fragment size for this op, fixed when it starts */
+	uint32_t frag;
+
+	/*! Start time, to measure the op's throughput */
+	uint64_t start;
+
 	/*! Status of the RMA op */
 	cci_status_t status;
 
@@ -679,19 +1100,107 @@ typedef struct tcp_rma_op {
 
 	/*! Application completion msg ptr if provided */
 	char *msg_ptr;
+
+	/*! cci_rmav(): segments and fragments (num_msgs of them), in the
+	    op's allocation. NULL for cci_rma(). */
+	cci_rma_seg_t *segs;
+	tcp_rma_frag_t *frags;
 } tcp_rma_op_t;
 
-typedef struct tcp_ep {
-	/*! Socket for listen */
-	cci_os_handle_t sock;
+/*! A read request being streamed back by the target. Each reply tx
+    carries the next fragment and is refilled once it has been written
+    to its socket, until the whole range is sent. */
+typedef struct tcp_rma_stream {
+	/*! Requesting conn (primary) */
+	cci__conn_t *conn;
 
-	/*! List of open connections */
-	TAILQ_HEAD(s_conns, tcp_conn) conns;
+	/*! Next byte of the target's memory to send */
+	char *ptr;
+
+	/*! Initiator's and our handles and offsets of the next fragment */
+	uint64_t local_handle;
+	uint64_t local_offset;
+	uint64_t remote_handle;
+	uint64_t remote_offset;
+
+	/*! Bytes not yet queued */
+	uint64_t left;
+
+	/*! Bytes of the current segment not yet queued */
+	uint64_t seg_left;
+
+	/*! Segments of a cci_rmav() read, in the stream's allocation, and
+	    the next one. NULL for a plain read. */
+	cci_rma_seg_t *segs;
+	uint32_t seg;
+
+	/*! Fragment size requested by the initiator */
+	uint32_t frag;
+
+	/*! Current number of reply txs, adapted to the send queue */
+	uint32_t depth;
+
+	/*! Reply txs queued or being written */
+	uint32_t inflight;
+
+	/*! Initiator's tx id of the read request */
+	uint32_t tx_id;
+
+	/*! Our copy of the region's file descriptor, or -1 */
+	int fd;
+
+	/*! File offset of the next fragment */
+	uint64_t foff;
+} tcp_rma_stream_t;
+
+#ifdef TCP_HAVE_IO_URING
+/* An io_uring instance set up with the raw system calls */
+typedef struct tcp_uring {
+	/*! Ring fd, -1 if not set up */
+	int fd;
+
+	/*! Submission queue ring */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+
+	/*! Submission queue entries */
+	struct io_uring_sqe *sqes;
+
+	/*! Local SQ tail, published by tcp_uring_enter() */
+	unsigned sqe_tail;
+
+	/*! Number of SQEs queued but not yet submitted */
+	unsigned to_submit;
+
+	/*! Completion queue ring */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/*! Mappings to release in tcp_uring_fini() */
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+} tcp_uring_t;
+#endif
+
+/* A poller owns a disjoint subset of the endpoint's sockets. Each
+ * progress worker drives one poller. Poller 0 also owns the listening
+ * socket at fds[0]. */
+typedef struct tcp_poller {
+	/*! Owning endpoint */
+	cci__ep_t *ep;
 
 	/*! Set when polling - only one poll at a time.
 	 *  The poller will need to access fds, nfds, c and they cannot change
-	 *  while is_polling is set. We need to queue any changes and the
-	 *  poller can perform them after processing the poll results. */
+	 *  while is_polling is set. Sockets closed meanwhile are marked
+	 *  and removed by the poller after processing the poll results. */
 	uint32_t is_polling;
 
 	/*! For polling connection sockets */
@@ -703,20 +1212,76 @@ typedef struct tcp_ep {
 	/*! Array of conns indexed by fds */
 	cci__conn_t **c;
 
-	/*! TX common buffer */
-	void *tx_buf;
+	/*! Number of sockets waiting to be removed after the current poll */
+	uint32_t deferred;
+
+	/*! ID of the progress thread driving this poller */
+	pthread_t tid;
+
+	/*! Kernel ID of that thread once it runs, to pin it */
+	int os_tid;
+
+	/*! Index in tep->pollers */
+	uint32_t id;
+
+#ifdef TCP_HAVE_IO_URING
+	/*! Readiness ring, if tep->uring is set. Each fds[] slot has one
+	 *  one-shot poll armed; the poller re-arms it after handling it. */
+	tcp_uring_t ring;
+
+	/*! Generation of each fds[] slot, tagged in its poll's user_data
+	 *  so that completions for a moved or closed slot are dropped */
+	uint32_t *gens;
+#endif
+} tcp_poller_t;
+
+typedef struct tcp_ep {
+	/*! Socket for listen */
+	cci_os_handle_t sock;
+
+	/*! List of open connections */
+	TAILQ_HEAD(s_conns, tcp_conn) conns;
+
+	/*! Pollers, each owning a disjoint set of sockets */
+	tcp_poller_t *pollers;
+
+	/*! Number of pollers */
+	uint32_t npollers;
+
+	/*! Number of running progress threads */
+	uint32_t nthreads;
 
-	/*! All txs */
-	tcp_tx_t *txs;
+	/*! Completed events for the application, instead of ep->evts */
+	cci__evtq_t evtq;
+
+#ifdef TCP_HAVE_IO_URING
+	/*! Set if the sockets are driven through io_uring */
+	uint32_t uring;
+
+	/*! Ring for batched sends, used under ep->lock */
+	tcp_uring_t sring;
+#endif
+
+	/*! TX slabs, TCP_SLABS(ep->tx_buf_cnt) entries */
+	tcp_slab_t *tx_slabs;
+
+	/*! Number of allocated tx slabs */
+	uint32_t tx_nslabs;
+
+	/*! Number of idle txs */
+	uint32_t tx_idle;
 
 	/*! List of idle txs */
 	TAILQ_HEAD(s_itxs, cci__evt) idle_txs;
 
-	/*! RX common buffer */
-	void *rx_buf;
+	/*! RX slabs, TCP_SLABS(ep->rx_buf_cnt) entries */
+	tcp_slab_t *rx_slabs;
+
+	/*! Number of allocated rx slabs */
+	uint32_t rx_nslabs;
 
-	/*! All rxs */
-	tcp_rx_t *rxs;
+	/*! Number of idle rxs */
+	uint32_t rx_idle;
 
 	/*! List of idle rxs */
 	TAILQ_HEAD(s_rxsi, cci__evt) idle_rxs;
@@ -743,6 +1308,9 @@ typedef struct tcp_ep {
 	TAILQ_HEAD(s_ka, tcp_conn) ka_conns;
 	*/
 
+	/*! Conns not read from until rxs are returned, oldest first */
+	TAILQ_HEAD(s_rx_stalled, tcp_conn) rx_stalled;
+
 	/*! List of active connections awaiting replies */
 	TAILQ_HEAD(s_active, tcp_conn) active;
 
@@ -755,11 +1323,14 @@ typedef struct tcp_ep {
 	/*! List of RMA registrations */
 	TAILQ_HEAD(s_handles, tcp_rma_handle) handles;
 
+	/*! RMA registrations indexed by rma_handle.stuff[0] */
+	cci__rma_reg_t reg;
+
 	/*! List of RMA ops */
 	TAILQ_HEAD(s_ops, tcp_rma_op) rma_ops;
 
-	/*! ID of the recv thread for the endpoint */
-	pthread_t tid;
+	/*! Next conn id */
+	uint32_t conn_id;
 } tcp_ep_t;
 
 /* Connection info */
@@ -783,7 +1354,7 @@ typedef enum tcp_conn_status {
 	/*! Waiting on client request */
 	TCP_CONN_PASSIVE1,
 
-	/*! Waiting on conn ack */
+	/*! Waiting on the app to accept or reject */
 	TCP_CONN_PASSIVE2,
 
 	/*! Connection open and useable */
@@ -816,6 +1387,9 @@ tcp_conn_status_str(tcp_conn_status_t status)
 	return NULL;
 }
 
+/* A list of txs, e.g. sent txs waiting to be released or completed */
+TAILQ_HEAD(tcp_evt_list, cci__evt);
+
 typedef struct tcp_conn {
 	/*! Owning conn */
 	cci__conn_t *conn;
@@ -835,9 +1409,15 @@ typedef struct tcp_conn {
 	/*! Lock for sending */
 	pthread_mutex_t slock;
 
-	/*! Index in tep->fds */
+	/*! Poller that owns this socket */
+	tcp_poller_t *poller;
+
+	/*! Index in poller->fds */
 	uint32_t index;
 
+	/*! Set when the socket is closed while its poller is polling */
+	uint32_t ignore;
+
 	/*! Max sends in flight to this peer (i.e. rwnd) */
 	uint32_t max_tx_cnt;
 
@@ -855,6 +1435,66 @@ typedef struct tcp_conn {
 
 	/*! Flag to know if the receiver is ready or not */
 	uint32_t rnr;
+
+	/*! Conn id, used by the peer to attach data sockets */
+	uint32_t id;
+
+	/*! Random token that the peer sends on its data sockets */
+	uint64_t token;
+
+	/*! Primary conn if this is an auxiliary data socket, else NULL */
+	cci__conn_t *primary;
+
+	/*! Auxiliary data sockets used to stripe RMA fragments */
+	cci__conn_t *data[TCP_MAX_DATA_SOCKS];
+
+	/*! Number of attached data sockets */
+	uint32_t ndata;
+
+	/*! Number of data sockets negotiated in the handshake */
+	uint32_t max_data;
+
+	/*! Next data socket to use (round-robin) */
+	uint32_t next_data;
+
+	/*! RMA fragment size, adapted to the observed throughput */
+	uint32_t rma_frag;
+
+	/*! RMA fragments in flight, adapted to the send queue occupancy */
+	uint32_t rma_depth;
+
+	/*! Last RMA throughput measured at rma_frag (bytes per ms) */
+	uint64_t rma_rate;
+
+	/*! Direction of the last fragment size change (1 grow, 0 shrink) */
+	uint32_t rma_grow;
+
+	/*! Set while reads are stopped because the rx pool is empty */
+	uint32_t rx_stalled;
+
+	/*! Set if the stalled conn's io_uring poll was not re-armed */
+	uint32_t rx_disarmed;
+
+	/*! Entry in tep->rx_stalled */
+	TAILQ_ENTRY(tcp_conn) rx_entry;
+
+#ifdef TCP_HAVE_IO_URING
+	/*! Queued txs gathered for the current io_uring send */
+	struct iovec iov[TCP_URING_IOV];
+
+	/*! Message header of the current io_uring send */
+	struct msghdr msg;
+
+	/*! Next conn in the current io_uring send batch */
+	struct tcp_conn *uring_next;
+
+	/*! Txs of the current io_uring send to release or complete */
+	struct tcp_evt_list uring_put;
+	struct tcp_evt_list uring_done;
+
+	/*! Error of the current io_uring send, a data socket is closed */
+	int uring_err;
+#endif
 } tcp_conn_t;
 
 typedef struct tcp_dev {
@@ -866,6 +1506,15 @@ typedef struct tcp_dev {
 
 	/*! Set socket buffers sizes */
 	uint32_t bufsize;
+
+	/*! Number of auxiliary data sockets to open per connection */
+	uint32_t data_socks;
+
+	/*! Number of progress workers per endpoint */
+	uint32_t progress_threads;
+
+	/*! Use io_uring instead of poll() and send() */
+	uint32_t io_uring;
 } tcp_dev_t;
 
 typedef enum tcp_fd_type {
@@ -20,11 +20,18 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <search.h>
+#include <sched.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #ifdef HAVE_IFADDRS_H
 #include <net/if.h>
 #include <ifaddrs.h>
@@ -72,11 +79,19 @@ static int ctp_tcp_arm_os_handle(cci_endpoint_t * endpoint, int flags);
 static int ctp_tcp_get_event(cci_endpoint_t * endpoint,
 			  cci_event_t ** const event);
 static int ctp_tcp_return_event(cci_event_t * event);
+static int ctp_tcp_get_events(cci_endpoint_t * endpoint,
+			      cci_event_t ** events, uint32_t max,
+			      uint32_t * count);
+static int ctp_tcp_return_events(cci_event_t ** events, uint32_t count);
+static int ctp_tcp_wait_event(cci_endpoint_t * endpoint,
+			      cci_event_t ** const event,
+			      const struct timespec *deadline);
 static int ctp_tcp_send(cci_connection_t * connection,
 		     const void *msg_ptr, uint32_t msg_len, const void *context, int flags);
 static int ctp_tcp_sendv(cci_connection_t * connection,
 		      const struct iovec *data, uint32_t iovcnt,
 		      const void *context, int flags);
+static int ctp_tcp_send_batch(cci_send_desc_t * descs, uint32_t count);
 static int ctp_tcp_rma_register(cci_endpoint_t * endpoint,
 			     void *start, uint64_t length,
 			     int flags, cci_rma_handle_t ** rma_handle);
@@ -86,14 +101,29 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		    cci_rma_handle_t * local_handle, uint64_t local_offset,
 		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 		    uint64_t data_len, const void *context, int flags);
+static int ctp_tcp_rmav(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle,
+		    cci_rma_handle_t * remote_handle,
+		    const cci_rma_seg_t * segs, uint32_t segcnt,
+		    const void *context, int flags);
+static int ctp_tcp_rma_atomic(cci_connection_t * connection,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		    const void *context, int flags);
 
-static void tcp_progress_sends(cci__ep_t * ep);
+static void tcp_progress_sends(cci__ep_t * ep, tcp_poller_t *poller);
 static void *tcp_progress_thread(void *arg);
 static int tcp_progress_ep(cci__ep_t *ep);
-static int tcp_poll_events(cci__ep_t *ep);
+static int tcp_poll_events(cci__ep_t *ep, tcp_poller_t *poller);
+static void tcp_poll_wait(cci__ep_t *ep, tcp_poller_t *poller, int ms);
 static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
 			void *rma_ptr, uint32_t rma_len, uintptr_t *offset);
 static inline void tcp_progress_conn_sends(cci__conn_t *conn, int ep_locked);
+static void tcp_rma_stream_next(cci__ep_t *ep, cci__conn_t *conn,
+			tcp_tx_t *tx, int ep_locked);
+static inline void tcp_rx_resume_locked(tcp_ep_t *tep);
 
 
 /*
@@ -142,7 +172,13 @@ cci_plugin_ctp_t cci_ctp_tcp_plugin = {
 	ctp_tcp_sendv,
 	ctp_tcp_rma_register,
 	ctp_tcp_rma_deregister,
-	ctp_tcp_rma
+	ctp_tcp_rma,
+	ctp_tcp_get_events,
+	ctp_tcp_return_events,
+	ctp_tcp_send_batch,
+	ctp_tcp_wait_event,
+	ctp_tcp_rmav,
+	ctp_tcp_rma_atomic
 };
 
 static inline void
@@ -180,6 +216,12 @@ static inline const char *tcp_msg_type(tcp_msg_type_t type)
 		return "RMA read reply";
 	case TCP_MSG_RMA_INVALID:
 		return "invalid RMA handle";
+	case TCP_MSG_CONN_DATA:
+		return "conn_data";
+	case TCP_MSG_RMA_WRITEV:
+		return "RMA writev";
+	case TCP_MSG_RMA_ATOMIC:
+		return "RMA atomic";
 	case TCP_MSG_INVALID:
 		assert(0);
 		return "invalid";
@@ -190,30 +232,565 @@ static inline const char *tcp_msg_type(tcp_msg_type_t type)
 	return NULL;
 }
 
-static inline int tcp_create_thread(cci__ep_t *ep)
+static inline int tcp_create_threads(cci__ep_t *ep)
 {
-	int ret;
+	int ret = 0;
+	uint32_t i;
 	tcp_ep_t *tep;
 
 	assert (ep);
 
 	tep = ep->priv;
 
-	ret = pthread_create(&tep->tid, NULL, tcp_progress_thread, (void*)ep);
+	for (i = 0; i < tep->npollers; i++) {
+		tcp_poller_t *poller = &tep->pollers[i];
+
+		ret = pthread_create(&poller->tid, NULL, tcp_progress_thread,
+				(void*)poller);
+		if (ret)
+			break;
+		tep->nthreads++;
+	}
 
 	return ret;
 }
 
 static inline int tcp_terminate_threads (tcp_ep_t *tep)
 {
+	uint32_t i;
+
 	assert (tep);
 
-	if (tep->tid)
-		pthread_join(tep->tid, NULL);
+	for (i = 0; i < tep->nthreads; i++)
+		pthread_join(tep->pollers[i].tid, NULL);
+	tep->nthreads = 0;
+
+	return CCI_SUCCESS;
+}
+
+/* Allocate the next tx slab and put its txs on the idle list.
+ *
+ * NOTE: caller must hold ep->lock (or own the ep during setup)
+ */
+static int tcp_grow_txs_locked(cci__ep_t *ep)
+{
+	uint32_t i, s;
+	tcp_ep_t *tep = ep->priv;
+	tcp_slab_t *slab = NULL;
+	tcp_tx_t *txs;
+
+	/* reuse the first released slot */
+	for (s = 0; s < TCP_SLABS(ep->tx_buf_cnt); s++) {
+		if (!tep->tx_slabs[s].objs) {
+			slab = &tep->tx_slabs[s];
+			break;
+		}
+	}
+	if (!slab)
+		return CCI_ENOBUFS;
+
+	slab->cnt = ep->tx_buf_cnt - (s * TCP_SLAB_CNT);
+	if (slab->cnt > TCP_SLAB_CNT)
+		slab->cnt = TCP_SLAB_CNT;
+
+	/* on the endpoint's NUMA node */
+	slab->len = (size_t) slab->cnt * ep->buffer_len;
+	slab->buf = cci__numa_alloc(&ep->affinity, slab->len);
+	if (!slab->buf)
+		return CCI_ENOMEM;
+
+	txs = calloc(slab->cnt, sizeof(*txs));
+	if (!txs) {
+		cci__numa_free(slab->buf, slab->len);
+		slab->buf = NULL;
+		return CCI_ENOMEM;
+	}
+
+	for (i = 0; i < slab->cnt; i++) {
+		tcp_tx_t *tx = &txs[i];
+
+		tx->id = (s * TCP_SLAB_CNT) + i;
+		tx->ctx = TCP_CTX_TX;
+
+		tx->evt.event.type = CCI_EVENT_SEND;
+		tx->evt.ep = ep;
+		tx->buffer = (void*)((uintptr_t)slab->buf + (i * ep->buffer_len));
+		tx->len = 0;
+		TAILQ_INSERT_TAIL(&tep->idle_txs, &tx->evt, entry);
+	}
+	slab->objs = txs;
+	slab->idle = slab->cnt;
+	tep->tx_idle += slab->cnt;
+	tep->tx_nslabs++;
+
+	debug(CCI_DB_MEM, "%s: added tx slab %u (%u slabs)", __func__,
+		s, tep->tx_nslabs);
+
+	return CCI_SUCCESS;
+}
+
+/* Allocate the next rx slab and put its rxs on the idle list.
+ *
+ * NOTE: caller must hold ep->lock (or own the ep during setup)
+ */
+static int tcp_grow_rxs_locked(cci__ep_t *ep)
+{
+	uint32_t i, s;
+	tcp_ep_t *tep = ep->priv;
+	tcp_slab_t *slab = NULL;
+	tcp_rx_t *rxs;
+
+	for (s = 0; s < TCP_SLABS(ep->rx_buf_cnt); s++) {
+		if (!tep->rx_slabs[s].objs) {
+			slab = &tep->rx_slabs[s];
+			break;
+		}
+	}
+	if (!slab)
+		return CCI_ENOBUFS;
+
+	slab->cnt = ep->rx_buf_cnt - (s * TCP_SLAB_CNT);
+	if (slab->cnt > TCP_SLAB_CNT)
+		slab->cnt = TCP_SLAB_CNT;
+
+	/* on the endpoint's NUMA node */
+	slab->len = (size_t) slab->cnt * ep->buffer_len;
+	slab->buf = cci__numa_alloc(&ep->affinity, slab->len);
+	if (!slab->buf)
+		return CCI_ENOMEM;
+
+	rxs = calloc(slab->cnt, sizeof(*rxs));
+	if (!rxs) {
+		cci__numa_free(slab->buf, slab->len);
+		slab->buf = NULL;
+		return CCI_ENOMEM;
+	}
+
+	for (i = 0; i < slab->cnt; i++) {
+		tcp_rx_t *rx = &rxs[i];
+
+		rx->id = (s * TCP_SLAB_CNT) + i;
+		rx->ctx = TCP_CTX_RX;
+
+		rx->evt.event.type = CCI_EVENT_RECV;
+		rx->evt.ep = ep;
+		rx->buffer = (void*)((uintptr_t)slab->buf + (i * ep->buffer_len));
+		rx->len = 0;
+		TAILQ_INSERT_TAIL(&tep->idle_rxs, &rx->evt, entry);
+	}
+	slab->objs = rxs;
+	slab->idle = slab->cnt;
+	tep->rx_idle += slab->cnt;
+	tep->rx_nslabs++;
+
+	debug(CCI_DB_MEM, "%s: added rx slab %u (%u slabs)", __func__,
+		s, tep->rx_nslabs);
 
 	return CCI_SUCCESS;
 }
 
+/* Give an idle slab back once more than a slab's worth of other idle
+ * objects remain (the low-water mark). The first slab is never released.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static void tcp_shrink_txs_locked(tcp_ep_t *tep, uint32_t s)
+{
+	uint32_t i;
+	tcp_slab_t *slab = &tep->tx_slabs[s];
+	tcp_tx_t *txs = slab->objs;
+
+	if (s == 0 || slab->idle != slab->cnt ||
+	    tep->tx_idle < slab->cnt + TCP_SLAB_CNT)
+		return;
+
+	for (i = 0; i < slab->cnt; i++)
+		TAILQ_REMOVE(&tep->idle_txs, &txs[i].evt, entry);
+	tep->tx_idle -= slab->cnt;
+	tep->tx_nslabs--;
+
+	free(slab->objs);
+	cci__numa_free(slab->buf, slab->len);
+	memset(slab, 0, sizeof(*slab));
+
+	debug(CCI_DB_MEM, "%s: released tx slab %u (%u slabs)", __func__,
+		s, tep->tx_nslabs);
+
+	return;
+}
+
+/* NOTE: caller must hold ep->lock */
+static void tcp_shrink_rxs_locked(tcp_ep_t *tep, uint32_t s)
+{
+	uint32_t i;
+	tcp_slab_t *slab = &tep->rx_slabs[s];
+	tcp_rx_t *rxs = slab->objs;
+
+	if (s == 0 || slab->idle != slab->cnt ||
+	    tep->rx_idle < slab->cnt + TCP_SLAB_CNT)
+		return;
+
+	for (i = 0; i < slab->cnt; i++)
+		TAILQ_REMOVE(&tep->idle_rxs, &rxs[i].evt, entry);
+	tep->rx_idle -= slab->cnt;
+	tep->rx_nslabs--;
+
+	free(slab->objs);
+	cci__numa_free(slab->buf, slab->len);
+	memset(slab, 0, sizeof(*slab));
+
+	debug(CCI_DB_MEM, "%s: released rx slab %u (%u slabs)", __func__,
+		s, tep->rx_nslabs);
+
+	return;
+}
+
+static void tcp_free_slabs(cci__ep_t *ep)
+{
+	uint32_t s;
+	tcp_ep_t *tep = ep->priv;
+
+	if (tep->tx_slabs) {
+		for (s = 0; s < TCP_SLABS(ep->tx_buf_cnt); s++) {
+			free(tep->tx_slabs[s].objs);
+			cci__numa_free(tep->tx_slabs[s].buf,
+				       tep->tx_slabs[s].len);
+		}
+		free(tep->tx_slabs);
+		tep->tx_slabs = NULL;
+	}
+	if (tep->rx_slabs) {
+		for (s = 0; s < TCP_SLABS(ep->rx_buf_cnt); s++) {
+			free(tep->rx_slabs[s].objs);
+			cci__numa_free(tep->rx_slabs[s].buf,
+				       tep->rx_slabs[s].len);
+		}
+		free(tep->rx_slabs);
+		tep->rx_slabs = NULL;
+	}
+
+	return;
+}
+
+/* Apply CCI_OPT_ENDPT_NUMA_NODE by moving the slabs' buffers to the node,
+ * or CCI_OPT_ENDPT_CPUS by re-pinning the progress threads.
+ */
+static int tcp_set_affinity(cci__ep_t *ep, cci_opt_name_t name,
+			    const void *val)
+{
+	int ret;
+	uint32_t i, s;
+	tcp_ep_t *tep = ep->priv;
+
+	cci__ep_lock(ep, &ep->lock);
+	ret = cci__affinity_set_opt(&ep->affinity, name, val);
+	if (ret)
+		goto out;
+
+	if (name == CCI_OPT_ENDPT_NUMA_NODE) {
+		for (s = 0; s < TCP_SLABS(ep->tx_buf_cnt); s++) {
+			if (tep->tx_slabs[s].buf)
+				cci__numa_move(&ep->affinity, tep->tx_slabs[s].buf,
+					       tep->tx_slabs[s].len);
+		}
+		for (s = 0; s < TCP_SLABS(ep->rx_buf_cnt); s++) {
+			if (tep->rx_slabs[s].buf)
+				cci__numa_move(&ep->affinity, tep->rx_slabs[s].buf,
+					       tep->rx_slabs[s].len);
+		}
+	} else {
+		/* threads that did not start yet pin themselves */
+		for (i = 0; i < tep->npollers; i++) {
+			if (tep->pollers[i].os_tid)
+				cci__affinity_bind(&ep->affinity,
+						   tep->pollers[i].os_tid);
+		}
+	}
+out:
+	cci__ep_unlock(ep, &ep->lock);
+
+	return ret;
+}
+
+#ifdef TCP_HAVE_IO_URING
+/* liburing is not required: the few ring operations needed here are
+ * done with the raw system calls. */
+
+static inline void tcp_uring_fini(tcp_uring_t *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_sz);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_sz);
+	if (ring->fd != -1)
+		close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	return;
+}
+
+static inline int tcp_uring_init(tcp_uring_t *ring, unsigned entries)
+{
+	int ret = 0;
+	unsigned i;
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		ret = errno;
+		ring->fd = -1;
+		return ret;
+	}
+
+	ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_sz = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto out;
+	}
+	ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) {
+		ring->cq_ring = NULL;
+		goto out;
+	}
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto out;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+
+	ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)
+		((char *)ring->cq_ring + p.cq_off.cqes);
+
+	/* SQEs are used in ring order */
+	for (i = 0; i < ring->sq_entries; i++)
+		ring->sq_array[i] = i;
+
+	return 0;
+out:
+	ret = errno;
+	tcp_uring_fini(ring);
+	return ret;
+}
+
+/* Submit the queued SQEs and wait for min_complete completions.
+ *
+ * NOTE: the caller must serialize the users of the SQ
+ */
+static inline int tcp_uring_enter(tcp_uring_t *ring, unsigned min_complete)
+{
+	int ret;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	if (!ring->to_submit && !min_complete)
+		return 0;
+
+	do {
+		ret = (int) syscall(__NR_io_uring_enter, ring->fd,
+				ring->to_submit, min_complete,
+				min_complete ? IORING_ENTER_GETEVENTS : 0,
+				NULL, 0);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		return errno;
+
+	ring->to_submit -= ret;
+
+	return 0;
+}
+
+/* Return a zeroed SQE, submitting the queued ones if the SQ is full.
+ *
+ * NOTE: the caller must serialize the users of the SQ
+ */
+static inline struct io_uring_sqe *tcp_uring_get_sqe(tcp_uring_t *ring)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)
+			>= ring->sq_entries) {
+		tcp_uring_enter(ring, 0);
+		if (ring->sqe_tail - __atomic_load_n(ring->sq_head,
+				__ATOMIC_ACQUIRE) >= ring->sq_entries)
+			return NULL;
+	}
+
+	sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sqe_tail++;
+	ring->to_submit++;
+
+	return sqe;
+}
+
+/* Return the oldest completion or NULL. Consume it with
+ * tcp_uring_cqe_seen().
+ *
+ * NOTE: only one thread may consume the CQ
+ */
+static inline struct io_uring_cqe *tcp_uring_peek_cqe(tcp_uring_t *ring)
+{
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline void tcp_uring_cqe_seen(tcp_uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* user_data of a poll: the slot's generation and index */
+#define TCP_URING_POLL_DATA(gen, index) \
+	(((uint64_t) (gen) << 32) | (uint64_t) (index))
+#define TCP_URING_IGNORE       (~0ULL)	/* user_data of poll removals */
+#define TCP_URING_BATCH        (256)	/* poll completions per round */
+
+/* Arm a one-shot poll on fds[index] for its current events.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_uring_arm_locked(tcp_poller_t *poller, uint32_t index)
+{
+	struct io_uring_sqe *sqe = tcp_uring_get_sqe(&poller->ring);
+
+	if (!sqe) {
+		debug(CCI_DB_WARN, "%s: poller %u ring is full",
+			__func__, poller->id);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = poller->fds[index].fd;
+	/* the 16-bit field is read correctly on both byte orders */
+	sqe->poll_events = (__u16) poller->fds[index].events;
+	sqe->user_data = TCP_URING_POLL_DATA(poller->gens[index], index);
+
+	return;
+}
+
+/* Cancel the poll armed on fds[index] and retire its generation.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_uring_disarm_locked(tcp_poller_t *poller, uint32_t index)
+{
+	struct io_uring_sqe *sqe = tcp_uring_get_sqe(&poller->ring);
+
+	if (sqe) {
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = TCP_URING_POLL_DATA(poller->gens[index], index);
+		sqe->user_data = TCP_URING_IGNORE;
+	} else {
+		debug(CCI_DB_WARN, "%s: poller %u ring is full",
+			__func__, poller->id);
+	}
+	poller->gens[index]++;
+
+	return;
+}
+
+/* Set up the rings if the device asked for them. If the kernel cannot
+ * provide them, stay with poll() and send(). */
+static inline void tcp_uring_setup(cci__ep_t *ep)
+{
+	int ret = 0;
+	uint32_t i;
+	tcp_ep_t *tep = ep->priv;
+	tcp_dev_t *tdev = ep->dev->priv;
+
+	if (!tdev->io_uring)
+		return;
+
+	ret = tcp_uring_init(&tep->sring, TCP_EP_MAX_CONNS);
+	for (i = 0; !ret && i < tep->npollers; i++) {
+		tcp_poller_t *poller = &tep->pollers[i];
+
+		poller->gens = calloc(TCP_EP_MAX_CONNS, sizeof(*poller->gens));
+		if (!poller->gens) {
+			ret = ENOMEM;
+			break;
+		}
+		ret = tcp_uring_init(&poller->ring, TCP_EP_MAX_CONNS);
+	}
+	if (ret) {
+		debug(CCI_DB_WARN, "%s: io_uring is not available (%s), "
+			"using poll()", __func__, strerror(ret));
+		tcp_uring_fini(&tep->sring);
+		for (i = 0; i < tep->npollers; i++) {
+			tcp_uring_fini(&tep->pollers[i].ring);
+			free(tep->pollers[i].gens);
+			tep->pollers[i].gens = NULL;
+		}
+		return;
+	}
+
+	tep->uring = 1;
+	debug(CCI_DB_EP, "%s: using io_uring", __func__);
+
+	cci__ep_lock(ep, &ep->lock);
+	tcp_uring_arm_locked(&tep->pollers[0], 0);
+	tcp_uring_enter(&tep->pollers[0].ring, 0);
+	cci__ep_unlock(ep, &ep->lock);
+
+	return;
+}
+#endif
+
+static inline void tcp_free_pollers(tcp_ep_t *tep)
+{
+	uint32_t i;
+
+	if (!tep->pollers)
+		return;
+
+	for (i = 0; i < tep->npollers; i++) {
+		free(tep->pollers[i].fds);
+		free(tep->pollers[i].c);
+#ifdef TCP_HAVE_IO_URING
+		tcp_uring_fini(&tep->pollers[i].ring);
+		free(tep->pollers[i].gens);
+#endif
+	}
+	free(tep->pollers);
+	tep->pollers = NULL;
+#ifdef TCP_HAVE_IO_URING
+	tcp_uring_fini(&tep->sring);
+	tep->uring = 0;
+#endif
+
+	return;
+}
+
 static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 		     uint32_t abi_ver, uint32_t flags, uint32_t * caps)
 {
@@ -326,7 +903,7 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 			const char *interface = NULL;
 			struct cci_device *device;
 			tcp_dev_t *tdev;
-			uint32_t mtu = (uint32_t) -1;
+			uint32_t mtu = (uint32_t) -1, mss = 0;
 
 			dev->plugin = plugin;
 			if (dev->priority == -1)
@@ -356,6 +933,7 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 			device->pci.bus = -1;	/* per CCI spec */
 			device->pci.dev = -1;	/* per CCI spec */
 			device->pci.func = -1;	/* per CCI spec */
+			tdev->progress_threads = 1;
 
 			/* parse conf_argv */
 			for (arg = device->conf_argv; *arg != NULL; arg++) {
@@ -366,6 +944,13 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 				} else if (0 == strncmp("mtu=", *arg, 4)) {
 					const char *mtu_str = *arg + 4;
 					mtu = strtol(mtu_str, NULL, 0);
+				} else if (0 == strncmp("max_send_size=", *arg, 14)) {
+					const char *mss_str = *arg + 14;
+					mss = strtol(mss_str, NULL, 0);
+					if (mss > TCP_MAX_SEND_SIZE)
+						mss = TCP_MAX_SEND_SIZE;
+					else if (mss < TCP_MIN_MSS)
+						mss = TCP_MIN_MSS;
 				} else if (0 == strncmp("port=", *arg, 5)) {
 					const char *s_port = *arg + 5;
 					uint16_t    port;
@@ -374,6 +959,19 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 				} else if (0 == strncmp("bufsize=", *arg, 8)) {
 					const char *size_str = *arg + 8;
 					tdev->bufsize = strtol(size_str, NULL, 0);
+				} else if (0 == strncmp("data_sockets=", *arg, 13)) {
+					const char *socks_str = *arg + 13;
+					tdev->data_socks = strtol(socks_str, NULL, 0);
+					if (tdev->data_socks > TCP_MAX_DATA_SOCKS)
+						tdev->data_socks = TCP_MAX_DATA_SOCKS;
+				} else if (0 == strncmp("progress_threads=", *arg, 17)) {
+					const char *thr_str = *arg + 17;
+					tdev->progress_threads = strtol(thr_str, NULL, 0);
+					if (tdev->progress_threads > TCP_MAX_PROGRESS_THREADS)
+						tdev->progress_threads = TCP_MAX_PROGRESS_THREADS;
+				} else if (0 == strncmp("io_uring=", *arg, 9)) {
+					const char *uring_str = *arg + 9;
+					tdev->io_uring = strtol(uring_str, NULL, 0);
 				} else if (0 == strncmp("interface=", *arg, 10)) {
 					interface = *arg + 10;
 				}
@@ -418,6 +1016,10 @@ static int ctp_tcp_init(cci_plugin_ctp_t *plugin,
 					assert(mtu >= TCP_MIN_MSS); /* FIXME rather ignore the device? */
 					device->max_send_size = mtu;
 				}
+				/* tcp is a stream, larger messages do not
+				 * depend on the mtu */
+				if (mss)
+					device->max_send_size = mss;
 				/* queue to the main device list now */
 				TAILQ_REMOVE(&globals->configfile_devs, dev, entry);
 				cci__add_dev(dev);
@@ -520,6 +1122,29 @@ static inline void tcp_close_socket(cci_os_handle_t sock)
 	return;
 }
 
+static inline void
+tcp_set_bufsize(cci_os_handle_t sock, uint32_t bufsize)
+{
+	int ret;
+	socklen_t opt_len = sizeof(bufsize);
+
+	if (!bufsize)
+		return;
+
+	debug(CCI_DB_CONN, "%s: setting socket buffer sizes to %u",
+		__func__, bufsize);
+
+	ret = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, opt_len);
+	if (ret) debug(CCI_DB_EP, "%s: unable to set SO_SNDBUF (%s)",
+			__func__, strerror(errno));
+
+	ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, opt_len);
+	if (ret) debug(CCI_DB_EP, "%s: unable to set SO_RCVBUF (%s)",
+			__func__, strerror(errno));
+
+	return;
+}
+
 static int ctp_tcp_create_endpoint(cci_device_t * device,
 				int flags,
 				cci_endpoint_t ** endpointp,
@@ -568,7 +1193,13 @@ static int ctp_tcp_create_endpoint(cci_device_t * device,
 
 	ep->rx_buf_cnt = TCP_EP_RX_CNT;
 	ep->tx_buf_cnt = TCP_EP_TX_CNT;
-	ep->buffer_len = dev->device.max_send_size + TCP_HDR_LEN;
+	/* larger messages get their own buffers */
+	ep->buffer_len = dev->device.max_send_size;
+	if (ep->buffer_len > TCP_MAX_MSS)
+		ep->buffer_len = TCP_MAX_MSS;
+	ep->buffer_len += TCP_HDR_LEN;
+	/* handles are refcounted, deferred deregistrations are safe */
+	ep->rma_cache = 1;
 	ep->tx_timeout = 0;
 
 	tep = ep->priv;
@@ -617,91 +1248,116 @@ static int ctp_tcp_create_endpoint(cci_device_t * device,
 	TAILQ_INIT(&tep->active);
 	TAILQ_INIT(&tep->passive);
 	TAILQ_INIT(&tep->closing);
+	TAILQ_INIT(&tep->rx_stalled);
 
 	TAILQ_INIT(&tep->idle_txs);
 	TAILQ_INIT(&tep->idle_rxs);
 	TAILQ_INIT(&tep->handles);
 	TAILQ_INIT(&tep->rma_ops);
 
-	tep->fds = calloc(TCP_EP_MAX_CONNS, sizeof(*tep->fds));
-	if (!tep->fds) {
-		ret = CCI_ENOMEM;
+	ret = cci__rma_reg_init(&tep->reg);
+	if (ret)
 		goto out;
-	}
 
-	tep->fds[0].fd = tep->sock;
-	tep->fds[0].events = POLLIN;
-	tep->nfds = 1;
-
-	tep->c = calloc(TCP_EP_MAX_CONNS, sizeof(*tep->c));
-	if (!tep->c) {
-		ret = CCI_ENOMEM;
+	/* room for every tx and rx, so delivering an event never fails */
+	ret = cci__evtq_init(&tep->evtq, ep->tx_buf_cnt + ep->rx_buf_cnt);
+	if (ret)
 		goto out;
-	}
-	/* NOTE: tep->c[0] is the listening socket and not a connection */
 
-	tep->tx_buf = calloc(1, ep->tx_buf_cnt * ep->buffer_len);
-	if (!tep->tx_buf) {
+	/* without threads, the application's calls drive the only poller */
+	if (ep->app_progress && tdev->progress_threads > 1)
+		debug(CCI_DB_WARN, "%s: ignoring progress_threads on an "
+			"endpoint without threads", __func__);
+	tep->npollers = tdev->progress_threads && !ep->app_progress ?
+		tdev->progress_threads : 1;
+	tep->pollers = calloc(tep->npollers, sizeof(*tep->pollers));
+	if (!tep->pollers) {
 		ret = CCI_ENOMEM;
 		goto out;
 	}
+#ifdef TCP_HAVE_IO_URING
+	tep->sring.fd = -1;
+	for (i = 0; i < (int) tep->npollers; i++)
+		tep->pollers[i].ring.fd = -1;
+#endif
 
-	tep->txs = calloc(1, ep->tx_buf_cnt * sizeof(tcp_tx_t));
-	if (!tep->txs) {
-		ret = CCI_ENOMEM;
-		goto out;
-	}
+	for (i = 0; i < (int) tep->npollers; i++) {
+		tcp_poller_t *poller = &tep->pollers[i];
 
-	/* alloc txs */
-	for (i = 0; i < (int) ep->tx_buf_cnt; i++) {
-		tcp_tx_t *tx = &tep->txs[i];
+		poller->ep = ep;
+		poller->id = i;
 
-		tx->id = i;
-		tx->ctx = TCP_CTX_TX;
+		poller->fds = calloc(TCP_EP_MAX_CONNS, sizeof(*poller->fds));
+		if (!poller->fds) {
+			ret = CCI_ENOMEM;
+			goto out;
+		}
 
-		tx->evt.event.type = CCI_EVENT_SEND;
-		tx->evt.ep = ep;
-		tx->buffer = (void*)((uintptr_t)tep->tx_buf + (i * ep->buffer_len));
-		tx->len = 0;
-		TAILQ_INSERT_TAIL(&tep->idle_txs, &tx->evt, entry);
+		poller->c = calloc(TCP_EP_MAX_CONNS, sizeof(*poller->c));
+		if (!poller->c) {
+			ret = CCI_ENOMEM;
+			goto out;
+		}
+	}
+
+	/* NOTE: pollers[0].c[0] is the listening socket and not a connection.
+	 * The other pollers leave slot 0 unused so that index 0 always
+	 * means "not monitored". */
+	tep->pollers[0].fds[0].fd = tep->sock;
+	tep->pollers[0].fds[0].events = POLLIN;
+	for (i = 0; i < (int) tep->npollers; i++) {
+		if (i)
+			tep->pollers[i].fds[0].fd = -1;
+		tep->pollers[i].nfds = 1;
 	}
 
-	tep->rx_buf = calloc(1, ep->rx_buf_cnt * ep->buffer_len);
-	if (!tep->rx_buf) {
+	tep->tx_slabs = calloc(TCP_SLABS(ep->tx_buf_cnt), sizeof(*tep->tx_slabs));
+	if (!tep->tx_slabs) {
 		ret = CCI_ENOMEM;
 		goto out;
 	}
 
-	tep->rxs = calloc(1, ep->rx_buf_cnt * sizeof(tcp_rx_t));
-	if (!tep->rxs) {
+	tep->rx_slabs = calloc(TCP_SLABS(ep->rx_buf_cnt), sizeof(*tep->rx_slabs));
+	if (!tep->rx_slabs) {
 		ret = CCI_ENOMEM;
 		goto out;
 	}
 
-	/* alloc rxs */
-	for (i = 0; i < (int) ep->rx_buf_cnt; i++) {
-		tcp_rx_t *rx = &tep->rxs[i];
-
-		rx->id = i;
-		rx->ctx = TCP_CTX_RX;
+	/* start with one slab of each, the rest is allocated on demand */
+	ret = tcp_grow_txs_locked(ep);
+	if (ret)
+		goto out;
 
-		rx->evt.event.type = CCI_EVENT_RECV;
-		rx->evt.ep = ep;
-		rx->buffer = (void*)((uintptr_t)tep->rx_buf + (i * ep->buffer_len));
-		rx->len = 0;
-		TAILQ_INSERT_TAIL(&tep->idle_rxs, &rx->evt, entry);
-	}
+	ret = tcp_grow_rxs_locked(ep);
+	if (ret)
+		goto out;
 
 	ret = tcp_set_nonblocking(tep->sock);
 	if (ret)
 		goto out;
 
+#ifdef TCP_FASTOPEN
+	{
+		/* accept requests carried on the client's SYN */
+		int qlen = SOMAXCONN;
+
+		if (setsockopt(tep->sock, IPPROTO_TCP, TCP_FASTOPEN,
+				&qlen, sizeof(qlen)))
+			debug(CCI_DB_EP, "%s: TCP_FASTOPEN failed with %s",
+				__func__, strerror(errno));
+	}
+#endif
+
 	ret = listen(tep->sock, SOMAXCONN);
 	if (ret) {
 		ret = errno;
 		goto out;
 	}
 
+#ifdef TCP_HAVE_IO_URING
+	tcp_uring_setup(ep);
+#endif
+
 	if (fd) {
 		ret = pipe(tep->pipe);
 		if (ret) {
@@ -709,8 +1365,12 @@ static int ctp_tcp_create_endpoint(cci_device_t * device,
 			goto out;
 		}
 		*fd = tep->pipe[0];
+	}
 
-		ret = tcp_create_thread(ep);
+	/* A single poller is driven by the application unless it asked for
+	 * an OS handle. Multiple pollers always get one worker each. */
+	if (fd || tep->npollers > 1) {
+		ret = tcp_create_threads(ep);
 		if (ret)
 			goto out;
 	}
@@ -719,20 +1379,21 @@ static int ctp_tcp_create_endpoint(cci_device_t * device,
 	return CCI_SUCCESS;
 
 out:
+	if (tep && tep->nthreads) {
+		ep->closing = 1;
+		tcp_terminate_threads(tep);
+	}
 	pthread_mutex_lock(&dev->lock);
 	if (!TAILQ_EMPTY(&dev->eps)) {
 		TAILQ_REMOVE(&dev->eps, ep, entry);
 	}
 	pthread_mutex_unlock(&dev->lock);
 	if (tep) {
-		free(tep->txs);
-		free(tep->tx_buf);
-
-		free(tep->rxs);
-		free(tep->rx_buf);
+		tcp_free_slabs(ep);
 
-		free(tep->fds);
+		tcp_free_pollers(tep);
 
+		cci__evtq_fini(&tep->evtq);
 		if (tep->ids)
 			free(tep->ids);
 		if (tep->sock)
@@ -751,17 +1412,135 @@ out:
 static inline void
 tcp_ignore_fd_locked(tcp_ep_t *tep, tcp_conn_t *tconn);
 
-/* NOTE: this calls tcp_ignore_fd_locked() which requires
- *	 the caller holds both ep->lock and tep->is_polling
+/* NOTE: caller must hold ep->lock */
+static inline void
+tcp_conn_detach_data_locked(cci__conn_t *conn, cci__conn_t *dconn)
+{
+	uint32_t i;
+	tcp_conn_t *tconn = conn->priv;
+
+	for (i = 0; i < tconn->ndata; i++) {
+		if (tconn->data[i] == dconn) {
+			tconn->data[i] = tconn->data[--tconn->ndata];
+			tconn->data[tconn->ndata] = NULL;
+			break;
+		}
+	}
+
+	return;
+}
+
+static inline tcp_tx_t *
+tcp_get_tx_locked(cci__ep_t *ep);
+
+static inline void
+tcp_set_events(tcp_conn_t *tconn, short events);
+
+/* Move the RMA fragments of a closing data socket (dconn) to its primary
+ * socket (conn). The queued ones, even if partly sent, did not reach the
+ * peer whole, so it cannot ack them. The sent ones may be lost with the
+ * socket: each is sent again in a new tx, whose id the peer acks, and a
+ * late ack of the old tx is ignored (see tcp_progress_rma()).
+ *
+ * NOTE: caller must hold ep->lock
  */
 static void
+tcp_conn_requeue_data_locked(cci__ep_t *ep, cci__conn_t *conn,
+				cci__conn_t *dconn)
+{
+	tcp_conn_t *tconn = conn->priv;
+	tcp_conn_t *dtconn = dconn->priv;
+	cci__evt_t *evt, *tmp;
+	struct tcp_evt_list moved = TAILQ_HEAD_INITIALIZER(moved);
+
+	cci__ep_lock(ep, &dtconn->slock);
+	TAILQ_FOREACH_SAFE(evt, &dtconn->queued, entry, tmp) {
+		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+
+		if (tx->msg_type == TCP_MSG_CONN_DATA)
+			continue;
+		TAILQ_REMOVE(&dtconn->queued, evt, entry);
+		tx->offset = 0;
+		tx->dconn = conn;
+		TAILQ_INSERT_TAIL(&moved, evt, entry);
+	}
+	TAILQ_FOREACH(evt, &dtconn->pending, entry) {
+		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+		tcp_tx_t *ntx = NULL;
+
+		if (!tx->rma_op)
+			continue;
+		ntx = tcp_get_tx_locked(ep);
+		if (!ntx) {
+			debug(CCI_DB_WARN, "%s: no tx to send RMA fragment "
+				"%u again", __func__, tx->rma_id);
+			continue;
+		}
+
+		memcpy(ntx->buffer, tx->buffer, tx->len);
+		((tcp_header_t *) ntx->buffer)->b = htonl(ntx->id);
+		ntx->msg_type = tx->msg_type;
+		ntx->flags = tx->flags;
+		ntx->state = TCP_TX_QUEUED;
+		ntx->len = tx->len;
+		ntx->rma_ptr = tx->rma_ptr;
+		ntx->rma_len = tx->rma_len;
+		ntx->rma_op = tx->rma_op;
+		ntx->rma_id = tx->rma_id;
+		ntx->dconn = conn;
+		ntx->evt.event = tx->evt.event;
+		ntx->evt.conn = tx->evt.conn;
+		tx->rma_op = NULL;
+		TAILQ_INSERT_TAIL(&moved, &ntx->evt, entry);
+	}
+	cci__ep_unlock(ep, &dtconn->slock);
+
+	if (TAILQ_EMPTY(&moved))
+		return;
+
+	debug(CCI_DB_CONN, "%s: moving the RMA fragments of data socket %p "
+		"to conn %p", __func__, (void*)dconn, (void*)conn);
+
+	cci__ep_lock(ep, &tconn->slock);
+	TAILQ_CONCAT(&tconn->queued, &moved, entry);
+	tcp_set_events(tconn, POLLIN | POLLOUT);
+	cci__ep_unlock(ep, &tconn->slock);
+
+	return;
+}
+
+/* NOTE: caller must hold ep->lock */
+static void
 tcp_conn_set_closing_locked(cci__ep_t *ep, cci__conn_t *conn)
 {
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
 
+	/* a data socket leaves its primary's stripe set and hands it its
+	 * RMA fragments, a primary takes its data sockets down with it */
+	if (tconn->primary) {
+		cci__conn_t *primary = tconn->primary;
+
+		tcp_conn_detach_data_locked(primary, conn);
+		tconn->primary = NULL;
+		tcp_conn_requeue_data_locked(ep, primary, conn);
+	}
+	while (tconn->ndata) {
+		cci__conn_t *dconn = tconn->data[--tconn->ndata];
+		tcp_conn_t *dtconn = dconn->priv;
+
+		tconn->data[tconn->ndata] = NULL;
+		dtconn->primary = NULL;
+		tcp_conn_set_closing_locked(ep, dconn);
+	}
+
 	tcp_ignore_fd_locked(tep, tconn);
 
+	if (tconn->rx_stalled) {
+		TAILQ_REMOVE(&tep->rx_stalled, tconn, rx_entry);
+		tconn->rx_stalled = 0;
+	}
+
 	if (tconn->status == TCP_CONN_READY)
 		TAILQ_REMOVE(&tep->conns, tconn, entry);
 	else if (tconn->status == TCP_CONN_ACTIVE1 ||
@@ -802,7 +1581,7 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 		ep->uri, tep->sock);
 
 	pthread_mutex_lock(&dev->lock);
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 
 	if (tep) {
 		cci__conn_t *conn;
@@ -810,15 +1589,18 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 
 		ep->closing = 1;
 
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		pthread_mutex_unlock(&dev->lock);
 		tcp_terminate_threads (tep);
 		pthread_mutex_lock(&dev->lock);
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 
 		if (tep->sock)
 			tcp_close_socket(tep->sock);
 
+		/* the conns are freed below */
+		TAILQ_INIT(&tep->rx_stalled);
+
 		while (!TAILQ_EMPTY(&tep->conns)) {
 			tconn = TAILQ_FIRST(&tep->conns);
 			conn = tconn->conn;
@@ -853,14 +1635,9 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 			free(conn->priv);
 			free(conn);
 		}
-		free(tep->txs);
-		free(tep->tx_buf);
-
-		free(tep->rxs);
-		free(tep->rx_buf);
+		tcp_free_slabs(ep);
 
-		free(tep->fds);
-		free(tep->c);
+		tcp_free_pollers(tep);
 
 		while (!TAILQ_EMPTY(&tep->rma_ops)) {
 			tcp_rma_op_t *rma_op = TAILQ_FIRST(&tep->rma_ops);
@@ -872,12 +1649,14 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 			TAILQ_REMOVE(&tep->handles, handle, entry);
 			free(handle);
 		}
+		cci__rma_reg_fini(&tep->reg);
+		cci__evtq_fini(&tep->evtq);
 		free(tep->ids);
 		free(tep);
 	}
 	ep->priv = NULL;
 	free((char *)ep->uri);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 	pthread_mutex_unlock(&dev->lock);
 
 	CCI_EXIT;
@@ -885,19 +1664,43 @@ static int ctp_tcp_destroy_endpoint(cci_endpoint_t * endpoint)
 }
 
 static inline tcp_tx_t *
-tcp_get_tx_locked(tcp_ep_t *tep)
+tcp_tx_by_id(cci__ep_t *ep, uint32_t id)
+{
+	tcp_ep_t *tep = ep->priv;
+	tcp_slab_t *slab;
+
+	if (id >= ep->tx_buf_cnt)
+		return NULL;
+	slab = &tep->tx_slabs[id / TCP_SLAB_CNT];
+	if (!slab->objs)
+		return NULL;
+
+	return &((tcp_tx_t *)slab->objs)[id % TCP_SLAB_CNT];
+}
+
+static inline tcp_tx_t *
+tcp_get_tx_locked(cci__ep_t *ep)
 {
+	tcp_ep_t *tep = ep->priv;
 	tcp_tx_t *tx = NULL;
 
+	if (TAILQ_EMPTY(&tep->idle_txs))
+		tcp_grow_txs_locked(ep);
+
 	if (!TAILQ_EMPTY(&tep->idle_txs)) {
 		cci__evt_t *evt = TAILQ_FIRST(&tep->idle_txs);
 		TAILQ_REMOVE(&tep->idle_txs, evt, entry);
 		tx = container_of(evt, tcp_tx_t, evt);
+		tep->tx_slabs[tx->id / TCP_SLAB_CNT].idle--;
+		tep->tx_idle--;
 		tx->offset = 0;
 		tx->rma_ptr = NULL;
 		tx->rma_len = 0;
 		tx->rma_op = NULL;
 		tx->rma_id = 0;
+		tx->dconn = NULL;
+		tx->rma_left = 0;
+		tx->stream = NULL;
 		tx->evt.conn = NULL;
 		debug(CCI_DB_MSG, "%s: getting tx %p buffer %p",
 			__func__, (void*)tx, (void*)tx->buffer);
@@ -908,12 +1711,11 @@ tcp_get_tx_locked(tcp_ep_t *tep)
 static inline tcp_tx_t *
 tcp_get_tx(cci__ep_t *ep, int allocate)
 {
-	tcp_ep_t *tep = ep->priv;
 	tcp_tx_t *tx = NULL;
 
-	pthread_mutex_lock(&ep->lock);
-	tx = tcp_get_tx_locked(tep);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	tx = tcp_get_tx_locked(ep);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (!tx && allocate) {
 		debug(CCI_DB_MSG, "%s: allocating a tx ***", __func__);
@@ -934,7 +1736,13 @@ tcp_put_tx_locked(tcp_ep_t *tep, tcp_tx_t *tx)
 	assert(tx->ctx == TCP_CTX_TX);
 	debug(CCI_DB_MSG, "%s: putting tx %p buffer %p",
 		__func__, (void*)tx, (void*)tx->buffer);
+	free(tx->large);
+	tx->large = NULL;
+	tx->waiter = NULL;
 	TAILQ_INSERT_HEAD(&tep->idle_txs, &tx->evt, entry);
+	tep->tx_slabs[tx->id / TCP_SLAB_CNT].idle++;
+	tep->tx_idle++;
+	tcp_shrink_txs_locked(tep, tx->id / TCP_SLAB_CNT);
 
 	return;
 }
@@ -945,22 +1753,28 @@ tcp_put_tx(tcp_tx_t *tx)
 	cci__ep_t *ep = tx->evt.ep;
 	tcp_ep_t *tep = ep->priv;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_put_tx_locked(tep, tx);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 }
 
 static inline tcp_rx_t *
-tcp_get_rx_locked(tcp_ep_t *tep)
+tcp_get_rx_locked(cci__ep_t *ep)
 {
+	tcp_ep_t *tep = ep->priv;
 	tcp_rx_t *rx = NULL;
 
+	if (TAILQ_EMPTY(&tep->idle_rxs))
+		tcp_grow_rxs_locked(ep);
+
 	if (!TAILQ_EMPTY(&tep->idle_rxs)) {
 		cci__evt_t *evt = TAILQ_FIRST(&tep->idle_rxs);
 		TAILQ_REMOVE(&tep->idle_rxs, evt, entry);
 		rx = container_of(evt, tcp_rx_t, evt);
+		tep->rx_slabs[rx->id / TCP_SLAB_CNT].idle--;
+		tep->rx_idle--;
 	}
 	return rx;
 }
@@ -968,12 +1782,11 @@ tcp_get_rx_locked(tcp_ep_t *tep)
 static inline tcp_rx_t *
 tcp_get_rx(cci__ep_t *ep)
 {
-	tcp_ep_t *tep = ep->priv;
 	tcp_rx_t *rx = NULL;
 
-	pthread_mutex_lock(&ep->lock);
-	rx = tcp_get_rx_locked(tep);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	rx = tcp_get_rx_locked(ep);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return rx;
 }
@@ -982,7 +1795,15 @@ static inline void
 tcp_put_rx_locked(tcp_ep_t *tep, tcp_rx_t *rx)
 {
 	assert(rx->ctx == TCP_CTX_RX);
+	free(rx->large);
+	rx->large = NULL;
 	TAILQ_INSERT_HEAD(&tep->idle_rxs, &rx->evt, entry);
+	tep->rx_slabs[rx->id / TCP_SLAB_CNT].idle++;
+	tep->rx_idle++;
+	tcp_shrink_rxs_locked(tep, rx->id / TCP_SLAB_CNT);
+
+	/* each returned rx lets one stalled conn read again */
+	tcp_rx_resume_locked(tep);
 
 	return;
 }
@@ -993,13 +1814,56 @@ tcp_put_rx(tcp_rx_t *rx)
 	cci__ep_t *ep = rx->evt.ep;
 	tcp_ep_t *tep = ep->priv;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_put_rx_locked(tep, rx);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 }
 
+/* Hand a completed event to the application. A blocking send is not
+ * queued, its sender is woken up instead.
+ */
+static inline void
+tcp_deliver_evt(tcp_ep_t *tep, cci__evt_t *evt)
+{
+	if (evt->event.type == CCI_EVENT_SEND) {
+		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+
+		if (tx->waiter) {
+			cci__waiter_wake(tx->waiter);
+			return;
+		}
+	}
+
+	/* the queue holds every tx and rx, it cannot be full */
+	if (cci__evtq_push(&tep->evtq, evt))
+		debug(CCI_DB_ERR, "%s: event queue full, dropping event %p",
+			__func__, (void*)evt);
+
+	return;
+}
+
+/* Draw the token that the peer must send on its data sockets. random()
+ * is seeded with the time, so read the kernel's generator. Returns 0 or
+ * errno. */
+static int tcp_get_token(uint64_t *token)
+{
+	int fd, ret = 0;
+	ssize_t len;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd == -1)
+		return errno;
+
+	len = read(fd, token, sizeof(*token));
+	if (len != (ssize_t) sizeof(*token))
+		ret = len == -1 ? errno : EIO;
+	close(fd);
+
+	return ret;
+}
+
 static int ctp_tcp_accept(cci_event_t *event, const void *context)
 {
 	cci_endpoint_t *endpoint;
@@ -1041,9 +1905,9 @@ static int ctp_tcp_accept(cci_event_t *event, const void *context)
 
 		close(tconn->fd);
 
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_REMOVE(&tep->passive, tconn, entry); /* FIXME */
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 
 		free((char*)conn->uri);
 		free(conn->priv);
@@ -1071,22 +1935,44 @@ static int ctp_tcp_accept(cci_event_t *event, const void *context)
 	evt->event.accept.context = (void *)context;
 	evt->event.accept.connection = &conn->connection;
 
+	/* without a token, the client opens no data sockets */
+	if (tconn->max_data) {
+		int ret = tcp_get_token(&tconn->token);
+
+		if (ret) {
+			debug(CCI_DB_WARN, "%s: no data sockets, reading "
+				"/dev/urandom failed with %s", __func__,
+				strerror(ret));
+			tconn->max_data = 0;
+		}
+	}
+
 	/* pack the msg */
 
 	hdr = (tcp_header_t *) tx->buffer;
-	tcp_pack_conn_reply(hdr, CCI_SUCCESS, tx->id);
+	tcp_pack_conn_reply(hdr, CCI_SUCCESS, client_tx_id);
 	hs = (tcp_handshake_t *) ((uintptr_t)tx->buffer + sizeof(*hdr));
 	tcp_pack_handshake(hs, ep->rx_buf_cnt,
-			   conn->connection.max_send_size, 0, tx->id);
+			   conn->connection.max_send_size, 0, tx->id,
+			   tconn->max_data, tconn->id, tconn->token);
 
 	tx->len = sizeof(*hdr) + sizeof(*hs);
 
+	/* The client does not ack the reply. Anything we send after it
+	 * arrives after it, so the conn is usable now. The accept event
+	 * is delivered once the reply is sent. */
+	cci__ep_lock(ep, &ep->lock);
+	tconn->status = TCP_CONN_READY;
+	TAILQ_REMOVE(&tep->passive, tconn, entry);
+	TAILQ_INSERT_TAIL(&tep->conns, tconn, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
 	/* insert at tail of tep's queued list */
 
 	tx->state = TCP_TX_QUEUED;
-	pthread_mutex_lock(&tconn->slock);
+	cci__ep_lock(ep, &tconn->slock);
 	TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&tconn->slock);
+	cci__ep_unlock(ep, &tconn->slock);
 
 	/* try to progress txs */
 
@@ -1104,9 +1990,9 @@ static int ctp_tcp_accept(cci_event_t *event, const void *context)
  */
 static int ctp_tcp_reject(cci_event_t *event)
 {
-	int ret = CCI_SUCCESS, ready = 0;
+	int ret = CCI_SUCCESS;
 	uint32_t a;
-	uint32_t unused;
+	uint32_t client_tx_id;
 	cci__evt_t *evt = NULL;
 	cci__ep_t *ep = NULL;
 	cci__conn_t *conn = NULL;
@@ -1133,7 +2019,7 @@ static int ctp_tcp_reject(cci_event_t *event)
 	rx = container_of(evt, tcp_rx_t, evt);
 
 	hdr = rx->buffer;
-	tcp_parse_header(hdr, &type, &a, &unused);
+	tcp_parse_header(hdr, &type, &a, &client_tx_id);
 
 	/* get a tx */
 	tx = tcp_get_tx(ep, 0);
@@ -1157,16 +2043,16 @@ static int ctp_tcp_reject(cci_event_t *event)
 	/* prepare conn_reply */
 
 	hdr = (tcp_header_t *) tx->buffer;
-	tcp_pack_conn_reply(hdr, CCI_ECONNREFUSED, tx->id);
+	tcp_pack_conn_reply(hdr, CCI_ECONNREFUSED, client_tx_id);
 
 	tx->len = sizeof(*hdr);
 
 	/* insert at tail of endpoint's queued list */
 
 	tx->state = TCP_TX_QUEUED;
-	pthread_mutex_lock(&tconn->slock);
+	cci__ep_lock(ep, &tconn->slock);
 	TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&tconn->slock);
+	cci__ep_unlock(ep, &tconn->slock);
 
 	/* try to progress txs */
 
@@ -1177,75 +2063,15 @@ static int ctp_tcp_reject(cci_event_t *event)
 	debug((CCI_DB_MSG | CCI_DB_CONN), "ep %d sending reject to %s",
 	      tep->sock, name);
 
-	do {
-		pthread_mutex_lock(&ep->lock);
-		if (!tep->is_polling) {
-			tep->is_polling++;
-			ready = 1;
-		}
-		pthread_mutex_unlock(&ep->lock);
-	} while (!ready);
-
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_conn_set_closing_locked(ep, conn);
-	tep->is_polling--;
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 out:
 	CCI_EXIT;
 	return ret;
 }
 
-static int tcp_getaddrinfo(const char *uri, in_addr_t * in, uint16_t * port)
-{
-	int ret;
-	char *hostname, *svc, *colon;
-	struct addrinfo *ai = NULL, hints;
-
-	if (0 == strncmp("tcp://", uri, 6))
-		hostname = strdup(&uri[6]);
-	else {
-		debug(CCI_DB_CONN, "%s: invalid URI %s", __func__, uri);
-		CCI_EXIT;
-		return CCI_EINVAL;
-	}
-
-	colon = strchr(hostname, ':');
-	if (colon) {
-		*colon = '\0';
-	} else {
-		debug(CCI_DB_CONN, "%s: invalid URI %s", __func__, uri);
-		free(hostname);
-		CCI_EXIT;
-		return CCI_EINVAL;
-	}
-
-	colon++;
-	svc = colon;
-
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-
-	ret = getaddrinfo(hostname, svc, &hints, &ai);
-	free(hostname);
-
-	if (ret) {
-		if (ai)
-			freeaddrinfo(ai);
-		CCI_EXIT;
-		return ret;
-	}
-
-	*in = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
-	*port = ((struct sockaddr_in *)ai->ai_addr)->sin_port;
-	freeaddrinfo(ai);
-
-	CCI_EXIT;
-	return CCI_SUCCESS;
-}
-
 static inline int
 tcp_new_conn(cci__ep_t *ep, struct sockaddr_in sin, int fd, cci__conn_t **connp)
 {
@@ -1278,6 +2104,9 @@ tcp_new_conn(cci__ep_t *ep, struct sockaddr_in sin, int fd, cci__conn_t **connp)
 	TAILQ_INIT(&tconn->rmas);
 	TAILQ_INIT(&tconn->queued);
 	TAILQ_INIT(&tconn->pending);
+	tconn->rma_frag = TCP_RMA_FRAG_SIZE;
+	tconn->rma_depth = TCP_RMA_DEPTH;
+	tconn->rma_grow = 1;
 
 	memcpy(&tconn->sin, &sin, sizeof(sin));
 
@@ -1289,6 +2118,10 @@ tcp_new_conn(cci__ep_t *ep, struct sockaddr_in sin, int fd, cci__conn_t **connp)
 	if (ret)
 		goto out_with_rlock;
 
+	cci__ep_lock(ep, &ep->lock);
+	tconn->id = ((tcp_ep_t *)ep->priv)->conn_id++;
+	cci__ep_unlock(ep, &ep->lock);
+
 	*connp = conn;
 
 	return ret;
@@ -1306,8 +2139,10 @@ static inline int
 tcp_monitor_fd(cci__ep_t *ep, cci__conn_t *conn, int events)
 {
 	int ret = CCI_SUCCESS, one = 1;
+	uint32_t i;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
+	tcp_poller_t *poller = NULL;
 
 	ret = tcp_set_nonblocking(tconn->fd);
 	if (ret)
@@ -1317,60 +2152,89 @@ tcp_monitor_fd(cci__ep_t *ep, cci__conn_t *conn, int events)
 	if (ret)
 		goto out;
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->index = tep->nfds++;
-	assert(tep->nfds < TCP_EP_MAX_CONNS);
-	tep->fds[tconn->index].fd = tconn->fd;
-	tep->fds[tconn->index].events = events;
-	tep->c[tconn->index] = conn;
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	/* hand the socket to the least loaded poller */
+	poller = &tep->pollers[0];
+	for (i = 1; i < tep->npollers; i++) {
+		if (tep->pollers[i].nfds < poller->nfds)
+			poller = &tep->pollers[i];
+	}
+	tconn->poller = poller;
+	tconn->index = poller->nfds++;
+	assert(poller->nfds < TCP_EP_MAX_CONNS);
+	poller->fds[tconn->index].fd = tconn->fd;
+	poller->fds[tconn->index].events = events;
+	poller->fds[tconn->index].revents = 0;
+	poller->c[tconn->index] = conn;
+#ifdef TCP_HAVE_IO_URING
+	/* submitted with the poller's next round */
+	if (tep->uring)
+		tcp_uring_arm_locked(poller, tconn->index);
+#endif
+	cci__ep_unlock(ep, &ep->lock);
 
-	debug(CCI_DB_CONN, "%s: tconn->index = %u tep->nfds = %u",
-		__func__, tconn->index, (unsigned) tep->nfds);
+	debug(CCI_DB_CONN, "%s: poller %u tconn->index = %u nfds = %u",
+		__func__, poller->id, tconn->index, (unsigned) poller->nfds);
 
 out:
 	return ret;
 }
 
-/* NOTE: caller must have both ep->lock _and_ ep->is_polling
- *       to prevent the poll_events() from accessing these
- *       structures.
+/* NOTE: caller must hold ep->lock and the poller must not be polling
+ *       since poll_events() accesses these structures.
  */
 static inline void
-tcp_ignore_fd_locked(tcp_ep_t *tep, tcp_conn_t *tconn)
+tcp_poller_remove_locked(tcp_poller_t *poller, tcp_conn_t *tconn)
 {
 	uint32_t index = tconn->index, nfds = 0;
 	cci__conn_t *conn = tconn->conn;
+#ifdef TCP_HAVE_IO_URING
+	tcp_ep_t *tep = poller->ep->priv;
+#endif
 
-	/* If 1, then only the listening socket is open */
-	if (tep->nfds == 1 || index == 0)
-		return;
+	nfds = --poller->nfds;
 
-	nfds = --tep->nfds;
+#ifdef TCP_HAVE_IO_URING
+	/* the ring holds a reference on the socket until its poll is gone */
+	if (tep->uring) {
+		tcp_uring_disarm_locked(poller, index);
+		if (index != nfds)
+			tcp_uring_disarm_locked(poller, nfds);
+	}
+#endif
 
-	debug(CCI_DB_CONN, "%s: conn=%p tconn=%p tconn->index=%u nfds=%u",
-		__func__, (void*)conn, (void*)tconn, index, nfds);
+	debug(CCI_DB_CONN, "%s: poller %u conn=%p tconn=%p tconn->index=%u "
+		"nfds=%u", __func__, poller->id, (void*)conn, (void*)tconn,
+		index, nfds);
 
 	if (index != nfds) {
 		/* The closing conn is not the last conn.
 		 * Move the last conn to the closing conn's place.
 		 */
-		cci__conn_t *c = tep->c[nfds];
+		cci__conn_t *c = poller->c[nfds];
 		tcp_conn_t *tc = c->priv;
 
 		debug(CCI_DB_CONN, "%s: moving conn %p from index %u to %u",
 			__func__, (void*)c, nfds, index);
 
-		tep->fds[index].fd = tep->fds[nfds].fd;
-		tep->fds[index].events = tep->fds[nfds].events;
-		tep->c[index] = tep->c[nfds];
+		poller->fds[index].fd = poller->fds[nfds].fd;
+		poller->fds[index].events = poller->fds[nfds].events;
+		poller->c[index] = poller->c[nfds];
 		tc->index = index;
+#ifdef TCP_HAVE_IO_URING
+		if (tep->uring)
+			tcp_uring_arm_locked(poller, index);
+#endif
 
 		index = nfds;
 	}
-	tep->fds[nfds].fd = 0;
-	tep->fds[nfds].events = 0;
-	tep->c[nfds] = NULL;
+	poller->fds[nfds].fd = 0;
+	poller->fds[nfds].events = 0;
+	poller->c[nfds] = NULL;
+#ifdef TCP_HAVE_IO_URING
+	if (tep->uring)
+		tcp_uring_enter(&poller->ring, 0);
+#endif
 
 	close(tconn->fd);
 	tconn->index = 0;
@@ -1378,105 +2242,291 @@ tcp_ignore_fd_locked(tcp_ep_t *tep, tcp_conn_t *tconn)
 	return;
 }
 
-static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
-			const void *data_ptr, uint32_t data_len,
-			cci_conn_attribute_t attribute,
-			const void *context, int flags, const struct timeval *timeout)
+/* NOTE: caller must hold ep->lock. If the owning poller is polling,
+ *       the socket is only marked and the poller removes it once it
+ *       has processed its poll results.
+ */
+static inline void
+tcp_ignore_fd_locked(tcp_ep_t *tep, tcp_conn_t *tconn)
 {
-	int ret, fd = -1;
-	cci__ep_t *ep = NULL;
-	cci__dev_t *dev = NULL;
-	cci__conn_t *conn = NULL;
-	tcp_ep_t *tep = NULL;
-	tcp_dev_t *tdev = NULL;
-	tcp_conn_t *tconn = NULL;
-	tcp_tx_t *tx = NULL;
-	tcp_header_t *hdr = NULL;
-	cci__evt_t *evt = NULL;
-	struct sockaddr_in sin;
-	socklen_t slen = sizeof(sin);
-	void *ptr = NULL;
-	in_addr_t ip;
-	tcp_handshake_t *hs = NULL;
-	uint16_t port;
-	uint32_t keepalive = 0ULL;
+	tcp_poller_t *poller = tconn->poller;
 
-	CCI_ENTER;
+	if (!poller || tconn->index == 0 || tconn->ignore)
+		return;
 
-	if (!tglobals) {
-		CCI_EXIT;
-		return CCI_ENODEV;
+	if (poller->is_polling) {
+		tconn->ignore = 1;
+		poller->deferred++;
+		return;
 	}
 
-	/* get our endpoint and device */
-	ep = container_of(endpoint, cci__ep_t, endpoint);
-	tep = ep->priv;
-	dev = ep->dev;
-	tdev = dev->priv;
-
-	memset(&sin, 0, sizeof(sin));
-	sin.sin_family = AF_INET;
-
-	ret = tcp_getaddrinfo(server_uri, &ip, &port);
-	if (ret)
-		goto out;
-	sin.sin_addr.s_addr = ip;	/* already in network order */
-	sin.sin_port = port;	/* already in network order */
+	tcp_poller_remove_locked(poller, tconn);
 
-	ret = socket(PF_INET, SOCK_STREAM, 0);
-	if (ret == -1) {
-		ret = errno;
-		debug(CCI_DB_CONN, "%s: socket returned %s", __func__, strerror(ret));
-		goto out;
-	}
-	fd = ret;
+	return;
+}
 
-	if (tdev->bufsize) {
-		uint32_t bufsize = tdev->bufsize;
-		socklen_t opt_len = sizeof(bufsize);
+/* Set the poll events for a conn's socket, if it is still monitored */
+static inline void
+tcp_set_events(tcp_conn_t *tconn, short events)
+{
+	/* a stalled conn is read again by tcp_rx_resume_locked() */
+	if (tconn->rx_stalled)
+		events &= ~POLLIN;
+	if (tconn->poller && tconn->index)
+		tconn->poller->fds[tconn->index].events = events;
+}
 
-		debug(CCI_DB_CONN, "%s: setting socket buffer sizes to %u",
-			__func__, bufsize);
+/* Stop reading from tconn until an rx is returned. Its socket would stay
+ * readable, so the peer is instead held back by its TCP window.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_rx_stall_locked(tcp_ep_t *tep, tcp_conn_t *tconn)
+{
+	if (tconn->poller && tconn->index)
+		tconn->poller->fds[tconn->index].events &= ~POLLIN;
+	if (tconn->rx_stalled)
+		return;
 
-		ret = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, opt_len);
-		if (ret) debug(CCI_DB_EP, "%s: unable to set SO_SNDBUF (%s)",
-				__func__, strerror(errno));
+	debug(CCI_DB_MSG, "%s: no rxs available, stop reading conn %p",
+		__func__, (void*)tconn->conn);
+	tconn->rx_stalled = 1;
+	TAILQ_INSERT_TAIL(&tep->rx_stalled, tconn, rx_entry);
 
-		ret = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, opt_len);
-		if (ret) debug(CCI_DB_EP, "%s: unable to set SO_RCVBUF (%s)",
-				__func__, strerror(errno));
-	}
+	return;
+}
 
-	ret = tcp_new_conn(ep, sin, fd, &conn);
-	if (ret)
-		goto out;
+/* Resume reading from the conn that stalled first. Conns take turns so
+ * that one busy peer cannot take every returned rx.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_rx_resume_locked(tcp_ep_t *tep)
+{
+	tcp_conn_t *tconn = TAILQ_FIRST(&tep->rx_stalled);
+	tcp_poller_t *poller = NULL;
 
-	conn->connection.attribute = attribute;
-	conn->connection.context = (void *)context;
-	conn->uri = strdup(server_uri);
+	if (!tconn)
+		return;
 
-	/* set up tcp specific info */
+	TAILQ_REMOVE(&tep->rx_stalled, tconn, rx_entry);
+	tconn->rx_stalled = 0;
 
-	tconn = conn->priv;
-	tconn->status = TCP_CONN_ACTIVE1;
+	poller = tconn->poller;
+	if (!poller || !tconn->index)
+		return;
 
-	/* Dealing with keepalive, if set, include the keepalive timeout value into
-	   the connection request */
-	if ((((attribute & CCI_CONN_ATTR_RO) == CCI_CONN_ATTR_RO)
-	     || ((attribute & CCI_CONN_ATTR_RU) == CCI_CONN_ATTR_RU))
-	    && ep->keepalive_timeout != 0UL) {
-		keepalive = ep->keepalive_timeout;
+	poller->fds[tconn->index].events |= POLLIN;
+#ifdef TCP_HAVE_IO_URING
+	/* submitted with the poller's next round */
+	if (tconn->rx_disarmed) {
+		tconn->rx_disarmed = 0;
+		tcp_uring_arm_locked(poller, tconn->index);
 	}
+#endif
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&tep->active, tconn, entry);
-	pthread_mutex_unlock(&ep->lock);
+	return;
+}
 
-	/* get a tx */
-	tx = tcp_get_tx(ep, 0);
-	if (!tx) {
-		ret = CCI_ENOBUFS;
-		goto out;
+/* Start a non-blocking connect. Where TCP Fast Open is available, the
+ * CONN_REQUEST in tx goes out with the SYN (if we hold a cookie for the
+ * server) and tx->offset records how much was sent. Returns 0 when the
+ * connect is in progress. */
+static int tcp_start_connect(int fd, struct sockaddr_in *sin, tcp_tx_t *tx)
+{
+	int ret;
+
+#ifdef MSG_FASTOPEN
+	ret = sendto(fd, tx->buffer, tx->len, MSG_FASTOPEN,
+			(struct sockaddr *)sin, sizeof(*sin));
+	if (ret >= 0) {
+		debug(CCI_DB_CONN, "%s: sent %d bytes with the SYN",
+			__func__, ret);
+		tx->offset = ret;
+		return 0;
+	}
+	ret = errno;
+	if (ret == EINPROGRESS)
+		return 0;
+	if (ret != EOPNOTSUPP) {
+		debug(CCI_DB_CONN, "%s: sendto() returned %s",
+			__func__, strerror(ret));
+		return ret;
+	}
+	/* fast open is disabled, fall back to connect() */
+#endif
+	ret = connect(fd, (struct sockaddr *)sin, sizeof(*sin));
+	if (ret) {
+		ret = errno;
+		if (ret == EINPROGRESS)
+			return 0;
+		debug(CCI_DB_CONN, "%s: connect() returned %s",
+			__func__, strerror(ret));
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Open the socket of a connecting conn and start the connect. The
+ * CONN_REQUEST is the first tx queued on the conn. */
+static int
+tcp_connect_start(cci__ep_t *ep, cci__conn_t *conn, uint32_t ip, uint16_t port)
+{
+	int ret, fd;
+	tcp_dev_t *tdev = ep->dev->priv;
+	tcp_conn_t *tconn = conn->priv;
+	tcp_tx_t *tx = container_of(TAILQ_FIRST(&tconn->queued), tcp_tx_t, evt);
+
+	tconn->sin.sin_addr.s_addr = ip;	/* already in network order */
+	tconn->sin.sin_port = port;	/* already in network order */
+
+	fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+		ret = errno;
+		debug(CCI_DB_CONN, "%s: socket returned %s", __func__, strerror(ret));
+		return ret;
+	}
+
+	tcp_set_bufsize(fd, tdev->bufsize);
+
+	/* Initiate the connect before a poller sees the socket, an
+	 * unconnected socket polls as hung up. */
+	ret = tcp_set_nonblocking(fd);
+	if (!ret)
+		ret = tcp_start_connect(fd, &tconn->sin, tx);
+	if (ret) {
+		close(fd);
+		return ret;
+	}
+	tconn->fd = fd;
+
+	/* we will have to check for POLLOUT to determine when
+	 * the connect completed
+	 */
+	ret = tcp_monitor_fd(ep, conn, POLLOUT);
+	if (ret) {
+		close(fd);
+		tconn->fd = -1;
+	}
+
+	return ret;
+}
+
+/* Resolver callback for connects to names that needed a lookup. Failures
+ * are reported with the CONNECT event. */
+static void
+tcp_connect_resolved(cci__ep_t *ep, void *arg, int status,
+			uint32_t ip, uint16_t port)
+{
+	cci__conn_t *conn = arg;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+	cci__evt_t *evt = NULL;
+
+	if (!status)
+		status = tcp_connect_start(ep, conn, ip, port);
+	if (!status)
+		return;
+
+	debug(CCI_DB_CONN, "%s: connect to %s failed with %s", __func__,
+		conn->uri, cci_strerror(&ep->endpoint, status));
+
+	evt = TAILQ_FIRST(&tconn->queued);
+	TAILQ_REMOVE(&tconn->queued, evt, entry);
+	evt->conn = NULL;
+	evt->event.connect.status = status;
+	evt->event.connect.connection = NULL;
+	container_of(evt, tcp_tx_t, evt)->state = TCP_TX_COMPLETED;
+
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_REMOVE(&tep->active, tconn, entry);
+	cci__ep_unlock(ep, &ep->lock);
+	tcp_deliver_evt(tep, evt);
+
+	pthread_mutex_destroy(&tconn->rlock);
+	pthread_mutex_destroy(&tconn->slock);
+	free((char *)conn->uri);
+	free(tconn);
+	free(conn);
+
+	return;
+}
+
+static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
+			const void *data_ptr, uint32_t data_len,
+			cci_conn_attribute_t attribute,
+			const void *context, int flags, const struct timeval *timeout)
+{
+	int ret;
+	cci__ep_t *ep = NULL;
+	cci__dev_t *dev = NULL;
+	cci__conn_t *conn = NULL;
+	tcp_ep_t *tep = NULL;
+	tcp_dev_t *tdev = NULL;
+	tcp_conn_t *tconn = NULL;
+	tcp_tx_t *tx = NULL;
+	tcp_header_t *hdr = NULL;
+	cci__evt_t *evt = NULL;
+	struct sockaddr_in sin;
+	void *ptr = NULL;
+	uint32_t ip;
+	tcp_handshake_t *hs = NULL;
+	uint16_t port;
+	uint32_t keepalive = 0ULL;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	/* get our endpoint and device */
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
+	dev = ep->dev;
+	tdev = dev->priv;
+
+	/* the address is set once the name is resolved */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+
+	ret = tcp_new_conn(ep, sin, -1, &conn);
+	if (ret)
+		goto out;
+
+	conn->connection.attribute = attribute;
+	conn->connection.context = (void *)context;
+	conn->uri = strdup(server_uri);
+
+	/* set up tcp specific info */
+
+	tconn = conn->priv;
+	tconn->status = TCP_CONN_ACTIVE1;
+
+	/* Dealing with keepalive, if set, include the keepalive timeout value into
+	   the connection request */
+	if ((((attribute & CCI_CONN_ATTR_RO) == CCI_CONN_ATTR_RO)
+	     || ((attribute & CCI_CONN_ATTR_RU) == CCI_CONN_ATTR_RU))
+	    && ep->keepalive_timeout != 0UL) {
+		keepalive = ep->keepalive_timeout;
+	}
+
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_INSERT_TAIL(&tep->active, tconn, entry);
+	cci__ep_unlock(ep, &ep->lock);
+
+	/* get a tx */
+	tx = tcp_get_tx(ep, 0);
+	if (!tx) {
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_REMOVE(&tep->active, tconn, entry);
+		cci__ep_unlock(ep, &ep->lock);
+		ret = CCI_ENOBUFS;
+		goto out;
 	}
 
 	tx->rma_ptr = NULL;
@@ -1502,8 +2552,10 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	hs = (tcp_handshake_t *) & hdr->data;
 	if (keepalive != 0UL)
 		conn->keepalive_timeout = keepalive;
+	tconn->max_data = tdev->data_socks;
 	tcp_pack_handshake(hs, ep->rx_buf_cnt,
-			    conn->connection.max_send_size, keepalive, 0);
+			    conn->connection.max_send_size, keepalive, 0,
+			    tconn->max_data, 0, 0);
 
 	tx->len += sizeof(*hs);
 	ptr = (void*)((uintptr_t)tx->buffer + tx->len);
@@ -1516,57 +2568,36 @@ static int ctp_tcp_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	tx->len += data_len;
 	assert(tx->len <= ep->buffer_len);
 
-	/* start connect now */
-	ret = socket(PF_INET, SOCK_STREAM, 0);
-	if (ret == -1) {
-		ret = errno;
-		debug(CCI_DB_CONN, "%s: socket returned %s", __func__, strerror(ret));
-		goto out;
-	}
-	tconn->fd = ret;
-
-	/* we will have to check for POLLOUT to determine when
-	 * the connect completed
-	 */
-	ret = tcp_monitor_fd(ep, conn, POLLOUT);
-	if (ret)
-		goto out;
-
 	tx->state = TCP_TX_QUEUED;
 
 	/* insert at tail of conn's queued list */
-	pthread_mutex_lock(&tconn->slock);
+	cci__ep_lock(ep, &tconn->slock);
 	TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
-	pthread_mutex_unlock(&tconn->slock);
+	cci__ep_unlock(ep, &tconn->slock);
 
-	/* ok, initiate connect()... */
-	ret = connect(tconn->fd, (struct sockaddr *)&sin, slen);
-	if (ret) {
-		ret = errno;
-		if (ret != EINPROGRESS) {
-			debug(CCI_DB_CONN, "%s: connect() returned %s",
-				__func__, strerror(ret));
-			goto out;
-		}
-	} else {
-		/* TODO connect completed, send CONN_REQUEST */
-		debug(CCI_DB_CONN, "%s: connect() completed", __func__);
-		tep->fds[tconn->index].events = POLLIN | POLLOUT;
+	/* names that need a lookup finish in tcp_connect_resolved() */
+	ret = cci__resolve(ep, server_uri, "tcp://", SOCK_STREAM, &ip, &port,
+			tcp_connect_resolved, conn);
+	if (ret == CCI_EAGAIN) {
+		CCI_EXIT;
+		return CCI_SUCCESS;
+	} else if (ret) {
+		goto out;
 	}
 
-	/* try to progress txs */
-
-	tcp_progress_conn_sends(conn, 0);
+	ret = tcp_connect_start(ep, conn, ip, port);
+	if (ret)
+		goto out;
 
 	CCI_EXIT;
 	return CCI_SUCCESS;
 
 out:
 	if (conn) {
-		if (ret == CCI_ENOBUFS) {
-			pthread_mutex_lock(&ep->lock);
+		if (tx) {
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_REMOVE(&tep->active, tconn, entry);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 		}
 
 		free((char *)conn->uri);
@@ -1584,7 +2615,6 @@ static int ctp_tcp_disconnect(cci_connection_t * connection)
 	cci__conn_t *conn = NULL;
 	cci__ep_t *ep = NULL;
 	tcp_ep_t *tep = NULL;
-	int ready = 0;
 
 	CCI_ENTER;
 
@@ -1597,24 +2627,59 @@ static int ctp_tcp_disconnect(cci_connection_t * connection)
 	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
 
-	do {
-		pthread_mutex_lock(&ep->lock);
-		if (!tep->is_polling) {
-			tep->is_polling++;
-			ready = 1;
-		}
-		pthread_mutex_unlock(&ep->lock);
-	} while (!ready);
-
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_conn_set_closing_locked(ep, conn);
-	tep->is_polling--;
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	CCI_EXIT;
 	return CCI_SUCCESS;
 }
 
+/* Record the file backing a registered region so that reads of the
+ * region are sent with sendfile(). We keep our own descriptor.
+ */
+static int tcp_rma_set_file(cci__ep_t *ep, const cci_rma_file_t *file)
+{
+#ifdef HAVE_SENDFILE
+	int ret = CCI_SUCCESS, fd = -1, old = -1;
+	tcp_ep_t *tep = ep->priv;
+	tcp_rma_handle_t *handle = NULL;
+	struct stat st;
+
+	if (!file->rma_handle || file->fd < 0)
+		return CCI_EINVAL;
+
+	if (fstat(file->fd, &st) || !S_ISREG(st.st_mode)) {
+		debug(CCI_DB_INFO, "%s: fd %d is not a regular file",
+			__func__, file->fd);
+		return CCI_EINVAL;
+	}
+
+	fd = dup(file->fd);
+	if (fd == -1)
+		return errno;
+
+	cci__ep_lock(ep, &ep->lock);
+	handle = cci__rma_reg_lookup(&tep->reg, file->rma_handle->stuff[0]);
+	if (handle && file->offset + handle->length <= (uint64_t) st.st_size) {
+		old = handle->fd;
+		handle->fd = fd;
+		handle->file_offset = file->offset;
+	} else {
+		ret = CCI_EINVAL;
+		old = fd;
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (old != -1)
+		close(old);
+
+	return ret;
+#else
+	return CCI_ERR_NOT_IMPLEMENTED;
+#endif
+}
+
 static int ctp_tcp_set_opt(cci_opt_handle_t * handle,
 			cci_opt_name_t name, const void *val)
 {
@@ -1648,6 +2713,15 @@ static int ctp_tcp_set_opt(cci_opt_handle_t * handle,
 		conn = container_of(handle, cci__conn_t, connection);
 		conn->tx_timeout = *((uint32_t*) val);
 		break;
+	case CCI_OPT_ENDPT_RMA_FILE:
+		ep = container_of(handle, cci__ep_t, endpoint);
+		ret = tcp_rma_set_file(ep, val);
+		break;
+	case CCI_OPT_ENDPT_NUMA_NODE:
+	case CCI_OPT_ENDPT_CPUS:
+		ep = container_of(handle, cci__ep_t, endpoint);
+		ret = tcp_set_affinity(ep, name, val);
+		break;
 	default:
 		debug(CCI_DB_INFO, "unknown option %u", name);
 		ret = CCI_EINVAL;
@@ -1686,11 +2760,26 @@ static int ctp_tcp_arm_os_handle(cci_endpoint_t * endpoint, int flags)
 	return CCI_ERR_NOT_IMPLEMENTED;
 }
 
+/* Without an event, tell the application whether it holds all rxs.
+ * The unlocked read may be stale, it only picks the return code.
+ */
+static inline int
+tcp_no_event(cci__ep_t *ep)
+{
+	tcp_ep_t *tep = ep->priv;
+
+	if (TAILQ_EMPTY(&tep->idle_rxs) &&
+	    __atomic_load_n(&tep->rx_nslabs, __ATOMIC_RELAXED) ==
+	    TCP_SLABS(ep->rx_buf_cnt))
+		return CCI_ENOBUFS;
+	return CCI_EAGAIN;
+}
+
 static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const event)
 {
 	int ret = CCI_SUCCESS;
 	cci__ep_t *ep;
-	cci__evt_t *ev = NULL, *e;
+	cci__evt_t *ev = NULL;
 	tcp_ep_t *tep;
 
 	CCI_ENTER;
@@ -1703,39 +2792,13 @@ static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const eve
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
 
-	if (!tep->pipe[0])
+	if (!tep->nthreads)
 		tcp_progress_ep(ep);
 
-	pthread_mutex_lock(&ep->lock);
-
-	/* give the user the first event */
-	TAILQ_FOREACH(e, &ep->evts, entry) {
-		if (e->event.type == CCI_EVENT_SEND) {
-			/* NOTE: if it is blocking, skip it since tcp_sendv()
-			 * is waiting on it
-			 */
-			tcp_tx_t *tx = container_of(e, tcp_tx_t, evt);
-			if (tx->flags & CCI_FLAG_BLOCKING) {
-				continue;
-			} else {
-				ev = e;
-				break;
-			}
-		} else {
-			ev = e;
-			break;
-		}
-	}
-
-	if (ev) {
-		TAILQ_REMOVE(&ep->evts, ev, entry);
-	} else {
-		ret = CCI_EAGAIN;
-		if (TAILQ_EMPTY(&tep->idle_rxs))
-			ret = CCI_ENOBUFS;
-	}
-
-	pthread_mutex_unlock(&ep->lock);
+	/* give the user the first event, blocking sends are never queued */
+	ev = cci__evtq_pop(&tep->evtq);
+	if (!ev)
+		ret = tcp_no_event(ep);
 
 	/* TODO drain fd so that they can block again */
 
@@ -1745,13 +2808,14 @@ static int ctp_tcp_get_event(cci_endpoint_t * endpoint, cci_event_t ** const eve
 	return ret;
 }
 
-static int ctp_tcp_return_event(cci_event_t * event)
+/* Sleep until an event is queued or until the deadline. */
+static int ctp_tcp_wait_event(cci_endpoint_t * endpoint,
+			      cci_event_t ** const event,
+			      const struct timespec *deadline)
 {
 	cci__ep_t *ep;
+	cci__evt_t *ev = NULL;
 	tcp_ep_t *tep;
-	cci__evt_t *evt;
-	tcp_tx_t *tx;
-	tcp_rx_t *rx;
 
 	CCI_ENTER;
 
@@ -1760,61 +2824,245 @@ static int ctp_tcp_return_event(cci_event_t * event)
 		return CCI_ENODEV;
 	}
 
-	evt = container_of(event, cci__evt_t, event);
-
-	ep = evt->ep;
+	ep = container_of(endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
 
-	/* enqueue the event */
+	if (tep->nthreads) {
+		/* the progress threads push the events and wake us up */
+		ev = cci__evtq_wait(&tep->evtq, deadline);
+	} else {
+		/* no one else drives progress, sleep in poll() instead */
+		for (;;) {
+			int ms = TCP_PROG_TIME_MS;
 
-	switch (event->type) {
-	case CCI_EVENT_SEND:
-		tx = container_of(evt, tcp_tx_t, evt);
-		tcp_put_tx(tx);
-		break;
-	case CCI_EVENT_RECV:
-		rx = container_of(evt, tcp_rx_t, evt);
-		tcp_put_rx(rx);
-		break;
-	case CCI_EVENT_CONNECT:
-		rx = container_of(evt, tcp_rx_t, evt);
-		tx = (tcp_tx_t*)rx;
-		if (rx->ctx == TCP_CTX_RX)
-			tcp_put_rx(rx);
-		else
-			tcp_put_tx(tx);
-		break;
-	default:
-		/* TODO */
-		break;
+			tcp_progress_ep(ep);
+			ev = cci__evtq_pop(&tep->evtq);
+			if (ev)
+				break;
+
+			if (deadline) {
+				struct timespec now;
+				int64_t left;
+
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				left = (int64_t) (deadline->tv_sec - now.tv_sec) *
+					1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+				if (left <= 0)
+					break;
+				if (left < ms * 1000000LL)
+					ms = (int) ((left + 999999) / 1000000);
+			}
+			/* other threads may queue sends or push events
+			 * meanwhile, so wake up every TCP_PROG_TIME_MS */
+			tcp_poll_wait(ep, &tep->pollers[0], ms);
+		}
 	}
 
-	CCI_EXIT;
+	if (!ev) {
+		CCI_EXIT;
+		return CCI_ETIMEDOUT;
+	}
+	*event = &ev->event;
 
+	CCI_EXIT;
 	return CCI_SUCCESS;
 }
 
-static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
-			void *rma_ptr, uint32_t rma_len, uintptr_t *offset)
+/* Get up to max events from the event queue. */
+static int ctp_tcp_get_events(cci_endpoint_t * endpoint,
+			      cci_event_t ** events, uint32_t max,
+			      uint32_t * count)
 {
 	int ret = CCI_SUCCESS;
-	uintptr_t off = *offset;
+	uint32_t n = 0;
+	cci__ep_t *ep;
+	cci__evt_t *e;
+	tcp_ep_t *tep;
 
-	if (off < (uintptr_t) len) {
-		ret = send(sock, (void*)((uintptr_t)buf + off), (int)((uintptr_t)len - off), 0);
-		if (ret != -1) {
-			off += ret;
-			*offset += ret;
-			ret = CCI_SUCCESS;
-		} else {
-			ret = errno;
-			goto out;
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
+
+	if (!tep->nthreads)
+		tcp_progress_ep(ep);
+
+	while (n < max && (e = cci__evtq_pop(&tep->evtq)))
+		events[n++] = &e->event;
+	if (!n)
+		ret = tcp_no_event(ep);
+
+	*count = n;
+
+	CCI_EXIT;
+	return ret;
+}
+
+/* Return events of one endpoint under a single ep->lock. */
+static int ctp_tcp_return_events(cci_event_t ** events, uint32_t count)
+{
+	uint32_t i;
+	cci__ep_t *ep;
+	tcp_ep_t *tep;
+	cci__evt_t *evt;
+	tcp_rx_t *rx;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(events[0], cci__evt_t, event)->ep;
+	tep = ep->priv;
+
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < count; i++) {
+		evt = container_of(events[i], cci__evt_t, event);
+		assert(evt->ep == ep);
+
+		switch (evt->event.type) {
+		case CCI_EVENT_SEND:
+			tcp_put_tx_locked(tep, container_of(evt, tcp_tx_t, evt));
+			break;
+		case CCI_EVENT_RECV:
+			tcp_put_rx_locked(tep, container_of(evt, tcp_rx_t, evt));
+			break;
+		case CCI_EVENT_CONNECT:
+			rx = container_of(evt, tcp_rx_t, evt);
+			if (rx->ctx == TCP_CTX_RX)
+				tcp_put_rx_locked(tep, rx);
+			else
+				tcp_put_tx_locked(tep, (tcp_tx_t *)rx);
+			break;
+		default:
+			/* TODO */
+			break;
 		}
 	}
-	if (rma_ptr && (off >= (uintptr_t)len)) {
+	cci__ep_unlock(ep, &ep->lock);
+
+	CCI_EXIT;
+
+	return CCI_SUCCESS;
+}
+
+static int ctp_tcp_return_event(cci_event_t * event)
+{
+	cci__ep_t *ep;
+	tcp_ep_t *tep;
+	cci__evt_t *evt;
+	tcp_tx_t *tx;
+	tcp_rx_t *rx;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	evt = container_of(event, cci__evt_t, event);
+
+	ep = evt->ep;
+	tep = ep->priv;
+
+	/* enqueue the event */
+
+	switch (event->type) {
+	case CCI_EVENT_SEND:
+		tx = container_of(evt, tcp_tx_t, evt);
+		tcp_put_tx(tx);
+		break;
+	case CCI_EVENT_RECV:
+		rx = container_of(evt, tcp_rx_t, evt);
+		tcp_put_rx(rx);
+		break;
+	case CCI_EVENT_CONNECT:
+		rx = container_of(evt, tcp_rx_t, evt);
+		tx = (tcp_tx_t*)rx;
+		if (rx->ctx == TCP_CTX_RX)
+			tcp_put_rx(rx);
+		else
+			tcp_put_tx(tx);
+		break;
+	default:
+		/* TODO */
+		break;
+	}
+
+	CCI_EXIT;
+
+	return CCI_SUCCESS;
+}
+
+/* Send the rest of the header and payload with a single system call, so
+ * that the peer does not wait for the payload of a header it received.
+ */
+static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
+			void *rma_ptr, uint32_t rma_len, uintptr_t *offset)
+{
+	int ret = CCI_SUCCESS, niov = 0;
+	uintptr_t off = *offset;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t sent;
+
+	if (off < (uintptr_t) len) {
+		iov[niov].iov_base = (void*)((uintptr_t)buf + off);
+		iov[niov].iov_len = (uintptr_t)len - off;
+		niov++;
+		off = 0;
+	} else {
 		off -= len;
-		ret = send(sock, (void*)((uintptr_t)rma_ptr + off), rma_len - off, 0);
+	}
+	if (rma_ptr && off < (uintptr_t) rma_len) {
+		iov[niov].iov_base = (void*)((uintptr_t)rma_ptr + off);
+		iov[niov].iov_len = rma_len - off;
+		niov++;
+	}
+	if (!niov)
+		goto out;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+
+	sent = sendmsg(sock, &msg, 0);
+	if (sent != -1)
+		*offset += sent;
+	else
+		ret = errno;
+out:
+	return ret;
+}
+
+#ifdef HAVE_SENDFILE
+/* Like tcp_sendto(), but send the payload from the page cache of file fd
+ * starting at foff. If the file cannot be sent from, fall back to the
+ * mapped memory at rma_ptr.
+ */
+static int tcp_sendfile(cci_os_handle_t sock, void *buf, int len,
+			void *rma_ptr, uint32_t rma_len, int fd, uint64_t foff,
+			uintptr_t *offset)
+{
+	int ret = CCI_SUCCESS, more = 0;
+	uintptr_t off = *offset;
+
+#ifdef MSG_MORE
+	/* hold the header back to go out with the payload */
+	more = MSG_MORE;
+#endif
+	if (off < (uintptr_t) len) {
+		ret = send(sock, (void*)((uintptr_t)buf + off), (int)((uintptr_t)len - off), more);
 		if (ret != -1) {
+			off += ret;
 			*offset += ret;
 			ret = CCI_SUCCESS;
 		} else {
@@ -1822,52 +3070,168 @@ static int tcp_sendto(cci_os_handle_t sock, void *buf, int len,
 			goto out;
 		}
 	}
+	if (off >= (uintptr_t) len && off < (uintptr_t) len + rma_len) {
+		off_t foffset = (off_t) (foff + off - len);
+		ssize_t sent;
+
+		sent = sendfile(sock, fd, &foffset, rma_len - (off - len));
+		if (sent > 0) {
+			*offset += sent;
+		} else if (sent == 0 || errno == EINVAL || errno == ENOSYS) {
+			/* truncated file or no sendfile() support here */
+			debug(CCI_DB_MSG, "%s: sendfile() failed, sending from "
+				"memory", __func__);
+			ret = tcp_sendto(sock, buf, len, rma_ptr, rma_len, offset);
+		} else {
+			ret = errno;
+		}
+	}
 out:
 	return ret;
 }
+#endif
 
 static void tcp_progress_pending(cci__ep_t * ep)
 {
 	return;
 }
 
+/* Move a fully sent tx to pending (waiting for its ack), put (to release
+ * or refill) or done (to complete).
+ *
+ * NOTE: caller must hold tconn->slock
+ */
+static inline void
+tcp_tx_sent_locked(cci__conn_t *conn, tcp_tx_t *tx, struct tcp_evt_list *put,
+		struct tcp_evt_list *done)
+{
+	tcp_conn_t *tconn = conn->priv;
+	cci__evt_t *evt = &tx->evt;
+
+	debug(CCI_DB_MSG, "%s: completed %s send to conn %p",
+		__func__, tcp_msg_type(tx->msg_type), (void*)conn);
+
+	TAILQ_REMOVE(&tconn->queued, evt, entry);
+	switch (tx->msg_type) {
+	default:
+		TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
+		break;
+	case TCP_MSG_RMA_READ_REPLY:
+	case TCP_MSG_CONN_DATA:
+		TAILQ_INSERT_TAIL(put, evt, entry);
+		break;
+	case TCP_MSG_RMA_ATOMIC:
+		/* a request waits for the reply, a reply is done once sent */
+		if (tx->rma_op)
+			TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
+		else
+			TAILQ_INSERT_TAIL(put, evt, entry);
+		break;
+	case TCP_MSG_CONN_REPLY:
+		/* an accept completes once sent */
+		if (evt->event.type == CCI_EVENT_ACCEPT) {
+			tx->state = TCP_TX_COMPLETED;
+			TAILQ_INSERT_TAIL(done, evt, entry);
+		} else {
+			TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
+		}
+		break;
+	case TCP_MSG_ACK:
+		if (!tx->evt.ep) {
+			debug(CCI_DB_MSG, "%s: freeing tx %p",
+				__func__, (void*)tx);
+			free(tx->buffer);
+			free(tx);
+		} else {
+			/* not put under slock, which is taken after
+			 * ep->lock */
+			TAILQ_INSERT_TAIL(put, evt, entry);
+		}
+		break;
+	}
+
+	return;
+}
+
+/* Release or complete the txs set aside by tcp_tx_sent_locked().
+ *
+ * NOTE: caller must not hold tconn->slock
+ */
+static inline void
+tcp_finish_sent(cci__conn_t *conn, struct tcp_evt_list *put,
+		struct tcp_evt_list *done, int ep_locked)
+{
+	while (!TAILQ_EMPTY(put)) {
+		cci__evt_t *evt = TAILQ_FIRST(put);
+		tcp_tx_t *put_tx = container_of(evt, tcp_tx_t, evt);
+
+		TAILQ_REMOVE(put, evt, entry);
+		if (put_tx->stream) {
+			tcp_rma_stream_next(put_tx->evt.ep, conn, put_tx,
+					ep_locked);
+		} else if (ep_locked) {
+			cci_endpoint_t *endpoint = conn->connection.endpoint;
+			cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
+			tcp_ep_t *tep = ep->priv;
+
+			tcp_put_tx_locked(tep, put_tx);
+		} else {
+			tcp_put_tx(put_tx);
+		}
+	}
+
+	while (!TAILQ_EMPTY(done)) {
+		cci__evt_t *evt = TAILQ_FIRST(done);
+
+		TAILQ_REMOVE(done, evt, entry);
+		tcp_deliver_evt(evt->ep->priv, evt);
+	}
+
+	return;
+}
+
 static inline void
 tcp_progress_conn_sends(cci__conn_t *conn, int ep_locked)
 {
-	int ret, is_reliable = 0;
+	int ret, is_reliable = 0, failed = 0;
+	cci__ep_t *ep;
 	tcp_conn_t *tconn = conn->priv;
-	tcp_tx_t *put_tx = NULL;
+	struct tcp_evt_list put = TAILQ_HEAD_INITIALIZER(put);
+	struct tcp_evt_list done = TAILQ_HEAD_INITIALIZER(done);
 
 	if (!conn || !conn->priv)
 		return;
 
+	ep = container_of(conn->connection.endpoint, cci__ep_t, endpoint);
 	tconn = conn->priv;
 
 	is_reliable = cci_conn_is_reliable(conn);
 	tconn = conn->priv;
 
-	pthread_mutex_lock(&tconn->slock);
+	cci__ep_lock(ep, &tconn->slock);
 	while (!TAILQ_EMPTY(&tconn->queued)) {
 		cci__evt_t *evt = TAILQ_FIRST(&tconn->queued);
 		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
 		int off = tx->offset;
 
-		if (tx->msg_type == TCP_MSG_CONN_REQUEST &&
+		if ((tx->msg_type == TCP_MSG_CONN_REQUEST ||
+			tx->msg_type == TCP_MSG_CONN_DATA) &&
 			tconn->status == TCP_CONN_ACTIVE1)
 			break;
 
-		if (tx->msg_type == TCP_MSG_RMA_WRITE ||
-			tx->msg_type == TCP_MSG_RMA_READ_REQUEST) {
-			if (tx->rma_op->pending >= TCP_RMA_DEPTH)
-				break;
-		}
-
 		debug(CCI_DB_MSG, "%s: sending %s to conn %p",
 			__func__, tcp_msg_type(tx->msg_type), (void*)conn);
 
 		debug(CCI_DB_MSG, "%s: buffer %p len %u rma_ptr %p rma_len %u offset %"PRIuPTR"",
 			__func__, (void*)tx->buffer, tx->len, (void*)tx->rma_ptr, tx->rma_len, tx->offset);
 
+#ifdef HAVE_SENDFILE
+		if (tx->stream && tx->stream->fd != -1)
+			ret = tcp_sendfile(tconn->fd, tx->buffer, tx->len,
+					tx->rma_ptr, tx->rma_len, tx->stream->fd,
+					tx->rma_foff, &tx->offset);
+		else
+#endif
 		ret = tcp_sendto(tconn->fd, tx->buffer, tx->len,
 				tx->rma_ptr, tx->rma_len, &tx->offset);
 		if (ret) {
@@ -1876,6 +3240,14 @@ tcp_progress_conn_sends(cci__conn_t *conn, int ep_locked)
 					__func__, tcp_msg_type(tx->msg_type),
 					strerror(ret));
 				break;
+			} else if (tconn->primary) {
+				/* closed below, the primary socket takes
+				 * its fragments */
+				debug(CCI_DB_CONN, "%s: send() on data socket "
+					"%p returned %s", __func__,
+					(void*)conn, strerror(ret));
+				failed = 1;
+				break;
 			} else {
 				/* close connection? */
 				debug(CCI_DB_CONN, "%s: send() returned %s (%d) - "
@@ -1885,70 +3257,254 @@ tcp_progress_conn_sends(cci__conn_t *conn, int ep_locked)
 		} else {
 			debug(CCI_DB_MSG, "%s: sent %u bytes to conn %p (offset %u off %u)",
 				__func__, (int) tx->offset - off, (void*)conn, (int) tx->offset, off);
-			if (tx->offset == (tx->len + tx->rma_len)) {
-				debug(CCI_DB_MSG, "%s: completed %s send to conn %p",
-					__func__, tcp_msg_type(tx->msg_type), (void*)conn);
-				TAILQ_REMOVE(&tconn->queued, evt, entry);
-				switch (tx->msg_type) {
-				default:
-					TAILQ_INSERT_TAIL(&tconn->pending, evt, entry);
-					break;
-				case TCP_MSG_RMA_READ_REPLY:
-					put_tx = tx;
-					break;
-				case TCP_MSG_CONN_ACK:
-					put_tx = tx;
-					break;
-				case TCP_MSG_ACK:
-					if (!tx->evt.ep) {
-						debug(CCI_DB_MSG, "%s: freeing "
-							"tx %p", __func__, (void*)tx);
-						free(tx->buffer);
-						free(tx);
-					} else {
-						cci_endpoint_t *endpoint =
-							conn->connection.endpoint;
-						cci__ep_t *ep =
-							container_of(endpoint, cci__ep_t,
-									endpoint);
-						tcp_ep_t *tep = ep->priv;
-
-						if (ep_locked)
-							tcp_put_tx_locked(tep, tx);
-						else
-							tcp_put_tx(tx);
-					}
-					break;
-				}
-			} else {
+			if (tx->offset == (tx->len + tx->rma_len))
+				tcp_tx_sent_locked(conn, tx, &put, &done);
+			else
 				break;
-			}
 		}
 	}
-	if (TAILQ_EMPTY(&tconn->queued)) {
-		cci_endpoint_t *endpoint = conn->connection.endpoint;
-		cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
-		tcp_ep_t *tep = ep->priv;
-		tep->fds[tconn->index].events = POLLIN;
+	if (TAILQ_EMPTY(&tconn->queued))
+		tcp_set_events(tconn, POLLIN);
+	cci__ep_unlock(ep, &tconn->slock);
+
+	if (failed) {
+		if (!ep_locked)
+			cci__ep_lock(ep, &ep->lock);
+		if (tconn->status != TCP_CONN_CLOSING)
+			tcp_conn_set_closing_locked(ep, conn);
+		if (!ep_locked)
+			cci__ep_unlock(ep, &ep->lock);
 	}
-	pthread_mutex_unlock(&tconn->slock);
 
-	if (put_tx) {
-		if (ep_locked) {
-			cci_endpoint_t *endpoint = conn->connection.endpoint;
-			cci__ep_t *ep = container_of(endpoint, cci__ep_t, endpoint);
-			tcp_ep_t *tep = ep->priv;
+	tcp_finish_sent(conn, &put, &done, ep_locked);
 
-			tcp_put_tx_locked(tep, put_tx);
+	return;
+}
+
+#ifdef TCP_HAVE_IO_URING
+/* Gather the queued txs of tconn in tconn->msg, stopping at the first
+ * tx that must wait or go out with sendfile(). Returns the number of
+ * iovecs.
+ *
+ * NOTE: caller must hold tconn->slock
+ */
+static inline int tcp_uring_prep_msg(tcp_conn_t *tconn)
+{
+	int niov = 0;
+	cci__evt_t *evt;
+
+	TAILQ_FOREACH(evt, &tconn->queued, entry) {
+		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+		uintptr_t off = tx->offset;
+
+		if ((tx->msg_type == TCP_MSG_CONN_REQUEST ||
+			tx->msg_type == TCP_MSG_CONN_DATA) &&
+			tconn->status == TCP_CONN_ACTIVE1)
+			break;
+		if (tx->stream && tx->stream->fd != -1)
+			break;
+		if (niov + 2 > TCP_URING_IOV)
+			break;
+
+		if (off < (uintptr_t) tx->len) {
+			tconn->iov[niov].iov_base = (char *)tx->buffer + off;
+			tconn->iov[niov].iov_len = tx->len - off;
+			niov++;
+			off = 0;
 		} else {
-			tcp_put_tx(put_tx);
+			off -= tx->len;
+		}
+		if (tx->rma_ptr && off < (uintptr_t) tx->rma_len) {
+			tconn->iov[niov].iov_base = (char *)tx->rma_ptr + off;
+			tconn->iov[niov].iov_len = tx->rma_len - off;
+			niov++;
 		}
 	}
 
+	memset(&tconn->msg, 0, sizeof(tconn->msg));
+	tconn->msg.msg_iov = tconn->iov;
+	tconn->msg.msg_iovlen = niov;
+
+	return niov;
+}
+
+/* Account the bytes sent by tconn's io_uring send.
+ *
+ * NOTE: caller must hold tconn->slock
+ */
+static inline void
+tcp_uring_sent_locked(tcp_conn_t *tconn, int res, struct tcp_evt_list *put,
+		struct tcp_evt_list *done)
+{
+	cci__conn_t *conn = tconn->conn;
+	uintptr_t bytes;
+
+	if (res < 0) {
+		if (res != -EAGAIN && res != -EINTR) {
+			debug(CCI_DB_CONN, "%s: sendmsg() returned %s - "
+				"do we need to close the connection?",
+				__func__, strerror(-res));
+			tconn->uring_err = -res;
+		}
+		return;
+	}
+
+	debug(CCI_DB_MSG, "%s: sent %d bytes to conn %p",
+		__func__, res, (void*)conn);
+
+	bytes = (uintptr_t) res;
+	while (!TAILQ_EMPTY(&tconn->queued)) {
+		cci__evt_t *evt = TAILQ_FIRST(&tconn->queued);
+		tcp_tx_t *tx = container_of(evt, tcp_tx_t, evt);
+		uintptr_t left = tx->len + tx->rma_len - tx->offset;
+
+		if (bytes < left) {
+			tx->offset += bytes;
+			break;
+		}
+		tx->offset += left;
+		bytes -= left;
+		tcp_tx_sent_locked(conn, tx, put, done);
+	}
+	if (TAILQ_EMPTY(&tconn->queued))
+		tcp_set_events(tconn, POLLIN);
+
+	return;
+}
+
+/* Submit the batched sends and wait for all of them. Each conn's slock
+ * is released once its send is accounted; the sent txs are released
+ * after all slocks are, since refilling them may queue on any conn.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static void
+tcp_uring_flush_sends_locked(cci__ep_t *ep, tcp_conn_t *batch, uint32_t n)
+{
+	int ret;
+	tcp_ep_t *tep = ep->priv;
+	uint32_t seen = 0;
+	tcp_uring_t *ring = &tep->sring;
+	struct io_uring_cqe *cqe;
+	tcp_conn_t *tconn;
+
+	while (seen < n) {
+		ret = tcp_uring_enter(ring, n - seen);
+		if (ret && ret != EAGAIN && ret != EBUSY) {
+			debug(CCI_DB_WARN, "%s: io_uring_enter() returned %s",
+				__func__, strerror(ret));
+			break;
+		}
+		while ((cqe = tcp_uring_peek_cqe(ring))) {
+			int res = cqe->res;
+
+			tconn = (tcp_conn_t *)(uintptr_t) cqe->user_data;
+			tcp_uring_cqe_seen(ring);
+			seen++;
+
+			tcp_uring_sent_locked(tconn, res, &tconn->uring_put,
+					&tconn->uring_done);
+			tconn->msg.msg_iovlen = 0;
+			cci__ep_unlock(ep, &tconn->slock);
+		}
+	}
+
+	for (tconn = batch; tconn; tconn = tconn->uring_next) {
+		/* not accounted if the ring failed */
+		if (tconn->msg.msg_iovlen) {
+			tconn->msg.msg_iovlen = 0;
+			cci__ep_unlock(ep, &tconn->slock);
+		}
+	}
+
+	/* once no slock is held, the primary socket takes the fragments
+	 * of a data socket that failed */
+	for (tconn = batch; tconn; tconn = tconn->uring_next) {
+		if (tconn->uring_err && tconn->primary &&
+		    tconn->status != TCP_CONN_CLOSING)
+			tcp_conn_set_closing_locked(ep, tconn->conn);
+		tcp_finish_sent(tconn->conn, &tconn->uring_put,
+				&tconn->uring_done, 1);
+	}
+
 	return;
 }
 
-static void tcp_progress_queued(cci__ep_t * ep)
+/* Send the queued txs of the conns owned by poller, or of all conns if
+ * poller is NULL, with one sendmsg() per socket submitted in a single
+ * io_uring_enter(). The txs it cannot gather take tcp_progress_conn_sends().
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static void tcp_uring_progress_queued_locked(cci__ep_t *ep, tcp_poller_t *poller)
+{
+	uint32_t n = 0;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn, *tmp, *batch = NULL, *sync = NULL;
+
+	TAILQ_FOREACH_SAFE(tconn, &tep->conns, entry, tmp) {
+		struct io_uring_sqe *sqe;
+
+		if (poller && tconn->poller != poller)
+			continue;
+		if (TAILQ_EMPTY(&tconn->queued))
+			continue;
+
+		/* a busy conn is being sent on, skip it this time */
+		if (cci__ep_trylock(ep, &tconn->slock))
+			continue;
+
+		if (!tcp_uring_prep_msg(tconn)) {
+			tcp_tx_t *tx = NULL;
+
+			if (!TAILQ_EMPTY(&tconn->queued))
+				tx = container_of(TAILQ_FIRST(&tconn->queued),
+						tcp_tx_t, evt);
+			if (!tx)
+				tcp_set_events(tconn, POLLIN);
+			cci__ep_unlock(ep, &tconn->slock);
+			if (tx && tx->stream && tx->stream->fd != -1) {
+				tconn->uring_next = sync;
+				sync = tconn;
+			}
+			continue;
+		}
+
+		if (n == tep->sring.sq_entries) {
+			/* the ring is full, send what we have */
+			tcp_uring_flush_sends_locked(ep, batch, n);
+			batch = NULL;
+			n = 0;
+		}
+		sqe = tcp_uring_get_sqe(&tep->sring);
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = tconn->fd;
+		sqe->addr = (uintptr_t) &tconn->msg;
+		sqe->msg_flags = MSG_DONTWAIT;
+		sqe->user_data = (uintptr_t) tconn;
+
+		/* slock stays held until the send is accounted */
+		TAILQ_INIT(&tconn->uring_put);
+		TAILQ_INIT(&tconn->uring_done);
+		tconn->uring_err = 0;
+		tconn->uring_next = batch;
+		batch = tconn;
+		n++;
+	}
+	if (n)
+		tcp_uring_flush_sends_locked(ep, batch, n);
+
+	for (; sync; sync = sync->uring_next)
+		tcp_progress_conn_sends(sync->conn, 1);
+
+	return;
+}
+#endif
+
+/* Progress the sends of the conns owned by poller, or of all conns
+ * if poller is NULL.
+ */
+static void tcp_progress_queued(cci__ep_t * ep, tcp_poller_t *poller)
 {
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn, *tmp;
@@ -1958,11 +3514,21 @@ static void tcp_progress_queued(cci__ep_t * ep)
 	if (!tep)
 		return;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+#ifdef TCP_HAVE_IO_URING
+	if (tep->uring) {
+		tcp_uring_progress_queued_locked(ep, poller);
+		cci__ep_unlock(ep, &ep->lock);
+		CCI_EXIT;
+		return;
+	}
+#endif
 	TAILQ_FOREACH_SAFE(tconn, &tep->conns, entry, tmp) {
+		if (poller && tconn->poller != poller)
+			continue;
 		tcp_progress_conn_sends(tconn->conn, 1);
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	CCI_EXIT;
 
@@ -1970,40 +3536,297 @@ static void tcp_progress_queued(cci__ep_t * ep)
 }
 
 static void
-tcp_progress_sends(cci__ep_t * ep)
+tcp_progress_sends(cci__ep_t * ep, tcp_poller_t *poller)
 {
 	tcp_progress_pending(ep);
-	tcp_progress_queued(ep);
+	tcp_progress_queued(ep, poller);
+
+	return;
+}
+
+static int
+tcp_progress_ep(cci__ep_t *ep)
+{
+	int ret = CCI_EAGAIN;
+	uint32_t i;
+	tcp_ep_t *tep = ep->priv;
+
+	/* pollers busy in a progress thread are skipped */
+	for (i = 0; i < tep->npollers; i++)
+		tcp_poll_events(ep, &tep->pollers[i]);
+	tcp_progress_sends(ep, NULL);
+
+	return ret;
+}
+
+static int
+tcp_progress_poller(cci__ep_t *ep, tcp_poller_t *poller)
+{
+	int ret;
+
+	ret = tcp_poll_events(ep, poller);
+	tcp_progress_sends(ep, poller);
+
+	return ret;
+}
+
+static inline void
+tcp_queue_tx(cci__ep_t *ep, tcp_conn_t *tconn, cci__evt_t *evt)
+{
+	cci__ep_lock(ep, &tconn->slock);
+	TAILQ_INSERT_TAIL(&tconn->queued, evt, entry);
+	tcp_set_events(tconn, POLLIN | POLLOUT);
+	cci__ep_unlock(ep, &tconn->slock);
+}
+
+/* Queue an RMA fragment on the socket picked for it, or on the primary
+ * socket if that data socket closed since. Returns the socket used.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline cci__conn_t *
+tcp_queue_frag_locked(cci__ep_t *ep, tcp_tx_t *tx)
+{
+	cci__conn_t *dconn = tx->dconn;
+	tcp_conn_t *dtconn = dconn->priv;
+
+	if (dtconn->status == TCP_CONN_CLOSING && dconn != tx->evt.conn)
+		dconn = tx->dconn = tx->evt.conn;
+	tcp_queue_tx(ep, dconn->priv, &tx->evt);
+
+	return dconn;
+}
+
+/* Return the conn that owns the connection state (acks, pending txs,
+ * RMA ops) for a primary or data socket conn.
+ */
+static inline cci__conn_t *
+tcp_primary_conn(cci__conn_t *conn)
+{
+	tcp_conn_t *tconn = conn->priv;
+
+	return tconn->primary ? tconn->primary : conn;
+}
+
+/* Pick the socket to carry the next RMA data fragment. Fragments are
+ * striped round-robin across the data sockets. Connections without data
+ * sockets use the primary socket.
+ */
+static inline cci__conn_t *
+tcp_data_conn_locked(cci__conn_t *conn)
+{
+	tcp_conn_t *tconn = conn->priv;
+
+	if (tconn->ndata)
+		return tconn->data[tconn->next_data++ % tconn->ndata];
+	return conn;
+}
+
+static inline cci__conn_t *
+tcp_data_conn(cci__ep_t *ep, cci__conn_t *conn)
+{
+	cci__conn_t *dconn = NULL;
+
+	cci__ep_lock(ep, &ep->lock);
+	dconn = tcp_data_conn_locked(conn);
+	cci__ep_unlock(ep, &ep->lock);
+
+	return dconn;
+}
+
+/* Read how many bytes wait in the socket's send queue and the size of
+ * its send buffer. Returns 0 on success, -1 if the OS cannot tell.
+ */
+static inline int
+tcp_sock_sndq(tcp_conn_t *tconn, uint32_t *outq, uint32_t *sndbuf)
+{
+#ifdef TIOCOUTQ
+	int q = 0, size = 0;
+	socklen_t slen = sizeof(size);
+
+	if (ioctl(tconn->fd, TIOCOUTQ, &q) ||
+	    getsockopt(tconn->fd, SOL_SOCKET, SO_SNDBUF, &size, &slen))
+		return -1;
+	*outq = (uint32_t) q;
+	*sndbuf = (uint32_t) size;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/* Adapt an RMA depth to the occupancy of a socket's send queue. A queue
+ * holding less than a fragment drains faster than we refill it, so allow
+ * one more fragment in flight. A nearly full buffer means that more
+ * fragments would only wait in the kernel, so allow one less.
+ */
+static inline uint32_t
+tcp_rma_adapt_depth(uint32_t depth, uint32_t outq, uint32_t sndbuf,
+		    uint32_t frag)
+{
+	if (outq < frag && depth < TCP_RMA_MAX_DEPTH)
+		depth++;
+	else if (outq > sndbuf / 4 * 3 && depth > TCP_RMA_MIN_DEPTH)
+		depth--;
+
+	return depth;
+}
+
+/* Adapt the conn's RMA fragment size once an op completes. The size
+ * climbs in one direction (doubling or halving) as long as throughput
+ * does not drop by more than 10%, otherwise it turns around. Ops too
+ * short to measure, or started with another size, are ignored.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_rma_adapt_frag_locked(tcp_conn_t *tconn, tcp_rma_op_t *rma_op)
+{
+	uint64_t usecs = tcp_get_usecs() - rma_op->start, rate;
+
+	if (rma_op->status || rma_op->frag != tconn->rma_frag ||
+	    rma_op->data_len < 4 * (uint64_t) rma_op->frag)
+		return;
 
-	return;
+	rate = rma_op->data_len * 1000 / (usecs ? usecs : 1);
+	if (rate < tconn->rma_rate - tconn->rma_rate / 10)
+		tconn->rma_grow = !tconn->rma_grow;
+	tconn->rma_rate = rate;
+
+	if (tconn->rma_grow && tconn->rma_frag < TCP_RMA_MAX_FRAG)
+		tconn->rma_frag *= 2;
+	else if (!tconn->rma_grow && tconn->rma_frag > TCP_RMA_MIN_FRAG)
+		tconn->rma_frag /= 2;
+
+	debug(CCI_DB_MSG, "%s: conn %p %"PRIu64" bytes/ms, fragment size %u",
+		__func__, (void*)tconn->conn, rate, tconn->rma_frag);
 }
 
-static int
-tcp_progress_ep(cci__ep_t *ep)
+/* Pack the stream's next fragment in a read reply tx.
+ *
+ * NOTE: caller must hold ep->lock
+ */
+static inline void
+tcp_rma_stream_fill_locked(tcp_rma_stream_t *stream, tcp_tx_t *tx)
 {
-	int ret = CCI_EAGAIN;
+	uint32_t len = stream->seg_left < stream->frag ?
+		(uint32_t) stream->seg_left : stream->frag;
 
-	tcp_poll_events(ep);
-	tcp_progress_sends(ep);
+	tx->msg_type = TCP_MSG_RMA_READ_REPLY;
+	tx->flags = CCI_FLAG_SILENT;
+	tx->state = TCP_TX_QUEUED;
+	tx->len = sizeof(tcp_rma_header_t);
+	tx->offset = 0;
+	tx->rma_op = NULL;
+	tx->rma_ptr = stream->ptr;
+	tx->rma_len = len;
+	tx->rma_foff = stream->foff;
+	tx->stream = stream;
 
-	return ret;
+	tx->evt.event.type = CCI_EVENT_SEND;
+	tx->evt.event.send.status = CCI_SUCCESS;
+	tx->evt.event.send.context = NULL;
+	tx->evt.event.send.connection = &stream->conn->connection;
+	tx->evt.conn = stream->conn;
+
+	tcp_pack_rma_read_reply(tx->buffer, len, stream->tx_id,
+			stream->local_handle, stream->local_offset,
+			stream->remote_handle, stream->remote_offset);
+
+	/* the reply carries the data, stripe it across the data sockets */
+	tx->dconn = tcp_data_conn_locked(stream->conn);
+
+	stream->ptr += len;
+	stream->local_offset += len;
+	stream->remote_offset += len;
+	stream->foff += len;
+	stream->left -= len;
+	stream->seg_left -= len;
+
+	/* move to the next segment of a vectored read */
+	if (!stream->seg_left && stream->left) {
+		cci_rma_seg_t *seg = &stream->segs[stream->seg++];
+		char *start = stream->ptr - stream->remote_offset;
+
+		stream->ptr = start + seg->remote_offset;
+		stream->foff += seg->remote_offset - stream->remote_offset;
+		stream->local_offset = seg->local_offset;
+		stream->remote_offset = seg->remote_offset;
+		stream->seg_left = seg->length;
+	}
 }
 
 static inline void
-tcp_queue_tx(tcp_ep_t *tep, tcp_conn_t *tconn, cci__evt_t *evt)
+tcp_rma_stream_free(tcp_rma_stream_t *stream)
 {
-	pthread_mutex_lock(&tconn->slock);
-	TAILQ_INSERT_TAIL(&tconn->queued, evt, entry);
-	tep->fds[tconn->index].events = POLLIN | POLLOUT;
-	pthread_mutex_unlock(&tconn->slock);
+	if (stream->fd != -1)
+		close(stream->fd);
+	free(stream);
+}
+
+/* A read reply has been written to its socket (conn). Refill the tx
+ * with the stream's next fragment, add or drop reply txs as the send
+ * queue allows, and free the stream once the whole range is sent.
+ */
+static void
+tcp_rma_stream_next(cci__ep_t *ep, cci__conn_t *conn, tcp_tx_t *tx,
+		    int ep_locked)
+{
+	tcp_ep_t *tep = ep->priv;
+	tcp_rma_stream_t *stream = tx->stream;
+	tcp_tx_t *txs[2];
+	uint32_t outq = 0, sndbuf = 0;
+	int i, n = 0, sampled = 0, done = 0;
+
+	sampled = !tcp_sock_sndq(conn->priv, &outq, &sndbuf);
+
+	if (!ep_locked)
+		cci__ep_lock(ep, &ep->lock);
+	if (sampled)
+		stream->depth = tcp_rma_adapt_depth(stream->depth, outq,
+						sndbuf, stream->frag);
+	if (stream->left && stream->inflight <= stream->depth) {
+		tcp_rma_stream_fill_locked(stream, tx);
+		txs[n++] = tx;
+
+		if (stream->left && stream->inflight < stream->depth) {
+			tcp_tx_t *ntx = tcp_get_tx_locked(ep);
+
+			if (ntx) {
+				stream->inflight++;
+				tcp_rma_stream_fill_locked(stream, ntx);
+				txs[n++] = ntx;
+			}
+		}
+	} else {
+		/* depth is at least 2, so others remain while data is left */
+		stream->inflight--;
+		tcp_put_tx_locked(tep, tx);
+		done = !stream->inflight;
+	}
+	for (i = 0; i < n; i++)
+		tcp_queue_frag_locked(ep, txs[i]);
+	if (!ep_locked)
+		cci__ep_unlock(ep, &ep->lock);
+
+	if (done) {
+		debug(CCI_DB_MSG, "%s: completed read stream for tx id %u",
+			__func__, stream->tx_id);
+		tcp_rma_stream_free(stream);
+	}
+
+	return;
 }
 
+/* If defer is set, a message that must be queued is left for the caller
+ * to send with tcp_progress_queued().
+ */
 static int tcp_send_common(cci_connection_t * connection,
 		      const struct iovec *data, uint32_t iovcnt,
 		      const void *context, int flags,
-		      tcp_rma_op_t *rma_op)
+		      tcp_rma_op_t *rma_op, int defer)
 {
-	int i, ret, is_reliable = 0, data_len = 0;
+	int i, ret, is_reliable = 0, data_len = 0, blocking = 0;
 	char *func = iovcnt < 2 ? "send" : "sendv";
 	cci_endpoint_t *endpoint = connection->endpoint;
 	cci__ep_t *ep;
@@ -2015,6 +3838,7 @@ static int tcp_send_common(cci_connection_t * connection,
 	void *ptr;
 	cci__evt_t *evt;
 	union cci_event *event;	/* generic CCI event */
+	cci__waiter_t waiter;
 
 	debug(CCI_DB_FUNC, "entering %s", func);
 
@@ -2026,6 +3850,11 @@ static int tcp_send_common(cci_connection_t * connection,
 	for (i = 0; i < (int) iovcnt; i++)
 		data_len += data[i].iov_len;
 
+	if (data_len > (int) connection->max_send_size) {
+		debug(CCI_DB_FUNC, "exiting %s", func);
+		return CCI_EMSGSIZE;
+	}
+
 	ep = container_of(endpoint, cci__ep_t, endpoint);
 	tep = ep->priv;
 	conn = container_of(connection, cci__conn_t, connection);
@@ -2074,6 +3903,30 @@ static int tcp_send_common(cci_connection_t * connection,
 
 	ptr = (void*)((uintptr_t)tx->buffer + tx->len);
 
+	if (data_len > (int) (ep->buffer_len - sizeof(*hdr))) {
+		/* Too large for the tx buffer. Send the payload after the
+		 * header from the user's buffer if allowed, else from a
+		 * copy. Completion messages of RMAs always fit. */
+		if ((flags & CCI_FLAG_NO_COPY) && iovcnt == 1) {
+			tx->rma_ptr = data[0].iov_base;
+		} else {
+			tx->large = malloc(data_len);
+			if (!tx->large) {
+				tcp_put_tx(tx);
+				debug(CCI_DB_FUNC, "exiting %s", func);
+				return CCI_ENOMEM;
+			}
+			ptr = tx->large;
+			for (i = 0; i < (int) iovcnt; i++) {
+				memcpy(ptr, data[i].iov_base, data[i].iov_len);
+				ptr = (void*)((uintptr_t)ptr + data[i].iov_len);
+			}
+			tx->rma_ptr = tx->large;
+		}
+		tx->rma_len = data_len;
+		iovcnt = 0;
+	}
+
 	/* copy user data to buffer
 	 * NOTE: ignore CCI_FLAG_NO_COPY because we need to
 	 send the entire packet in one shot. We could
@@ -2096,9 +3949,10 @@ static int tcp_send_common(cci_connection_t * connection,
 		if (ret == CCI_SUCCESS) {
 			/* queue event on enpoint's completed queue */
 			tx->state = TCP_TX_COMPLETED;
-			pthread_mutex_lock(&ep->lock);
-			TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-			pthread_mutex_unlock(&ep->lock);
+			if (flags & CCI_FLAG_BLOCKING)
+				tcp_put_tx(tx);
+			else
+				tcp_deliver_evt(tep, evt);
 			debug(CCI_DB_MSG, "sent UU msg with %d bytes",
 			      tx->len - (int)sizeof(tcp_header_t));
 
@@ -2115,12 +3969,20 @@ static int tcp_send_common(cci_connection_t * connection,
 
 	debug(CCI_DB_MSG, "%s: queuing MSG %p to conn %p", __func__, (void*)tx, (void*)conn);
 
+	/* a blocked sender is woken up by the completion, not an event */
+	if (is_reliable && (flags & CCI_FLAG_BLOCKING) && !rma_op) {
+		cci__waiter_init(&waiter);
+		tx->waiter = &waiter;
+		blocking = 1;
+	}
+
 	tx->state = TCP_TX_QUEUED;
-	tcp_queue_tx(tep, tconn, evt);
+	tcp_queue_tx(ep, tconn, evt);
 
 	/* try to progress txs */
 
-	tcp_progress_conn_sends(conn, 0);
+	if (!defer)
+		tcp_progress_conn_sends(conn, 0);
 
 	/* if unreliable, we are done since it is buffered internally */
 	if (!is_reliable) {
@@ -2132,21 +3994,19 @@ static int tcp_send_common(cci_connection_t * connection,
 
 	/* if blocking, wait for completion */
 
-	if (tx->flags & CCI_FLAG_BLOCKING) {
-		while (tx->state != TCP_TX_COMPLETED)
-			tcp_progress_ep(ep);
+	if (blocking) {
+		/* sleep if progress threads complete the send, else drive
+		 * progress until it completes */
+		if (tep->nthreads)
+			cci__waiter_wait(&waiter);
+		else
+			while (!cci__waiter_done(&waiter))
+				tcp_progress_ep(ep);
 
 		/* get status and cleanup */
 		ret = event->send.status;
-
-		/* NOTE race with get_event()
-		 *      get_event() must ignore sends with
-		 *      flags & CCI_FLAG_BLOCKING */
-
-		pthread_mutex_lock(&ep->lock);
-		TAILQ_REMOVE(&ep->evts, evt, entry);
-		tcp_put_tx_locked(tep, tx);
-		pthread_mutex_unlock(&ep->lock);
+		cci__waiter_fini(&waiter);
+		tcp_put_tx(tx);
 	}
 
 	debug(CCI_DB_FUNC, "exiting %s", func);
@@ -2168,7 +4028,7 @@ static int ctp_tcp_send(cci_connection_t * connection,
 		iov.iov_len = msg_len;
 	}
 
-	ret = tcp_send_common(connection, &iov, iovcnt, context, flags, NULL);
+	ret = tcp_send_common(connection, &iov, iovcnt, context, flags, NULL, 0);
 
 	CCI_EXIT;
 	return ret;
@@ -2182,7 +4042,51 @@ static int ctp_tcp_sendv(cci_connection_t * connection,
 
 	CCI_ENTER;
 
-	ret = tcp_send_common(connection, data, iovcnt, context, flags, NULL);
+	ret = tcp_send_common(connection, data, iovcnt, context, flags, NULL, 0);
+
+	CCI_EXIT;
+	return ret;
+}
+
+/* Queue the whole batch, then send the queued messages of all conns in
+ * one progress pass (a single system call with io_uring). Blocking and
+ * unreliable messages are still sent as they are posted.
+ */
+static int ctp_tcp_send_batch(cci_send_desc_t * descs, uint32_t count)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i, queued = 0;
+	cci__ep_t *ep;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	ep = container_of(descs[0].connection->endpoint, cci__ep_t, endpoint);
+
+	for (i = 0; i < count; i++) {
+		cci_send_desc_t *desc = &descs[i];
+		cci__conn_t *conn = container_of(desc->connection,
+						 cci__conn_t, connection);
+		int defer = cci_conn_is_reliable(conn) &&
+			    !(desc->flags & CCI_FLAG_BLOCKING);
+
+		assert(desc->connection->endpoint == &ep->endpoint);
+
+		desc->status = tcp_send_common(desc->connection, desc->data,
+					desc->iovcnt, desc->context,
+					desc->flags, NULL, defer);
+		if (desc->status == CCI_SUCCESS)
+			queued += defer;
+		else if (ret == CCI_SUCCESS)
+			ret = desc->status;
+	}
+
+	if (queued)
+		tcp_progress_queued(ep, NULL);
 
 	CCI_EXIT;
 	return ret;
@@ -2195,6 +4099,7 @@ static int ctp_tcp_rma_register(cci_endpoint_t * endpoint,
 	cci__ep_t *ep = NULL;
 	tcp_ep_t *tep = NULL;
 	tcp_rma_handle_t *handle = NULL;
+	int ret;
 
 	CCI_ENTER;
 
@@ -2215,13 +4120,21 @@ static int ctp_tcp_rma_register(cci_endpoint_t * endpoint,
 	handle->ep = ep;
 	handle->length = length;
 	handle->start = start;
-	*((uint64_t*)&handle->rma_handle.stuff[0]) = (uintptr_t) handle;
 	handle->flags = flags;
 	handle->refcnt = 1;
+	handle->fd = -1;
+
+	ret = cci__rma_reg_insert(&tep->reg, handle,
+			(uint64_t *) &handle->rma_handle.stuff[0]);
+	if (ret) {
+		free(handle);
+		CCI_EXIT;
+		return ret;
+	}
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&tep->handles, handle, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	*rma_handle = &handle->rma_handle;
 
@@ -2238,7 +4151,6 @@ static int ctp_tcp_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t *
 	cci__ep_t *ep = NULL;
 	tcp_ep_t *tep = NULL;
 	tcp_rma_handle_t *h = NULL;
-	tcp_rma_handle_t *tmp = NULL;
 
 	CCI_ENTER;
 
@@ -2250,19 +4162,21 @@ static int ctp_tcp_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t *
 	ep = handle->ep;
 	tep = ep->priv;
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH_SAFE(h, &tep->handles, entry, tmp) {
-		if (h == handle) {
-			handle->refcnt--;
-			if (handle->refcnt == 1)
-				TAILQ_REMOVE(&tep->handles, handle, entry);
-			break;
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&tep->reg, rma_handle->stuff[0]);
+	if (h == handle) {
+		handle->refcnt--;
+		if (handle->refcnt == 1) {
+			TAILQ_REMOVE(&tep->handles, handle, entry);
+			cci__rma_reg_remove(&tep->reg, rma_handle->stuff[0]);
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (h == handle) {
 		if (handle->refcnt == 1) {
+			if (handle->fd != -1)
+				close(handle->fd);
 			memset(handle, 0, sizeof(*handle));
 			free(handle);
 		}
@@ -2273,13 +4187,188 @@ static int ctp_tcp_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t *
 	return ret;
 }
 
-static int ctp_tcp_rma(cci_connection_t * connection,
-		    const void *msg_ptr, uint32_t msg_len,
-		    cci_rma_handle_t * local_handle, uint64_t local_offset,
-		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
-		    uint64_t data_len, const void *context, int flags)
+/* Split the segments of a cci_rmav() op in fragments. A write copies
+ * consecutive small segments together and slices the others at the
+ * fragment size, a read requests up to TCP_RMAV_MAX_SEGS segments at
+ * once. Returns the number of fragments and adds the size of the packed
+ * fragments to *stage_len. Fills frags, pointing them into stage, if
+ * not NULL.
+ */
+static uint32_t
+tcp_rmav_plan(const cci_rma_seg_t *segs, uint32_t segcnt, uint32_t frag,
+		int write, tcp_rma_frag_t *frags, char *stage, size_t *stage_len)
+{
+	uint32_t i = 0, n = 0;
+
+	while (i < segcnt) {
+		uint32_t cnt = 0;
+		uint64_t len = 0, off = 0;
+
+		while (i + cnt < segcnt && cnt < TCP_RMAV_MAX_SEGS &&
+			(!write || (segs[i + cnt].length <= TCP_RMAV_PACK_LEN &&
+			len + segs[i + cnt].length <= frag)))
+			len += segs[i + cnt++].length;
+
+		if (cnt > 1) {
+			if (frags) {
+				frags[n].seg = i;
+				frags[n].cnt = cnt;
+				frags[n].offset = 0;
+				frags[n].len = len;
+				frags[n].buf = stage + *stage_len;
+			}
+			/* keep the segment tables aligned */
+			if (write)
+				*stage_len += (cnt * sizeof(tcp_rma_seg_t) +
+						len + 7) & ~7;
+			else
+				*stage_len += cnt * sizeof(tcp_rma_read_seg_t);
+			n++;
+			i += cnt;
+			continue;
+		}
+
+		/* a lone small segment is not worth a copy */
+		do {
+			uint64_t left = segs[i].length - off;
+
+			if (frags) {
+				frags[n].seg = i;
+				frags[n].cnt = 0;
+				frags[n].offset = off;
+				frags[n].len = write && left > frag ? frag : left;
+				frags[n].buf = NULL;
+			}
+			off += write && left > frag ? frag : left;
+			n++;
+		} while (off < segs[i].length);
+		i++;
+	}
+
+	return n;
+}
+
+/* Pack fragment id of an RMA op in tx: a write fragment, several packed
+ * segments of a vectored write or a read request of one or more segments.
+ */
+static void
+tcp_rma_pack_frag(cci__ep_t *ep, cci__conn_t *conn, tcp_rma_op_t *rma_op,
+		tcp_tx_t *tx, uint32_t id, uint32_t depth)
+{
+	tcp_rma_frag_t *f = rma_op->frags ? &rma_op->frags[id] : NULL;
+	tcp_rma_handle_t *local =
+		container_of(rma_op->local_handle, tcp_rma_handle_t, rma_handle);
+	uint64_t local_offset, remote_offset, len;
+
+	tx->flags = rma_op->flags | CCI_FLAG_SILENT;
+	tx->state = TCP_TX_QUEUED;
+	tx->offset = 0;
+	tx->rma_op = rma_op;
+	tx->rma_id = id;
+
+	tx->evt.event.type = CCI_EVENT_SEND;
+	tx->evt.event.send.status = CCI_SUCCESS; /* for now */
+	tx->evt.event.send.context = rma_op->context;
+	tx->evt.event.send.connection = &conn->connection;
+	tx->evt.conn = conn;
+
+	if (f) {
+		local_offset = rma_op->segs[f->seg].local_offset + f->offset;
+		remote_offset = rma_op->segs[f->seg].remote_offset + f->offset;
+		len = f->len;
+	} else if (rma_op->flags & CCI_FLAG_WRITE) {
+		uint64_t offset = (uint64_t) id * (uint64_t) rma_op->frag;
+
+		local_offset = rma_op->local_offset + offset;
+		remote_offset = rma_op->remote_offset + offset;
+		len = rma_op->data_len - offset < rma_op->frag ?
+			rma_op->data_len - offset : rma_op->frag;
+	} else {
+		local_offset = rma_op->local_offset;
+		remote_offset = rma_op->remote_offset;
+		len = rma_op->data_len;
+	}
+
+	if (f && f->cnt && (rma_op->flags & CCI_FLAG_WRITE)) {
+		tcp_rma_header_t *write = tx->buffer;
+
+		tx->msg_type = TCP_MSG_RMA_WRITEV;
+		tx->len = sizeof(*write);
+		tx->rma_ptr = f->buf;
+		tx->rma_len = f->cnt * sizeof(tcp_rma_seg_t) + (uint32_t) len;
+
+		debug(CCI_DB_MSG, "%s: %s of %u segments length %"PRIu64,
+			__func__, tcp_msg_type(tx->msg_type), f->cnt, len);
+
+		tcp_pack_rma_writev(write, f->cnt, tx->id,
+				rma_op->local_handle->stuff[0],
+				rma_op->remote_handle->stuff[0]);
+		/* data fragments are striped across the data sockets */
+		tx->dconn = tcp_data_conn(ep, conn);
+	} else if (rma_op->flags & CCI_FLAG_WRITE) {
+		tcp_rma_header_t *write = tx->buffer;
+
+		tx->msg_type = TCP_MSG_RMA_WRITE;
+		tx->len = sizeof(*write);
+		tx->rma_len = (uint32_t) len;
+		tx->rma_ptr = (void*)((uintptr_t)local->start + local_offset);
+
+		debug(CCI_DB_MSG, "%s: %s local offset %"PRIu64" "
+			"remote offset %"PRIu64" length %u", __func__,
+			tcp_msg_type(tx->msg_type),
+			local_offset, remote_offset, tx->rma_len);
+
+		tcp_pack_rma_write(write, tx->rma_len, tx->id,
+					rma_op->local_handle->stuff[0],
+					local_offset,
+					rma_op->remote_handle->stuff[0],
+					remote_offset);
+		tx->dconn = tcp_data_conn(ep, conn);
+	} else {
+		tcp_rma_read_request_t *read = tx->buffer;
+		uint32_t cnt = f ? f->cnt : 0;
+
+		tx->msg_type = TCP_MSG_RMA_READ_REQUEST;
+
+		debug(CCI_DB_MSG, "%s: %s local offset %"PRIu64" "
+			"remote offset %"PRIu64" length %"PRIu64" segments %u",
+			__func__, tcp_msg_type(tx->msg_type),
+			local_offset, remote_offset, len, cnt);
+
+		/* the segment table carries the offsets */
+		if (cnt)
+			local_offset = remote_offset = 0;
+
+		tx->len = sizeof(*read);
+		tcp_pack_rma_read_request(read, rma_op->frag, depth, cnt, len,
+					tx->id,
+					rma_op->local_handle->stuff[0],
+					local_offset,
+					rma_op->remote_handle->stuff[0],
+					remote_offset);
+		tx->rma_ptr = cnt ? f->buf : NULL;
+		tx->rma_len = cnt * sizeof(tcp_rma_read_seg_t);
+		tx->rma_left = len;
+		tx->dconn = conn;
+	}
+
+	return;
+}
+
+/* Post an RMA: the range of cci_rma() or the segments of cci_rmav() if
+ * segs is not NULL.
+ */
+static int
+tcp_rma_common(cci_connection_t * connection,
+		const void *msg_ptr, uint32_t msg_len,
+		cci_rma_handle_t * local_handle, uint64_t local_offset,
+		cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		uint64_t data_len, const cci_rma_seg_t * segs, uint32_t segcnt,
+		const void *context, int flags)
 {
 	int ret = CCI_SUCCESS, i, cnt, err = 0;
+	uint32_t frag, depth, j, nfrags = 0;
+	size_t stage_len = 0;
 	cci__ep_t *ep = NULL;
 	cci__conn_t *conn = NULL;
 	tcp_ep_t *tep = NULL;
@@ -2289,8 +4378,7 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 	tcp_rma_handle_t *h = NULL;
 	tcp_rma_op_t *rma_op = NULL;
 	tcp_tx_t **txs = NULL;
-	tcp_msg_type_t msg_type = flags & CCI_FLAG_WRITE ?
-		TCP_MSG_RMA_WRITE : TCP_MSG_RMA_READ_REQUEST;
+	cci__conn_t *socks[TCP_RMA_MAX_DEPTH];
 
 	CCI_ENTER;
 
@@ -2310,14 +4398,17 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &tep->handles, entry) {
-		if (h == local) {
-			local->refcnt++;
-			break;
-		}
+	/* the completion message is sent from the tx buffer */
+	if (msg_len > ep->buffer_len - sizeof(tcp_header_t)) {
+		CCI_EXIT;
+		return CCI_EMSGSIZE;
 	}
-	pthread_mutex_unlock(&ep->lock);
+
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&tep->reg, local_handle->stuff[0]);
+	if (h == local)
+		local->refcnt++;
+	cci__ep_unlock(ep, &ep->lock);
 
 	if (h != local) {
 		debug(CCI_DB_INFO, "%s: invalid endpoint for this RMA handle",
@@ -2326,13 +4417,35 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		return CCI_EINVAL;
 	}
 
-	rma_op = calloc(1, sizeof(*rma_op));
+	/* the conn's current fragment size and depth apply to the whole op */
+	cci__ep_lock(ep, &ep->lock);
+	frag = tconn->rma_frag;
+	depth = tconn->rma_depth;
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (segs) {
+		data_len = 0;
+		for (j = 0; j < segcnt; j++) {
+			/* packed segments are copied from the local region */
+			if (segs[j].local_offset > local->length ||
+			    segs[j].length > local->length - segs[j].local_offset) {
+				debug(CCI_DB_INFO, "%s: segment %u exceeds the "
+					"local RMA handle", __func__, j);
+				ret = CCI_EINVAL;
+				goto out;
+			}
+			data_len += segs[j].length;
+		}
+		nfrags = tcp_rmav_plan(segs, segcnt, frag,
+				flags & CCI_FLAG_WRITE, NULL, NULL, &stage_len);
+	}
+
+	/* a vectored op keeps its segments and fragments with it */
+	rma_op = calloc(1, sizeof(*rma_op) + segcnt * sizeof(*segs) +
+			nfrags * sizeof(*rma_op->frags) + stage_len);
 	if (!rma_op) {
-		pthread_mutex_lock(&ep->lock);
-		local->refcnt--;
-		pthread_mutex_unlock(&ep->lock);
-		CCI_EXIT;
-		return CCI_ENOMEM;
+		ret = CCI_ENOMEM;
+		goto out;
 	}
 
 	rma_op->data_len = data_len;
@@ -2340,10 +4453,61 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 	rma_op->local_offset = local_offset;
 	rma_op->remote_handle = remote_handle;
 	rma_op->remote_offset = remote_offset;
-	/* avoid modulo */
-	rma_op->num_msgs = data_len / TCP_RMA_FRAG_SIZE;
-	if ((rma_op->num_msgs * TCP_RMA_FRAG_SIZE) < data_len)
-		rma_op->num_msgs++;
+	rma_op->frag = frag;
+	rma_op->start = tcp_get_usecs();
+	if (segs) {
+		char *stage;
+
+		rma_op->segs = (cci_rma_seg_t *) (rma_op + 1);
+		memcpy(rma_op->segs, segs, segcnt * sizeof(*segs));
+		rma_op->frags = (tcp_rma_frag_t *) (rma_op->segs + segcnt);
+		stage = (char *) (rma_op->frags + nfrags);
+		stage_len = 0;
+		rma_op->num_msgs = tcp_rmav_plan(segs, segcnt, frag,
+				flags & CCI_FLAG_WRITE, rma_op->frags, stage,
+				&stage_len);
+
+		/* copy the packed segments now, they may be sent at once */
+		for (j = 0; j < rma_op->num_msgs; j++) {
+			tcp_rma_frag_t *f = &rma_op->frags[j];
+			tcp_rma_seg_t *table = f->buf;
+			char *data = (char *) (table + f->cnt);
+			uint32_t k;
+
+			if (!(flags & CCI_FLAG_WRITE)) {
+				tcp_rma_read_seg_t *rtable = f->buf;
+
+				for (k = 0; k < f->cnt; k++) {
+					const cci_rma_seg_t *seg =
+						&segs[f->seg + k];
+
+					tcp_pack_rma_read_seg(&rtable[k],
+						seg->local_offset,
+						seg->remote_offset,
+						seg->length);
+				}
+				continue;
+			}
+
+			for (k = 0; k < f->cnt; k++) {
+				const cci_rma_seg_t *seg = &segs[f->seg + k];
+
+				tcp_pack_rma_seg(&table[k], seg->remote_offset,
+						(uint32_t) seg->length);
+				memcpy(data, (char *) local->start +
+					seg->local_offset, seg->length);
+				data += seg->length;
+			}
+		}
+	} else if (flags & CCI_FLAG_WRITE) {
+		/* avoid modulo */
+		rma_op->num_msgs = data_len / frag;
+		if (((uint64_t) rma_op->num_msgs * frag) < data_len)
+			rma_op->num_msgs++;
+	} else {
+		/* a single request, the target streams the range back */
+		rma_op->num_msgs = 1;
+	}
 	rma_op->acked = -1;
 	rma_op->status = CCI_SUCCESS;	/* for now */
 	rma_op->context = (void *)context;
@@ -2364,120 +4528,225 @@ static int ctp_tcp_rma(cci_connection_t * connection,
 		rma_op->msg_ptr = NULL;
 	}
 
-	debug(CCI_DB_MSG, "%s: starting RMA %s ***", __func__,
-		flags & CCI_FLAG_WRITE ? "Write" : "Read");
+	debug(CCI_DB_MSG, "%s: starting RMA %s *** (fragment size %u depth %u)",
+		__func__, flags & CCI_FLAG_WRITE ? "Write" : "Read", frag, depth);
+
+	cnt = rma_op->num_msgs < depth ? rma_op->num_msgs : depth;
+	rma_op->next = cnt;
+	rma_op->pending = cnt;
+
+	txs = calloc(cnt, sizeof(*txs));
+	if (!txs) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < cnt; i++) {
+		txs[i] = tcp_get_tx_locked(ep);
+		if (!txs[i])
+			err++;
+	}
+	if (err) {
+		for (i = 0; i < cnt; i++) {
+			if (txs[i])
+				tcp_put_tx_locked(tep, txs[i]);
+		}
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (err) {
+		free(txs);
+		ret = CCI_ENOBUFS;
+		goto out;
+	}
+
+	/* we have all the txs we need, pack them and queue them */
+	for (i = 0; i < cnt; i++)
+		tcp_rma_pack_frag(ep, conn, rma_op, txs[i], i, depth);
+
+	cci__ep_lock(ep, &tconn->slock);
+	TAILQ_INSERT_TAIL(&tconn->rmas, rma_op, rmas);
+	cci__ep_unlock(ep, &tconn->slock);
+
+	/* the txs may complete as soon as they are queued */
+	cci__ep_lock(ep, &ep->lock);
+	TAILQ_INSERT_TAIL(&tep->rma_ops, rma_op, entry);
+	for (i = 0; i < cnt; i++)
+		socks[i] = tcp_queue_frag_locked(ep, txs[i]);
+	cci__ep_unlock(ep, &ep->lock);
+
+	ret = CCI_SUCCESS;
+
+	for (i = 0; i < cnt; i++) {
+		int k;
+
+		/* progress each socket once */
+		for (k = 0; k < i && socks[k] != socks[i]; k++) ;
+		if (k == i && socks[i] != conn)
+			tcp_progress_conn_sends(socks[i], 0);
+	}
+	tcp_progress_conn_sends(conn, 0);
+
+	/* it is no longer needed */
+	free(txs);
+
+out:
+	if (ret) {
+		cci__ep_lock(ep, &ep->lock);
+		local->refcnt--;
+		cci__ep_unlock(ep, &ep->lock);
+		if (rma_op && rma_op->tx)
+			tcp_put_tx(rma_op->tx);
+		free(rma_op);
+	}
+	CCI_EXIT;
+	return ret;
+}
+
+static int ctp_tcp_rma(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    uint64_t data_len, const void *context, int flags)
+{
+	return tcp_rma_common(connection, msg_ptr, msg_len,
+			local_handle, local_offset,
+			remote_handle, remote_offset,
+			data_len, NULL, 0, context, flags);
+}
+
+static int ctp_tcp_rmav(cci_connection_t * connection,
+		    const void *msg_ptr, uint32_t msg_len,
+		    cci_rma_handle_t * local_handle,
+		    cci_rma_handle_t * remote_handle,
+		    const cci_rma_seg_t * segs, uint32_t segcnt,
+		    const void *context, int flags)
+{
+	return tcp_rma_common(connection, msg_ptr, msg_len,
+			local_handle, 0, remote_handle, 0,
+			0, segs, segcnt, context, flags);
+}
+
+static int ctp_tcp_rma_atomic(cci_connection_t * connection,
+		    cci_rma_handle_t * local_handle, uint64_t local_offset,
+		    cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		    cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		    const void *context, int flags)
+{
+	int ret = CCI_SUCCESS;
+	cci__ep_t *ep = NULL;
+	cci__conn_t *conn = NULL;
+	tcp_ep_t *tep = NULL;
+	tcp_conn_t *tconn = NULL;
+	tcp_rma_handle_t *local =
+		container_of(local_handle, tcp_rma_handle_t, rma_handle);
+	tcp_rma_handle_t *h = NULL;
+	tcp_rma_op_t *rma_op = NULL;
+	tcp_tx_t *tx = NULL;
+
+	CCI_ENTER;
+
+	if (!tglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	tconn = conn->priv;
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	tep = ep->priv;
 
-	cnt = rma_op->num_msgs < TCP_RMA_DEPTH ?
-	    rma_op->num_msgs : TCP_RMA_DEPTH;
+	cci__ep_lock(ep, &ep->lock);
+	h = cci__rma_reg_lookup(&tep->reg, local_handle->stuff[0]);
+	if (h == local)
+		local->refcnt++;
+	cci__ep_unlock(ep, &ep->lock);
 
-	txs = calloc(cnt, sizeof(*txs));
-	if (!txs) {
-		pthread_mutex_lock(&ep->lock);
-		local->refcnt--;
-		pthread_mutex_unlock(&ep->lock);
-		free(rma_op);
+	if (h != local) {
+		debug(CCI_DB_INFO, "%s: invalid endpoint for this RMA handle",
+		      __func__);
 		CCI_EXIT;
-		return CCI_ENOMEM;
+		return CCI_EINVAL;
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	for (i = 0; i < cnt; i++) {
-		txs[i] = tcp_get_tx_locked(tep);
-		if (!txs[i])
-			err++;
+	if (local_offset > local->length ||
+	    sizeof(uint64_t) > local->length - local_offset) {
+		debug(CCI_DB_INFO, "%s: local offset exceeds the local RMA "
+			"handle", __func__);
+		ret = CCI_EINVAL;
+		goto out;
 	}
-	if (err) {
-		for (i = 0; i < cnt; i++) {
-			if (txs[i])
-				TAILQ_INSERT_HEAD(&tep->idle_txs,
-						  &txs[i]->evt, entry);
-		}
-		local->refcnt--;
+
+	rma_op = calloc(1, sizeof(*rma_op));
+	if (!rma_op) {
+		ret = CCI_ENOMEM;
+		goto out;
 	}
-	pthread_mutex_unlock(&ep->lock);
 
-	if (err) {
-		free(txs);
-		free(rma_op);
-		CCI_EXIT;
-		return CCI_ENOBUFS;
+	rma_op->data_len = sizeof(uint64_t);
+	rma_op->local_handle = local_handle;
+	rma_op->local_offset = local_offset;
+	rma_op->remote_handle = remote_handle;
+	rma_op->remote_offset = remote_offset;
+	rma_op->frag = tconn->rma_frag;
+	rma_op->start = tcp_get_usecs();
+	rma_op->num_msgs = 1;
+	rma_op->next = 1;
+	rma_op->pending = 1;
+	rma_op->acked = -1;
+	rma_op->status = CCI_SUCCESS;	/* for now */
+	rma_op->context = (void *)context;
+	rma_op->flags = flags;
+
+	tx = tcp_get_tx(ep, 0);
+	if (!tx) {
+		ret = CCI_ENOBUFS;
+		goto out;
 	}
 
-	/* we have all the txs we need, pack them and queue them */
-	for (i = 0; i < cnt; i++) {
-		tcp_tx_t *tx = txs[i];
-		uint64_t offset =
-		    (uint64_t) i * (uint64_t) TCP_RMA_FRAG_SIZE;
-		tcp_rma_header_t *rma_hdr =
-		    (tcp_rma_header_t *) tx->buffer;
-
-		rma_op->next = i + 1;
-		tx->msg_type = msg_type;
-		tx->flags = flags | CCI_FLAG_SILENT;
-		tx->state = TCP_TX_QUEUED;
-		tx->len = sizeof(*rma_hdr);
-		tx->rma_len = TCP_RMA_FRAG_SIZE; /* for now */
-		tx->rma_op = rma_op;
-		tx->rma_id = i;
+	tx->msg_type = TCP_MSG_RMA_ATOMIC;
+	tx->flags = flags | CCI_FLAG_SILENT;
+	tx->state = TCP_TX_QUEUED;
+	tx->len = sizeof(tcp_rma_atomic_t);
+	tx->offset = 0;
+	tx->rma_op = rma_op;
+	tx->rma_id = 0;
+	tx->rma_ptr = NULL;
+	tx->rma_len = 0;
+	/* atomics stay on the primary socket, ordered with the messages */
+	tx->dconn = conn;
 
-		tx->evt.event.type = CCI_EVENT_SEND;
-		tx->evt.event.send.status = CCI_SUCCESS; /* for now */
-		tx->evt.event.send.context = (void *)context;
-		tx->evt.event.send.connection = connection;
-		tx->evt.conn = conn;
+	tx->evt.event.type = CCI_EVENT_SEND;
+	tx->evt.event.send.status = CCI_SUCCESS; /* for now */
+	tx->evt.event.send.context = (void *)context;
+	tx->evt.event.send.connection = connection;
+	tx->evt.conn = conn;
 
-		if (i == (int)(rma_op->num_msgs - 1)) {
-			if (data_len % TCP_RMA_FRAG_SIZE)
-				tx->rma_len = data_len % TCP_RMA_FRAG_SIZE;
-		}
+	debug(CCI_DB_MSG, "%s: op %d local offset %"PRIu64" remote offset "
+		"%"PRIu64, __func__, op, local_offset, remote_offset);
 
-		tx->rma_ptr = (void*)((uintptr_t)local->start + local_offset + offset);
+	tcp_pack_rma_atomic(tx->buffer, op, 0, tx->id,
+			local_handle->stuff[0], local_offset,
+			remote_handle->stuff[0], remote_offset,
+			operand, compare);
 
-		debug(CCI_DB_MSG, "%s: %s local offset %"PRIu64" "
-			"remote offset %"PRIu64" length %u", __func__,
-			tcp_msg_type(msg_type),
-			local_offset + offset, remote_offset + offset,
-			tx->rma_len);
-
-		if (msg_type == TCP_MSG_RMA_WRITE) {
-			tcp_pack_rma_write(rma_hdr, tx->rma_len, tx->id,
-						local_handle->stuff[0],
-						local_offset + offset,
-						remote_handle->stuff[0],
-						remote_offset + offset);
-		} else {
-			tcp_pack_rma_read_request(rma_hdr, tx->rma_len, tx->id,
-						local_handle->stuff[0],
-						local_offset + offset,
-						remote_handle->stuff[0],
-						remote_offset + offset);
-			tx->rma_ptr = NULL;
-			tx->rma_len = 0;
-		}
-	}
-	pthread_mutex_lock(&tconn->slock);
-	for (i = 0; i < cnt; i++)
-		TAILQ_INSERT_TAIL(&tconn->queued, &(txs[i])->evt, entry);
+	cci__ep_lock(ep, &tconn->slock);
 	TAILQ_INSERT_TAIL(&tconn->rmas, rma_op, rmas);
-	tep->fds[tconn->index].events = POLLIN | POLLOUT;
-	pthread_mutex_unlock(&tconn->slock);
+	cci__ep_unlock(ep, &tconn->slock);
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&tep->rma_ops, rma_op, entry);
-	pthread_mutex_unlock(&ep->lock);
-
-	/* it is no longer needed */
-	free(txs);
-
-	ret = CCI_SUCCESS;
+	cci__ep_unlock(ep, &ep->lock);
 
+	tcp_queue_tx(ep, tconn, &tx->evt);
 	tcp_progress_conn_sends(conn, 0);
 
 out:
 	if (ret) {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		local->refcnt--;
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		free(rma_op);
 	}
 	CCI_EXIT;
@@ -2529,9 +4798,9 @@ tcp_handle_listen_socket(cci__ep_t *ep)
 
 	tconn->status = TCP_CONN_PASSIVE1;
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_INSERT_TAIL(&tep->passive, tconn, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	memset(name, 0, sizeof(name));
 	tcp_sin_to_name(tconn->sin, name, sizeof(name));
@@ -2541,9 +4810,9 @@ tcp_handle_listen_socket(cci__ep_t *ep)
 	return;
 
 out:
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_conn_set_closing_locked(ep, conn);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 
@@ -2599,7 +4868,9 @@ tcp_handle_conn_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t
 	cci_conn_attribute_t attr = a & 0xF;
 	uint32_t len = (a >> 4) & 0xFFFF;
 	uint32_t total = len + sizeof(*hs);
-	uint32_t rx_cnt, mss, ka, ignore;
+	uint32_t rx_cnt, mss, ka, ignore, data_socks, ignore_id;
+	uint64_t ignore_token;
+	tcp_dev_t *tdev = ep->dev->priv;
 
 	ret = tcp_recv_msg(tconn->fd, hdr->data, total);
 	if (ret) {
@@ -2609,7 +4880,8 @@ tcp_handle_conn_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t
 
 	tconn->status = TCP_CONN_PASSIVE2;
 
-	tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &ignore);
+	tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &ignore,
+			&data_socks, &ignore_id, &ignore_token);
 
 	conn->keepalive_timeout = ka;
 	if (mss < conn->connection.max_send_size)
@@ -2620,6 +4892,9 @@ tcp_handle_conn_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t
 	if (cci_conn_is_reliable(conn)) {
 		tconn->max_tx_cnt = rx_cnt < ep->tx_buf_cnt ?
 				    rx_cnt : ep->tx_buf_cnt;
+		/* only reliable conns use RMA */
+		tconn->max_data = data_socks < tdev->data_socks ?
+				  data_socks : tdev->data_socks;
 	}
 
 	rx->evt.event.type = CCI_EVENT_CONNECT_REQUEST;
@@ -2634,21 +4909,108 @@ tcp_handle_conn_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t
 
 	debug(CCI_DB_CONN, "%s: recv'd conn request on conn %p", __func__, (void*)conn);
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, &rx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	tcp_deliver_evt(ep->priv, &rx->evt);
 
 	return;
 out:
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	tcp_conn_set_closing_locked(ep, conn);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	tcp_put_rx(rx);
 
 	return;
 }
 
+/* Open the data sockets negotiated in the handshake. Each one announces
+ * itself with a CONN_DATA message carrying the server's conn id and token
+ * so that the server can attach it to this connection.
+ *
+ * NOTE: called from the poller which holds poller->is_polling
+ */
+static void
+tcp_open_data_socks(cci__ep_t *ep, cci__conn_t *conn, uint32_t count,
+			uint32_t conn_id, uint64_t token)
+{
+	int ret, fd;
+	uint32_t i;
+	tcp_ep_t *tep = ep->priv;
+	tcp_dev_t *tdev = ep->dev->priv;
+	tcp_conn_t *tconn = conn->priv;
+
+	for (i = 0; i < count; i++) {
+		cci__conn_t *dconn = NULL;
+		tcp_conn_t *dtconn = NULL;
+		tcp_tx_t *tx = NULL;
+
+		tx = tcp_get_tx(ep, 0);
+		if (!tx)
+			break;
+
+		fd = socket(PF_INET, SOCK_STREAM, 0);
+		if (fd == -1) {
+			debug(CCI_DB_CONN, "%s: socket returned %s",
+				__func__, strerror(errno));
+			tcp_put_tx(tx);
+			break;
+		}
+
+		tcp_set_bufsize(fd, tdev->bufsize);
+
+		ret = tcp_new_conn(ep, tconn->sin, fd, &dconn);
+		if (ret) {
+			close(fd);
+			tcp_put_tx(tx);
+			break;
+		}
+
+		dconn->connection.attribute = conn->connection.attribute;
+		dtconn = dconn->priv;
+		dtconn->primary = conn;
+		dtconn->status = TCP_CONN_ACTIVE1;
+
+		tx->msg_type = TCP_MSG_CONN_DATA;
+		tx->evt.event.type = CCI_EVENT_NONE;
+		tx->evt.conn = dconn;
+		tcp_pack_conn_data(tx->buffer, i, conn_id, token);
+		tx->len = sizeof(tcp_header_t) + sizeof(tcp_conn_data_t);
+		tx->state = TCP_TX_QUEUED;
+		TAILQ_INSERT_TAIL(&dtconn->queued, &tx->evt, entry);
+
+		ret = tcp_monitor_fd(ep, dconn, POLLOUT);
+		if (!ret) {
+			ret = connect(fd, (struct sockaddr *)&tconn->sin,
+					sizeof(tconn->sin));
+			if (ret) {
+				ret = errno;
+				if (ret == EINPROGRESS)
+					ret = 0;
+			}
+		}
+
+		cci__ep_lock(ep, &ep->lock);
+		TAILQ_INSERT_TAIL(&tep->active, dtconn, entry);
+		if (ret) {
+			debug(CCI_DB_CONN, "%s: data socket %u failed with %s",
+				__func__, i, strerror(ret));
+			TAILQ_REMOVE(&dtconn->queued, &tx->evt, entry);
+			tcp_put_tx_locked(tep, tx);
+			tcp_conn_set_closing_locked(ep, dconn);
+		} else {
+			tconn->data[tconn->ndata++] = dconn;
+		}
+		cci__ep_unlock(ep, &ep->lock);
+
+		if (ret)
+			break;
+	}
+
+	debug(CCI_DB_CONN, "%s: conn %p opened %u of %u data sockets",
+		__func__, (void*)conn, tconn->ndata, count);
+
+	return;
+}
+
 static void
 tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 			uint32_t a, uint32_t tx_id)
@@ -2660,8 +5022,24 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	tcp_handshake_t *hs = (void*)((uintptr_t)rx->buffer + sizeof(*hdr));
 	int reply = a & 0xFF, accepted = 0;
 	uint32_t total = sizeof(*hs);
-	uint32_t rx_cnt, mss, ka, server_tx_id;
-	tcp_tx_t *tx = &tep->txs[tx_id];
+	uint32_t rx_cnt, mss, ka, ignore, data_socks = 0, conn_id = 0;
+	uint64_t token = 0;
+	tcp_tx_t *tx = tcp_tx_by_id(ep, tx_id);
+
+	if (!tx) {
+		cci__evt_t *evt;
+
+		/* fail the connect we sent instead */
+		debug(CCI_DB_WARN, "%s: conn %p replied to invalid tx id %u",
+			__func__, (void*)conn, tx_id);
+		cci__ep_lock(ep, &tconn->slock);
+		evt = TAILQ_FIRST(&tconn->pending);
+		cci__ep_unlock(ep, &tconn->slock);
+		if (!evt)
+			goto out;
+		tx = container_of(evt, tcp_tx_t, evt);
+		reply = CCI_ERROR;
+	}
 
 	accepted = reply == CCI_SUCCESS ? 1 : 0;
 
@@ -2671,9 +5049,9 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	if (accepted) {
 		tconn->status = TCP_CONN_READY;
 	} else {
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		tcp_conn_set_closing_locked(ep, conn);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	if (accepted) {
@@ -2683,7 +5061,8 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 			goto out;
 		}
 
-		tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &server_tx_id);
+		tcp_parse_handshake(hs, &rx_cnt, &mss, &ka, &ignore,
+				&data_socks, &conn_id, &token);
 
 		if (mss < conn->connection.max_send_size)
 			conn->connection.max_send_size = mss;
@@ -2702,82 +5081,91 @@ tcp_handle_conn_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	else
 		rx->evt.event.connect.connection = NULL;
 
-	tx->msg_type = TCP_MSG_CONN_ACK;
-	tx->rma_op = NULL;
-	tx->rma_ptr = NULL;
-	tx->rma_len = 0;
-	tx->evt.event.type = CCI_EVENT_NONE;
-
-	/* pack the msg */
-
-	hdr = (tcp_header_t *) tx->buffer;
-	tcp_pack_conn_ack(hdr, server_tx_id);
-
-	tx->len = sizeof(*hdr);
-	tx->offset = 0;
-
-	/* insert at tail of tep's queued list */
-
-	tx->state = TCP_TX_QUEUED;
+	/* the reply completes the handshake, no conn_ack is sent */
 
 	if (accepted) {
-		pthread_mutex_lock(&tconn->slock);
+		cci__ep_lock(ep, &tconn->slock);
 		TAILQ_REMOVE(&tconn->pending, &tx->evt, entry); /* FIXME */
-		TAILQ_INSERT_TAIL(&tconn->queued, &tx->evt, entry);
+		cci__ep_unlock(ep, &tconn->slock);
 
+		cci__ep_lock(ep, &ep->lock);
 		TAILQ_REMOVE(&tep->active, tconn, entry);
 		TAILQ_INSERT_TAIL(&tep->conns, tconn, entry);
-		pthread_mutex_unlock(&tconn->slock);
+		tcp_put_tx_locked(tep, tx);
+		cci__ep_unlock(ep, &ep->lock);
 
-		/* try to progress txs */
-		tcp_progress_conn_sends(conn, 0);
+		if (data_socks > tconn->max_data)
+			data_socks = tconn->max_data;
+		if (data_socks)
+			tcp_open_data_socks(ep, conn, data_socks, conn_id,
+					token);
 	} else {
 		tcp_put_tx(tx);
 	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, &rx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	tcp_deliver_evt(tep, &rx->evt);
 
 	return;
 out:
 	close(tconn->fd);
 
-	pthread_mutex_lock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
 	TAILQ_REMOVE(&tep->active, tconn, entry);
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_unlock(ep, &ep->lock);
 
 	free(tconn);
 	free((void *)conn->uri);
 	free(conn);
 	tcp_put_rx(rx);
-	tcp_put_tx(tx);
+	if (tx)
+		tcp_put_tx(tx);
 
 	return;
 }
 
+/* Attach an incoming data socket to the connection named by conn_id, if
+ * it carries the connection's token and comes from its peer's address. */
 static void
-tcp_handle_conn_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx, uint32_t tx_id)
+tcp_handle_conn_data(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t index, uint32_t conn_id)
 {
+	int ret;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
-	tcp_tx_t *tx = &tep->txs[tx_id];
-
-	debug(CCI_DB_CONN, "%s: recv'd conn_ack from conn %p",
-		__func__, (void*)conn);
-
-	pthread_mutex_lock(&tconn->slock);
-	TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
-	pthread_mutex_unlock(&tconn->slock);
+	tcp_conn_t *p = NULL;
+	tcp_header_t *hdr = rx->buffer;
+	uint64_t token = 0;
+
+	ret = tcp_recv_msg(tconn->fd, hdr->data, sizeof(tcp_conn_data_t));
+	if (!ret)
+		tcp_parse_conn_data((tcp_conn_data_t *) hdr->data, &token);
+
+	cci__ep_lock(ep, &ep->lock);
+	/* accepted conns are ready before the client sees the reply */
+	TAILQ_FOREACH(p, &tep->conns, entry) {
+		if (!ret && !p->primary && p->id == conn_id &&
+		    p->max_data && p->token == token &&
+		    p->sin.sin_addr.s_addr == tconn->sin.sin_addr.s_addr)
+			break;
+	}
 
-	pthread_mutex_lock(&ep->lock);
-	tconn->status = TCP_CONN_READY;
-	TAILQ_REMOVE(&tep->passive, tconn, entry);
-	TAILQ_INSERT_TAIL(&tep->conns, tconn, entry);
-	TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	if (p && p->ndata < p->max_data) {
+		conn->connection.attribute = p->conn->connection.attribute;
+		tconn->primary = p->conn;
+		TAILQ_REMOVE(&tep->passive, tconn, entry);
+		tconn->status = TCP_CONN_READY;
+		TAILQ_INSERT_TAIL(&tep->conns, tconn, entry);
+		p->data[p->ndata++] = conn;
 
-	debug(CCI_DB_CONN, "%s: conn %p ready", __func__, (void*)conn);
+		debug(CCI_DB_CONN, "%s: attached data socket %u to conn %p",
+			__func__, index, (void*)p->conn);
+	} else {
+		debug(CCI_DB_CONN, "%s: no conn for data socket %u "
+			"(conn id %u)", __func__, index, conn_id);
+		tcp_conn_set_closing_locked(ep, conn);
+	}
+	tcp_put_rx_locked(tep, rx);
+	cci__ep_unlock(ep, &ep->lock);
 
 	return;
 }
@@ -2789,10 +5177,32 @@ tcp_handle_send(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	int ret;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_header_t *hdr = rx->buffer;
-	uint32_t len = a & 0xFFFF;
+	uint32_t len = a & TCP_SEND_LEN_MASK;
 	uint32_t total = len;
+	void *ptr = hdr->data;
 
-	ret = tcp_recv_msg(tconn->fd, hdr->data, total);
+	if (len > ep->buffer_len - sizeof(*hdr)) {
+		/* large message, receive it in its own buffer */
+		rx->large = malloc(len);
+		if (!rx->large) {
+			uint32_t max = ep->buffer_len - sizeof(*hdr);
+
+			/* drop the payload and nack it */
+			while (total) {
+				uint32_t n = total < max ? total : max;
+
+				if (tcp_recv_msg(tconn->fd, hdr->data, n))
+					break;
+				total -= n;
+			}
+			tcp_put_rx(rx);
+			ret = CCI_ENOMEM;
+			goto out;
+		}
+		ptr = rx->large;
+	}
+
+	ret = tcp_recv_msg(tconn->fd, ptr, total);
 	if (ret) {
 		/* TODO handle error */
 		goto out;
@@ -2800,7 +5210,7 @@ tcp_handle_send(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	rx->evt.event.type = CCI_EVENT_RECV;
 	if (len)
-		rx->evt.event.recv.ptr = hdr->data;
+		rx->evt.event.recv.ptr = ptr;
 	else
 		rx->evt.event.recv.ptr = NULL;
 	rx->evt.event.recv.len = len;
@@ -2808,14 +5218,11 @@ tcp_handle_send(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	/* queue event on endpoint's completed event queue */
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_INSERT_TAIL(&ep->evts, &rx->evt, entry);
-	pthread_mutex_unlock(&ep->lock);
+	tcp_deliver_evt(ep->priv, &rx->evt);
 
 	ret = CCI_SUCCESS;
 out:
 	if (cci_conn_is_reliable(conn)) {
-		tcp_ep_t *tep = ep->priv;
 		tcp_tx_t *tx = NULL;
 		tcp_header_t *ack;
 
@@ -2827,7 +5234,7 @@ out:
 		ack = tx->buffer;
 		tcp_pack_ack(ack, tx_id, ret);
 
-		tcp_queue_tx(tep, tconn, &tx->evt);
+		tcp_queue_tx(ep, tconn, &tx->evt);
 	}
 
 	/* TODO close conn */
@@ -2847,7 +5254,7 @@ tcp_handle_rma_write(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	tcp_rma_header_t *rma_header = rx->buffer; /* need to read more */
 	uint32_t handle_len = 2 * sizeof(rma_header->local);
 	uint64_t remote_handle, remote_offset;
-	tcp_rma_handle_t *remote, *h = NULL;
+	tcp_rma_handle_t *remote;
 	void *ptr = NULL;
 
 	debug(CCI_DB_MSG, "%s: recv'ing RMA_WRITE on conn %p with len %u",
@@ -2861,17 +5268,9 @@ tcp_handle_rma_write(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	tcp_parse_rma_handle_offset(&rma_header->remote, &remote_handle,
 				     &remote_offset);
-	remote = (tcp_rma_handle_t *) (uintptr_t) remote_handle;
-
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &tep->handles, entry) {
-		if (h == remote) {
-			break;
-		}
-	}
-	pthread_mutex_unlock(&ep->lock);
+	remote = cci__rma_reg_lookup(&tep->reg, remote_handle);
 
-	if (h != remote) {
+	if (!remote) {
 		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
@@ -2905,101 +5304,274 @@ out:
 	ack = tx->buffer;
 	tcp_pack_ack(ack, tx_id, ret);
 
-	tcp_queue_tx(tep, tconn, &tx->evt);
+	/* the fragment may have arrived on a data socket, ack on the primary */
+	tcp_queue_tx(ep, tcp_primary_conn(conn)->priv, &tx->evt);
 
 	tcp_put_rx(rx);
 
 	return;
 }
 
+/* Read and drop len bytes of the stream */
+static int
+tcp_skip_msg(int fd, uint64_t len)
+{
+	int ret = CCI_SUCCESS;
+	char buf[4096];
+
+	while (len && !ret) {
+		uint32_t n = len < sizeof(buf) ? (uint32_t) len : sizeof(buf);
+
+		ret = tcp_recv_msg(fd, buf, n);
+		len -= n;
+	}
+
+	return ret;
+}
+
 static void
-tcp_handle_rma_read_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
-			uint32_t len, uint32_t tx_id)
+tcp_handle_rma_writev(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t count, uint32_t tx_id)
 {
-	int ret;
+	int ret, status = CCI_SUCCESS;
+	uint32_t i;
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
 	tcp_tx_t *tx = NULL;
-	tcp_rma_header_t *read_request = rx->buffer; /* need to read more */
-	tcp_rma_header_t *read_reply = NULL;
-	uint32_t handle_len = 2 * sizeof(read_request->local);
-	uint64_t local_handle, local_offset, remote_handle, remote_offset;
-	tcp_rma_handle_t *remote, *h = NULL;
+	tcp_header_t *ack;
+	tcp_rma_header_t *rma_header = rx->buffer; /* need to read more */
+	uint32_t handle_len = 2 * sizeof(rma_header->local);
+	uint64_t remote_handle, remote_offset;
+	tcp_rma_handle_t *remote;
+	tcp_rma_seg_t segs[TCP_RMAV_MAX_SEGS];
 
-	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REQUEST on conn %p with len %u",
-		__func__, (void*)conn, len);
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_WRITEV on conn %p with %u segments",
+		__func__, (void*)conn, count);
+
+	if (count == 0 || count > TCP_RMAV_MAX_SEGS) {
+		debug(CCI_DB_WARN, "%s: invalid segment count %u",
+			__func__, count);
+		goto close;
+	}
 
-	ret = tcp_recv_msg(tconn->fd, read_request->header.data, handle_len);
+	ret = tcp_recv_msg(tconn->fd, rma_header->header.data, handle_len);
+	if (!ret)
+		ret = tcp_recv_msg(tconn->fd, segs, count * sizeof(segs[0]));
 	if (ret) {
-		/* TODO handle error */
-		goto out;
+		debug(CCI_DB_MSG, "%s: recv'ing RMA WRITEV segments failed "
+			"with %s", __func__, strerror(ret));
+		goto close;
 	}
 
-	tcp_parse_rma_handle_offset(&read_request->local, &local_handle,
-				     &local_offset);
-	tcp_parse_rma_handle_offset(&read_request->remote, &remote_handle,
+	tcp_parse_rma_handle_offset(&rma_header->remote, &remote_handle,
 				     &remote_offset);
-	remote = (tcp_rma_handle_t *) (uintptr_t) remote_handle;
+	remote = cci__rma_reg_lookup(&tep->reg, remote_handle);
+	if (!remote) {
+		status = CCI_ERR_RMA_HANDLE;
+		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
+	}
 
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &tep->handles, entry) {
-		if (h == remote) {
-			break;
+	for (i = 0; i < count && !ret; i++) {
+		uint64_t offset;
+		uint32_t len;
+
+		tcp_parse_rma_seg(&segs[i], &offset, &len);
+		if (remote && (offset > remote->length ||
+				len > remote->length - offset)) {
+			status = CCI_ERR_RMA_HANDLE;
+			debug(CCI_DB_WARN, "%s: segment %u exceeds the remote "
+				"handle", __func__, i);
+		}
+		if (status) {
+			/* keep reading the stream */
+			ret = tcp_skip_msg(tconn->fd, len);
+			continue;
 		}
+		ret = tcp_recv_msg(tconn->fd,
+				(void*)((uintptr_t)remote->start + offset), len);
+	}
+	if (ret)
+		debug(CCI_DB_MSG, "%s: recv'ing RMA WRITEV payload failed with %s",
+			__func__, strerror(ret));
+	if (!ret)
+		ret = status;
+
+	tx = tcp_get_tx(ep, 1);
+
+	tx->msg_type = TCP_MSG_ACK;
+	tx->len = sizeof(*ack);
+
+	ack = tx->buffer;
+	tcp_pack_ack(ack, tx_id, ret);
+
+	/* the fragment may have arrived on a data socket, ack on the primary */
+	tcp_queue_tx(ep, tcp_primary_conn(conn)->priv, &tx->evt);
+
+	tcp_put_rx(rx);
+
+	return;
+
+close:
+	/* the payload is left unread, we cannot find the next message */
+	cci__ep_lock(ep, &ep->lock);
+	tcp_conn_set_closing_locked(ep, conn);
+	cci__ep_unlock(ep, &ep->lock);
+	tcp_put_rx(rx);
+
+	return;
+}
+
+static void
+tcp_handle_rma_read_request(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t a, uint32_t tx_id)
+{
+	int ret, i, cnt = 0;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+	tcp_tx_t *txs[TCP_RMA_MAX_DEPTH];
+	tcp_rma_read_request_t *read_request = rx->buffer; /* need to read more */
+	uint32_t handle_len = sizeof(*read_request) - sizeof(tcp_header_t);
+	uint64_t local_handle, local_offset, remote_handle, remote_offset, len;
+	uint32_t frag, depth, count, j;
+	tcp_rma_handle_t *remote;
+	tcp_rma_stream_t *stream = NULL;
+	tcp_rma_read_seg_t table[TCP_RMAV_MAX_SEGS];
+	cci_rma_seg_t segs[TCP_RMAV_MAX_SEGS];
+
+	tcp_parse_rma_read_request(a, &frag, &depth, &count);
+
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REQUEST on conn %p with "
+		"fragment size %u depth %u segments %u", __func__, (void*)conn,
+		frag, depth, count);
+
+	if (count > TCP_RMAV_MAX_SEGS) {
+		debug(CCI_DB_WARN, "%s: invalid segment count %u",
+			__func__, count);
+		goto close;
+	}
+
+	ret = tcp_recv_msg(tconn->fd, read_request->rma.header.data, handle_len);
+	if (!ret && count)
+		ret = tcp_recv_msg(tconn->fd, table, count * sizeof(table[0]));
+	if (ret) {
+		debug(CCI_DB_MSG, "%s: recv'ing RMA READ request failed with %s",
+			__func__, strerror(ret));
+		goto close;
 	}
-	pthread_mutex_unlock(&ep->lock);
 
-	if (h != remote) {
+	tcp_parse_rma_handle_offset(&read_request->rma.local, &local_handle,
+				     &local_offset);
+	tcp_parse_rma_handle_offset(&read_request->rma.remote, &remote_handle,
+				     &remote_offset);
+	len = ((uint64_t) ntohl(read_request->len_high)) << 32;
+	len |= (uint64_t) ntohl(read_request->len_low);
+	remote = cci__rma_reg_lookup(&tep->reg, remote_handle);
+
+	if (!remote) {
 		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
 		goto out;
-	} else if (remote_offset > remote->length) {
+	} else if (!count && remote_offset > remote->length) {
 		/* offset exceeds remote handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: remote offset not valid", __func__);
 		goto out;
-	} else if ((remote_offset + len) > remote->length) {
+	} else if (!count && (remote_offset + len) > remote->length) {
 		/* length exceeds remote handle's range, send nak */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: remote length not valid", __func__);
 		goto out;
 	}
 
-	tx = tcp_get_tx(ep, 0);
-	if (!tx) {
+	for (j = 0; j < count; j++) {
+		tcp_parse_rma_read_seg(&table[j], &segs[j].local_offset,
+				&segs[j].remote_offset, &segs[j].length);
+		if (segs[j].remote_offset > remote->length ||
+		    segs[j].length > remote->length - segs[j].remote_offset) {
+			ret = CCI_ERR_RMA_HANDLE;
+			debug(CCI_DB_WARN, "%s: segment %u exceeds the remote "
+				"handle", __func__, j);
+			goto out;
+		}
+	}
+
+	if (frag < TCP_RMA_MIN_FRAG)
+		frag = TCP_RMA_MIN_FRAG;
+	else if (frag > TCP_RMA_MAX_FRAG)
+		frag = TCP_RMA_MAX_FRAG;
+	if (depth < TCP_RMA_MIN_DEPTH)
+		depth = TCP_RMA_MIN_DEPTH;
+	else if (depth > TCP_RMA_MAX_DEPTH)
+		depth = TCP_RMA_MAX_DEPTH;
+
+	/* a vectored read keeps its segments with the stream */
+	stream = calloc(1, sizeof(*stream) + count * sizeof(segs[0]));
+	if (!stream) {
 		ret = CCI_ERR_RNR;
 		goto out;
 	}
+	if (count) {
+		stream->segs = (cci_rma_seg_t *) (stream + 1);
+		memcpy(stream->segs, segs, count * sizeof(segs[0]));
+		stream->seg = 1;
+		local_offset = segs[0].local_offset;
+		remote_offset = segs[0].remote_offset;
+		len = 0;
+		for (j = 0; j < count; j++)
+			len += segs[j].length;
+	}
+	stream->conn = conn;
+	stream->ptr = (char *)remote->start + remote_offset;
+	stream->local_handle = local_handle;
+	stream->local_offset = local_offset;
+	stream->remote_handle = remote_handle;
+	stream->remote_offset = remote_offset;
+	stream->left = len;
+	stream->seg_left = count ? segs[0].length : len;
+	stream->frag = frag;
+	stream->depth = depth;
+	stream->tx_id = tx_id;
+	stream->fd = -1;
+
+	cci__ep_lock(ep, &ep->lock);
+#ifdef HAVE_SENDFILE
+	/* send a file-backed region from the page cache, with our own
+	 * descriptor in case the region is deregistered meanwhile. The
+	 * lock keeps tcp_rma_set_file() from closing it under us. */
+	if (remote->fd != -1) {
+		stream->fd = dup(remote->fd);
+		stream->foff = remote->file_offset + remote_offset;
+	}
+#endif
 
-	tx->msg_type = TCP_MSG_RMA_READ_REPLY;
-	tx->flags = CCI_FLAG_SILENT;
-	tx->state = TCP_TX_QUEUED;
-	tx->len = sizeof(*read_reply);
-	tx->rma_op = NULL;
-	tx->rma_ptr = (void*)((uintptr_t)remote->start + (uintptr_t) remote_offset);
-	tx->rma_len = len;
-
-	tx->evt.event.type = CCI_EVENT_SEND;
-	tx->evt.event.send.status = CCI_SUCCESS; /* for now */
-	tx->evt.event.send.context = NULL;
-	tx->evt.event.send.connection = &conn->connection;
-	tx->evt.conn = conn;
-
-	read_reply = tx->buffer;
-	tcp_pack_rma_read_reply(read_reply, len, tx_id,
-			local_handle,
-			local_offset,
-			remote_handle,
-			remote_offset);
+	/* start the stream with up to depth replies, at least one even if
+	 * the range is empty so that the initiator completes */
+	do {
+		txs[cnt] = tcp_get_tx_locked(ep);
+		if (!txs[cnt])
+			break;
+		tcp_rma_stream_fill_locked(stream, txs[cnt]);
+		cnt++;
+	} while (stream->left && cnt < (int) depth);
+	stream->inflight = cnt;
+	cci__ep_unlock(ep, &ep->lock);
+
+	if (!cnt) {
+		tcp_rma_stream_free(stream);
+		ret = CCI_ERR_RNR;
+		goto out;
+	}
 
-	tcp_queue_tx(tep, tconn, &tx->evt);
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < cnt; i++)
+		tcp_queue_frag_locked(ep, txs[i]);
+	cci__ep_unlock(ep, &ep->lock);
 
 out:
 	if (ret) {
 		tcp_header_t *ack;
-
-		tx = tcp_get_tx(ep, 1);
+		tcp_tx_t *tx = tcp_get_tx(ep, 1);
 
 		tx->msg_type = TCP_MSG_ACK;
 		tx->len = sizeof(*ack);
@@ -3007,10 +5579,20 @@ out:
 		ack = tx->buffer;
 		tcp_pack_ack(ack, tx_id, ret);
 
-		tcp_queue_tx(tep, tconn, &tx->evt);
+		tcp_queue_tx(ep, tconn, &tx->evt);
 	}
 	tcp_put_rx(rx);
 
+	return;
+
+close:
+	/* the rest of the request is left unread, we cannot find the next
+	 * message */
+	cci__ep_lock(ep, &ep->lock);
+	tcp_conn_set_closing_locked(ep, conn);
+	cci__ep_unlock(ep, &ep->lock);
+	tcp_put_rx(rx);
+
 	return;
 }
 
@@ -3020,29 +5602,78 @@ tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
 {
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
+	tcp_conn_t *stconn = tx->dconn ? tx->dconn->priv : tconn;
 	tcp_rma_op_t *rma_op = tx->rma_op;
 	tcp_msg_type_t msg_type = tx->msg_type;
-
+	tcp_tx_t *txs[TCP_RMA_MAX_DEPTH];
+	uint32_t ids[TCP_RMA_MAX_DEPTH];
+	uint32_t outq = 0, sndbuf = 0;
+	int i, n = 0, done = 0, sampled = 0;
+
+	/* the fragment's socket tells how well the conn keeps up */
+	if (msg_type != TCP_MSG_RMA_READ_REQUEST &&
+	    msg_type != TCP_MSG_RMA_ATOMIC)
+		sampled = !tcp_sock_sndq(stconn, &outq, &sndbuf);
+
+	/* fragments of one op may complete on several progress threads */
+	cci__ep_lock(ep, &ep->lock);
+	rma_op = tx->rma_op;
+	if (!rma_op) {
+		/* a late ack of a fragment sent again by
+		 * tcp_conn_requeue_data_locked() */
+		cci__ep_unlock(ep, &ep->lock);
+		cci__ep_lock(ep, &stconn->slock);
+		TAILQ_REMOVE(&stconn->pending, &tx->evt, entry);
+		cci__ep_unlock(ep, &stconn->slock);
+		tcp_put_tx(tx);
+		tcp_put_rx(rx);
+		return;
+	}
 	rma_op->acked = tx->rma_id;
+	rma_op->completed++;
+	rma_op->pending--;
 
 	if (status && (rma_op->status == CCI_SUCCESS))
 		rma_op->status = status;
 
-	pthread_mutex_lock(&tconn->slock);
-	TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
-	pthread_mutex_unlock(&tconn->slock);
+	if (rma_op->completed == rma_op->num_msgs) {
+		done = 1;
+		tcp_rma_adapt_frag_locked(tconn, rma_op);
+	} else {
+		if (sampled)
+			tconn->rma_depth = tcp_rma_adapt_depth(tconn->rma_depth,
+						outq, sndbuf, rma_op->frag);
+
+		/* reuse this tx first, then top up to the current depth */
+		while (rma_op->next != rma_op->num_msgs &&
+			rma_op->pending < tconn->rma_depth) {
+			tcp_tx_t *ntx = n ? tcp_get_tx_locked(ep) : tx;
+
+			if (!ntx)
+				break;
+			txs[n] = ntx;
+			ids[n++] = rma_op->next++;
+			rma_op->pending++;
+		}
+	}
+	cci__ep_unlock(ep, &ep->lock);
 
-	if (tx->rma_id == (rma_op->num_msgs - 1)) {
+	/* the tx is pending on the socket that sent it */
+	cci__ep_lock(ep, &stconn->slock);
+	TAILQ_REMOVE(&stconn->pending, &tx->evt, entry);
+	cci__ep_unlock(ep, &stconn->slock);
+
+	if (done) {
 		int ret;
 
 		/* last segment - complete rma */
 		tx->evt.event.send.status = rma_op->status;
 		if (rma_op->status || !rma_op->msg_ptr) {
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_REMOVE(&tep->rma_ops, rma_op, entry);
 			TAILQ_REMOVE(&tconn->rmas, rma_op, rmas);
-			TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
+			tcp_deliver_evt(tep, &tx->evt);
 			debug(CCI_DB_MSG, "%s: completed %s ***",
 				__func__, tcp_msg_type(msg_type));
 		} else {
@@ -3058,10 +5689,10 @@ tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
 			iov.iov_base = rma_op->msg_ptr;
 			iov.iov_len = rma_op->msg_len;
 
-			pthread_mutex_lock(&ep->lock);
+			cci__ep_lock(ep, &ep->lock);
 			TAILQ_REMOVE(&tep->rma_ops, rma_op, entry);
 			TAILQ_REMOVE(&tconn->rmas, rma_op, rmas);
-			pthread_mutex_unlock(&ep->lock);
+			cci__ep_unlock(ep, &ep->lock);
 			debug(CCI_DB_MSG, "%s: sending RMA completion MSG ***",
 				__func__);
 			ret = tcp_send_common(&conn->connection,
@@ -3069,69 +5700,31 @@ tcp_progress_rma(cci__ep_t *ep, cci__conn_t *conn,
 						1,
 						rma_op->context,
 						rma_op->flags,
-						rma_op);
+						rma_op, 0);
 			if (ret) {
 				rma_op->status = ret;
-				pthread_mutex_lock(&ep->lock);
-				TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
-				pthread_mutex_unlock(&ep->lock);
+				tcp_deliver_evt(tep, &tx->evt);
 			} else {
 				tcp_put_tx(tx);
 			}
 		}
 		free(rma_op);
-	} else if (rma_op->next == rma_op->num_msgs) {
-		/* no more fragments, we don't need this tx anymore */
+	} else if (!n) {
+		/* enough fragments in flight, we don't need this tx anymore */
 		debug(CCI_DB_MSG, "%s: releasing tx %p", __func__, (void*)tx);
 		tcp_put_tx(tx);
-	} else {
-		/* send next fragment (or read fragment request) */
-		int i = rma_op->next++;
-		uint64_t offset =
-		    (uint64_t) i * (uint64_t) TCP_RMA_FRAG_SIZE;
-		tcp_rma_header_t *rma_hdr =
-			(tcp_rma_header_t *) tx->buffer;
-		tcp_rma_handle_t *local =
-			container_of(rma_op->local_handle, tcp_rma_handle_t, rma_handle);
-
-		tx->state = TCP_TX_QUEUED;
-		tx->rma_len = TCP_RMA_FRAG_SIZE; /* for now */
-		tx->offset = 0;
-		tx->rma_id = i;
-
-		debug(CCI_DB_MSG, "%s: sending fragment %d at offset %"PRIu64,
-			__func__, i, offset);
-
-		if (i == (int)(rma_op->num_msgs - 1)) {
-			if (rma_op->data_len % TCP_RMA_FRAG_SIZE)
-				tx->rma_len = rma_op->data_len % TCP_RMA_FRAG_SIZE;
-		}
-
-		tx->rma_ptr = (void*)((uintptr_t)local->start + rma_op->local_offset + offset);
+	}
 
-		debug(CCI_DB_MSG, "%s: %s local offset %"PRIu64" "
-			"remote offset %"PRIu64" length %u", __func__,
-			tcp_msg_type(msg_type),
-			rma_op->local_offset + offset,
-			rma_op->remote_offset + offset, tx->rma_len);
+	/* send the next fragments */
+	for (i = 0; i < n; i++) {
+		tcp_tx_t *ntx = txs[i];
 
-		if (msg_type == TCP_MSG_RMA_WRITE) {
-			tcp_pack_rma_write(rma_hdr, tx->rma_len, tx->id,
-					rma_op->local_handle->stuff[0],
-					rma_op->local_offset + offset,
-					rma_op->remote_handle->stuff[0],
-					rma_op->remote_offset + offset);
-		} else {
-			tcp_pack_rma_read_request(rma_hdr, tx->rma_len, tx->id,
-					rma_op->local_handle->stuff[0],
-					rma_op->local_offset + offset,
-					rma_op->remote_handle->stuff[0],
-					rma_op->remote_offset + offset);
-			tx->rma_ptr = NULL;
-			tx->rma_len = 0;
-		}
+		debug(CCI_DB_MSG, "%s: sending fragment %u", __func__, ids[i]);
 
-		tcp_queue_tx(tep, tconn, &tx->evt);
+		tcp_rma_pack_frag(ep, conn, rma_op, ntx, ids[i], tconn->rma_depth);
+		cci__ep_lock(ep, &ep->lock);
+		tcp_queue_frag_locked(ep, ntx);
+		cci__ep_unlock(ep, &ep->lock);
 	}
 
 	tcp_put_rx(rx);
@@ -3149,13 +5742,24 @@ tcp_handle_rma_read_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 	tcp_rma_header_t *rma_header = rx->buffer; /* need to read more */
 	uint32_t handle_len = 2 * sizeof(rma_header->local);
 	uint64_t local_handle, local_offset;
-	tcp_rma_handle_t *local, *h = NULL;
+	tcp_rma_handle_t *local;
 	void *ptr = NULL;
-	tcp_tx_t *tx = &tep->txs[tx_id];
+	tcp_tx_t *tx = tcp_tx_by_id(ep, tx_id);
 
 	debug(CCI_DB_MSG, "%s: recv'ing RMA_READ_REPLY on conn %p with len %u",
 		__func__, (void*)conn, len);
 
+	if (!tx || tx->msg_type != TCP_MSG_RMA_READ_REQUEST || !tx->rma_op) {
+		/* we cannot tell where the payload goes, the stream is lost */
+		debug(CCI_DB_WARN, "%s: conn %p replied to invalid tx id %u",
+			__func__, (void*)conn, tx_id);
+		cci__ep_lock(ep, &ep->lock);
+		tcp_conn_set_closing_locked(ep, conn);
+		cci__ep_unlock(ep, &ep->lock);
+		tcp_put_rx(rx);
+		return;
+	}
+
 	ret = tcp_recv_msg(tconn->fd, rma_header->header.data, handle_len);
 	if (ret) {
 		/* TODO handle error */
@@ -3166,17 +5770,9 @@ tcp_handle_rma_read_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 
 	tcp_parse_rma_handle_offset(&rma_header->local, &local_handle,
 				     &local_offset);
-	local = (tcp_rma_handle_t *) (uintptr_t) local_handle;
-
-	pthread_mutex_lock(&ep->lock);
-	TAILQ_FOREACH(h, &tep->handles, entry) {
-		if (h == local) {
-			break;
-		}
-	}
-	pthread_mutex_unlock(&ep->lock);
+	local = cci__rma_reg_lookup(&tep->reg, local_handle);
 
-	if (h != local) {
+	if (!local) {
 		/* local is no longer valid, send CCI_ERR_RMA_HANDLE */
 		ret = CCI_ERR_RMA_HANDLE;
 		debug(CCI_DB_WARN, "%s: local handle not valid", __func__);
@@ -3204,8 +5800,157 @@ tcp_handle_rma_read_reply(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 out:
 	if (ret) {
 		/* TODO we need to drain the message from the fd */
+		cci__ep_lock(ep, &ep->lock);
+		if (tx->rma_op->status == CCI_SUCCESS)
+			tx->rma_op->status = ret;
+		cci__ep_unlock(ep, &ep->lock);
+	}
+	/* fragments arrive on several sockets, the last one completes
+	 * the read */
+	if (__atomic_sub_fetch(&tx->rma_left, len, __ATOMIC_ACQ_REL) == 0)
+		tcp_progress_rma(ep, tcp_primary_conn(conn), rx, ret, tx);
+	else
+		tcp_put_rx(rx);
+
+	return;
+}
+
+/* Apply an atomic op to a word of a registered region and reply with its
+ * previous value, or the reply of our request: store the previous value.
+ */
+static void
+tcp_handle_rma_atomic(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
+			uint32_t a, uint32_t tx_id)
+{
+	int ret, reply;
+	tcp_ep_t *tep = ep->priv;
+	tcp_conn_t *tconn = conn->priv;
+	tcp_rma_atomic_t *atomic = rx->buffer; /* need to read more */
+	uint32_t handle_len = sizeof(*atomic) - sizeof(tcp_header_t);
+	uint64_t local_handle, local_offset, remote_handle, remote_offset;
+	uint64_t operand, compare, old = 0;
+	uint32_t op;
+	uint64_t *word = NULL;
+	tcp_rma_handle_t *h = NULL;
+	tcp_tx_t *tx = NULL;
+
+	ret = tcp_recv_msg(tconn->fd, atomic->rma.header.data, handle_len);
+	if (ret) {
+		/* TODO handle error */
+		debug(CCI_DB_MSG, "%s: recv_msg() returned %s",
+			__func__, strerror(ret));
+		tcp_put_rx(rx);
+		return;
+	}
+
+	tcp_parse_rma_atomic(atomic, a, &op, &reply, &operand, &compare);
+	tcp_parse_rma_handle_offset(&atomic->rma.local, &local_handle,
+				     &local_offset);
+	tcp_parse_rma_handle_offset(&atomic->rma.remote, &remote_handle,
+				     &remote_offset);
+
+	debug(CCI_DB_MSG, "%s: recv'ing RMA_ATOMIC %s on conn %p op %u",
+		__func__, reply ? "reply" : "request", (void*)conn, op);
+
+	if (reply) {
+		tx = tcp_tx_by_id(ep, tx_id);
+		if (!tx) {
+			debug(CCI_DB_WARN, "%s: conn %p replied to invalid tx "
+				"id %u", __func__, (void*)conn, tx_id);
+			tcp_put_rx(rx);
+			return;
+		}
+		h = cci__rma_reg_lookup(&tep->reg, local_handle);
+		if (!h || local_offset > h->length ||
+		    sizeof(operand) > h->length - local_offset) {
+			ret = CCI_ERR_RMA_HANDLE;
+			debug(CCI_DB_WARN, "%s: local handle not valid",
+				__func__);
+		} else {
+			memcpy((char *)h->start + local_offset, &operand,
+				sizeof(operand));
+		}
+		tcp_progress_rma(ep, conn, rx, ret, tx);
+		return;
+	}
+
+	h = cci__rma_reg_lookup(&tep->reg, remote_handle);
+	if (!h) {
+		/* remote is no longer valid, send CCI_ERR_RMA_HANDLE */
+		ret = CCI_ERR_RMA_HANDLE;
+		debug(CCI_DB_WARN, "%s: remote handle not valid", __func__);
+		goto out;
+	} else if (remote_offset > h->length ||
+		   sizeof(*word) > h->length - remote_offset) {
+		/* offset exceeds remote handle's range, send nak */
+		ret = CCI_ERR_RMA_HANDLE;
+		debug(CCI_DB_WARN, "%s: remote offset not valid", __func__);
+		goto out;
+	}
+
+	word = (uint64_t *)((uintptr_t)h->start + (uintptr_t)remote_offset);
+	if ((uintptr_t)word & (sizeof(*word) - 1)) {
+		ret = CCI_EINVAL;
+		debug(CCI_DB_WARN, "%s: remote word not aligned", __func__);
+		goto out;
+	}
+
+	/* get the reply first, the op must not be applied unless we can
+	 * return the previous value */
+	tx = tcp_get_tx(ep, 0);
+	if (!tx) {
+		ret = CCI_ERR_RNR;
+		goto out;
+	}
+
+	switch (op) {
+	case CCI_RMA_ATOMIC_FETCH_ADD:
+		old = __atomic_fetch_add(word, operand, __ATOMIC_SEQ_CST);
+		break;
+	case CCI_RMA_ATOMIC_CSWAP:
+		/* old keeps compare if the swap succeeds */
+		old = compare;
+		__atomic_compare_exchange_n(word, &old, operand, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		break;
+	case CCI_RMA_ATOMIC_SWAP:
+		old = __atomic_exchange_n(word, operand, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		ret = CCI_EINVAL;
+		tcp_put_tx(tx);
+		goto out;
+	}
+
+	tx->msg_type = TCP_MSG_RMA_ATOMIC;
+	tx->flags = CCI_FLAG_SILENT;
+	tx->state = TCP_TX_QUEUED;
+	tx->len = sizeof(*atomic);
+	tx->offset = 0;
+	tx->rma_op = NULL;
+	tx->rma_ptr = NULL;
+	tx->rma_len = 0;
+	tx->evt.conn = conn;
+
+	tcp_pack_rma_atomic(tx->buffer, op, 1, tx_id, local_handle,
+			local_offset, remote_handle, remote_offset, old, compare);
+
+	tcp_queue_tx(ep, tconn, &tx->evt);
+
+out:
+	if (ret) {
+		tcp_header_t *ack;
+
+		tx = tcp_get_tx(ep, 1);
+		tx->msg_type = TCP_MSG_ACK;
+		tx->len = sizeof(*ack);
+
+		ack = tx->buffer;
+		tcp_pack_ack(ack, tx_id, ret);
+
+		tcp_queue_tx(ep, tconn, &tx->evt);
 	}
-	tcp_progress_rma(ep, conn, rx, ret, tx);
+	tcp_put_rx(rx);
 
 	return;
 }
@@ -3216,9 +5961,16 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 {
 	tcp_ep_t *tep = ep->priv;
 	tcp_conn_t *tconn = conn->priv;
-	tcp_tx_t *tx = &tep->txs[tx_id];
+	tcp_tx_t *tx = tcp_tx_by_id(ep, tx_id);
 	uint32_t status = a & 0xFF;
 
+	if (!tx) {
+		debug(CCI_DB_WARN, "%s: conn %p acked invalid tx id %u",
+			__func__, (void*)conn, tx_id);
+		tcp_put_rx(rx);
+		return;
+	}
+
 	debug(CCI_DB_MSG, "%s: conn %p acked tx %p (%s) with status %u",
 		__func__, (void*)conn, (void*)tx, tcp_msg_type(tx->msg_type), status);
 
@@ -3230,23 +5982,28 @@ tcp_handle_ack(cci__ep_t *ep, cci__conn_t *conn, tcp_rx_t *rx,
 				"with error %s", __func__,
 				cci_strerror(&ep->endpoint, status));
 
-		pthread_mutex_lock(&tconn->slock);
+		cci__ep_lock(ep, &tconn->slock);
 		TAILQ_REMOVE(&tconn->pending, &tx->evt, entry);
-		pthread_mutex_unlock(&tconn->slock);
+		cci__ep_unlock(ep, &tconn->slock);
 
-		pthread_mutex_lock(&ep->lock);
+		cci__ep_lock(ep, &ep->lock);
 		if (!(tx->msg_type == TCP_MSG_CONN_REPLY &&
 			tconn->status == TCP_CONN_CLOSING)) {
-			TAILQ_INSERT_TAIL(&ep->evts, &tx->evt, entry);
+			tcp_deliver_evt(tep, &tx->evt);
 		} else {
 			/* We rejected this conn, clean it up */
 			/* FIXME */
 			tcp_conn_set_closing_locked(ep, conn);
 		}
 		tcp_put_rx_locked(tep, rx);
-		pthread_mutex_unlock(&ep->lock);
+		cci__ep_unlock(ep, &ep->lock);
 		break;
 	case TCP_MSG_RMA_WRITE:
+	case TCP_MSG_RMA_WRITEV:
+	case TCP_MSG_RMA_READ_REQUEST:
+	case TCP_MSG_RMA_ATOMIC:
+		/* read and atomic requests are only acked if the target
+		 * failed them */
 		tcp_progress_rma(ep, conn, rx, status, tx);
 		break;
 	default:
@@ -3271,12 +6028,13 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 
 	debug(CCI_DB_MSG, "%s: conn %p recv'd message", __func__, (void*)conn);
 
-	rx = tcp_get_rx(ep);
-	if (!rx) {
-		debug(CCI_DB_MSG, "%s: no rxs available", __func__);
-		/* TODO peek at header, get msg id, send RNR */
+	cci__ep_lock(ep, &ep->lock);
+	rx = tcp_get_rx_locked(ep);
+	if (!rx)
+		tcp_rx_stall_locked(ep->priv, tconn);
+	cci__ep_unlock(ep, &ep->lock);
+	if (!rx)
 		return;
-	}
 
 	rx->evt.conn = conn;
 	hdr = rx->buffer;
@@ -3287,7 +6045,10 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 		debug(CCI_DB_MSG, "%s: tcp_recv_msg() returned %d (rx=%p hdr=%p)",
 			__func__, ret, (void*)rx, (void*)hdr);
 		q_rx = 1;
-		tcp_conn_set_closing_locked(ep, conn);
+		cci__ep_lock(ep, &ep->lock);
+		if (tconn->status != TCP_CONN_CLOSING)
+			tcp_conn_set_closing_locked(ep, conn);
+		cci__ep_unlock(ep, &ep->lock);
 		goto out;
 	}
 
@@ -3301,7 +6062,9 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 		tcp_handle_conn_reply(ep, conn, rx, a, b);
 		break;
 	case TCP_MSG_CONN_ACK:
-		tcp_handle_conn_ack(ep, conn, rx, b);
+		debug(CCI_DB_CONN, "%s: ignoring conn_ack from conn %p",
+			__func__, (void*)conn);
+		q_rx = 1;
 		break;
 	case TCP_MSG_SEND:
 		tcp_handle_send(ep, conn, rx, a, b);
@@ -3324,6 +6087,15 @@ tcp_handle_recv(cci__ep_t *ep, cci__conn_t *conn)
 		break;
 	case TCP_MSG_RMA_INVALID:
 		break;
+	case TCP_MSG_CONN_DATA:
+		tcp_handle_conn_data(ep, conn, rx, a, b);
+		break;
+	case TCP_MSG_RMA_WRITEV:
+		tcp_handle_rma_writev(ep, conn, rx, a, b);
+		break;
+	case TCP_MSG_RMA_ATOMIC:
+		tcp_handle_rma_atomic(ep, conn, rx, a, b);
+		break;
 	default:
 		debug(CCI_DB_MSG, "%s: invalid msg type %d", __func__, type);
 		break;
@@ -3334,8 +6106,194 @@ out:
 	return;
 }
 
+/* Handle the poll results of fds[i]. Returns the number of events
+ * handled or -1 if the socket was disconnected.
+ */
+static int
+tcp_handle_revents(cci__ep_t *ep, tcp_poller_t *poller, int i, short revents)
+{
+	int found = 0;
+	tcp_ep_t *tep = ep->priv;
+	cci__conn_t *conn = poller->c[i];
+	tcp_conn_t *tconn = NULL;
+
+	debug(CCI_DB_CONN, "%s: revents 0x%x", __func__, revents);
+
+	if (conn)
+		tconn = conn->priv;
+
+	/* closed while we were polling */
+	if (tconn && tconn->ignore)
+		return 1;
+
+	if (revents & POLLHUP) {
+		tcp_conn_status_t old_status = tconn->status;
+		cci__evt_t *evt = NULL;
+		tcp_tx_t *tx = NULL;
+		int is_data = tconn->primary != NULL;
+
+		/* handle disconnect */
+		debug(CCI_DB_CONN, "%s: got POLLHUP on conn %p (%s)",
+			__func__, (void*)conn, tcp_conn_status_str(tconn->status));
+
+		/* a data socket may have closed on a send error */
+		cci__ep_lock(ep, &ep->lock);
+		if (tconn->status != TCP_CONN_CLOSING)
+			tcp_conn_set_closing_locked(ep, conn);
+		cci__ep_unlock(ep, &ep->lock);
+
+		/* a data socket has no application visible state */
+		if (is_data)
+			return -1;
+
+		switch (old_status) {
+		case TCP_CONN_READY:
+			/* TODO drain queues */
+			break;
+		case TCP_CONN_ACTIVE1:
+		case TCP_CONN_ACTIVE2:
+			cci__ep_lock(ep, &tconn->slock);
+			if (old_status == TCP_CONN_ACTIVE1)
+				evt = TAILQ_FIRST(&tconn->queued);
+			else
+				evt = TAILQ_FIRST(&tconn->pending);
+			TAILQ_REMOVE(&tconn->queued, evt, entry);
+			cci__ep_unlock(ep, &tconn->slock);
+
+			evt->event.connect.status = CCI_ETIMEDOUT;
+			tx = container_of(evt, tcp_tx_t, evt);
+			tx->state = TCP_TX_COMPLETED;
+			tcp_deliver_evt(tep, evt);
+			break;
+		case TCP_CONN_PASSIVE1:
+		case TCP_CONN_PASSIVE2:
+			/* handled in tcp_conn_set_closing_locked() */
+			break;
+		case TCP_CONN_CLOSING:
+			fprintf(stderr, "%s: got POLLHUP on conn %p (%s) "
+					"with status TCP_CONN_CLOSING\n",
+					__func__, (void*)conn, conn->uri);
+			break;
+		default:
+			debug(CCI_DB_CONN, "%s: connection status was %s",
+				__func__, tcp_conn_status_str(tconn->status));
+		}
+
+		return -1;
+	}
+	if (revents & POLLIN) {
+		found++;
+		if (i == 0 && poller->id == 0) {
+			/* handle accept */
+			tcp_handle_listen_socket(ep);
+		} else {
+			/* process recv */
+			if (conn)
+				tcp_handle_recv(ep, conn);
+			else
+				debug(CCI_DB_WARN, "%s: POLLIN event on "
+					"fds[%d] but no conn in tep->c",
+					__func__, i);
+		}
+	}
+	if (revents & POLLOUT) {
+		if (tconn->status == TCP_CONN_ACTIVE1) {
+			/*  send CONN_REQUEST on new connection */
+			debug(CCI_DB_CONN, "%s: connect() completed", __func__);
+			if (tconn->primary) {
+				/* data sockets are ready once connected */
+				cci__ep_lock(ep, &ep->lock);
+				TAILQ_REMOVE(&tep->active, tconn, entry);
+				tconn->status = TCP_CONN_READY;
+				TAILQ_INSERT_TAIL(&tep->conns, tconn, entry);
+				cci__ep_unlock(ep, &ep->lock);
+			} else {
+				tconn->status = TCP_CONN_ACTIVE2;
+			}
+			poller->fds[i].events = POLLIN | POLLOUT;
+		}
+		tcp_progress_conn_sends(conn, 0);
+		found++;
+	}
+	if (revents & POLLERR) {
+		/* handle error */
+		debug(CCI_DB_CONN, "%s: got POLLERR on conn %p",
+			__func__, (void*)conn);
+		found++;
+	}
+	if (!found)
+		debug(CCI_DB_WARN, "%s: unhandled revents %u",
+			__func__, revents);
+
+	return found;
+}
+
+#ifdef TCP_HAVE_IO_URING
+/* Handle the poll completions on the poller's ring, then re-arm the
+ * handled sockets. Returns the number of sockets with events.
+ */
+static int
+tcp_poll_uring(cci__ep_t *ep, tcp_poller_t *poller)
+{
+	int i, n = 0, count = 0;
+	uint32_t index[TCP_URING_BATCH];
+	tcp_uring_t *ring = &poller->ring;
+	struct io_uring_cqe *cqe;
+
+	while (n < TCP_URING_BATCH && (cqe = tcp_uring_peek_cqe(ring))) {
+		uint64_t data = cqe->user_data;
+		uint32_t idx = (uint32_t) data;
+		int res = cqe->res;
+
+		tcp_uring_cqe_seen(ring);
+
+		/* poll removals and polls of moved or closed slots */
+		if (data == TCP_URING_IGNORE || idx >= poller->nfds ||
+			(uint32_t) (data >> 32) != poller->gens[idx])
+			continue;
+
+		if (res < 0) {
+			debug(CCI_DB_WARN, "%s: poll on fds[%u] returned %s",
+				__func__, idx, strerror(-res));
+			continue;
+		}
+		poller->fds[idx].revents = (short) res;
+		index[n++] = idx;
+	}
+	if (!n)
+		return CCI_EAGAIN;
+
+	debug(CCI_DB_EP, "%s: ring found %d events", __func__, n);
+
+	for (i = 0; i < n; i++) {
+		if (tcp_handle_revents(ep, poller, index[i],
+				poller->fds[index[i]].revents))
+			count++;
+	}
+
+	/* sockets closed meanwhile are dropped by the caller */
+	cci__ep_lock(ep, &ep->lock);
+	for (i = 0; i < n; i++) {
+		cci__conn_t *c = poller->c[index[i]];
+		tcp_conn_t *tc = c ? c->priv : NULL;
+
+		if ((tc && tc->ignore) || (!c && index[i]))
+			continue;
+		if (tc && tc->rx_stalled) {
+			/* re-armed by tcp_rx_resume_locked() */
+			tc->rx_disarmed = 1;
+			continue;
+		}
+		tcp_uring_arm_locked(poller, index[i]);
+	}
+	cci__ep_unlock(ep, &ep->lock);
+
+	return count ? count : CCI_EAGAIN;
+}
+#endif
+
 static int
-tcp_poll_events(cci__ep_t *ep)
+tcp_poll_events(cci__ep_t *ep, tcp_poller_t *poller)
 {
 	int ret = CCI_EAGAIN, i, count;
 	tcp_ep_t *tep = ep->priv;
@@ -3343,21 +6301,28 @@ tcp_poll_events(cci__ep_t *ep)
 	if (!tep)
 		return CCI_ENODEV;
 
-	pthread_mutex_lock(&ep->lock);
-	if (ep->closing || tep->is_polling) {
-		pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	if (ep->closing || poller->is_polling) {
+		cci__ep_unlock(ep, &ep->lock);
 		CCI_EXIT;
 		return ret;
 	}
 
-	tep->is_polling++;
-	assert(tep->is_polling == 1);
-	pthread_mutex_unlock(&ep->lock);
+	poller->is_polling++;
+	assert(poller->is_polling == 1);
+	cci__ep_unlock(ep, &ep->lock);
+
+#ifdef TCP_HAVE_IO_URING
+	if (tep->uring) {
+		ret = tcp_poll_uring(ep, poller);
+		goto out;
+	}
+#endif
 
 	/* check for incoming messages (POLLIN) _and_
 	 * connect completions (POLLOUT)
 	 */
-	ret = poll(tep->fds, tep->nfds, 0);
+	ret = poll(poller->fds, poller->nfds, 0);
 	if (ret < 1) {
 		if (ret == -1) {
 			ret = errno;
@@ -3374,134 +6339,102 @@ tcp_poll_events(cci__ep_t *ep)
 
 	i = 0;
 	do {
-		uint32_t found = 0;
-		short revents = tep->fds[i].revents;
-		cci__conn_t *conn = tep->c[i];
-		tcp_conn_t *tconn = NULL;
+		short revents = poller->fds[i].revents;
 
 		if (revents) {
-			debug(CCI_DB_CONN, "%s: revents 0x%x",
-				__func__, revents);
-		} else {
-			goto increment;
-		}
-
-		if (conn)
-			tconn = conn->priv;
-
-		if (revents & POLLHUP) {
-			tcp_conn_status_t old_status = tconn->status;
-			cci__evt_t *evt = NULL;
-			tcp_tx_t *tx = NULL;
-
-			/* handle disconnect */
-			debug(CCI_DB_CONN, "%s: got POLLHUP on conn %p (%s)",
-				__func__, (void*)conn, tcp_conn_status_str(tconn->status));
-
-			pthread_mutex_lock(&ep->lock);
-			tcp_conn_set_closing_locked(ep, conn);
-			pthread_mutex_unlock(&ep->lock);
+			int found = tcp_handle_revents(ep, poller, i, revents);
 
-			switch (old_status) {
-			case TCP_CONN_READY:
-				/* TODO drain queues */
-				break;
-			case TCP_CONN_ACTIVE1:
-			case TCP_CONN_ACTIVE2:
-				pthread_mutex_lock(&tconn->slock);
-				if (old_status == TCP_CONN_ACTIVE1)
-					evt = TAILQ_FIRST(&tconn->queued);
-				else
-					evt = TAILQ_FIRST(&tconn->pending);
-				TAILQ_REMOVE(&tconn->queued, evt, entry);
-				pthread_mutex_unlock(&tconn->slock);
-
-				evt->event.connect.status = CCI_ETIMEDOUT;
-				tx = container_of(evt, tcp_tx_t, evt);
-				tx->state = TCP_TX_COMPLETED;
-
-				pthread_mutex_lock(&ep->lock);
-				TAILQ_INSERT_TAIL(&ep->evts, evt, entry);
-				pthread_mutex_unlock(&ep->lock);
-				break;
-			case TCP_CONN_PASSIVE1:
-			case TCP_CONN_PASSIVE2:
-				/* handled in tcp_conn_set_closing_locked() */
-				break;
-			case TCP_CONN_CLOSING:
-				fprintf(stderr, "%s: got POLLHUP on conn %p (%s) "
-						"with status TCP_CONN_CLOSING\n",
-						__func__, (void*)conn, conn->uri);
-				break;
-			default:
-				debug(CCI_DB_CONN, "%s: connection status was %s",
-					__func__, tcp_conn_status_str(tconn->status));
-			}
-
-			goto out;
-		}
-		if (revents & POLLIN) {
-			found++;
-			if (i == 0) {
-				/* handle accept */
-				tcp_handle_listen_socket(ep);
-			} else {
-				/* process recv */
-				if (conn)
-					tcp_handle_recv(ep, conn);
-				else
-					debug(CCI_DB_WARN, "%s: POLLIN event on "
-						"fds[%d] but no conn in tep->c",
-						__func__, i);
-			}
+			if (found < 0)
+				goto out;
+			if (found)
+				count--;
 		}
-		if (revents & POLLOUT) {
-			if (tconn->status == TCP_CONN_ACTIVE1) {
-				/*  send CONN_REQUEST on new connection */
-				debug(CCI_DB_CONN, "%s: connect() completed", __func__);
-				tconn->status = TCP_CONN_ACTIVE2;
-				tep->fds[i].events = POLLIN | POLLOUT;
-			}
-			tcp_progress_conn_sends(conn, 0);
-			found++;
-		}
-		if (revents & POLLERR) {
-			/* handle error */
-			debug(CCI_DB_CONN, "%s: got POLLERR on conn %p",
-				__func__, (void*)conn);
-			found++;
-		}
-		if (!found && revents)
-			debug(CCI_DB_WARN, "%s: unhandled revents %u",
-				__func__, revents);
-		if (found)
-			count--;
-increment:
 		i++;
 
-		if (count == (int)tep->nfds)
+		if (count == (int)poller->nfds)
 			break; /* because OSX returns the wrong count from poll */
 	} while (count);
 
 out:
-	pthread_mutex_lock(&ep->lock);
-	/* TODO process queued changes to tep->fds, tep->c */
-	tep->is_polling = 0;
-	pthread_mutex_unlock(&ep->lock);
+	cci__ep_lock(ep, &ep->lock);
+	/* drop the sockets closed while we were polling. Walk backwards
+	 * since removing a socket moves the last one into its slot. */
+	if (poller->deferred) {
+		for (i = (int)poller->nfds - 1; i > 0; i--) {
+			cci__conn_t *c = poller->c[i];
+			tcp_conn_t *tc = c ? c->priv : NULL;
+
+			if (tc && tc->ignore)
+				tcp_poller_remove_locked(poller, tc);
+		}
+		poller->deferred = 0;
+	}
+#ifdef TCP_HAVE_IO_URING
+	/* one submission for the round's re-arms and new sockets */
+	if (tep->uring)
+		tcp_uring_enter(&poller->ring, 0);
+#endif
+	poller->is_polling = 0;
+	cci__ep_unlock(ep, &ep->lock);
 
 	return ret;
 }
 
+/* Sleep up to ms until one of the poller's sockets is ready, without
+ * handling it; the next tcp_poll_events() does. Only used when there
+ * are no progress threads.
+ */
+static void
+tcp_poll_wait(cci__ep_t *ep, tcp_poller_t *poller, int ms)
+{
+#ifdef TCP_HAVE_IO_URING
+	tcp_ep_t *tep = ep->priv;
+#endif
+
+	cci__ep_lock(ep, &ep->lock);
+	if (ep->closing || poller->is_polling) {
+		cci__ep_unlock(ep, &ep->lock);
+		return;
+	}
+	poller->is_polling++;
+	cci__ep_unlock(ep, &ep->lock);
+
+#ifdef TCP_HAVE_IO_URING
+	if (tep->uring) {
+		/* the ring's fd is readable when completions are waiting */
+		struct pollfd pfd = { poller->ring.fd, POLLIN, 0 };
+
+		poll(&pfd, 1, ms);
+	} else
+#endif
+		poll(poller->fds, poller->nfds, ms);
+
+	cci__ep_lock(ep, &ep->lock);
+	poller->is_polling = 0;
+	cci__ep_unlock(ep, &ep->lock);
+
+	return;
+}
+
 static void *tcp_progress_thread(void *arg)
 {
-	cci__ep_t *ep = (cci__ep_t *) arg;
-	tcp_ep_t *tep;
+	tcp_poller_t *poller = (tcp_poller_t *) arg;
+	cci__ep_t *ep;
 
-	assert (ep);
-	tep = ep->priv;
+	assert (poller);
+	ep = poller->ep;
 
-	while (!ep->closing)
-		tcp_progress_ep(ep);
+	/* run near the NIC, see tcp_set_affinity() */
+	cci__ep_lock(ep, &ep->lock);
+	poller->os_tid = cci__affinity_tid();
+	cci__affinity_bind(&ep->affinity, 0);
+	cci__ep_unlock(ep, &ep->lock);
+
+	while (!ep->closing) {
+		/* let the other workers run if we found nothing */
+		if (tcp_progress_poller(ep, poller) == CCI_EAGAIN)
+			sched_yield();
+	}
 
 	pthread_exit(NULL);
 	return (NULL);		/* make pgcc happy */
@@ -55,6 +55,7 @@ BEGIN_C_DECLS
 #define VERBS_EP_RMSG_CONNS	(16)
 #define VERBS_CONN_RMSG_DEPTH	(16)	/* NOTE: limited to 31 due to vconn->avail */
 #define VERBS_INLINE_BYTES	(128)
+#define VERBS_RMAV_MAX_SGE	(16)	/* SGEs per cci_rmav() work request */
 
 #define VERBS_ACK_CNT		(512)
 #define VERBS_PROGRESS_TIMEOUT	(10000) /* microseconds */
@@ -292,6 +293,11 @@ typedef struct verbs_rma_op {
 	verbs_tx_t *tx;
 	uint32_t msg_len;
 	char *msg_ptr;
+	uint32_t pending;	/* work requests not completed yet */
+	int fetch_add;		/* atomic fetch-and-add, else compare-and-swap */
+	int swap;		/* CCI_RMA_ATOMIC_SWAP as compare-and-swap */
+	uint64_t operand;	/* atomic add or swap value */
+	uint64_t compare;	/* compare-and-swap's expected value */
 } verbs_rma_op_t;
 
 typedef struct verbs_rx_pool {
@@ -345,6 +351,7 @@ typedef struct verbs_ep {
 	int acks;		/* accumulated acks from ibv_get_cq_event() */
 	pthread_t tid;		/* progress thread */
 	int is_progressing;	/* being progressed? */
+	int atomics;		/* device supports remote atomics? */
 
 	 TAILQ_HEAD(v_conns, verbs_conn) conns;	/* all conns */
 	 TAILQ_HEAD(v_active, verbs_conn) active;	/* active conns */
@@ -377,6 +384,7 @@ typedef struct verbs_conn {
 	uint32_t mss;		/* max send size */
 	uint32_t max_tx_cnt;	/* max sends in flight */
 	uint32_t inline_size;	/* largest inline msg */
+	uint32_t max_sge;	/* SGEs per RMA work request */
 
 	/* for RDMA SEND enabled connections */
 	void *rbuf;		/* buffer for recving RDMA MSGs */
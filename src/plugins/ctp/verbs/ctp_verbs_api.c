@@ -77,6 +77,17 @@ static int ctp_verbs_rma(cci_connection_t * connection,
 		     cci_rma_handle_t * local_handle, uint64_t local_offset,
 		     cci_rma_handle_t * remote_handle, uint64_t remote_offset,
 		     uint64_t data_len, const void *context, int flags);
+static int ctp_verbs_rmav(cci_connection_t * connection,
+		      const void *msg_ptr, uint32_t msg_len,
+		      cci_rma_handle_t * local_handle,
+		      cci_rma_handle_t * remote_handle,
+		      const cci_rma_seg_t * segs, uint32_t segcnt,
+		      const void *context, int flags);
+static int ctp_verbs_rma_atomic(cci_connection_t * connection,
+		      cci_rma_handle_t * local_handle, uint64_t local_offset,
+		      cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+		      cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+		      const void *context, int flags);
 
 /*
  * Public plugin structure.
@@ -124,7 +135,13 @@ cci_plugin_ctp_t cci_ctp_verbs_plugin = {
 	ctp_verbs_sendv,
 	ctp_verbs_rma_register,
 	ctp_verbs_rma_deregister,
-	ctp_verbs_rma
+	ctp_verbs_rma,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	ctp_verbs_rmav,
+	ctp_verbs_rma_atomic
 };
 
 static uint32_t verbs_mtu_val(enum ibv_mtu mtu)
@@ -1065,6 +1082,7 @@ static int verbs_progress_ep(cci__ep_t * ep);
 static int verbs_get_cq_event(cci__ep_t * ep);
 static int verbs_get_cm_event(cci__ep_t * ep);
 static int verbs_get_rdma_msg_event(cci__ep_t* ep);
+static int verbs_post_atomic(verbs_rma_op_t * rma_op);
 
 #if 0
 void *
@@ -1148,6 +1166,9 @@ ctp_verbs_create_endpoint(cci_device_t * device,
 	ep->tx_buf_cnt = VERBS_EP_TX_CNT;
 	ep->buffer_len = dev->device.max_send_size;
 	ep->tx_timeout = 0;	/* FIXME */
+	/* the MR stays pinned while cached, cci_rma_invalidate() must
+	 * drop it before the memory is unmapped */
+	ep->rma_cache = 1;
 
 	vep->rdma_channel = rdma_create_event_channel();
 	if (!vep->rdma_channel) {
@@ -1203,6 +1224,13 @@ ctp_verbs_create_endpoint(cci_device_t * device,
 		goto out;
 	}
 
+	{
+		struct ibv_device_attr dev_attr;
+
+		if (!ibv_query_device(vdev->context, &dev_attr))
+			vep->atomics = dev_attr.atomic_cap != IBV_ATOMIC_NONE;
+	}
+
 	if (fd) {
 		vep->ib_channel = ibv_create_comp_channel(vep->id_rc->verbs);
 
@@ -1785,8 +1813,10 @@ static int ctp_verbs_accept(cci_event_t * event, const void *context)
 		struct ibv_qp_init_attr init;
 
 		ret = ibv_query_qp(vconn->id->qp, &attr, IBV_QP_CAP, &init);
-		if (!ret)
+		if (!ret) {
 			vconn->inline_size = init.cap.max_inline_data;
+			vconn->max_sge = init.cap.max_send_sge;
+		}
 	}
 
 	if (vconn->num_slots) {
@@ -2002,6 +2032,19 @@ verbs_insert_conn(cci__conn_t *conn)
 	return;
 }
 
+/* SGEs to ask for per send work request: enough for cci_rmav(), but no
+ * more than the device supports. Messages only need two. */
+static int verbs_max_send_sge(struct ibv_context *context)
+{
+	struct ibv_device_attr dev_attr;
+
+	if (ibv_query_device(context, &dev_attr))
+		return 2;
+	if (dev_attr.max_sge > VERBS_RMAV_MAX_SGE)
+		return VERBS_RMAV_MAX_SGE;
+	return dev_attr.max_sge > 2 ? dev_attr.max_sge : 2;
+}
+
 static int
 ctp_verbs_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	      const void *data_ptr, uint32_t data_len,
@@ -2085,7 +2128,7 @@ ctp_verbs_connect(cci_endpoint_t * endpoint, const char *server_uri,
 	attr.recv_cq = vep->cq;
 	attr.srq = vep->srq;
 	attr.cap.max_send_wr = VERBS_EP_TX_CNT;
-	attr.cap.max_send_sge = 2;
+	attr.cap.max_send_sge = verbs_max_send_sge(vep->pd->context);
 	attr.cap.max_recv_sge = 1;
 	attr.cap.max_inline_data = VERBS_INLINE_BYTES;
 
@@ -2582,7 +2625,7 @@ verbs_handle_conn_request(cci__ep_t * ep, struct rdma_cm_event *cm_evt)
 	attr.recv_cq = vep->cq;
 	attr.srq = vep->srq;
 	attr.cap.max_send_wr = VERBS_EP_TX_CNT;
-	attr.cap.max_send_sge = 2;
+	attr.cap.max_send_sge = verbs_max_send_sge(vep->pd->context);
 	attr.cap.max_recv_sge = 1;
 	attr.cap.max_inline_data = VERBS_INLINE_BYTES;
 
@@ -3056,8 +3099,10 @@ static int verbs_handle_conn_reply(cci__ep_t * ep, struct ibv_wc wc)
 		}
 
 		ret = ibv_query_qp(vconn->id->qp, &attr, IBV_QP_CAP, &init);
-		if (!ret)
+		if (!ret) {
 			vconn->inline_size = init.cap.max_inline_data;
+			vconn->max_sge = init.cap.max_send_sge;
+		}
 
 		pthread_mutex_lock(&ep->lock);
 		TAILQ_INSERT_TAIL(&vep->conns, vconn, entry);
@@ -3342,12 +3387,37 @@ verbs_send_common(cci_connection_t * connection, const struct iovec *iov,
 static int verbs_handle_rma_completion(cci__ep_t * ep, struct ibv_wc wc)
 {
 	int ret = CCI_SUCCESS;
+	uint32_t pending = 0;
 	verbs_rma_op_t *rma_op = (verbs_rma_op_t *) (uintptr_t) wc.wr_id;
 	verbs_ep_t *vep = ep->priv;
 
 	CCI_ENTER;
 
-	rma_op->status = verbs_wc_to_cci_status(wc.status);
+	if (rma_op->swap && wc.status == IBV_WC_SUCCESS) {
+		verbs_rma_handle_t *local = container_of(rma_op->local_handle,
+				verbs_rma_handle_t, rma_handle);
+		uint64_t old = 0;
+
+		/* the word changed since we read it, try again */
+		memcpy(&old, (char *)local->mr->addr + rma_op->local_offset,
+		       sizeof(old));
+		if (old != rma_op->compare) {
+			rma_op->compare = old;
+			if (!verbs_post_atomic(rma_op))
+				goto out;
+			wc.status = IBV_WC_GENERAL_ERR;
+		}
+	}
+
+	/* a cci_rmav() may post several work requests, keep the first
+	 * error and complete the op with the last one */
+	pthread_mutex_lock(&ep->lock);
+	if (rma_op->status == CCI_SUCCESS)
+		rma_op->status = verbs_wc_to_cci_status(wc.status);
+	pending = --rma_op->pending;
+	pthread_mutex_unlock(&ep->lock);
+	if (pending)
+		goto out;
 
 	if (rma_op->msg_len == 0 || rma_op->status != CCI_SUCCESS) {
 queue:
@@ -3381,6 +3451,7 @@ queue:
 		free(rma_op);
 	}
 
+out:
 	CCI_EXIT;
 	return ret;
 }
@@ -3552,6 +3623,8 @@ static int verbs_get_cq_event(cci__ep_t * ep)
 					}
 				}
 			case IBV_WC_RDMA_READ:
+			case IBV_WC_COMP_SWAP:
+			case IBV_WC_FETCH_ADD:
 complete_rma:
 				ret = verbs_handle_rma_completion(ep, wc[i]);
 				break;
@@ -4071,7 +4144,8 @@ ctp_verbs_rma_register(cci_endpoint_t * endpoint,
 	handle->mr = ibv_reg_mr(vep->pd, start, (size_t) length,
 				IBV_ACCESS_LOCAL_WRITE |
 				IBV_ACCESS_REMOTE_WRITE |
-				IBV_ACCESS_REMOTE_READ);
+				IBV_ACCESS_REMOTE_READ |
+				(vep->atomics ? IBV_ACCESS_REMOTE_ATOMIC : 0));
 	if (!handle->mr) {
 		free(handle);
 		CCI_EXIT;
@@ -4119,6 +4193,55 @@ static int ctp_verbs_rma_deregister(cci_endpoint_t * endpoint, cci_rma_handle_t
 	return ret;
 }
 
+/* Post an atomic as a single 8 byte work request on the local region.
+ * The device has no swap, so a swap is a compare-and-swap with the last
+ * value read, reposted by the completion until the word did not change.
+ */
+static int verbs_post_atomic(verbs_rma_op_t * rma_op)
+{
+	int ret = CCI_SUCCESS;
+	cci__conn_t *conn = rma_op->evt.conn;
+	verbs_conn_t *vconn = conn->priv;
+	verbs_rma_handle_t *local =
+		container_of(rma_op->local_handle, verbs_rma_handle_t, rma_handle);
+	struct ibv_sge list;
+	struct ibv_send_wr wr, *bad_wr;
+
+	CCI_ENTER;
+
+	memset(&list, 0, sizeof(list));
+	list.addr =
+	    (uintptr_t) local->mr->addr + (uintptr_t) rma_op->local_offset;
+	list.length = sizeof(uint64_t);
+	list.lkey = local->mr->lkey;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.wr_id = (uintptr_t) rma_op;
+	wr.sg_list = &list;
+	wr.num_sge = 1;
+	wr.send_flags = IBV_SEND_SIGNALED;
+	if (rma_op->flags & CCI_FLAG_FENCE)
+		wr.send_flags |= IBV_SEND_FENCE;
+	if (rma_op->fetch_add) {
+		wr.opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
+		wr.wr.atomic.compare_add = rma_op->operand;
+	} else {
+		wr.opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
+		wr.wr.atomic.compare_add = rma_op->compare;
+		wr.wr.atomic.swap = rma_op->operand;
+	}
+	wr.wr.atomic.remote_addr =
+		verbs_ntohll(rma_op->remote_handle->stuff[0]) + rma_op->remote_offset;
+	wr.wr.atomic.rkey = (uint32_t) verbs_ntohll(rma_op->remote_handle->stuff[1]);
+
+	ret = ibv_post_send(vconn->id->qp, &wr, &bad_wr);
+	if (ret == -1)
+		ret = errno;
+
+	CCI_EXIT;
+	return ret;
+}
+
 static int verbs_post_rma(verbs_rma_op_t * rma_op)
 {
 	int ret = CCI_SUCCESS;
@@ -4208,6 +4331,7 @@ ctp_verbs_rma(cci_connection_t * connection,
 	rma_op->flags = flags;
 	rma_op->msg_len = 0;
 	rma_op->msg_ptr = NULL;
+	rma_op->pending = 1;
 
 	rma_op->evt.event.type = CCI_EVENT_SEND;
 	rma_op->evt.event.send.connection = connection;
@@ -4244,3 +4368,289 @@ out:
 	CCI_EXIT;
 	return ret;
 }
+
+/* Post a cci_rmav() as a chain of work requests. The segments that
+ * follow each other in the remote region share a work request with one
+ * SGE per segment (up to vconn->max_sge). Each work request is signaled
+ * and rma_op->pending counts them.
+ */
+static int
+verbs_post_rmav(verbs_rma_op_t * rma_op, const cci_rma_seg_t * segs,
+		uint32_t segcnt)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i = 0, nwr = 0, posted = 0;
+	uint64_t next = 0, wr_len = 0;
+	cci__conn_t *conn = rma_op->evt.conn;
+	cci__ep_t *ep = rma_op->evt.ep;
+	verbs_conn_t *vconn = conn->priv;
+	verbs_rma_handle_t *local =
+		container_of(rma_op->local_handle, verbs_rma_handle_t, rma_handle);
+	uint64_t raddr = verbs_ntohll(rma_op->remote_handle->stuff[0]);
+	uint32_t rkey = (uint32_t) verbs_ntohll(rma_op->remote_handle->stuff[1]);
+	int max_sge = vconn->max_sge ? (int) vconn->max_sge : 1;
+	struct ibv_sge *list = NULL;
+	struct ibv_send_wr *wrs = NULL, *wr = NULL, *bad_wr = NULL;
+
+	CCI_ENTER;
+
+	list = calloc(segcnt, sizeof(*list));
+	wrs = calloc(segcnt, sizeof(*wrs));
+	if (!list || !wrs) {
+		ret = CCI_ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < segcnt; i++) {
+		list[i].addr = (uintptr_t) local->mr->addr +
+			(uintptr_t) segs[i].local_offset;
+		list[i].length = (uint32_t) segs[i].length;
+		list[i].lkey = local->mr->lkey;
+
+		if (wr && wr->num_sge < max_sge &&
+		    segs[i].remote_offset == next &&
+		    wr_len + segs[i].length <= UINT32_MAX) {
+			wr->num_sge++;
+			wr_len += segs[i].length;
+		} else {
+			if (wr)
+				wr->next = &wrs[nwr];
+			wr = &wrs[nwr++];
+			wr->wr_id = (uintptr_t) rma_op;
+			wr->sg_list = &list[i];
+			wr->num_sge = 1;
+			wr->opcode = rma_op->flags & CCI_FLAG_WRITE ?
+				IBV_WR_RDMA_WRITE : IBV_WR_RDMA_READ;
+			wr->send_flags = IBV_SEND_SIGNALED;
+			wr->wr.rdma.remote_addr = raddr + segs[i].remote_offset;
+			wr->wr.rdma.rkey = rkey;
+			wr_len = segs[i].length;
+		}
+		if ((rma_op->flags & CCI_FLAG_WRITE) &&
+		    wr_len <= vconn->inline_size)
+			wr->send_flags |= IBV_SEND_INLINE;
+		else
+			wr->send_flags &= ~IBV_SEND_INLINE;
+		next = segs[i].remote_offset + segs[i].length;
+	}
+	if (rma_op->flags & CCI_FLAG_FENCE)
+		wrs[0].send_flags |= IBV_SEND_FENCE;
+
+	debug(CCI_DB_MSG, "%s: %u segments in %u work requests", __func__,
+	      segcnt, nwr);
+
+	rma_op->pending = nwr;
+	ret = ibv_post_send(vconn->id->qp, wrs, &bad_wr);
+	if (ret == -1)
+		ret = errno;
+	if (ret) {
+		posted = bad_wr ? (uint32_t) (bad_wr - wrs) : 0;
+		if (posted) {
+			struct ibv_wc wc;
+
+			/* the posted work requests complete the op, keep one
+			 * reference and drop it with an error completion */
+			pthread_mutex_lock(&ep->lock);
+			rma_op->status = ret;
+			rma_op->pending -= nwr - posted - 1;
+			pthread_mutex_unlock(&ep->lock);
+
+			memset(&wc, 0, sizeof(wc));
+			wc.wr_id = (uintptr_t) rma_op;
+			wc.status = IBV_WC_GENERAL_ERR;
+			verbs_handle_rma_completion(ep, wc);
+			ret = CCI_SUCCESS;
+		}
+	}
+
+out:
+	free(list);
+	free(wrs);
+	CCI_EXIT;
+	return ret;
+}
+
+static int
+ctp_verbs_rmav(cci_connection_t * connection,
+	   const void *msg_ptr, uint32_t msg_len,
+	   cci_rma_handle_t * local_handle,
+	   cci_rma_handle_t * remote_handle,
+	   const cci_rma_seg_t * segs, uint32_t segcnt,
+	   const void *context, int flags)
+{
+	int ret = CCI_SUCCESS;
+	uint32_t i = 0;
+	uint64_t len = 0;
+	cci__ep_t *ep = NULL;
+	cci__conn_t *conn = NULL;
+	verbs_ep_t *vep = NULL;
+	verbs_rma_handle_t *local = container_of(local_handle, verbs_rma_handle_t, rma_handle);
+	verbs_rma_op_t *rma_op = NULL;
+
+	CCI_ENTER;
+
+	if (!vglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	vep = ep->priv;
+
+	if (!local || local->ep != ep) {
+		CCI_EXIT;
+		return CCI_EINVAL;
+	}
+
+	for (i = 0; i < segcnt; i++) {
+		if (segs[i].local_offset > local->mr->length ||
+		    segs[i].length > local->mr->length - segs[i].local_offset) {
+			debug(CCI_DB_INFO, "%s: segment %u exceeds the local "
+			      "handle", __func__, i);
+			CCI_EXIT;
+			return CCI_EINVAL;
+		}
+		if (segs[i].length > UINT32_MAX) {
+			CCI_EXIT;
+			return CCI_EMSGSIZE;
+		}
+		len += segs[i].length;
+	}
+
+	rma_op = calloc(1, sizeof(*rma_op));
+	if (!rma_op) {
+		CCI_EXIT;
+		return CCI_ENOMEM;
+	}
+
+	rma_op->msg_type = VERBS_MSG_RMA;
+	rma_op->local_handle = local_handle;
+	rma_op->local_offset = segs[0].local_offset;
+	rma_op->remote_handle = remote_handle;
+	rma_op->remote_offset = segs[0].remote_offset;
+	rma_op->len = len;
+	rma_op->context = (void *)context;
+	rma_op->flags = flags;
+
+	rma_op->evt.event.type = CCI_EVENT_SEND;
+	rma_op->evt.event.send.connection = connection;
+	rma_op->evt.event.send.context = (void *)context;
+	rma_op->evt.event.send.status = CCI_SUCCESS;	/* for now */
+	rma_op->evt.ep = ep;
+	rma_op->evt.conn = conn;
+	rma_op->evt.priv = rma_op;
+
+	if (msg_ptr && msg_len) {
+		rma_op->tx = verbs_get_tx(ep);
+		if (!rma_op->tx) {
+			ret = CCI_ENOBUFS;
+			goto out;
+		}
+		memcpy(rma_op->tx->buffer, msg_ptr, msg_len);
+		rma_op->msg_ptr = rma_op->tx->buffer;
+		rma_op->msg_len = msg_len;
+	}
+
+	pthread_mutex_lock(&ep->lock);
+	TAILQ_INSERT_TAIL(&vep->rma_ops, rma_op, entry);
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = verbs_post_rmav(rma_op, segs, segcnt);
+	if (ret) {
+		pthread_mutex_lock(&ep->lock);
+		TAILQ_REMOVE(&vep->rma_ops, rma_op, entry);
+		pthread_mutex_unlock(&ep->lock);
+		if (rma_op->tx)
+			verbs_return_tx(rma_op->tx);
+	}
+
+out:
+	if (ret)
+		free(rma_op);
+
+	CCI_EXIT;
+	return ret;
+}
+
+static int
+ctp_verbs_rma_atomic(cci_connection_t * connection,
+	  cci_rma_handle_t * local_handle, uint64_t local_offset,
+	  cci_rma_handle_t * remote_handle, uint64_t remote_offset,
+	  cci_rma_atomic_op_t op, uint64_t operand, uint64_t compare,
+	  const void *context, int flags)
+{
+	int ret = CCI_SUCCESS;
+	cci__ep_t *ep = NULL;
+	cci__conn_t *conn = NULL;
+	verbs_ep_t *vep = NULL;
+	verbs_rma_handle_t *local = container_of(local_handle, verbs_rma_handle_t, rma_handle);
+	verbs_rma_op_t *rma_op = NULL;
+
+	CCI_ENTER;
+
+	if (!vglobals) {
+		CCI_EXIT;
+		return CCI_ENODEV;
+	}
+
+	conn = container_of(connection, cci__conn_t, connection);
+	ep = container_of(connection->endpoint, cci__ep_t, endpoint);
+	vep = ep->priv;
+
+	if (!vep->atomics) {
+		CCI_EXIT;
+		return CCI_ERR_NOT_IMPLEMENTED;
+	}
+
+	/* the device writes the previous value in the local region */
+	if (!local || local->ep != ep || local_offset > local->mr->length ||
+	    sizeof(uint64_t) > local->mr->length - local_offset) {
+		CCI_EXIT;
+		return CCI_EINVAL;
+	}
+
+	rma_op = calloc(1, sizeof(*rma_op));
+	if (!rma_op) {
+		CCI_EXIT;
+		return CCI_ENOMEM;
+	}
+
+	rma_op->msg_type = VERBS_MSG_RMA;
+	rma_op->local_handle = local_handle;
+	rma_op->local_offset = local_offset;
+	rma_op->remote_handle = remote_handle;
+	rma_op->remote_offset = remote_offset;
+	rma_op->len = sizeof(uint64_t);
+	rma_op->context = (void *)context;
+	rma_op->flags = flags;
+	rma_op->pending = 1;
+	rma_op->fetch_add = op == CCI_RMA_ATOMIC_FETCH_ADD;
+	rma_op->swap = op == CCI_RMA_ATOMIC_SWAP;
+	rma_op->operand = operand;
+	/* a swap starts by guessing 0 */
+	rma_op->compare = op == CCI_RMA_ATOMIC_CSWAP ? compare : 0;
+
+	rma_op->evt.event.type = CCI_EVENT_SEND;
+	rma_op->evt.event.send.connection = connection;
+	rma_op->evt.event.send.context = (void *)context;
+	rma_op->evt.event.send.status = CCI_SUCCESS;	/* for now */
+	rma_op->evt.ep = ep;
+	rma_op->evt.conn = conn;
+	rma_op->evt.priv = rma_op;
+
+	pthread_mutex_lock(&ep->lock);
+	TAILQ_INSERT_TAIL(&vep->rma_ops, rma_op, entry);
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = verbs_post_atomic(rma_op);
+	if (ret) {
+		pthread_mutex_lock(&ep->lock);
+		TAILQ_REMOVE(&vep->rma_ops, rma_op, entry);
+		pthread_mutex_unlock(&ep->lock);
+		free(rma_op);
+	}
+
+	CCI_EXIT;
+	return ret;
+}
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Check and time cci_rma_atomic(). The server sends the handle of a
+ * word that the client clears with a cci_rma() write. The client then
+ * fetches-and-adds one to it, one at a time and then window at a time,
+ * and checks that each addition returned a different previous value.
+ * It checks that a compare-and-swap only swaps when the word matches,
+ * that a swap returns the previous value, and reads the word back.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "cci.h"
+
+#define ITERS		(1000)
+#define WINDOW		(64)
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+cci_connection_t *connection = NULL;
+cci_rma_handle_t *local_handle = NULL;
+struct cci_rma_handle remote_handle;
+uint64_t *words;	/* the server's word, or the client's results */
+int failed = 0;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-i <iters>]\n",
+		name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-i\tFetch-and-adds of each kind (default %d)\n\n",
+		ITERS);
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h tcp://10.0.0.1:5555 -i 10000\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void check_return(char *func, int ret)
+{
+	if (ret) {
+		fprintf(stderr, "%s() returned %s\n", func,
+			cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+	return;
+}
+
+static void expect(char *what, uint64_t value, uint64_t expected)
+{
+	if (value != expected) {
+		fprintf(stderr, "%s returned %" PRIu64 " instead of %" PRIu64
+			"\n", what, value, expected);
+		failed = 1;
+	}
+	return;
+}
+
+/* Wait for the completion of an operation. */
+static void wait_send(void)
+{
+	int ret;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_SEND)
+			break;
+		cci_return_event(event);
+	}
+
+	check_return("RMA", event->send.status);
+	cci_return_event(event);
+
+	return;
+}
+
+/* Run op on the server's word and return its previous value. */
+static uint64_t run_atomic(cci_rma_atomic_op_t op, uint64_t operand,
+			   uint64_t compare)
+{
+	int ret;
+
+	ret = cci_rma_atomic(connection, local_handle, 0, &remote_handle, 0,
+			     op, operand, compare, NULL, 0);
+	check_return("cci_rma_atomic", ret);
+	wait_send();
+
+	return words[0];
+}
+
+/* Write value to the server's word, or read it. */
+static uint64_t rma(uint64_t value, int flags)
+{
+	int ret;
+
+	words[0] = value;
+	ret = cci_rma(connection, NULL, 0, local_handle, 0, &remote_handle,
+		      0, sizeof(uint64_t), NULL, flags);
+	check_return("cci_rma", ret);
+	wait_send();
+
+	return words[0];
+}
+
+static int cmp_words(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double usecs_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (double)(end.tv_sec - start->tv_sec) * 1000000.0 +
+		(double)(end.tv_usec - start->tv_usec);
+}
+
+static void do_server(void)
+{
+	int ret;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		switch (event->type) {
+		case CCI_EVENT_CONNECT_REQUEST:
+			ret = cci_accept(event, NULL);
+			check_return("cci_accept", ret);
+			break;
+		case CCI_EVENT_ACCEPT:
+			ret = cci_send(event->accept.connection, local_handle,
+				       sizeof(*local_handle), NULL,
+				       CCI_FLAG_SILENT);
+			check_return("cci_send", ret);
+			break;
+		default:
+			break;
+		}
+		cci_return_event(event);
+	}
+}
+
+static void do_client(char *server_uri, uint32_t iters)
+{
+	int ret;
+	uint32_t i, j, n;
+	uint64_t value;
+	cci_event_t *event;
+	struct timeval start;
+	double one, windowed;
+
+	ret = cci_connect(endpoint, server_uri, NULL, 0, CCI_CONN_ATTR_RO,
+			  NULL, 0, NULL);
+	check_return("cci_connect", ret);
+
+	/* the connection, then the server's handle */
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			check_return("connect", event->connect.status);
+			connection = event->connect.connection;
+		} else if (event->type == CCI_EVENT_RECV) {
+			memcpy(&remote_handle, event->recv.ptr,
+			       sizeof(remote_handle));
+			cci_return_event(event);
+			break;
+		}
+		cci_return_event(event);
+	}
+
+	rma(0, CCI_FLAG_WRITE);
+
+	/* one at a time, each sees the previous one */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iters; i++) {
+		value = run_atomic(CCI_RMA_ATOMIC_FETCH_ADD, 1, 0);
+		if (value != i) {
+			expect("fetch-add", value, i);
+			break;
+		}
+	}
+	one = usecs_since(&start) / iters;
+
+	/* window at a time, into separate words, in any order */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iters; i += n) {
+		n = iters - i < WINDOW ? iters - i : WINDOW;
+		for (j = 0; j < n; j++) {
+			ret = cci_rma_atomic(connection, local_handle,
+					     j * sizeof(uint64_t),
+					     &remote_handle, 0,
+					     CCI_RMA_ATOMIC_FETCH_ADD, 1, 0,
+					     NULL, 0);
+			check_return("cci_rma_atomic", ret);
+		}
+		for (j = 0; j < n; j++)
+			wait_send();
+
+		qsort(words, n, sizeof(uint64_t), cmp_words);
+		for (j = 0; j < n; j++) {
+			if (words[j] != (uint64_t) iters + i + j) {
+				expect("windowed fetch-add", words[j],
+				       (uint64_t) iters + i + j);
+				break;
+			}
+		}
+	}
+	windowed = usecs_since(&start) / iters;
+
+	value = 2 * (uint64_t) iters;
+	expect("cswap with the wrong value",
+	       run_atomic(CCI_RMA_ATOMIC_CSWAP, 7, value + 1), value);
+	expect("read after a failed cswap", rma(0, CCI_FLAG_READ), value);
+	expect("cswap", run_atomic(CCI_RMA_ATOMIC_CSWAP, 7, value), value);
+	expect("swap", run_atomic(CCI_RMA_ATOMIC_SWAP, 42, 0), 7);
+	expect("read after swap", rma(0, CCI_FLAG_READ), 42);
+
+	printf("fetch-add latency %.1f us, %.1f us with %d in flight\n",
+	       one, windowed, WINDOW);
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+	if (failed)
+		exit(EXIT_FAILURE);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0;
+	uint32_t caps = 0, iters = ITERS;
+	char *server_uri = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:si:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'i':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (iters < 1)
+		print_usage();
+
+	words = calloc(WINDOW, sizeof(uint64_t));
+	if (!words) {
+		fprintf(stderr, "unable to allocate the words\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	ret = cci_rma_register(endpoint, words, WINDOW * sizeof(uint64_t),
+			       CCI_FLAG_READ | CCI_FLAG_WRITE, &local_handle);
+	check_return("cci_rma_register", ret);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, iters);
+
+	/* clean up */
+	ret = cci_rma_deregister(endpoint, local_handle);
+	check_return("cci_rma_deregister", ret);
+
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(uri);
+	free(server_uri);
+	free(words);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Measure connection setup rate. The client opens 1, 2, 4, ... up to
+ * max_conns connections at once and reports how many complete per second.
+ * With -H, the client connects by host name instead of the server's
+ * address to include name resolution.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "cci.h"
+
+#define MAX_CONNS	(256)
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+cci_conn_attribute_t attr = CCI_CONN_ATTR_RO;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-H <host name>] "
+		"[-n <max_conns>] [-c <type>]\n", name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-H\tConnect to this host name instead of the "
+		"URI's address\n");
+	fprintf(stderr, "\t-n\tOpen up to this many connections at once "
+		"(default %d)\n", MAX_CONNS);
+	fprintf(stderr,
+		"\t-c\tConnection type (UU, RU, or RO) set by client only\n\n");
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h tcp://10.0.0.1:5555 -H foo\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void do_server(void)
+{
+	int ret;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		if (event->type == CCI_EVENT_CONNECT_REQUEST) {
+			ret = cci_accept(event, NULL);
+			if (ret)
+				fprintf(stderr, "cci_accept() failed with %s\n",
+					cci_strerror(endpoint, ret));
+		}
+		cci_return_event(event);
+	}
+}
+
+static void do_client(char *server_uri, int max_conns)
+{
+	int ret, n, i;
+	cci_connection_t **conns = NULL;
+
+	conns = calloc(max_conns, sizeof(*conns));
+	if (!conns) {
+		fprintf(stderr, "unable to allocate connections\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Conns\tTime (us)\tConnects/s\tFailed\n");
+
+	for (n = 1; n <= max_conns; n *= 2) {
+		int done = 0, failed = 0;
+		uint64_t usecs;
+		struct timeval start, end;
+
+		gettimeofday(&start, NULL);
+
+		for (i = 0; i < n; i++) {
+			ret = cci_connect(endpoint, server_uri, NULL, 0, attr,
+					  (void *)(uintptr_t) i, 0, NULL);
+			if (ret) {
+				fprintf(stderr, "cci_connect() failed with %s\n",
+					cci_strerror(endpoint, ret));
+				failed++;
+				done++;
+			}
+		}
+
+		while (done < n) {
+			cci_event_t *event;
+
+			ret = cci_get_event(endpoint, &event);
+			if (ret != CCI_SUCCESS)
+				continue;
+
+			if (event->type == CCI_EVENT_CONNECT) {
+				i = (int)(uintptr_t) event->connect.context;
+				conns[i] = event->connect.connection;
+				if (event->connect.status != CCI_SUCCESS)
+					failed++;
+				done++;
+			}
+			cci_return_event(event);
+		}
+
+		gettimeofday(&end, NULL);
+		usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+			end.tv_usec - start.tv_usec;
+
+		printf("%5d\t%9" PRIu64 "\t%10.1f\t%6d\n", n, usecs,
+		       (double)(n - failed) * 1000000.0 / (double)usecs, failed);
+
+		for (i = 0; i < n; i++) {
+			if (conns[i])
+				cci_disconnect(conns[i]);
+			conns[i] = NULL;
+		}
+	}
+
+	free(conns);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0, max_conns = MAX_CONNS;
+	uint32_t caps = 0;
+	char *server_uri = NULL, *host = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:sH:n:c:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'H':
+			host = strdup(optarg);
+			break;
+		case 'n':
+			max_conns = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strncasecmp("ru", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RU;
+			else if (strncasecmp("ro", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RO;
+			else if (strncasecmp("uu", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_UU;
+			else
+				print_usage();
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (max_conns < 1)
+		print_usage();
+
+	if (host && server_uri) {
+		/* replace the address in <transport>://<address>:<port> */
+		char *scheme = strstr(server_uri, "://");
+		char *port = strrchr(server_uri, ':');
+		char *new_uri;
+
+		if (!scheme || port == scheme)
+			print_usage();
+		new_uri = calloc(1, strlen(server_uri) + strlen(host) + 1);
+		if (!new_uri) {
+			fprintf(stderr, "unable to allocate URI\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(new_uri, server_uri, scheme + 3 - server_uri);
+		strcat(new_uri, host);
+		strcat(new_uri, port);
+		free(server_uri);
+		server_uri = new_uri;
+	}
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, max_conns);
+
+	/* clean up */
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(uri);
+	free(server_uri);
+	free(host);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Check and time cci_sendto() without a connection. The client resolves
+ * the server's URI with cci_addr_resolve() and sends it datagrams of
+ * each power of two size up to max_send_size, one at a time. The server
+ * echoes them to the address of their CCI_EVENT_RECV_FROM event. The
+ * client checks the contents and the sender of each echo, and sends a
+ * datagram again when its echo is late, since datagrams may be lost.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "cci.h"
+
+#define ITERS		(1000)
+#define TIMEOUT_US	(100000)	/* resend a datagram after this */
+
+/* start of each datagram, the rest is a pattern */
+typedef struct hdr {
+	uint32_t seq;
+	uint32_t len;
+} hdr_t;
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+int failed = 0;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-i <iters>]\n",
+		name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-i\tDatagrams of each size (default %d)\n\n",
+		ITERS);
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h sock://10.0.0.1:5555 -i 10000\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void check_return(char *func, int ret)
+{
+	if (ret) {
+		fprintf(stderr, "%s() returned %s\n", func,
+			cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+	return;
+}
+
+static uint64_t usecs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void fill(char *buf, uint32_t seq, uint32_t len)
+{
+	uint32_t i;
+	hdr_t *hdr = (hdr_t *) buf;
+
+	hdr->seq = seq;
+	hdr->len = len;
+	for (i = sizeof(*hdr); i < len; i++)
+		buf[i] = (char) (seq + i);
+
+	return;
+}
+
+/* Returns 1 if the datagram is intact. */
+static int intact(const char *buf, uint32_t len)
+{
+	uint32_t i;
+	const hdr_t *hdr = (const hdr_t *) buf;
+
+	if (len < sizeof(*hdr) || hdr->len != len)
+		return 0;
+	for (i = sizeof(*hdr); i < len; i++) {
+		if (buf[i] != (char) (hdr->seq + i))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void do_server(void)
+{
+	int ret;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		if (event->type == CCI_EVENT_RECV_FROM) {
+			ret = cci_sendto(endpoint, event->recv_from.addr,
+					 event->recv_from.ptr,
+					 event->recv_from.len, NULL,
+					 CCI_FLAG_SILENT);
+			if (ret)
+				fprintf(stderr, "cci_sendto() returned %s\n",
+					cci_strerror(endpoint, ret));
+		}
+		cci_return_event(event);
+	}
+}
+
+/* Send the datagram until its echo comes back, returns the resends. */
+static uint32_t echo(const cci_addr_t *addr, char *buf, uint32_t seq,
+		     uint32_t len)
+{
+	int ret, done = 0;
+	uint32_t resends = 0;
+	uint64_t deadline;
+	cci_event_t *event;
+
+	fill(buf, seq, len);
+	while (!done) {
+		ret = cci_sendto(endpoint, addr, buf, len, NULL,
+				 CCI_FLAG_SILENT);
+		check_return("cci_sendto", ret);
+
+		deadline = usecs() + TIMEOUT_US;
+		while (!done && usecs() < deadline) {
+			const hdr_t *hdr;
+
+			ret = cci_get_event(endpoint, &event);
+			if (ret != CCI_SUCCESS)
+				continue;
+			if (event->type != CCI_EVENT_RECV_FROM) {
+				cci_return_event(event);
+				continue;
+			}
+
+			hdr = event->recv_from.ptr;
+			if (!intact(event->recv_from.ptr,
+				    event->recv_from.len)) {
+				fprintf(stderr, "%u bytes echo of seq %u is "
+					"corrupt\n", len, seq);
+				failed = 1;
+			} else if (event->recv_from.addr != addr) {
+				fprintf(stderr, "echo of seq %u is from %s\n",
+					seq, event->recv_from.addr->uri);
+				failed = 1;
+			} else if (hdr->seq == seq) {
+				done = 1;
+			}
+			/* else a late echo of a resent datagram */
+			cci_return_event(event);
+		}
+		if (!done)
+			resends++;
+	}
+
+	return resends;
+}
+
+static void do_client(char *server_uri, uint32_t iters)
+{
+	int ret;
+	uint32_t i, len, seq = 0, resends;
+	uint32_t max = endpoint->device->max_send_size;
+	uint64_t start;
+	const cci_addr_t *addr, *again;
+	cci_event_t *event;
+	char *buf;
+
+	ret = cci_addr_resolve(endpoint, server_uri, &addr);
+	if (ret == CCI_ERR_NOT_IMPLEMENTED) {
+		printf("The transport has no datagrams\n");
+		return;
+	}
+	check_return("cci_addr_resolve", ret);
+
+	ret = cci_addr_resolve(endpoint, server_uri, &again);
+	check_return("cci_addr_resolve", ret);
+	if (again != addr) {
+		fprintf(stderr, "resolving %s again returned another "
+			"address\n", server_uri);
+		failed = 1;
+	}
+
+	buf = calloc(1, max + 1);
+	if (!buf) {
+		fprintf(stderr, "unable to allocate the buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_sendto(endpoint, addr, buf, max + 1, NULL, CCI_FLAG_SILENT);
+	if (ret != CCI_EMSGSIZE) {
+		fprintf(stderr, "cci_sendto() of %u bytes returned %s "
+			"instead of CCI_EMSGSIZE\n", max + 1,
+			cci_strerror(endpoint, ret));
+		failed = 1;
+	}
+
+	/* without CCI_FLAG_SILENT, the send completes with no connection */
+	fill(buf, seq, sizeof(hdr_t));
+	ret = cci_sendto(endpoint, addr, buf, sizeof(hdr_t), buf, 0);
+	check_return("cci_sendto", ret);
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_SEND) {
+			if (event->send.status != CCI_SUCCESS ||
+			    event->send.context != buf ||
+			    event->send.connection != NULL) {
+				fprintf(stderr, "unexpected send event\n");
+				failed = 1;
+			}
+			cci_return_event(event);
+			break;
+		}
+		cci_return_event(event);
+	}
+
+	printf("Bytes\t\tLatency (one way)\tResends\n");
+	for (len = sizeof(hdr_t); ; len = len * 2 < max ? len * 2 : max) {
+		resends = 0;
+		start = usecs();
+		for (i = 0; i < iters; i++)
+			resends += echo(addr, buf, ++seq, len);
+		printf("%8u\t%8.2f us\t\t%u\n", len,
+		       (double)(usecs() - start) / iters / 2.0, resends);
+		if (len == max)
+			break;
+	}
+
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+	free(buf);
+	if (failed)
+		exit(EXIT_FAILURE);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0;
+	uint32_t caps = 0, iters = ITERS;
+	char *server_uri = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:si:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'i':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (iters < 1)
+		print_usage();
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, iters);
+
+	/* clean up */
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(uri);
+	free(server_uri);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
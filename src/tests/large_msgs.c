@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Check large messages (CCI_ENDPT_LARGE_MSGS). The client sends rounds of
+ * messages whose sizes go from 4 bytes to max_size and back, so that small
+ * messages follow large ones, and the server checks their contents and,
+ * on RO connections, their order. The client then reports the bandwidth
+ * of max_size messages.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "cci.h"
+
+#define MAX_SIZE	(1024 * 1024)
+#define ITERS		(4)
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+cci_conn_attribute_t attr = CCI_CONN_ATTR_RO;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-m <max_size>] "
+		"[-i <iters>] [-c <type>]\n", name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-m\tLargest message (default %d)\n", MAX_SIZE);
+	fprintf(stderr, "\t-i\tRounds of messages (default %d)\n", ITERS);
+	fprintf(stderr,
+		"\t-c\tConnection type (RU or RO) set by client only\n\n");
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h tcp://10.0.0.1:5555 -m 8388608\n", name);
+	exit(EXIT_FAILURE);
+}
+
+/* Each message starts with its sequence number, then a pattern of it. */
+static void fill(char *buf, uint32_t len, uint32_t seq)
+{
+	uint32_t i;
+
+	memcpy(buf, &seq, sizeof(seq));
+	for (i = sizeof(seq); i < len; i++)
+		buf[i] = (char)(i * 131 + seq);
+}
+
+static int check(const char *buf, uint32_t len, uint32_t seq)
+{
+	uint32_t i;
+
+	for (i = sizeof(seq); i < len; i++)
+		if (buf[i] != (char)(i * 131 + seq))
+			return 0;
+
+	return 1;
+}
+
+static void do_server(void)
+{
+	int ret, ordered = 0;
+	uint32_t next = 0, bad = 0, late = 0;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		switch (event->type) {
+		case CCI_EVENT_CONNECT_REQUEST:
+			ordered = event->request.attribute == CCI_CONN_ATTR_RO;
+			next = bad = late = 0;
+			ret = cci_accept(event, NULL);
+			if (ret)
+				fprintf(stderr, "cci_accept() failed with %s\n",
+					cci_strerror(endpoint, ret));
+			break;
+		case CCI_EVENT_RECV:
+		{
+			uint32_t seq, len = event->recv.len;
+
+			memcpy(&seq, event->recv.ptr, sizeof(seq));
+			if (!check(event->recv.ptr, len, seq)) {
+				fprintf(stderr, "message %u of %u bytes is "
+					"corrupted\n", seq, len);
+				bad++;
+			}
+			if (ordered && seq != next) {
+				fprintf(stderr, "message %u of %u bytes "
+					"arrived instead of %u\n", seq, len,
+					next);
+				late++;
+			}
+			if (seq >= next)
+				next = seq + 1;
+
+			/* echo the status back */
+			seq = bad + late;
+			ret = cci_send(event->recv.connection, &seq,
+				       sizeof(seq), NULL, CCI_FLAG_SILENT);
+			if (ret)
+				fprintf(stderr, "cci_send() failed with %s\n",
+					cci_strerror(endpoint, ret));
+			break;
+		}
+		default:
+			break;
+		}
+		cci_return_event(event);
+	}
+}
+
+/* Wait for sends completions and echoes, returns the last echo. */
+static uint32_t wait_msgs(int sends, int echoes)
+{
+	int ret;
+	uint32_t status = 0;
+	cci_event_t *event;
+
+	while (sends || echoes) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		if (event->type == CCI_EVENT_SEND) {
+			if (event->send.status)
+				fprintf(stderr, "send failed with %s\n",
+					cci_strerror(endpoint,
+						     event->send.status));
+			sends--;
+		} else if (event->type == CCI_EVENT_RECV) {
+			memcpy(&status, event->recv.ptr, sizeof(status));
+			echoes--;
+		}
+		cci_return_event(event);
+	}
+
+	return status;
+}
+
+static void send_msg(cci_connection_t *connection, char *buf, uint32_t len,
+		     uint32_t seq, int flags)
+{
+	int ret;
+
+	fill(buf, len, seq);
+	ret = cci_send(connection, buf, len, NULL, flags);
+	if (ret) {
+		fprintf(stderr, "cci_send() of %u bytes failed with %s\n",
+			len, cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return;
+}
+
+static void do_client(char *server_uri, uint32_t max_size, int iters)
+{
+	int ret, i, sends, echoes;
+	uint32_t len, seq = 0, status = 0;
+	char *buf;
+	cci_connection_t *connection = NULL;
+	cci_event_t *event;
+	struct timeval start, end;
+	uint64_t usecs;
+
+	buf = malloc(max_size);
+	if (!buf) {
+		fprintf(stderr, "unable to allocate %u bytes\n", max_size);
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_connect(endpoint, server_uri, NULL, 0, attr, NULL, 0, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_connect() failed with %s\n",
+			cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	while (!connection) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			if (event->connect.status) {
+				fprintf(stderr, "connect failed with %s\n",
+					cci_strerror(endpoint,
+						     event->connect.status));
+				exit(EXIT_FAILURE);
+			}
+			connection = event->connect.connection;
+		}
+		cci_return_event(event);
+	}
+
+	printf("max_send_size %u\n", connection->max_send_size);
+
+	/* up to max_size and back down, so that small messages follow the
+	 * large ones, some of them blocking */
+	for (i = 0; i < iters; i++) {
+		sends = echoes = 0;
+		for (len = 4; len <= max_size; len *= 2) {
+			send_msg(connection, buf, len, seq++, 0);
+			sends++;
+			echoes++;
+		}
+		for (len = max_size / 2; len >= 4; len /= 2) {
+			if (len & 16) {
+				send_msg(connection, buf, len, seq++,
+					 CCI_FLAG_BLOCKING);
+			} else {
+				send_msg(connection, buf, len, seq++, 0);
+				sends++;
+			}
+			echoes++;
+		}
+		status = wait_msgs(sends, echoes);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iters; i++) {
+		send_msg(connection, buf, max_size, seq++, 0);
+		status = wait_msgs(1, 1);
+	}
+	gettimeofday(&end, NULL);
+	usecs = (end.tv_sec - start.tv_sec) * 1000000 +
+		end.tv_usec - start.tv_usec;
+
+	printf("%u bytes: %.1f MB/s\n", max_size,
+	       (double)max_size * iters / (double)usecs);
+	printf("%s: %u messages %s\n", status ? "FAILED" : "PASSED", seq,
+	       attr == CCI_CONN_ATTR_RO ? "intact and in order" : "intact");
+
+	free(buf);
+
+	if (status)
+		exit(EXIT_FAILURE);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0, iters = ITERS;
+	uint32_t caps = 0, max_size = MAX_SIZE;
+	char *server_uri = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:sm:i:c:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iters = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strncasecmp("ru", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RU;
+			else if (strncasecmp("ro", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RO;
+			else
+				print_usage();
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (max_size < 4 || iters < 1)
+		print_usage();
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, CCI_ENDPT_LARGE_MSGS, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, max_size, iters);
+
+	/* clean up */
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(uri);
+	free(server_uri);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Measure the message rate of cci_send_batch(). The client opens conns
+ * connections and sends iters messages on each, batch messages per
+ * cci_send_batch() spread over the connections, and then as many with one
+ * cci_sendv() each. Every message carries its sequence number on its
+ * connection, and the server replies once it received all of them, with
+ * the number of missing or repeated ones. With -g, both sides get their
+ * events with cci_get_events(). With -w, they sleep in cci_wait_event()
+ * when they have nothing else to do.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "cci.h"
+
+#define CONNS		(4)
+#define ITERS		(10000)
+#define BATCH		(16)
+#define MAX_BATCH	(256)
+#define WINDOW		(256)	/* sends in flight */
+#define MAX_EVENTS	(256)
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+cci_conn_attribute_t attr = CCI_CONN_ATTR_RU;
+uint32_t max_events = 1;
+int waiting = 0;
+
+/* server side, one per connection */
+typedef struct peer {
+	uint32_t iters;
+	uint32_t received;
+	uint32_t bad;
+	uint8_t *seen;
+} peer_t;
+
+/* reply of the server to each round */
+typedef struct reply {
+	uint32_t received;
+	uint32_t bad;
+} reply_t;
+
+/* client side */
+typedef struct round {
+	cci_connection_t **conns;
+	uint32_t nconns;
+	uint32_t iters;
+	uint32_t *next;		/* next sequence number per connection */
+	uint32_t posted;
+	uint32_t completed;
+	uint32_t replies;
+	uint32_t bad;
+	uint32_t nretry;	/* messages that could not be posted */
+	uint32_t retry_conn[MAX_BATCH];
+	uint32_t retry_seq[MAX_BATCH];
+} round_t;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-n <conns>] "
+		"[-i <iters>] [-b <batch>] [-c <type>] [-g <max>] [-w]\n", name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-n\tConnections (default %d)\n", CONNS);
+	fprintf(stderr, "\t-i\tMessages per connection (default %d)\n", ITERS);
+	fprintf(stderr, "\t-b\tMessages per cci_send_batch() (default %d, "
+		"max %d)\n", BATCH, MAX_BATCH);
+	fprintf(stderr,
+		"\t-c\tConnection type (RU or RO) set by client only\n");
+	fprintf(stderr, "\t-g\tGet up to max events per cci_get_events() "
+		"(max %d)\n", MAX_EVENTS);
+	fprintf(stderr, "\t-w\tWait for events with cci_wait_event()\n\n");
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h tcp://10.0.0.1:5555 -n 16 -b 64\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+static void check_return(char *func, int ret)
+{
+	if (ret) {
+		fprintf(stderr, "%s() returned %s\n", func,
+			cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+	return;
+}
+
+/* Get up to max_events events, returns how many. With -w, block waits
+ * for the first one. */
+static uint32_t get_events(cci_event_t **events, int block)
+{
+	int ret;
+	uint32_t count = 0;
+
+	if (waiting && block) {
+		ret = cci_wait_event(endpoint, &events[0], NULL);
+		if (ret != CCI_SUCCESS)
+			return 0;
+		if (max_events > 1 &&
+		    cci_get_events(endpoint, &events[1], max_events - 1,
+				   &count) != CCI_SUCCESS)
+			count = 0;
+		return count + 1;
+	}
+
+	if (max_events > 1) {
+		ret = cci_get_events(endpoint, events, max_events, &count);
+		if (ret != CCI_SUCCESS)
+			return 0;
+	} else {
+		ret = cci_get_event(endpoint, &events[0]);
+		if (ret != CCI_SUCCESS)
+			return 0;
+		count = 1;
+	}
+
+	return count;
+}
+
+static void return_events(cci_event_t **events, uint32_t count)
+{
+	if (max_events > 1)
+		cci_return_events(events, count);
+	else
+		cci_return_event(events[0]);
+	return;
+}
+
+static void handle_server_event(cci_event_t *event)
+{
+	int ret;
+
+	switch (event->type) {
+	case CCI_EVENT_CONNECT_REQUEST:
+	{
+		peer_t *peer = calloc(1, sizeof(*peer));
+
+		if (!peer || event->request.data_len != sizeof(peer->iters)) {
+			fprintf(stderr, "rejecting a connection\n");
+			free(peer);
+			cci_reject(event);
+			break;
+		}
+		memcpy(&peer->iters, event->request.data_ptr,
+		       sizeof(peer->iters));
+		peer->seen = calloc(peer->iters, 1);
+		if (!peer->seen) {
+			fprintf(stderr, "unable to allocate %u bytes\n",
+				peer->iters);
+			exit(EXIT_FAILURE);
+		}
+		ret = cci_accept(event, peer);
+		check_return("cci_accept", ret);
+		break;
+	}
+	case CCI_EVENT_RECV:
+	{
+		cci_connection_t *connection = event->recv.connection;
+		peer_t *peer = connection->context;
+		uint32_t seq;
+
+		memcpy(&seq, event->recv.ptr, sizeof(seq));
+		if (seq >= peer->iters || peer->seen[seq]++)
+			peer->bad++;
+		else
+			peer->received++;
+
+		if (peer->received + peer->bad >= peer->iters) {
+			reply_t reply;
+
+			reply.received = peer->received;
+			reply.bad = peer->bad;
+			ret = cci_send(connection, &reply, sizeof(reply),
+				       NULL, CCI_FLAG_SILENT);
+			check_return("cci_send", ret);
+
+			/* ready for the next round */
+			peer->received = peer->bad = 0;
+			memset(peer->seen, 0, peer->iters);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return;
+}
+
+static void do_server(void)
+{
+	uint32_t i, count;
+	cci_event_t *events[MAX_EVENTS];
+
+	while (1) {
+		count = get_events(events, 1);
+		if (!count)
+			continue;
+
+		for (i = 0; i < count; i++)
+			handle_server_event(events[i]);
+		return_events(events, count);
+	}
+}
+
+static double usecs_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (double)(end.tv_sec - start->tv_sec) * 1000000.0 +
+		(double)(end.tv_usec - start->tv_usec);
+}
+
+/* Handle the send completions and the server's replies. */
+static void progress(round_t *round, int block)
+{
+	uint32_t i, count;
+	cci_event_t *events[MAX_EVENTS];
+
+	count = get_events(events, block);
+	for (i = 0; i < count; i++) {
+		cci_event_t *event = events[i];
+
+		if (event->type == CCI_EVENT_SEND) {
+			check_return("send", event->send.status);
+			round->completed++;
+		} else if (event->type == CCI_EVENT_RECV) {
+			reply_t reply;
+
+			memcpy(&reply, event->recv.ptr, sizeof(reply));
+			round->bad += reply.bad + round->iters -
+				reply.received;
+			round->replies++;
+		}
+	}
+	if (count)
+		return_events(events, count);
+
+	return;
+}
+
+/* Post up to batch messages, first the ones that could not be posted
+ * before, then the next one on each connection in turn. */
+static void post(round_t *round, uint32_t batch, int batched)
+{
+	int ret;
+	uint32_t i, n = 0, total = round->nconns * round->iters;
+	uint32_t conn[MAX_BATCH], seq[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	cci_send_desc_t descs[MAX_BATCH];
+	static uint32_t c = 0;
+
+	while (n < batch && round->nretry) {
+		round->nretry--;
+		conn[n] = round->retry_conn[round->nretry];
+		seq[n] = round->retry_seq[round->nretry];
+		n++;
+	}
+	while (n < batch && round->posted + n < total) {
+		/* skip the connections that are done */
+		while (round->next[c] == round->iters)
+			c = (c + 1) % round->nconns;
+		conn[n] = c;
+		seq[n] = round->next[c]++;
+		c = (c + 1) % round->nconns;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = &seq[i];
+		iov[i].iov_len = sizeof(seq[i]);
+		descs[i].connection = round->conns[conn[i]];
+		descs[i].data = &iov[i];
+		descs[i].iovcnt = 1;
+		descs[i].flags = 0;
+		descs[i].context = NULL;
+	}
+
+	if (batched) {
+		cci_send_batch(descs, n);
+	} else {
+		for (i = 0; i < n; i++)
+			descs[i].status = cci_sendv(descs[i].connection,
+						    descs[i].data,
+						    descs[i].iovcnt,
+						    descs[i].context,
+						    descs[i].flags);
+	}
+
+	/* retry the ones that found no buffer, fail on other errors */
+	for (i = 0; i < n; i++) {
+		ret = descs[i].status;
+		if (ret == CCI_SUCCESS) {
+			round->posted++;
+		} else if (ret == CCI_ENOBUFS || ret == CCI_EAGAIN) {
+			round->retry_conn[round->nretry] = conn[i];
+			round->retry_seq[round->nretry] = seq[i];
+			round->nretry++;
+		} else {
+			check_return(batched ? "cci_send_batch" : "cci_sendv",
+				     ret);
+		}
+	}
+
+	return;
+}
+
+/* Send iters messages on each connection and wait for the replies,
+ * returns the number of bad messages. */
+static uint32_t run(round_t *round, uint32_t batch, int batched)
+{
+	uint32_t total = round->nconns * round->iters;
+
+	memset(round->next, 0, round->nconns * sizeof(*round->next));
+	round->posted = round->completed = round->replies = 0;
+	round->bad = round->nretry = 0;
+
+	/* only block when sends are in flight */
+	while (round->posted < total) {
+		if (round->posted - round->completed + batch <= WINDOW) {
+			post(round, batch, batched);
+			progress(round, 0);
+		} else {
+			progress(round, 1);
+		}
+	}
+	while (round->completed < total || round->replies < round->nconns)
+		progress(round, 1);
+
+	return round->bad;
+}
+
+static void do_client(char *server_uri, uint32_t nconns, uint32_t iters,
+		      uint32_t batch)
+{
+	int ret;
+	uint32_t i, connected = 0, bad;
+	cci_event_t *event;
+	struct timeval start;
+	double batched, single;
+	round_t round;
+
+	memset(&round, 0, sizeof(round));
+	round.nconns = nconns;
+	round.iters = iters;
+	round.conns = calloc(nconns, sizeof(*round.conns));
+	round.next = calloc(nconns, sizeof(*round.next));
+	if (!round.conns || !round.next) {
+		fprintf(stderr, "unable to allocate the connections\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < nconns; i++) {
+		ret = cci_connect(endpoint, server_uri, &iters, sizeof(iters),
+				  attr, (void *)(uintptr_t) i, 0, NULL);
+		check_return("cci_connect", ret);
+	}
+
+	while (connected < nconns) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			check_return("connect", event->connect.status);
+			i = (uint32_t)(uintptr_t) event->connect.context;
+			round.conns[i] = event->connect.connection;
+			connected++;
+		}
+		cci_return_event(event);
+	}
+
+	gettimeofday(&start, NULL);
+	bad = run(&round, batch, 1);
+	batched = usecs_since(&start);
+
+	gettimeofday(&start, NULL);
+	bad += run(&round, batch, 0);
+	single = usecs_since(&start);
+
+	printf("Conns\tBatch\tcci_send_batch (msgs/s)\tcci_sendv (msgs/s)\n");
+	printf("%5u\t%5u\t%23.0f\t%18.0f\n", nconns, batch,
+	       (double)nconns * iters * 1000000.0 / batched,
+	       (double)nconns * iters * 1000000.0 / single);
+	if (bad)
+		fprintf(stderr, "%u messages missing or repeated\n", bad);
+	printf("%s\n", bad ? "FAILED" : "PASSED");
+
+	free(round.conns);
+	free(round.next);
+
+	if (bad)
+		exit(EXIT_FAILURE);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0;
+	uint32_t caps = 0, nconns = CONNS, iters = ITERS, batch = BATCH;
+	char *server_uri = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:sn:i:b:c:g:w")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'n':
+			nconns = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strncasecmp("ru", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RU;
+			else if (strncasecmp("ro", optarg, 2) == 0)
+				attr = CCI_CONN_ATTR_RO;
+			else
+				print_usage();
+			break;
+		case 'g':
+			max_events = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			waiting = 1;
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (nconns < 1 || iters < 1 || batch < 1 || batch > MAX_BATCH ||
+	    max_events < 1 || max_events > MAX_EVENTS)
+		print_usage();
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, nconns, iters, batch);
+
+	/* clean up */
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(uri);
+	free(server_uri);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
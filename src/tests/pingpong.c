@@ -49,6 +49,7 @@ uint32_t rmt_comp_len = 0;
 cci_os_handle_t fd = 0;
 int ignore_os_handle = 0;
 int blocking = 0;
+int ep_flags = 0;
 int nfds = 0;
 fd_set rfds;
 
@@ -68,7 +69,7 @@ options_t opts;
 static void print_usage(void)
 {
 	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-i <iters>] "
-		"[-W <warmup>] [-c <type>] [-n] [-b|-o]"
+		"[-W <warmup>] [-c <type>] [-n] [-b|-o|-P]"
 		"[[-w | -r] [-m <max_rma_size> [-C]]]\n", name);
 	fprintf(stderr, "where:\n");
 	fprintf(stderr, "\t-h\tServer's URI\n");
@@ -84,7 +85,9 @@ static void print_usage(void)
 	fprintf(stderr, "\t-m\tTest RMA messages up to max_rma_size\n");
 	fprintf(stderr, "\t-C\tSend RMA remote completion message\n");
 	fprintf(stderr, "\t-b\tBlock using the OS handle instead of polling\n");
-	fprintf(stderr, "\t-o\tGet OS handle but don't use it\n\n");
+	fprintf(stderr, "\t-o\tGet OS handle but don't use it\n");
+	fprintf(stderr, "\t-P\tProgress only in CCI calls (no transport "
+		"threads)\n\n");
 	fprintf(stderr, "Example:\n");
 	fprintf(stderr, "server$ %s -h ip://foo -p 2211 -s\n", name);
 	fprintf(stderr, "client$ %s -h ip://foo -p 2211\n", name);
@@ -474,7 +477,7 @@ int main(int argc, char *argv[])
 
 	name = argv[0];
 
-	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:W:bo")) != -1) {
+	while ((c = getopt(argc, argv, "h:sRc:nwrm:Ci:W:boP")) != -1) {
 		switch (c) {
 		case 'h':
 			server_uri = strdup(optarg);
@@ -527,6 +530,9 @@ int main(int argc, char *argv[])
 			ignore_os_handle = 1;
 			os_handle = &fd;
 			break;
+		case 'P':
+			ep_flags |= CCI_ENDPT_APP_PROGRESS;
+			break;
 		default:
 			print_usage();
 		}
@@ -544,6 +550,11 @@ int main(int argc, char *argv[])
 		print_usage();
 	}
 
+	if (ep_flags && os_handle) {
+		fprintf(stderr, "-P is not compatible with -b or -o.\n");
+		print_usage();
+	}
+
 	if (attr == CCI_CONN_ATTR_UU) {
 		if (opts.method != MSGS) {
 			fprintf(stderr,
@@ -574,7 +585,7 @@ int main(int argc, char *argv[])
 	}
 
 	/* create an endpoint */
-	ret = cci_create_endpoint(NULL, 0, &endpoint, os_handle);
+	ret = cci_create_endpoint(NULL, ep_flags, &endpoint, os_handle);
 	if (ret) {
 		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
 			cci_strerror(NULL, ret));
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2011-2013 UT-Battelle, LLC.  All rights reserved.
+ * Copyright (c) 2011-2013 Oak Ridge National Labs.  All rights reserved.
+ *
+ * See COPYING in top-level directory
+ *
+ * $COPYRIGHT$
+ *
+ * Check and time cci_rmav(). The server sends the handle of its buffer.
+ * For each segment length, the client writes count segments, one every
+ * other segment length, with a single cci_rmav() and a completion
+ * message, and the server checks them. The client then reads them back
+ * into a cleared buffer and checks them. Both are timed against one
+ * cci_rma() per segment, each completed before the next.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "cci.h"
+
+#define MAX_SEGS	(256)
+#define MAX_LEN		(32 * 1024)
+#define BUF_LEN		(2 * MAX_SEGS * MAX_LEN)
+#define ITERS		(8)
+
+char *name;
+cci_endpoint_t *endpoint = NULL;
+cci_connection_t *connection = NULL;
+cci_rma_handle_t *local_handle = NULL;
+struct cci_rma_handle remote_handle;
+char *buffer;
+
+/* remote completion of a write: its segment length and count. Without
+ * segments, it sets the server's buffer up for reads or clears it. */
+typedef struct msg {
+	uint32_t len;
+	uint32_t count;
+} msg_t;
+
+static void print_usage(void)
+{
+	fprintf(stderr, "usage: %s -h <server_uri> [-s] [-n <count>] "
+		"[-i <iters>]\n", name);
+	fprintf(stderr, "where:\n");
+	fprintf(stderr, "\t-h\tServer's URI\n");
+	fprintf(stderr, "\t-s\tSet to run as the server\n");
+	fprintf(stderr, "\t-n\tSegments per cci_rmav() (default and max %d)\n",
+		MAX_SEGS);
+	fprintf(stderr, "\t-i\tTimed iterations (default %d)\n\n", ITERS);
+	fprintf(stderr, "Example:\n");
+	fprintf(stderr, "server$ %s -s\n", name);
+	fprintf(stderr, "client$ %s -h tcp://10.0.0.1:5555 -n 64\n", name);
+	exit(EXIT_FAILURE);
+}
+
+static void check_return(char *func, int ret)
+{
+	if (ret) {
+		fprintf(stderr, "%s() returned %s\n", func,
+			cci_strerror(endpoint, ret));
+		exit(EXIT_FAILURE);
+	}
+	return;
+}
+
+/* Segment i starts at 2 * i * len on both sides. */
+static void make_segs(cci_rma_seg_t *segs, uint32_t count, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		segs[i].local_offset = (uint64_t) 2 * i * len;
+		segs[i].remote_offset = (uint64_t) 2 * i * len;
+		segs[i].length = len;
+	}
+	return;
+}
+
+static void fill(char *buf, uint32_t count, uint32_t len, int gaps)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < 2 * count; i++)
+		for (j = 0; j < len; j++)
+			buf[i * len + j] = i & 1 ?
+				(char)gaps : (char)(i * 7 + j * 131 + len);
+	return;
+}
+
+/* Returns the number of wrong bytes in the segments and in the gaps,
+ * which must still hold gaps. */
+static uint32_t check(const char *buf, uint32_t count, uint32_t len,
+		      int gaps)
+{
+	uint32_t i, j, bad = 0;
+
+	for (i = 0; i < 2 * count; i++)
+		for (j = 0; j < len; j++)
+			if (buf[i * len + j] != (i & 1 ? (char)gaps :
+			    (char)(i * 7 + j * 131 + len)))
+				bad++;
+	return bad;
+}
+
+/* Wait for the completion of a send or RMA, or for a reply. */
+static uint32_t wait_for(cci_event_type_t type)
+{
+	int ret;
+	uint32_t reply = 0;
+	cci_event_t *event;
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == type)
+			break;
+		cci_return_event(event);
+	}
+
+	if (type == CCI_EVENT_SEND)
+		check_return("RMA", event->send.status);
+	else
+		memcpy(&reply, event->recv.ptr, sizeof(reply));
+	cci_return_event(event);
+
+	return reply;
+}
+
+static void do_server(void)
+{
+	int ret, filled = 0;
+	cci_event_t *event;
+
+	ret = cci_rma_register(endpoint, buffer, BUF_LEN,
+			       CCI_FLAG_READ | CCI_FLAG_WRITE, &local_handle);
+	check_return("cci_rma_register", ret);
+
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+
+		switch (event->type) {
+		case CCI_EVENT_CONNECT_REQUEST:
+			ret = cci_accept(event, NULL);
+			check_return("cci_accept", ret);
+			break;
+		case CCI_EVENT_ACCEPT:
+			ret = cci_send(event->accept.connection, local_handle,
+				       sizeof(*local_handle), NULL,
+				       CCI_FLAG_SILENT);
+			check_return("cci_send", ret);
+			break;
+		case CCI_EVENT_RECV:
+		{
+			msg_t msg;
+			uint32_t bad;
+
+			/* a write completed, check it and clear the buffer
+			 * for the next one */
+			memcpy(&msg, event->recv.ptr, sizeof(msg));
+			bad = 0;
+			if (msg.count) {
+				bad = check(buffer, msg.count, msg.len, 0);
+				memset(buffer, 0, 2 * msg.count * msg.len);
+			} else if (!filled) {
+				fill(buffer, MAX_SEGS, msg.len, 0);
+				filled = 1;
+			} else {
+				memset(buffer, 0, BUF_LEN);
+				filled = 0;
+			}
+			ret = cci_send(event->recv.connection, &bad,
+				       sizeof(bad), NULL, CCI_FLAG_SILENT);
+			check_return("cci_send", ret);
+			break;
+		}
+		default:
+			break;
+		}
+		cci_return_event(event);
+	}
+}
+
+static double usecs_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	return (double)(end.tv_sec - start->tv_sec) * 1000000.0 +
+		(double)(end.tv_usec - start->tv_usec);
+}
+
+/* One cci_rmav() of the segments, or one cci_rma() per segment. */
+static void post(cci_rma_seg_t *segs, uint32_t count, msg_t *msg,
+		 int vectored, int flags)
+{
+	int ret;
+	uint32_t i;
+
+	if (vectored) {
+		ret = cci_rmav(connection, msg, msg ? sizeof(*msg) : 0,
+			       local_handle, &remote_handle, segs, count,
+			       NULL, flags);
+		check_return("cci_rmav", ret);
+		wait_for(CCI_EVENT_SEND);
+		return;
+	}
+
+	/* one at a time: tcp and sock do not fence, and sock drops what
+	 * does not fit in its receive buffer and resends it much later */
+	for (i = 0; i < count; i++) {
+		ret = cci_rma(connection, NULL, 0, local_handle,
+			      segs[i].local_offset, &remote_handle,
+			      segs[i].remote_offset, segs[i].length, NULL,
+			      flags);
+		check_return("cci_rma", ret);
+		wait_for(CCI_EVENT_SEND);
+	}
+
+	if (msg) {
+		ret = cci_send(connection, msg, sizeof(*msg), NULL,
+			       CCI_FLAG_SILENT);
+		check_return("cci_send", ret);
+	}
+
+	return;
+}
+
+static void do_client(char *server_uri, uint32_t count, int iters)
+{
+	int ret, i, failed = 0;
+	uint32_t len;
+	cci_event_t *event;
+	cci_rma_seg_t segs[MAX_SEGS];
+
+	ret = cci_rma_register(endpoint, buffer, BUF_LEN,
+			       CCI_FLAG_READ | CCI_FLAG_WRITE, &local_handle);
+	check_return("cci_rma_register", ret);
+
+	ret = cci_connect(endpoint, server_uri, NULL, 0, CCI_CONN_ATTR_RO,
+			  NULL, 0, NULL);
+	check_return("cci_connect", ret);
+
+	/* the connection, then the server's handle */
+	while (1) {
+		ret = cci_get_event(endpoint, &event);
+		if (ret != CCI_SUCCESS)
+			continue;
+		if (event->type == CCI_EVENT_CONNECT) {
+			check_return("connect", event->connect.status);
+			connection = event->connect.connection;
+		} else if (event->type == CCI_EVENT_RECV) {
+			memcpy(&remote_handle, event->recv.ptr,
+			       sizeof(remote_handle));
+			cci_return_event(event);
+			break;
+		}
+		cci_return_event(event);
+	}
+
+	printf("Bytes\tSegs\tWrite rmav (us)\tWrite rma (us)\t"
+	       "Read rmav (us)\tRead rma (us)\tErrors\n");
+
+	for (len = 8; len <= MAX_LEN; len *= 8) {
+		msg_t msg = { len, count };
+		struct timeval start;
+		double wv, w, rv, r;
+		uint32_t errors = 0;
+
+		make_segs(segs, count, len);
+
+		/* write, with the server checking each op */
+		fill(buffer, count, len, 0);
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iters; i++) {
+			post(segs, count, &msg, 1, CCI_FLAG_WRITE);
+			errors += wait_for(CCI_EVENT_RECV);
+		}
+		wv = usecs_since(&start) / iters;
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iters; i++) {
+			post(segs, count, &msg, 0, CCI_FLAG_WRITE);
+			errors += wait_for(CCI_EVENT_RECV);
+		}
+		w = usecs_since(&start) / iters;
+
+		/* read what the server sets up, the gaps stay clear */
+		msg.count = 0;
+		ret = cci_send(connection, &msg, sizeof(msg), NULL,
+			       CCI_FLAG_SILENT);
+		check_return("cci_send", ret);
+		wait_for(CCI_EVENT_RECV);
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iters; i++) {
+			memset(buffer, 1, 2 * count * len);
+			post(segs, count, NULL, 1, CCI_FLAG_READ);
+			errors += check(buffer, count, len, 1);
+		}
+		rv = usecs_since(&start) / iters;
+
+		gettimeofday(&start, NULL);
+		for (i = 0; i < iters; i++) {
+			memset(buffer, 1, 2 * count * len);
+			post(segs, count, NULL, 0, CCI_FLAG_READ);
+			errors += check(buffer, count, len, 1);
+		}
+		r = usecs_since(&start) / iters;
+
+		/* and clear it for the next writes */
+		ret = cci_send(connection, &msg, sizeof(msg), NULL,
+			       CCI_FLAG_SILENT);
+		check_return("cci_send", ret);
+		wait_for(CCI_EVENT_RECV);
+
+		printf("%5u\t%4u\t%15.1f\t%14.1f\t%14.1f\t%13.1f\t%6u\n", len,
+		       count, wv, w, rv, r, errors);
+		if (errors)
+			failed = 1;
+	}
+
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+	if (failed)
+		exit(EXIT_FAILURE);
+
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, c, is_server = 0, iters = ITERS;
+	uint32_t caps = 0, count = MAX_SEGS;
+	char *server_uri = NULL, *uri = NULL;
+
+	name = argv[0];
+
+	while ((c = getopt(argc, argv, "h:sn:i:")) != -1) {
+		switch (c) {
+		case 'h':
+			server_uri = strdup(optarg);
+			break;
+		case 's':
+			is_server = 1;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iters = strtol(optarg, NULL, 0);
+			break;
+		default:
+			print_usage();
+		}
+	}
+
+	if (!is_server && !server_uri) {
+		fprintf(stderr, "Must select -h or -s\n");
+		print_usage();
+	}
+	if (count < 1 || count > MAX_SEGS || iters < 1)
+		print_usage();
+
+	buffer = calloc(1, BUF_LEN);
+	if (!buffer) {
+		fprintf(stderr, "unable to allocate %d bytes\n", BUF_LEN);
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_init(CCI_ABI_VERSION, 0, &caps);
+	if (ret) {
+		fprintf(stderr, "cci_init() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create an endpoint */
+	ret = cci_create_endpoint(NULL, 0, &endpoint, NULL);
+	if (ret) {
+		fprintf(stderr, "cci_create_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	ret = cci_get_opt(endpoint, CCI_OPT_ENDPT_URI, &uri);
+	if (ret) {
+		fprintf(stderr, "cci_get_opt() failed with %s\n", cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+	printf("Opened %s\n", uri);
+
+	if (is_server)
+		do_server();
+	else
+		do_client(server_uri, count, iters);
+
+	/* clean up */
+	ret = cci_rma_deregister(endpoint, local_handle);
+	check_return("cci_rma_deregister", ret);
+
+	ret = cci_destroy_endpoint(endpoint);
+	if (ret) {
+		fprintf(stderr, "cci_destroy_endpoint() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	free(buffer);
+	free(uri);
+	free(server_uri);
+
+	ret = cci_finalize();
+	if (ret) {
+		fprintf(stderr, "cci_finalize() failed with %s\n",
+			cci_strerror(NULL, ret));
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}